@@ -48,6 +48,9 @@
 
 #include "tcpbridge.h"
 #include "bridge.h"
+#include "bridge_netmap.h"
+#include "bridge_tpacket.h"
+#include "mactable.h"
 #include "send_packets.h"
 #include "tcpedit/tcpedit.h"
 
@@ -64,44 +67,20 @@ static int live_callback(struct live_data_t *,
                          struct pcap_pkthdr *, const u_char *);
 
 /**
- * First, prep our RB Tree which tracks where each (source)
- * MAC really lives so we don't create really nasty network
- * storms.  
+ * Our MAC learning table tracks where each (source) MAC really
+ * lives so we don't create really nasty network storms.
  */
-static struct macsrc_t *new_node(void);
-
-RB_HEAD(macsrc_tree, macsrc_t) macsrc_root;
-
-static int
-rbmacsrc_comp(struct macsrc_t *a, struct macsrc_t *b)
-{
-    return (memcmp(a->key, b->key, ETHER_ADDR_LEN));
-}
-
-RB_PROTOTYPE(macsrc_tree, macsrc_t, node, rbmacsrc_comp)
-RB_GENERATE(macsrc_tree, macsrc_t, node, rbmacsrc_comp)
+static mactable_t *mactable = NULL;
+static mactable_stats_t mactable_totals;
 
 /**
- * redblack init
+ * Adds the MAC table stats of a finished bridge loop to the totals
  */
 void
-rbinit(void)
-{
-    RB_INIT(&macsrc_root);
-}
-
-/**
- * create a new node... Malloc's memory
- */
-struct macsrc_t *
-new_node(void)
+bridge_collect_stats(struct live_data_t *livedata)
 {
-    struct macsrc_t *node;
-
-    node = (struct macsrc_t *)safe_malloc(sizeof(struct macsrc_t));
-    
-    memset(node, '\0', sizeof(struct macsrc_t));
-    return (node);
+    assert(livedata);
+    mactable_stats_add(&mactable_totals, &livedata->mac_stats);
 }
 
 
@@ -118,6 +97,7 @@ do_bridge_unidirectional(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
     assert(options);
     assert(tcpedit);
     
+    memset(&livedata, 0, sizeof(livedata));
     livedata.tcpedit = tcpedit;
     livedata.source = PCAP_INT1;
     livedata.pcap = options->pcap1;
@@ -128,6 +108,7 @@ do_bridge_unidirectional(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
         warnx("Error in pcap_loop(): %s", pcap_geterr(options->pcap1));
     }
     
+    bridge_collect_stats(&livedata);
 }
 
 #ifndef HAVE_BPF
@@ -148,6 +129,7 @@ do_bridge_bidirectional(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
     assert(options);
     assert(tcpedit);
 
+    memset(&livedata, 0, sizeof(livedata));
     livedata.tcpedit = tcpedit;
     livedata.options = options;
 
@@ -214,6 +196,7 @@ do_bridge_bidirectional(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
         /* go back to the top of the loop */
     }
 
+    bridge_collect_stats(&livedata);
 } /* do_bridge_bidirectional() */
 
 #elif defined HAVE_BPF && defined HAVE_PCAP_SETNONBLOCK 
@@ -236,6 +219,7 @@ do_bridge_bidirectional(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
     assert(options);
     assert(tcpedit);
 
+    memset(&livedata, 0, sizeof(livedata));
     livedata.tcpedit = tcpedit;
     livedata.options = options;
 
@@ -301,6 +285,8 @@ do_bridge_bidirectional(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
 
         /* go back to the top of the loop */
     }    
+
+    bridge_collect_stats(&livedata);
 } 
 #else
 #error "Your system needs a libpcap with pcap_setnonblock().  Please upgrade libpcap."
@@ -321,11 +307,12 @@ do_bridge(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
             errx(-1, "Error compiling BPF filter: %s", pcap_geterr(options->pcap1));
         }
         
-        /* apply filter */
-        pcap_setfilter(options->pcap1, &options->bpf.program);
+        /* apply filter (netmap & TPACKET_V3 run it in userland instead) */
+        if (! options->netmap && ! options->tpacket)
+            pcap_setfilter(options->pcap1, &options->bpf.program);
 
         /* same for other interface if applicable */
-        if (options->unidir == 0) {
+        if (options->unidir == 0 && ! options->netmap && ! options->tpacket) {
             /* compile filter */
             dbgx(2, "Try to compile pcap bpf filter: %s", options->bpf.filter);
             if (pcap_compile(options->pcap2, &options->bpf.program, options->bpf.filter, options->bpf.optimize, 0) != 0) {
@@ -337,11 +324,24 @@ do_bridge(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
         }
     }
 
+    mactable = mactable_init(options->mac_table_size, options->mac_age);
+    memset(&mactable_totals, 0, sizeof(mactable_totals));
+
     /* register signals */
     didsig = 0;
     (void)signal(SIGINT, catcher);
 
 
+#ifdef HAVE_NETMAP
+    if (options->netmap) {
+        do_bridge_netmap(options, tcpedit);
+    } else
+#endif
+#ifdef HAVE_TPACKET_V3
+    if (options->tpacket) {
+        do_bridge_tpacket(options, tcpedit);
+    } else
+#endif
     if (options->unidir == 1) {
         do_bridge_unidirectional(options, tcpedit);
     } else {
@@ -349,154 +349,170 @@ do_bridge(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
     }
             
     packet_stats(&begin, &end, bytes_sent, pkts_sent, failed);
+    mactable_stats_print(mactable, &mactable_totals);
+
+    mactable_free(mactable);
+    mactable = NULL;
 }
 
 
 /**
- * This is the callback we use with pcap_dispatch to process
- * each packet recieved by libpcap on the two interfaces.
- * Need to return > 0 to denote success
+ * Runs a single packet received on livedata->source through the bridge
+ * logic: MAC learning, loop prevention, include/exclude and tcpedit.
+ * The packet is edited in place, so the buffer must have room for
+ * tcpedit to grow the layer 2 header.
+ *
+ * Returns the interface (PCAP_INT1 or PCAP_INT2) to send the packet out
+ * of, BRIDGE_SKIP if it should be dropped or BRIDGE_ERROR if tcpedit failed
  */
-static int
-live_callback(struct live_data_t *livedata, struct pcap_pkthdr *pkthdr,
-              const u_char * nextpkt)
+int
+bridge_packet(struct live_data_t *livedata, struct pcap_pkthdr **pkthdr,
+              u_char **pktdata)
 {
     ipv4_hdr_t *ip_hdr = NULL;
     ipv6_hdr_t *ip6_hdr = NULL;
-    pcap_t *send = NULL;
-    static u_char *pktdata = NULL;     /* full packet buffer */
     int cache_mode, retcode;
-    static unsigned long packetnum = 0;
-    struct macsrc_t *node, finder;  /* rb tree nodes */
+    const u_char *srcmac;
 #ifdef DEBUG
-    u_char dstmac[ETHER_ADDR_LEN];
+    const u_char *dstmac;
 #endif
     u_int16_t l2proto;
 
-    packetnum++;
-    dbgx(2, "packet %lu caplen %d", packetnum, pkthdr->caplen);
-
-    /* only malloc the first time */
-    if (pktdata == NULL) {
-        /* create packet buffers */
-        pktdata = (u_char *)safe_malloc(MAXPACKET);
-    } else {
-        /* zero out the old packet info */
-        memset(pktdata, '\0', MAXPACKET);
-    }
-
-    /* copy the packet to our buffer */
-    memcpy(pktdata, nextpkt, pkthdr->caplen);
-
+    livedata->packetnum++;
+    dbgx(2, "packet %lu caplen %d", livedata->packetnum, (*pkthdr)->caplen);
 
 #ifdef ENABLE_VERBOSE
     /* decode packet? */
     if (livedata->options->verbose)
-        tcpdump_print(livedata->options->tcpdump, pkthdr, nextpkt);
+        tcpdump_print(livedata->options->tcpdump, *pkthdr, *pktdata);
 #endif
 
 
-    /* lookup our source MAC in the tree */
-    memcpy(&finder.key, &pktdata[ETHER_ADDR_LEN], ETHER_ADDR_LEN);
+    srcmac = &(*pktdata)[ETHER_ADDR_LEN];
 #ifdef DEBUG
-    memcpy(&dstmac, pktdata, ETHER_ADDR_LEN);
+    dstmac = *pktdata;
     dbgx(1, "SRC MAC: " MAC_FORMAT "\tDST MAC: " MAC_FORMAT,
-        MAC_STR(finder.key), MAC_STR(dstmac));
+        MAC_STR(srcmac), MAC_STR(dstmac));
 #endif
 
     /* first, is this a packet sent locally?  If so, ignore it */
-    if ((memcmp(livedata->options->intf1_mac, &finder.key, ETHER_ADDR_LEN)) == 0) {
+    if ((memcmp(livedata->options->intf1_mac, srcmac, ETHER_ADDR_LEN)) == 0) {
         dbgx(1, "Packet matches the MAC of %s, skipping.", livedata->options->intf1);
-        return (1);
+        return BRIDGE_SKIP;
     }
-    else if ((memcmp(livedata->options->intf2_mac, &finder.key, ETHER_ADDR_LEN)) == 0) {
+    else if ((memcmp(livedata->options->intf2_mac, srcmac, ETHER_ADDR_LEN)) == 0) {
         dbgx(1, "Packet matches the MAC of %s, skipping.", livedata->options->intf2);
-        return (1);
+        return BRIDGE_SKIP;
     }
 
-    node = RB_FIND(macsrc_tree, &macsrc_root, &finder);
-    
-    /* if we can't find the node, build a new one */
-    if (node == NULL) {
-        dbg(1, "Unable to find MAC in the tree");
-        node = new_node();
-        node->source = livedata->source;
-        memcpy(&node->key, &finder.key, ETHER_ADDR_LEN);
-        RB_INSERT(macsrc_tree, &macsrc_root, node);
-    }
-    
-    /* otherwise compare sources */
-    else if (node->source != livedata->source) {
-        dbg(1, "Found the dest MAC in the tree and it doesn't match this source NIC... skipping packet");
-        /*
-         * IMPORTANT!!!
-         * Never send a packet out the same interface we sourced it on!
-         */
-        return (1);
+    /* Never send a packet out the same interface we sourced it on! */
+    if (mactable_learn(mactable, srcmac, livedata->source, (*pkthdr)->ts.tv_sec,
+                &livedata->mac_stats) != livedata->source) {
+        dbg(1, "Found the source MAC in the table and it doesn't match this source NIC... skipping packet");
+        return BRIDGE_SKIP;
     }
 
     /* what is our cache mode? */
     cache_mode = livedata->source == PCAP_INT1 ? TCPR_DIR_C2S : TCPR_DIR_S2C;
 
-    l2proto = tcpedit_l3proto(livedata->tcpedit, BEFORE_PROCESS, pktdata, pkthdr->len);
+    l2proto = tcpedit_l3proto(livedata->tcpedit, BEFORE_PROCESS, *pktdata, (*pkthdr)->len);
     dbgx(2, "Packet protocol: %04hx", l2proto);
     
     /* should we skip this packet based on CIDR match? */
     if (l2proto == ETHERTYPE_IP) {
         dbg(3, "Packet is IPv4");
-        ip_hdr = (ipv4_hdr_t *)tcpedit_l3data(livedata->tcpedit, BEFORE_PROCESS, pktdata, pkthdr->len);
+        ip_hdr = (ipv4_hdr_t *)tcpedit_l3data(livedata->tcpedit, BEFORE_PROCESS, *pktdata, (*pkthdr)->len);
 
         /* look for include or exclude CIDR match */
         if (livedata->options->xX.cidr != NULL) {
             if (!process_xX_by_cidr_ipv4(livedata->options->xX.mode, livedata->options->xX.cidr, ip_hdr)) {
                 dbg(2, "Skipping IPv4 packet due to CIDR match");
-                return (1);
+                return BRIDGE_SKIP;
             }
         }
 
     }
     else if (l2proto == ETHERTYPE_IP6) {
         dbg(3, "Packet is IPv6");
-        ip6_hdr = (ipv6_hdr_t *)tcpedit_l3data(livedata->tcpedit, BEFORE_PROCESS, pktdata, pkthdr->len);
+        ip6_hdr = (ipv6_hdr_t *)tcpedit_l3data(livedata->tcpedit, BEFORE_PROCESS, *pktdata, (*pkthdr)->len);
 
         /* look for include or exclude CIDR match */
         if (livedata->options->xX.cidr != NULL) {
             if (!process_xX_by_cidr_ipv6(livedata->options->xX.mode, livedata->options->xX.cidr, ip6_hdr)) {
                 dbg(2, "Skipping IPv6 packet due to CIDR match");
-                return (1);
+                return BRIDGE_SKIP;
             }
         }
 
     }
 
-    if ((retcode = tcpedit_packet(livedata->tcpedit, &pkthdr, &pktdata, cache_mode)) < 0) {
+    if ((retcode = tcpedit_packet(livedata->tcpedit, pkthdr, pktdata, cache_mode)) < 0) {
         if (retcode == TCPEDIT_SOFT_ERROR) {
-            return 1;
+            return BRIDGE_SKIP;
         } else { /* TCPEDIT_ERROR */
-            return -1;
+            return BRIDGE_ERROR;
         }
     }
 
-    /* 
-     * send packets out the OTHER interface
-     * and update the dst mac if necessary
-     */
-    switch(node->source) {
+    /* send packets out the OTHER interface */
+    switch(livedata->source) {
         case PCAP_INT1:
             dbgx(2, "Packet source was %s... sending out on %s", livedata->options->intf1, 
                 livedata->options->intf2);
-            send = livedata->options->pcap2;
-            break;
+            return PCAP_INT2;
 
         case PCAP_INT2:
             dbgx(2, "Packet source was %s... sending out on %s", livedata->options->intf2, 
                 livedata->options->intf1);
-            send = livedata->options->pcap1;
-            break;
+            return PCAP_INT1;
         
         default:
-            errx(-1, "wtf?  our node->source != PCAP_INT1 and != PCAP_INT2: %c", 
-                 node->source);        
+            errx(-1, "wtf?  our livedata->source != PCAP_INT1 and != PCAP_INT2: %c", 
+                 livedata->source);        
+    }
+
+    return BRIDGE_ERROR;
+} /* bridge_packet() */
+
+
+/**
+ * This is the callback we use with pcap_dispatch to process
+ * each packet recieved by libpcap on the two interfaces.
+ * Need to return > 0 to denote success
+ */
+static int
+live_callback(struct live_data_t *livedata, struct pcap_pkthdr *pkthdr,
+              const u_char * nextpkt)
+{
+    pcap_t *send = NULL;
+    static u_char *pktdata = NULL;     /* full packet buffer */
+
+    /* only malloc the first time */
+    if (pktdata == NULL) {
+        /* create packet buffers */
+        pktdata = (u_char *)safe_malloc(MAXPACKET);
+    } else {
+        /* zero out the old packet info */
+        memset(pktdata, '\0', MAXPACKET);
+    }
+
+    /* copy the packet to our buffer */
+    memcpy(pktdata, nextpkt, pkthdr->caplen);
+
+    switch (bridge_packet(livedata, &pkthdr, &pktdata)) {
+        case PCAP_INT1:
+            send = livedata->options->pcap1;
+            break;
+
+        case PCAP_INT2:
+            send = livedata->options->pcap2;
+            break;
+
+        case BRIDGE_SKIP:
+            return (1);
+
+        default: /* BRIDGE_ERROR */
+            return (-1);
     }
 
     /*
@@ -515,4 +531,3 @@ live_callback(struct live_data_t *livedata, struct pcap_pkthdr *pkthdr,
     return (1);
 } /* live_callback() */
 
-
@@ -34,20 +34,9 @@
 #define __BRIDGE_H__
 
 #include "config.h"
-#include "lib/tree.h"
+#include "mactable.h"
 #include "tcpedit/tcpedit.h"
 
-/*
- * RBTree node object for tracking which side of tcpreplay where 
- * each source MAC address lives
- */
-struct macsrc_t {
-    RB_ENTRY(macsrc_t) node;
-    u_char key[ETHER_ADDR_LEN];
-    u_char source;              /* interface device name we first saw the source MAC */
-    sendpacket_t *sp;           /* sendpacket handle to send packets out */
-};
-
 /* pri and secondary pcap interfaces */
 #define PCAP_INT1 0
 #define PCAP_INT2 1
@@ -58,14 +47,21 @@ struct live_data_t {
     int l2enabled;
     int l2len;
     u_char source;
+    unsigned long packetnum;
+    mactable_stats_t mac_stats;
     char *l2data;
     pcap_t *pcap;
     tcpedit_t *tcpedit;
     tcpbridge_opt_t *options;
 };
 
-void rbinit(void);
+/* bridge_packet() return codes besides PCAP_INT1/PCAP_INT2 */
+#define BRIDGE_SKIP  -1
+#define BRIDGE_ERROR -2
+
 void do_bridge(tcpbridge_opt_t *, tcpedit_t *);
+int bridge_packet(struct live_data_t *, struct pcap_pkthdr **, u_char **);
+void bridge_collect_stats(struct live_data_t *);
 
 
 #endif
@@ -0,0 +1,452 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * netmap(4) forwarding loop for tcpbridge.  Instead of copying each frame
+ * out of the kernel and back in again, packets are edited in place in the
+ * RX buffer and then handed to the other port by swapping the buffer index
+ * of the RX slot with that of a free TX slot.  Ring syncs happen once per
+ * poll() pass rather than once per packet.
+ *
+ * With --multiqueue, each hardware queue pair gets its own worker thread
+ * with its own tcpedit context, so RSS spreads the flows across CPUs.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE     /* pthread_setaffinity_np() & CPU_SET() */
+#endif
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#ifdef HAVE_NETMAP
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <net/netmap.h>
+#include <net/netmap_user.h>
+
+#include "tcpbridge.h"
+#include "bridge.h"
+#include "bridge_netmap.h"
+#include "tcpedit/tcpedit.h"
+
+extern COUNTER bytes_sent, failed, pkts_sent;
+extern volatile int didsig;
+
+/**
+ * Returns the number of hardware queue pairs the given interface has
+ */
+static int
+netmap_queues(const char *name)
+{
+    struct nmreq nmr;
+    int fd;
+
+    if ((fd = open("/dev/netmap", O_RDWR)) < 0)
+        errx(-1, "Unable to open /dev/netmap: %s", strerror(errno));
+
+    memset(&nmr, 0, sizeof(nmr));
+    nmr.nr_version = NETMAP_API;
+    strncpy(nmr.nr_name, name, sizeof(nmr.nr_name));
+
+    if (ioctl(fd, NIOCGINFO, &nmr) < 0)
+        errx(-1, "Unable to get netmap info for %s: %s", name, strerror(errno));
+
+    close(fd);
+    return nmr.nr_rx_rings < nmr.nr_tx_rings ? nmr.nr_rx_rings : nmr.nr_tx_rings;
+}
+
+/**
+ * Put the given interface into netmap mode and map its rings.  ringid
+ * is either 0 for all the hardware rings or NETMAP_HW_RING | queue to
+ * only bind one RX/TX ring pair.
+ */
+static void
+netmap_port_open(netmap_port_t *port, const char *name, u_int16_t ringid)
+{
+    struct nmreq nmr;
+
+    assert(port);
+    assert(name);
+
+    memset(port, 0, sizeof(netmap_port_t));
+    port->name = name;
+
+    if ((port->fd = open("/dev/netmap", O_RDWR)) < 0)
+        errx(-1, "Unable to open /dev/netmap: %s", strerror(errno));
+
+    memset(&nmr, 0, sizeof(nmr));
+    nmr.nr_version = NETMAP_API;
+    nmr.nr_ringid = ringid;
+    strncpy(nmr.nr_name, name, sizeof(nmr.nr_name));
+
+    if (ioctl(port->fd, NIOCREGIF, &nmr) < 0)
+        errx(-1, "Unable to register %s with netmap: %s", name, strerror(errno));
+
+    port->memsize = nmr.nr_memsize;
+    port->mem = mmap(0, port->memsize, PROT_WRITE | PROT_READ, MAP_SHARED,
+            port->fd, 0);
+    if (port->mem == MAP_FAILED)
+        errx(-1, "Unable to mmap netmap rings for %s: %s", name, strerror(errno));
+
+    port->nifp = NETMAP_IF(port->mem, nmr.nr_offset);
+
+    if (ringid & NETMAP_HW_RING) {
+        port->first_rx = port->first_tx = ringid & NETMAP_RING_MASK;
+        port->last_rx = port->last_tx = port->first_rx + 1;
+    } else {
+        port->first_rx = port->first_tx = 0;
+        port->last_rx = port->nifp->ni_rx_queues;
+        port->last_tx = port->nifp->ni_tx_queues;
+    }
+
+    dbgx(1, "%s: RX rings %u-%u, TX rings %u-%u", name, port->first_rx,
+            port->last_rx - 1, port->first_tx, port->last_tx - 1);
+}
+
+/**
+ * Flush anything still queued for transmit and release the interface
+ */
+static void
+netmap_port_close(netmap_port_t *port)
+{
+    assert(port);
+
+    if (ioctl(port->fd, NIOCTXSYNC, NULL) < 0)
+        warnx("NIOCTXSYNC on %s failed: %s", port->name, strerror(errno));
+
+    munmap(port->mem, port->memsize);
+    close(port->fd);
+}
+
+/**
+ * Forward everything waiting on the RX rings of src to the TX rings of dst.
+ * Each packet is edited in place and then swapped into a TX slot, so no
+ * packet data is ever copied.  Stops when src is drained, dst is full or
+ * we hit --limit.  Returns the number of packets queued on dst.
+ */
+static u_int
+netmap_forward(netmap_worker_t *worker, struct live_data_t *livedata,
+        netmap_port_t *src, netmap_port_t *dst)
+{
+    tcpbridge_opt_t *options = worker->options;
+    struct netmap_ring *rx, *tx;
+    struct netmap_slot *rs, *ts;
+    struct pcap_pkthdr pkthdr, *hdr;
+    u_char *pktdata;
+    u_int32_t buf_idx;
+    u_int queued = 0, ri, ti;
+
+    ri = src->first_rx;
+    ti = dst->first_tx;
+    while (ri < src->last_rx && ti < dst->last_tx) {
+        if (options->limit_send > 0 && worker->pkts_sent >= options->limit_send)
+            break;
+
+        rx = NETMAP_RXRING(src->nifp, ri);
+        if (rx->avail == 0) {
+            ri++;
+            continue;
+        }
+
+        tx = NETMAP_TXRING(dst->nifp, ti);
+        if (tx->avail == 0) {
+            ti++;
+            continue;
+        }
+
+        /* the RX slot is ours until the next sync, even once released */
+        rs = &rx->slot[rx->cur];
+        rx->cur = NETMAP_RING_NEXT(rx, rx->cur);
+        rx->avail--;
+
+        pktdata = (u_char *)NETMAP_BUF(rx, rs->buf_idx);
+        memset(&pkthdr, 0, sizeof(pkthdr));
+        pkthdr.ts = rx->ts;
+        pkthdr.caplen = pkthdr.len = rs->len;
+        hdr = &pkthdr;
+
+        if (rs->len + BRIDGE_NETMAP_HEADROOM > rx->nr_buf_size) {
+            dbgx(1, "Dropping %u byte packet: no room to edit in place", rs->len);
+            worker->failed++;
+            continue;
+        }
+
+        if (options->bpf.filter != NULL &&
+                bpf_filter(options->bpf.program.bf_insns, pktdata,
+                    pkthdr.len, pkthdr.caplen) == 0)
+            continue;
+
+        switch (bridge_packet(livedata, &hdr, &pktdata)) {
+            case BRIDGE_SKIP:
+                continue;
+
+            case BRIDGE_ERROR:
+                warnx("Unable to edit packet: %s", tcpedit_geterr(livedata->tcpedit));
+                worker->failed++;
+                continue;
+
+            default:
+                break;
+        }
+
+        assert(pktdata == (u_char *)NETMAP_BUF(rx, rs->buf_idx));
+        assert(hdr->caplen <= rx->nr_buf_size);
+
+        /* hand the edited buffer to the TX ring and take its spare one */
+        ts = &tx->slot[tx->cur];
+        buf_idx = ts->buf_idx;
+        ts->buf_idx = rs->buf_idx;
+        rs->buf_idx = buf_idx;
+        ts->len = hdr->caplen;
+        ts->flags |= NS_BUF_CHANGED;
+        rs->flags |= NS_BUF_CHANGED;
+
+        tx->cur = NETMAP_RING_NEXT(tx, tx->cur);
+        tx->avail--;
+
+        worker->bytes_sent += hdr->caplen;
+        worker->pkts_sent++;
+        queued++;
+    }
+
+    if (queued > 0)
+        dbgx(2, "Worker %d queued %u packets from %s to %s", worker->id, 
+                queued, src->name, dst->name);
+
+    return queued;
+}
+
+/**
+ * Bridge loop for a single worker.  Both interfaces are always put in
+ * netmap mode, but in unidirectional mode we only ever read from intf1.
+ */
+static void *
+netmap_worker_run(void *arg)
+{
+    netmap_worker_t *worker = (netmap_worker_t *)arg;
+    tcpbridge_opt_t *options = worker->options;
+    struct pollfd polls[2];
+    int i, nports, pollresult;
+
+    if (worker->cpu >= 0) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+        cpu_set_t cpuset;
+
+        CPU_ZERO(&cpuset);
+        CPU_SET(worker->cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+            warnx("Unable to pin worker %d to CPU %d", worker->id, worker->cpu);
+        else
+            dbgx(1, "Pinned worker %d to CPU %d", worker->id, worker->cpu);
+#else
+        warnx("Unable to pin worker %d to CPU %d: not supported on this platform",
+                worker->id, worker->cpu);
+#endif
+    }
+
+    netmap_port_open(&worker->ports[PCAP_INT1], options->intf1, worker->ringid);
+    netmap_port_open(&worker->ports[PCAP_INT2], options->intf2, worker->ringid);
+
+    nports = options->unidir ? 1 : 2;
+    for (i = 0; i < nports; i++) {
+        memset(&worker->livedata[i], 0, sizeof(struct live_data_t));
+        worker->livedata[i].tcpedit = worker->tcpedit;
+        worker->livedata[i].options = options;
+        worker->livedata[i].source = i;
+        worker->livedata[i].pcap = i == PCAP_INT1 ? options->pcap1 : options->pcap2;
+    }
+
+    /* 
+     * loop until ctrl-C or we've sent enough packets
+     * note that if -L wasn't specified, limit_send is
+     * set to 0 so this will loop infinately
+     */
+    while ((options->limit_send == 0) || (options->limit_send > worker->pkts_sent)) {
+        if (didsig)
+            break;
+
+        /* poll() on a netmap fd also syncs the RX rings for us */
+        for (i = 0; i < nports; i++) {
+            polls[i].fd = worker->ports[i].fd;
+            polls[i].events = POLLIN;
+            polls[i].revents = 0;
+        }
+
+        pollresult = poll(polls, nports, options->poll_timeout);
+        if (pollresult < 0) {
+            if (errno == EINTR)
+                continue;
+            warnx("poll() error: %s", strerror(errno));
+            break;
+        } else if (pollresult == 0) {
+            dbg(3, "poll timeout exceeded...");
+            continue;
+        }
+
+        /* one TX sync per port per pass, no matter how many we moved */
+        for (i = 0; i < nports; i++) {
+            if (netmap_forward(worker, &worker->livedata[i], &worker->ports[i],
+                        &worker->ports[!i]) == 0)
+                continue;
+
+            if (ioctl(worker->ports[!i].fd, NIOCTXSYNC, NULL) < 0)
+                warnx("NIOCTXSYNC on %s failed: %s", worker->ports[!i].name, 
+                        strerror(errno));
+        }
+    }
+
+    netmap_port_close(&worker->ports[PCAP_INT1]);
+    netmap_port_close(&worker->ports[PCAP_INT2]);
+
+    return NULL;
+}
+
+/**
+ * Main entry point for bridging with netmap.  Without --multiqueue we
+ * run a single worker over all the rings in this thread.  Otherwise we
+ * start a worker per hardware queue pair and wait for them to finish.
+ */
+void
+do_bridge_netmap(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
+{
+    netmap_worker_t *workers;
+    tcpr_list_t *cpu;
+    COUNTER c;
+    int i, nworkers = 1;
+
+    assert(options);
+    assert(tcpedit);
+
+    if (options->multiqueue) {
+#ifdef HAVE_LIBPTHREAD
+        nworkers = netmap_queues(options->intf1);
+        if (netmap_queues(options->intf2) != nworkers)
+            errx(-1, "--multiqueue requires %s and %s to have the same number of queues",
+                    options->intf1, options->intf2);
+#else
+        err(-1, "--multiqueue requires pthread support");
+#endif
+    }
+
+    workers = (netmap_worker_t *)safe_malloc(nworkers * sizeof(netmap_worker_t));
+
+    /* worker N gets the Nth CPU in --cpus, wrapping around if need be */
+    cpu = options->cpus;
+    c = cpu != NULL ? cpu->min : 0;
+    for (i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        workers[i].options = options;
+        workers[i].ringid = options->multiqueue ? (NETMAP_HW_RING | i) : 0;
+        workers[i].cpu = -1;
+
+        if (cpu != NULL) {
+            workers[i].cpu = (int)c;
+            if (++c > cpu->max) {
+                cpu = cpu->next != NULL ? cpu->next : options->cpus;
+                c = cpu->min;
+            }
+        } else if (options->multiqueue) {
+            workers[i].cpu = i % sysconf(_SC_NPROCESSORS_ONLN);
+        }
+
+        /* any warnings were already printed when we parsed tcpedit's args */
+        if (i == 0) {
+            workers[i].tcpedit = tcpedit;
+            continue;
+        }
+
+        if (tcpedit_init(&workers[i].tcpedit, pcap_datalink(options->pcap1)) < 0)
+            errx(-1, "Error initializing tcpedit: %s", tcpedit_geterr(workers[i].tcpedit));
+
+        if (tcpedit_post_args(&workers[i].tcpedit) < 0)
+            errx(-1, "Unable to parse args: %s", tcpedit_geterr(workers[i].tcpedit));
+
+        if (tcpedit_validate(workers[i].tcpedit) < 0)
+            errx(-1, "Unable to edit packets given options:\n%s",
+                    tcpedit_geterr(workers[i].tcpedit));
+    }
+
+    if (! options->multiqueue) {
+        netmap_worker_run(&workers[0]);
+    }
+#ifdef HAVE_LIBPTHREAD
+    else {
+        dbgx(1, "Bridging with %d netmap workers", nworkers);
+        for (i = 0; i < nworkers; i++) {
+            if (pthread_create(&workers[i].thread, NULL, netmap_worker_run, &workers[i]) != 0)
+                errx(-1, "Unable to create worker thread: %s", strerror(errno));
+        }
+
+        for (i = 0; i < nworkers; i++)
+            pthread_join(workers[i].thread, NULL);
+    }
+#endif
+
+    for (i = 0; i < nworkers; i++) {
+        if (options->multiqueue)
+            printf("Worker %d (queue %d, CPU %d): " COUNTER_SPEC " packets (" 
+                    COUNTER_SPEC " bytes) sent, " COUNTER_SPEC " failed\n", 
+                    i, i, workers[i].cpu, workers[i].pkts_sent, 
+                    workers[i].bytes_sent, workers[i].failed);
+
+        bridge_collect_stats(&workers[i].livedata[PCAP_INT1]);
+        bridge_collect_stats(&workers[i].livedata[PCAP_INT2]);
+        pkts_sent += workers[i].pkts_sent;
+        bytes_sent += workers[i].bytes_sent;
+        failed += workers[i].failed;
+
+        if (i > 0)
+            tcpedit_close(workers[i].tcpedit);
+    }
+
+    safe_free(workers);
+}
+
+#endif /* HAVE_NETMAP */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,101 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BRIDGE_NETMAP_H__
+#define __BRIDGE_NETMAP_H__
+
+#include "config.h"
+#include "tcpbridge.h"
+#include "bridge.h"
+#include "tcpedit/tcpedit.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_NETMAP
+
+/* room left in each netmap buffer for tcpedit to grow the layer 2 header */
+#define BRIDGE_NETMAP_HEADROOM 64
+
+/* one netmap-registered interface, bound to all its rings or just one pair */
+struct netmap_port_s {
+    const char *name;
+    int fd;
+    void *mem;
+    size_t memsize;
+    struct netmap_if *nifp;
+    u_int first_rx, last_rx;    /* RX rings [first, last) we own */
+    u_int first_tx, last_tx;    /* TX rings [first, last) we own */
+};
+
+typedef struct netmap_port_s netmap_port_t;
+
+/*
+ * A bridge worker forwards in both directions between the same queue 
+ * pair of each interface.  With --multiqueue there is one worker per
+ * hardware queue, each running in its own thread; otherwise a single
+ * worker handles all the rings from the main thread.
+ */
+struct netmap_worker_s {
+    int id;
+    int cpu;                    /* CPU to pin to, -1 for don't care */
+    u_int16_t ringid;           /* nr_ringid to register the ports with */
+    tcpbridge_opt_t *options;
+    tcpedit_t *tcpedit;         /* tcpedit contexts aren't thread safe */
+    netmap_port_t ports[2];
+    struct live_data_t livedata[2];
+#ifdef HAVE_LIBPTHREAD
+    pthread_t thread;
+#endif
+
+    /* per-worker stats, added to the global counters at exit */
+    COUNTER pkts_sent;
+    COUNTER bytes_sent;
+    COUNTER failed;
+};
+
+typedef struct netmap_worker_s netmap_worker_t;
+
+void do_bridge_netmap(tcpbridge_opt_t *, tcpedit_t *);
+
+#endif /* HAVE_NETMAP */
+
+#endif
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
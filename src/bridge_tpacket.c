@@ -0,0 +1,428 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Linux TPACKET_V3 forwarding loop for tcpbridge.  The kernel fills
+ * blocks of an mmap'd RX ring with many frames and only wakes us up once
+ * a block is full or the block timeout expires.  Each frame is edited in
+ * place in the ring and queued to the other interface, then the whole
+ * batch is sent with a single sendmmsg() before the block is handed back
+ * to the kernel.
+ */
+
+#define _GNU_SOURCE     /* sendmmsg() & struct mmsghdr */
+
+#include "config.h"
+
+#ifdef HAVE_TPACKET_V3
+/*
+ * glibc's <netpacket/packet.h>, which sendpacket.h pulls in, clashes with
+ * <linux/if_packet.h>, and only the latter has the TPACKET_V3 definitions.
+ * The kernel header is a superset of glibc's, so use it instead.
+ */
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#define __NETPACKET_PACKET_H 1
+#endif
+
+#include "defines.h"
+#include "common.h"
+
+#ifdef HAVE_TPACKET_V3
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "tcpbridge.h"
+#include "bridge.h"
+#include "bridge_tpacket.h"
+#include "tcpedit/tcpedit.h"
+
+extern COUNTER bytes_sent, failed, pkts_sent;
+extern volatile int didsig;
+
+/* one interface: a TPACKET_V3 RX ring and a socket to send on */
+struct tpacket_port_s {
+    const char *name;
+    int ifindex;
+    int rx_fd;                  /* -1 if we never read from this port */
+    int tx_fd;
+    u_char *map;                /* mmap'd RX ring */
+    size_t mapsize;
+    u_int block;                /* next RX block to look at */
+
+    /* packets queued to send, pointing into the RX ring of the other port */
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr *msgs;
+#endif
+    struct iovec *iovs;
+    int pending;
+    u_char *scratch;            /* for packets we can't edit in the ring */
+
+    COUNTER retry_enobufs;
+    COUNTER retry_eagain;
+};
+
+typedef struct tpacket_port_s tpacket_port_t;
+
+/**
+ * Opens the socket we send out the given interface with
+ */
+static void
+tpacket_port_open(tpacket_port_t *port, const char *name)
+{
+    struct sockaddr_ll sa;
+#ifdef HAVE_SENDMMSG
+    int i;
+#endif
+
+    memset(port, 0, sizeof(tpacket_port_t));
+    port->name = name;
+    port->rx_fd = -1;
+
+    if ((port->ifindex = if_nametoindex(name)) == 0)
+        errx(-1, "Unable to find interface %s: %s", name, strerror(errno));
+
+    /* protocol 0 so this socket never receives anything */
+    if ((port->tx_fd = socket(PF_PACKET, SOCK_RAW, 0)) < 0)
+        errx(-1, "Unable to open PF_PACKET socket: %s", strerror(errno));
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sll_family = AF_PACKET;
+    sa.sll_ifindex = port->ifindex;
+    if (bind(port->tx_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+        errx(-1, "Unable to bind to %s: %s", name, strerror(errno));
+
+#ifdef HAVE_SENDMMSG
+    port->msgs = (struct mmsghdr *)safe_malloc(BRIDGE_TPACKET_BATCH * sizeof(struct mmsghdr));
+#endif
+    port->iovs = (struct iovec *)safe_malloc(BRIDGE_TPACKET_BATCH * sizeof(struct iovec));
+    port->scratch = (u_char *)safe_malloc(MAXPACKET);
+
+#ifdef HAVE_SENDMMSG
+    for (i = 0; i < BRIDGE_TPACKET_BATCH; i++) {
+        port->msgs[i].msg_hdr.msg_iov = &port->iovs[i];
+        port->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+}
+
+/**
+ * Sets up a promiscuous TPACKET_V3 RX ring on the port
+ */
+static void
+tpacket_port_rx_ring(tpacket_port_t *port, int block_timeout)
+{
+    struct tpacket_req3 req;
+    struct packet_mreq mreq;
+    struct sockaddr_ll sa;
+    int version = TPACKET_V3;
+
+    if ((port->rx_fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+        errx(-1, "Unable to open PF_PACKET socket: %s", strerror(errno));
+
+    if (setsockopt(port->rx_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+        errx(-1, "Unable to use TPACKET_V3 on %s: %s", port->name, strerror(errno));
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = BRIDGE_TPACKET_BLOCK_SIZE;
+    req.tp_block_nr = BRIDGE_TPACKET_BLOCKS;
+    req.tp_frame_size = BRIDGE_TPACKET_FRAME_SIZE;
+    req.tp_frame_nr = (req.tp_block_size * req.tp_block_nr) / req.tp_frame_size;
+    req.tp_retire_blk_tov = block_timeout;
+
+    if (setsockopt(port->rx_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+        errx(-1, "Unable to create RX ring for %s: %s", port->name, strerror(errno));
+
+    port->mapsize = (size_t)req.tp_block_size * req.tp_block_nr;
+    port->map = mmap(NULL, port->mapsize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_LOCKED, port->rx_fd, 0);
+    if (port->map == MAP_FAILED)
+        errx(-1, "Unable to mmap RX ring for %s: %s", port->name, strerror(errno));
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sll_family = AF_PACKET;
+    sa.sll_protocol = htons(ETH_P_ALL);
+    sa.sll_ifindex = port->ifindex;
+    if (bind(port->rx_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+        errx(-1, "Unable to bind to %s: %s", port->name, strerror(errno));
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = port->ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(port->rx_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        warnx("Unable to put %s in promiscuous mode: %s", port->name, strerror(errno));
+
+    dbgx(1, "%s: %d x %d byte RX blocks, %d msec block timeout", port->name,
+            req.tp_block_nr, req.tp_block_size, block_timeout);
+}
+
+/**
+ * Sends everything queued on port.  Send attempts which fail because the
+ * socket buffer is full are retried and counted as retries, the same way
+ * sendpacket() does it.  Whatever can't be sent is counted as failed.
+ */
+static void
+tpacket_flush(tpacket_port_t *port)
+{
+    int i, sent, done = 0;
+
+    while (done < port->pending) {
+#ifdef HAVE_SENDMMSG
+        sent = sendmmsg(port->tx_fd, &port->msgs[done], port->pending - done, 0);
+#else
+        sent = send(port->tx_fd, port->iovs[done].iov_base, port->iovs[done].iov_len, 0) < 0 ? -1 : 1;
+#endif
+        if (sent < 0 && !didsig) {
+            switch (errno) {
+                case EAGAIN:
+                    port->retry_eagain++;
+                    continue;
+                case ENOBUFS:
+                    port->retry_enobufs++;
+                    continue;
+                case EINTR:
+                    continue;
+                default:
+                    warnx("Unable to send %d packets out %s: %s", port->pending - done,
+                            port->name, strerror(errno));
+            }
+        }
+
+        if (sent < 0) {
+            failed += port->pending - done;
+            break;
+        }
+
+        for (i = done; i < done + sent; i++)
+            bytes_sent += port->iovs[i].iov_len;
+        pkts_sent += sent;
+        done += sent;
+    }
+
+    dbgx(2, "Sent %d packets out %s", done, port->name);
+    port->pending = 0;
+}
+
+/**
+ * Processes every frame in one RX block of src, queueing them to dst.  
+ * The frames are sent before we return, since they point into the block.
+ */
+static void
+tpacket_block(struct live_data_t *livedata, u_char *blockp, tpacket_port_t *dst)
+{
+    tcpbridge_opt_t *options = livedata->options;
+    struct tpacket_block_desc *pbd = (struct tpacket_block_desc *)blockp;
+    struct tpacket3_hdr *hdr;
+    struct sockaddr_ll *sll;
+    struct pcap_pkthdr pkthdr, *phdr;
+    u_char *pktdata;
+    u_int32_t i, num, room;
+
+    num = pbd->hdr.bh1.num_pkts;
+    hdr = (struct tpacket3_hdr *)(blockp + pbd->hdr.bh1.offset_to_first_pkt);
+
+    for (i = 0; i < num; i++, hdr = (struct tpacket3_hdr *)((u_char *)hdr + hdr->tp_next_offset)) {
+        if (options->limit_send > 0 && pkts_sent + dst->pending >= options->limit_send)
+            break;
+
+        /* don't bridge what we sent out this interface ourselves */
+        sll = (struct sockaddr_ll *)((u_char *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        if (sll->sll_pkttype == PACKET_OUTGOING)
+            continue;
+
+        pktdata = (u_char *)hdr + hdr->tp_mac;
+        memset(&pkthdr, 0, sizeof(pkthdr));
+        pkthdr.ts.tv_sec = hdr->tp_sec;
+        pkthdr.ts.tv_usec = hdr->tp_nsec / 1000;
+        pkthdr.caplen = hdr->tp_snaplen;
+        pkthdr.len = hdr->tp_len;
+        phdr = &pkthdr;
+
+        if (options->bpf.filter != NULL &&
+                bpf_filter(options->bpf.program.bf_insns, pktdata,
+                    pkthdr.len, pkthdr.caplen) == 0)
+            continue;
+
+        /* the last frame can grow to the end of the block, others up to the next one */
+        if (i + 1 < num)
+            room = hdr->tp_next_offset - hdr->tp_mac;
+        else
+            room = BRIDGE_TPACKET_BLOCK_SIZE - (pktdata - blockp);
+
+        if (pkthdr.caplen + BRIDGE_TPACKET_HEADROOM > room) {
+            memcpy(dst->scratch, pktdata, pkthdr.caplen);
+            pktdata = dst->scratch;
+        }
+
+        switch (bridge_packet(livedata, &phdr, &pktdata)) {
+            case BRIDGE_SKIP:
+                continue;
+
+            case BRIDGE_ERROR:
+                warnx("Unable to edit packet: %s", tcpedit_geterr(livedata->tcpedit));
+                failed++;
+                continue;
+
+            default:
+                break;
+        }
+
+        dst->iovs[dst->pending].iov_base = pktdata;
+        dst->iovs[dst->pending].iov_len = phdr->caplen;
+        dst->pending++;
+
+        /* the scratch buffer gets reused, so it has to go out right away */
+        if (dst->pending == BRIDGE_TPACKET_BATCH || pktdata == dst->scratch)
+            tpacket_flush(dst);
+    }
+
+    if (dst->pending > 0)
+        tpacket_flush(dst);
+}
+
+/**
+ * Main loop for bridging with TPACKET_V3 RX rings.  In unidirectional 
+ * mode we only set up a ring on intf1.
+ */
+void
+do_bridge_tpacket(tcpbridge_opt_t *options, tcpedit_t *tcpedit)
+{
+    tpacket_port_t ports[2];
+    struct live_data_t livedata[2];
+    struct pollfd polls[2];
+    struct tpacket_block_desc *pbd;
+    struct tpacket_stats_v3 stats;
+    socklen_t len;
+    int i, nports, busy, pollresult;
+
+    assert(options);
+    assert(tcpedit);
+
+    tpacket_port_open(&ports[PCAP_INT1], options->intf1);
+    tpacket_port_open(&ports[PCAP_INT2], options->intf2);
+
+    nports = options->unidir ? 1 : 2;
+    for (i = 0; i < nports; i++) {
+        tpacket_port_rx_ring(&ports[i], options->block_timeout);
+
+        memset(&livedata[i], 0, sizeof(struct live_data_t));
+        livedata[i].tcpedit = tcpedit;
+        livedata[i].options = options;
+        livedata[i].source = i;
+        livedata[i].pcap = i == PCAP_INT1 ? options->pcap1 : options->pcap2;
+    }
+
+    /* 
+     * loop until ctrl-C or we've sent enough packets
+     * note that if -L wasn't specified, limit_send is
+     * set to 0 so this will loop infinately
+     */
+    while ((options->limit_send == 0) || (options->limit_send > pkts_sent)) {
+        if (didsig)
+            break;
+
+        /* drain every block the kernel has handed us */
+        busy = 0;
+        for (i = 0; i < nports; i++) {
+            pbd = (struct tpacket_block_desc *)(ports[i].map + 
+                    ports[i].block * BRIDGE_TPACKET_BLOCK_SIZE);
+            if ((pbd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+                continue;
+
+            tpacket_block(&livedata[i], (u_char *)pbd, &ports[!i]);
+
+            __sync_synchronize();
+            pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+            ports[i].block = (ports[i].block + 1) % BRIDGE_TPACKET_BLOCKS;
+            busy = 1;
+        }
+
+        if (busy)
+            continue;
+
+        /* nothing to do, so sleep until a block is retired */
+        for (i = 0; i < nports; i++) {
+            polls[i].fd = ports[i].rx_fd;
+            polls[i].events = POLLIN | POLLERR;
+            polls[i].revents = 0;
+        }
+
+        pollresult = poll(polls, nports, options->poll_timeout);
+        if (pollresult < 0 && errno != EINTR) {
+            warnx("poll() error: %s", strerror(errno));
+            break;
+        }
+    }
+
+    for (i = 0; i < nports; i++) {
+        len = sizeof(stats);
+        if (getsockopt(ports[i].rx_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0)
+            printf("%s: %u packets received by the kernel, %u dropped\n",
+                    ports[i].name, stats.tp_packets, stats.tp_drops);
+
+        bridge_collect_stats(&livedata[i]);
+        munmap(ports[i].map, ports[i].mapsize);
+        close(ports[i].rx_fd);
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (ports[i].retry_enobufs > 0 || ports[i].retry_eagain > 0)
+            printf("%s: retried " COUNTER_SPEC " sends (ENOBUFS), " COUNTER_SPEC 
+                    " sends (EAGAIN)\n", ports[i].name, ports[i].retry_enobufs,
+                    ports[i].retry_eagain);
+
+        close(ports[i].tx_fd);
+#ifdef HAVE_SENDMMSG
+        safe_free(ports[i].msgs);
+#endif
+        safe_free(ports[i].iovs);
+        safe_free(ports[i].scratch);
+    }
+}
+
+#endif /* HAVE_TPACKET_V3 */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
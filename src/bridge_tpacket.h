@@ -0,0 +1,67 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BRIDGE_TPACKET_H__
+#define __BRIDGE_TPACKET_H__
+
+#include "config.h"
+#include "tcpbridge.h"
+#include "tcpedit/tcpedit.h"
+
+#ifdef HAVE_TPACKET_V3
+
+/* RX ring geometry: 64 x 1MB blocks per interface */
+#define BRIDGE_TPACKET_BLOCK_SIZE (1 << 20)
+#define BRIDGE_TPACKET_BLOCKS 64
+#define BRIDGE_TPACKET_FRAME_SIZE 2048
+
+/* max packets handed to the kernel per sendmmsg() */
+#define BRIDGE_TPACKET_BATCH 256
+
+/* room tcpedit needs past the end of a frame to edit it in place */
+#define BRIDGE_TPACKET_HEADROOM 64
+
+#define BRIDGE_TPACKET_DEFAULT_TIMEOUT 10    /* msec */
+
+void do_bridge_tpacket(tcpbridge_opt_t *, tcpedit_t *);
+
+#endif /* HAVE_TPACKET_V3 */
+
+#endif
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,358 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Burst pacing for --pps and --mbps: rather than sleeping before every
+ * packet, which at high rates means waits shorter than the clock can
+ * time, tcpreplay sends trains of packets with a single
+ * sendpacket_batch() and waits once per train.  The train length follows
+ * the rate and how precisely this host can wait.
+ */
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "tcpreplay.h"
+#include "burst.h"
+#include "sleep.h"
+
+extern tcpreplay_opt_t options;
+
+#ifdef DEBUG
+extern int debug;
+#endif
+
+/* waits timed when the pacer is set up to seed its cost */
+#define BURST_CALIBRATE     16
+
+static u_int64_t burst_clock(void);
+static void burst_nap(int accurate, u_int64_t nsec);
+static double burst_gap(COUNTER packets, COUNTER bytes);
+
+/**
+ * Returns a new pacer sending at most max packets at a time and waiting
+ * with the given ACCURATE_* method
+ */
+burst_t *
+burst_new(int max, int accurate)
+{
+    burst_t *burst;
+    u_int64_t asked, woke;
+    double over = 0;
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec res;
+#endif
+    int i;
+
+    assert(max > 0 && max <= BURST_MAX);
+
+    burst = (burst_t *)safe_malloc(sizeof(burst_t));
+    burst->max = max;
+    burst->accurate = accurate;
+
+#ifdef HAVE_CLOCK_GETTIME
+    if (clock_getres(CLOCK_MONOTONIC, &res) < 0)
+        errx(-1, "clock_getres() failed: %s", strerror(errno));
+    burst->resolution = TIMESPEC_TO_NANOSEC(&res);
+#else
+    burst->resolution = 1000;
+#endif
+    if (burst->resolution == 0)
+        burst->resolution = 1;
+
+    /* how late does the shortest wait we could ask for wake up? */
+    for (i = 0; i < BURST_CALIBRATE; i++) {
+        asked = burst_clock() + 1000;
+        burst_nap(accurate, 1000);
+        woke = burst_clock();
+        if (woke > asked)
+            over += woke - asked;
+    }
+    burst->cost = over / BURST_CALIBRATE;
+    if (burst->cost < burst->resolution)
+        burst->cost = burst->resolution;
+
+    dbgx(1, "burst: clock resolution %llu nsec, waits wake up %.0f nsec late",
+            (unsigned long long)burst->resolution, burst->cost);
+
+    return burst;
+}
+
+/**
+ * Starts the schedule over, the next burst goes out right away
+ */
+void
+burst_start(burst_t *burst)
+{
+    assert(burst);
+
+    burst->start = burst_clock();
+    burst->due = 0;
+}
+
+/**
+ * Returns how many packets the burst starting with a packet of pktlen
+ * bytes should have: enough that the burst lasts BURST_COST_RATIO times
+ * as long as a wait oversleeps, and at least one
+ */
+int
+burst_size(burst_t *burst, u_int32_t pktlen)
+{
+    double gap, n;
+    int size;
+
+    assert(burst);
+
+    gap = burst_gap(1, pktlen);
+    if (gap <= 0)
+        return burst->max;
+
+    n = (BURST_COST_RATIO * burst->cost) / gap;
+    if (n < 1)
+        return 1;
+    if (n >= burst->max)
+        return burst->max;
+
+    /* round up, without pulling in libm for ceil() */
+    size = (int)n;
+    return size < n ? size + 1 : size;
+}
+
+/**
+ * Waits until the next burst is due.  The wait asks to wake up early by
+ * as much as waits have been oversleeping, and what this one does is
+ * folded back into that.
+ */
+void
+burst_wait(burst_t *burst)
+{
+    double now, nap;
+    u_int64_t asked, woke, maxsleep;
+
+    assert(burst);
+
+    now = burst_clock() - burst->start;
+    if (now >= burst->due) {
+        if (now - burst->due > burst->cost && burst->bursts > 0)
+            burst->behind ++;
+        return;
+    }
+
+    nap = burst->due - now - burst->cost;
+    if (nap <= 0)
+        return;
+
+    /* --maxsleep: move the rest of the schedule up by what we skip */
+    if (timesisset(&options.maxsleep)) {
+        maxsleep = TIMESPEC_TO_NANOSEC(&options.maxsleep);
+        if (nap > maxsleep) {
+            dbgx(2, "burst: was going to sleep %.0f nsec, maxsleeping", nap);
+            burst->start -= (u_int64_t)(nap - maxsleep);
+            nap = maxsleep;
+        }
+    }
+
+    asked = burst_clock() + (u_int64_t)nap;
+    burst_nap(burst->accurate, (u_int64_t)nap);
+    woke = burst_clock();
+
+    /* moving average of 1/8th, like TCP's RTT estimator */
+    burst->cost += ((double)woke - (double)asked - burst->cost) / 8;
+    if (burst->cost < burst->resolution)
+        burst->cost = burst->resolution;
+}
+
+/**
+ * Accounts for a burst of count packets and bytes bytes having been sent:
+ * the next one is due once they would have gone out at the target rate
+ */
+void
+burst_sent(burst_t *burst, int count, COUNTER bytes)
+{
+    int bucket = 0;
+
+    assert(burst);
+    assert(count > 0);
+
+    burst->due += burst_gap(count, bytes);
+    burst->bursts ++;
+    burst->packets += count;
+
+    while ((count >>= 1) > 0 && bucket < BURST_BUCKETS - 1)
+        bucket ++;
+    burst->hist[bucket] ++;
+}
+
+/**
+ * Prints how many bursts of which sizes were sent
+ */
+void
+burst_report(burst_t *burst)
+{
+    int i, lo, hi;
+
+    assert(burst);
+
+    if (burst->bursts == 0)
+        return;
+
+    printf("Bursts: " COUNTER_SPEC " (%.1f packets on average), " COUNTER_SPEC " behind schedule, "
+            "waits %.0f nsec late\n", burst->bursts, (double)burst->packets / burst->bursts,
+            burst->behind, burst->cost);
+
+    for (i = 0; i < BURST_BUCKETS; i++) {
+        if (burst->hist[i] == 0)
+            continue;
+
+        lo = 1 << i;
+        hi = (lo << 1) - 1;
+        if (hi > burst->max)
+            hi = burst->max;
+        if (lo == hi)
+            printf("\t%4d packets:      ", lo);
+        else
+            printf("\t%4d-%-4d packets: ", lo, hi);
+        printf(COUNTER_SPEC " bursts (%.1f%%)\n", burst->hist[i],
+                burst->hist[i] * 100.0 / burst->bursts);
+    }
+}
+
+void
+burst_free(burst_t *burst)
+{
+    assert(burst);
+    safe_free(burst);
+}
+
+/**
+ * The clock the schedule runs on, in nanoseconds
+ */
+static u_int64_t
+burst_clock(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+        errx(-1, "clock_gettime() failed: %s", strerror(errno));
+
+    return TIMESPEC_TO_NANOSEC(&now);
+#else
+    struct timeval now;
+
+    if (gettimeofday(&now, NULL) < 0)
+        errx(-1, "gettimeofday() failed: %s", strerror(errno));
+
+    return TIMEVAL_TO_NANOSEC(&now);
+#endif
+}
+
+/**
+ * Sleeps nsec nanoseconds the same way do_sleep() would
+ */
+static void
+burst_nap(int accurate, u_int64_t nsec)
+{
+    struct timespec nap;
+
+    NANOSEC_TO_TIMESPEC(nsec, &nap);
+
+    switch (accurate) {
+#ifdef HAVE_SELECT
+    case ACCURATE_SELECT:
+        select_sleep(nap);
+        break;
+#endif
+
+#ifdef HAVE_IOPERM
+    case ACCURATE_IOPORT:
+        ioport_sleep(nap);
+        break;
+#endif
+
+#ifdef HAVE_RDTSC
+    case ACCURATE_RDTSC:
+        rdtsc_sleep(nap);
+        break;
+#endif
+
+#ifdef HAVE_ABSOLUTE_TIME
+    case ACCURATE_ABS_TIME:
+        absolute_time_sleep(nap);
+        break;
+#endif
+
+    case ACCURATE_GTOD:
+        gettimeofday_sleep(nap);
+        break;
+
+    case ACCURATE_NANOSLEEP:
+        nanosleep_sleep(nap);
+        break;
+
+    default:
+        errx(-1, "Unknown timer mode %d", accurate);
+    }
+}
+
+/**
+ * Returns how many nanoseconds packets totalling bytes take at --pps or
+ * --mbps
+ */
+static double
+burst_gap(COUNTER packets, COUNTER bytes)
+{
+    if (options.speed.speed <= 0)
+        return 0;
+
+    if (options.speed.mode == SPEED_PACKETRATE)
+        return (double)packets * 1000000000 / options.speed.speed;
+
+    /* Mbps: 8 bits a byte, 1000 nsec per usec per Mbps */
+    return (double)bytes * 8 * 1000 / options.speed.speed;
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
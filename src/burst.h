@@ -0,0 +1,90 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BURST_H__
+#define __BURST_H__
+
+/* --burst-max limits */
+#define BURST_MAX_DEFAULT   64
+#define BURST_MAX           1024
+
+/* histogram buckets: bursts of 1, 2-3, 4-7 ... 512-1023 and 1024 packets */
+#define BURST_BUCKETS       11
+
+/*
+ * a burst lasts at least this many times as long as a wait oversleeps, so
+ * the clock's error is a small fraction of every gap between bursts
+ */
+#define BURST_COST_RATIO    8
+
+/*
+ * Paces --pps and --mbps replays in trains of packets handed to
+ * sendpacket_batch() at once instead of one timed send per packet.  All
+ * times are nanoseconds since start.  due is when the next burst should
+ * go out and only ever grows by the time its packets take at the target
+ * rate, so however the bursts are split and however late a wait wakes
+ * up, the average rate stays exact.  cost is how late a wait wakes up:
+ * it is measured when the pacer is set up, follows what every wait
+ * actually does and sets how many packets the next burst gets.
+ */
+struct burst_s {
+    int accurate;               /* ACCURATE_* method to wait with */
+    int max;                    /* --burst-max */
+    u_int64_t start;
+    double due;
+    double cost;
+    u_int64_t resolution;       /* of the clock, from clock_getres() */
+    COUNTER bursts;
+    COUNTER packets;
+    COUNTER behind;             /* bursts already late when they were due */
+    COUNTER hist[BURST_BUCKETS];
+};
+
+typedef struct burst_s burst_t;
+
+burst_t *burst_new(int max, int accurate);
+void burst_start(burst_t *burst);
+int burst_size(burst_t *burst, u_int32_t pktlen);
+void burst_wait(burst_t *burst);
+void burst_sent(burst_t *burst, int count, COUNTER bytes);
+void burst_report(burst_t *burst);
+void burst_free(burst_t *burst);
+
+#endif /* __BURST_H__ */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -20,7 +20,12 @@
 #include "common/timer.h"
 #include "common/abort.h"
 #include "common/sendpacket.h"
+#include "common/pcapwriter.h"
 #include "common/interface.h"
+#include "common/zpcap.h"
+#include "common/pcapreader.h"
+#include "common/numamem.h"
+#include "common/cpusched.h"
 
 const char *svn_version(void); /* svn_version.c */
 
@@ -0,0 +1,209 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE     /* pthread_setaffinity_np() & CPU_SET() */
+#endif
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sched.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "cpusched.h"
+
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024
+#endif
+
+cpusched_t cpusched_sender;
+cpusched_t cpusched_helper;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/* what cpusched_apply() resets threads of a reset class to */
+static cpu_set_t cpusched_saved;
+#endif
+
+/**
+ * Parses a CPU list like "2,4-7" into sched.  Returns 0, or -1 and fills
+ * out errbuf if the list is malformed.
+ */
+int
+cpusched_parse(cpusched_t *sched, const char *list, char *errbuf)
+{
+    const char *p = list;
+    char *end;
+    long first, last;
+
+    assert(sched);
+    assert(list);
+    assert(errbuf);
+
+    sched->ncpus = 0;
+    while (*p != '\0') {
+        if (! isdigit((int)*p))
+            goto bad;
+        first = last = strtol(p, &end, 10);
+        p = end;
+        if (*p == '-') {
+            if (! isdigit((int)p[1]))
+                goto bad;
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        if (last < first || last >= CPU_SETSIZE)
+            goto bad;
+        for (; first <= last; first++) {
+            if (sched->ncpus == CPUSCHED_MAX_CPUS) {
+                snprintf(errbuf, CPUSCHED_ERRBUF_SIZE, "%s: more than %d CPUs", 
+                        list, CPUSCHED_MAX_CPUS);
+                return -1;
+            }
+            sched->cpus[sched->ncpus++] = (int)first;
+        }
+        if (*p == ',')
+            p++;
+        else if (*p != '\0')
+            goto bad;
+    }
+    if (sched->ncpus > 0)
+        return 0;
+
+bad:
+    snprintf(errbuf, CPUSCHED_ERRBUF_SIZE, "invalid CPU list: %s", list);
+    return -1;
+}
+
+/**
+ * Saves the CPU affinity of the calling thread, before it pins itself, so
+ * threads of sched with no CPU list don't inherit that pin: cpusched_apply()
+ * resets them to the saved CPUs instead.  Returns 0, or -1 and fills out
+ * errbuf.
+ */
+int
+cpusched_save(cpusched_t *sched, char *errbuf)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    int err;
+#endif
+
+    assert(sched);
+    assert(errbuf);
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    if ((err = pthread_getaffinity_np(pthread_self(), sizeof(cpusched_saved), &cpusched_saved)) != 0) {
+        snprintf(errbuf, CPUSCHED_ERRBUF_SIZE, "unable to get the CPU affinity: %s", strerror(err));
+        return -1;
+    }
+    sched->reset = 1;
+#endif
+    return 0;
+}
+
+/**
+ * Applies sched to the calling thread: pins it to the next CPU of the
+ * list, or back to the cpusched_save() CPUs, and switches it to
+ * SCHED_FIFO.  *cpu is set to the CPU, or -1 if the thread wasn't pinned
+ * to one.  Returns 0, or -1 and fills out errbuf.
+ */
+int
+cpusched_apply(cpusched_t *sched, int *cpu, char *errbuf)
+{
+#ifdef HAVE_LIBPTHREAD
+    struct sched_param param;
+#endif
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t cpuset;
+#endif
+    int err;
+
+    assert(sched);
+    assert(cpu);
+    assert(errbuf);
+
+    *cpu = -1;
+    if (sched->ncpus > 0) {
+        *cpu = sched->cpus[__sync_fetch_and_add(&sched->next, 1) % sched->ncpus];
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+        CPU_ZERO(&cpuset);
+        CPU_SET(*cpu, &cpuset);
+        if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset)) != 0) {
+            snprintf(errbuf, CPUSCHED_ERRBUF_SIZE, "unable to pin to CPU %d: %s", 
+                    *cpu, strerror(err));
+            return -1;
+        }
+#else
+        snprintf(errbuf, CPUSCHED_ERRBUF_SIZE, "CPU affinity is not supported on this platform");
+        return -1;
+#endif
+    }
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    else if (sched->reset &&
+            (err = pthread_setaffinity_np(pthread_self(), sizeof(cpusched_saved), &cpusched_saved)) != 0) {
+        snprintf(errbuf, CPUSCHED_ERRBUF_SIZE, "unable to reset the CPU affinity: %s", strerror(err));
+        return -1;
+    }
+#endif
+
+    if (sched->priority > 0) {
+#ifdef HAVE_LIBPTHREAD
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = sched->priority;
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0) {
+            snprintf(errbuf, CPUSCHED_ERRBUF_SIZE, "unable to use SCHED_FIFO priority %d: %s", 
+                    sched->priority, strerror(err));
+            return -1;
+        }
+#else
+        snprintf(errbuf, CPUSCHED_ERRBUF_SIZE, "SCHED_FIFO needs pthreads");
+        return -1;
+#endif
+    }
+
+    return 0;
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,75 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CPUSCHED_H_
+#define _CPUSCHED_H_
+
+#include "config.h"
+#include "defines.h"
+
+#define CPUSCHED_MAX_CPUS 256
+#define CPUSCHED_ERRBUF_SIZE 256
+
+/*
+ * CPU affinity and real-time priority for one class of threads.  Each
+ * thread calling cpusched_apply() is pinned to the next CPU of the list,
+ * wrapping around, so N threads can share or split M CPUs.
+ */
+typedef struct {
+    int cpus[CPUSCHED_MAX_CPUS];
+    int ncpus;                  /* 0 to leave affinity alone */
+    int priority;               /* SCHED_FIFO priority, 0 to leave alone */
+    int reset;                  /* with no cpus, undo an inherited pin */
+    volatile int next;          /* next entry of cpus to hand out */
+} cpusched_t;
+
+/* 
+ * Threads which send packets, and threads which feed or drain them (the
+ * TX ring kick thread, memring consumers, read-ahead readers).  Filled
+ * out by the program, applied by whoever starts the thread.
+ */
+extern cpusched_t cpusched_sender;
+extern cpusched_t cpusched_helper;
+
+int cpusched_parse(cpusched_t *sched, const char *list, char *errbuf);
+int cpusched_apply(cpusched_t *sched, int *cpu, char *errbuf);
+int cpusched_save(cpusched_t *sched, char *errbuf);
+
+#endif /* _CPUSCHED_H_ */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,277 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "memring.h"
+
+/* 
+ * every packet is stored as a pcap_pkthdr followed by caplen bytes of
+ * data, padded so the next header is aligned.  A header with this caplen
+ * (or less room than a header before the end of the buffer) means the
+ * producer skipped to the start of the buffer.
+ */
+#define MEMRING_WRAP   0xffffffff
+#define MEMRING_ALIGN  8
+#define MEMRING_RECLEN(caplen) \
+    ((sizeof(struct pcap_pkthdr) + (caplen) + MEMRING_ALIGN - 1) & ~(size_t)(MEMRING_ALIGN - 1))
+
+#ifdef HAVE_LIBPTHREAD
+static void *memring_consumer(void *arg);
+#endif
+
+/**
+ * Allocates a ring of size bytes (rounded up to a power of two, 0 for the
+ * default) and starts the consumer.  If path is not NULL, drained packets
+ * are written to it as a DLT_EN10MB pcap.  Returns NULL and fills out
+ * errbuf on error.
+ */
+memring_t *
+memring_open(size_t size, const char *path, char *errbuf)
+{
+    memring_t *ring;
+    size_t bufsize = 4096;
+
+    assert(errbuf);
+
+    if (size == 0)
+        size = MEMRING_SIZE;
+    while (bufsize < size)
+        bufsize <<= 1;
+
+    ring = (memring_t *)safe_malloc(sizeof(memring_t));
+    ring->buf = (u_char *)safe_malloc(bufsize);
+    ring->size = bufsize;
+
+    if (path != NULL && (ring->writer = pcapwriter_open(path, DLT_EN10MB, 
+            MAX_SNAPLEN, 0, 0, errbuf)) == NULL) {
+        safe_free(ring->buf);
+        safe_free(ring);
+        return NULL;
+    }
+
+#ifdef HAVE_LIBPTHREAD
+    if (pthread_create(&ring->consumer, NULL, memring_consumer, ring) != 0) {
+        snprintf(errbuf, MEMRING_ERRBUF_SIZE, "Unable to start memring consumer: %s",
+                strerror(errno));
+        if (ring->writer != NULL)
+            pcapwriter_close(ring->writer);
+        safe_free(ring->buf);
+        safe_free(ring);
+        return NULL;
+    }
+#endif
+
+    return ring;
+}
+
+/**
+ * Copies a packet into the ring.  Returns len on success, or -1 with 
+ * errno set to EAGAIN if the ring is full (try again once the consumer
+ * has caught up) or EMSGSIZE if the packet can never fit.
+ */
+int
+memring_put(memring_t *ring, const u_char *data, size_t len, 
+        const struct pcap_pkthdr *pkthdr)
+{
+    struct pcap_pkthdr hdr;
+    size_t head, off, needed, skip;
+
+    assert(ring);
+    assert(data);
+
+    needed = MEMRING_RECLEN(len);
+    if (needed > ring->size / 2) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    head = ring->head;
+    off = head & (ring->size - 1);
+    skip = (ring->size - off < needed) ? ring->size - off : 0;
+
+    if (head + skip + needed - ring->tail > ring->size) {
+        ring->full ++;
+#ifdef HAVE_LIBPTHREAD
+        /* give the consumer a chance if we share a CPU */
+        sched_yield();
+#else
+        memring_drain(ring);
+#endif
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (skip > 0) {
+        if (skip >= sizeof(hdr)) {
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.caplen = MEMRING_WRAP;
+            memcpy(ring->buf + off, &hdr, sizeof(hdr));
+        }
+        off = 0;
+    }
+
+    if (pkthdr != NULL) {
+        hdr = *pkthdr;
+    } else {
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.len = len;
+    }
+    hdr.caplen = len;
+    memcpy(ring->buf + off, &hdr, sizeof(hdr));
+    memcpy(ring->buf + off + sizeof(hdr), data, len);
+
+    /* the packet must be visible before the consumer sees the new head */
+    __sync_synchronize();
+    ring->head = head + skip + needed;
+    return (int)len;
+}
+
+/**
+ * Consumes everything currently in the ring.  Returns the number of
+ * packets drained.
+ */
+int
+memring_drain(memring_t *ring)
+{
+    struct pcap_pkthdr hdr;
+    size_t head, tail, off;
+    int count = 0;
+
+    assert(ring);
+
+    head = ring->head;
+    __sync_synchronize();
+
+    for (tail = ring->tail; tail != head; ) {
+        off = tail & (ring->size - 1);
+        if (ring->size - off < sizeof(hdr)) {
+            tail += ring->size - off;
+            continue;
+        }
+        memcpy(&hdr, ring->buf + off, sizeof(hdr));
+        if (hdr.caplen == MEMRING_WRAP) {
+            tail += ring->size - off;
+            continue;
+        }
+
+        if (ring->writer != NULL && 
+                pcapwriter_write(ring->writer, &hdr, ring->buf + off + sizeof(hdr)) < 0)
+            ring->write_errors ++;
+
+        ring->drained ++;
+        ring->drained_bytes += hdr.caplen;
+        tail += MEMRING_RECLEN(hdr.caplen);
+        count ++;
+    }
+
+    /* finish reading before handing the space back to the producer */
+    __sync_synchronize();
+    ring->tail = tail;
+    return count;
+}
+
+#ifdef HAVE_LIBPTHREAD
+/**
+ * Consumer thread: drains the ring until memring_close()
+ */
+static void *
+memring_consumer(void *arg)
+{
+    memring_t *ring = (memring_t *)arg;
+    char errbuf[CPUSCHED_ERRBUF_SIZE];
+    int cpu;
+
+    if (cpusched_apply(&cpusched_helper, &cpu, errbuf) < 0)
+        warnx("memring consumer: %s", errbuf);
+
+    while (! ring->done || ring->tail != ring->head) {
+        if (memring_drain(ring) == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+#endif
+
+/**
+ * Waits until the consumer has drained everything put so far
+ */
+void
+memring_sync(memring_t *ring)
+{
+    assert(ring);
+
+#ifdef HAVE_LIBPTHREAD
+    while (ring->tail != ring->head)
+        sched_yield();
+#else
+    memring_drain(ring);
+#endif
+}
+
+/**
+ * Drains the ring, stops the consumer, closes the pcap file and frees
+ * the ring
+ */
+void
+memring_close(memring_t *ring)
+{
+    assert(ring);
+
+    ring->done = 1;
+#ifdef HAVE_LIBPTHREAD
+    pthread_join(ring->consumer, NULL);
+#else
+    memring_drain(ring);
+#endif
+
+    if (ring->writer != NULL && pcapwriter_close(ring->writer) < 0)
+        warn("Error closing memring pcap file");
+
+    safe_free(ring->buf);
+    safe_free(ring);
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,90 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MEMRING_H_
+#define _MEMRING_H_
+
+#include "config.h"
+#include "defines.h"
+#include "pcapwriter.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#define MEMRING_ERRBUF_SIZE 1024
+
+/* default ring size, must be a power of two */
+#define MEMRING_SIZE (16 * 1024 * 1024)
+
+/*
+ * Single producer/single consumer ring of packets in one flat buffer, used
+ * by the "memring" sendpacket backend as a stand-in for a NIC.  The sending
+ * thread copies packets in with memring_put(); a consumer thread drains
+ * them and optionally writes them to a pcap file.  head and tail only ever
+ * grow, so the used space is always head - tail and neither side needs a
+ * lock.  Without pthreads the producer drains the ring itself when full.
+ */
+struct memring_s {
+    u_char *buf;
+    size_t size;
+    volatile size_t head;       /* next byte the producer writes */
+    volatile size_t tail;       /* next byte the consumer reads */
+    volatile int done;
+    pcapwriter_t *writer;       /* NULL to just drop drained packets */
+#ifdef HAVE_LIBPTHREAD
+    pthread_t consumer;
+#endif
+    COUNTER full;               /* memring_put() found no room */
+    COUNTER drained;
+    COUNTER drained_bytes;
+    COUNTER write_errors;
+};
+
+typedef struct memring_s memring_t;
+
+memring_t *memring_open(size_t size, const char *path, char *errbuf);
+int memring_put(memring_t *ring, const u_char *data, size_t len, 
+        const struct pcap_pkthdr *pkthdr);
+int memring_drain(memring_t *ring);
+void memring_sync(memring_t *ring);
+void memring_close(memring_t *ring);
+
+#endif /* _MEMRING_H_ */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
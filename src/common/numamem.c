@@ -0,0 +1,331 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * NUMA placement for tcpreplay: which node a NIC hangs off (from sysfs),
+ * pinning a thread to that node's CPUs and huge page backed memory bound
+ * to it.  Only Linux knows about nodes; elsewhere everything is
+ * NUMAMEM_ANY and the memory is just mmap()ed.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE     /* sched_setaffinity() & CPU_SET() */
+#endif
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "numamem.h"
+
+#if defined MAP_ANON && ! defined MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* from <linux/mempolicy.h>, which isn't always installed */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED  1
+#endif
+#ifndef MPOL_F_NODE
+#define MPOL_F_NODE     (1 << 0)
+#define MPOL_F_ADDR     (1 << 1)
+#endif
+
+#define NUMAMEM_MAX_NODES 1024
+#define NUMAMEM_ALIGN     16
+#define NUMAMEM_ROUND(size, to) (((size) + (to) - 1) & ~(size_t)((to) - 1))
+
+#ifdef __linux__
+/**
+ * Reads the first line of a sysfs file into buf without the newline.
+ * Returns 0, or -1 if the file can't be read.
+ */
+static int
+numamem_sysfs(const char *path, char *buf, size_t len)
+{
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+    if (fgets(buf, len, fp) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+#endif
+
+/**
+ * Returns the NUMA node of the NIC behind a tcpreplay device name, or
+ * NUMAMEM_ANY if it isn't a PCI device (lo, vale ports, null, memring)
+ * or the system has a single node.  netmap: prefixes and ring suffixes
+ * are stripped.
+ */
+int
+numamem_intf_node(const char *device)
+{
+#ifdef __linux__
+    char name[64], path[128], buf[32], *dash;
+    size_t len;
+    int node;
+
+    assert(device);
+
+    if (strncmp(device, "netmap:", 7) == 0)
+        device += 7;
+    len = strcspn(device, "^*@/{}");
+    if (len >= sizeof(name))
+        return NUMAMEM_ANY;
+    memcpy(name, device, len);
+    name[len] = '\0';
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", name);
+    if (numamem_sysfs(path, buf, sizeof(buf)) < 0) {
+        /* netmap:eth0-1 is ring 1 of eth0 */
+        if ((dash = strrchr(name, '-')) == NULL)
+            return NUMAMEM_ANY;
+        *dash = '\0';
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", name);
+        if (numamem_sysfs(path, buf, sizeof(buf)) < 0)
+            return NUMAMEM_ANY;
+    }
+
+    node = atoi(buf);
+    return node >= 0 ? node : NUMAMEM_ANY;
+#else
+    return NUMAMEM_ANY;
+#endif
+}
+
+/**
+ * Pins the calling thread to the CPUs of node and copies the node's CPU
+ * list (e.g. "0-7,16-23") into cpulist.  Returns the number of CPUs, or
+ * -1 if the thread can't be pinned.
+ */
+int
+numamem_bind_node(int node, char *cpulist, size_t len)
+{
+#ifdef __linux__
+    char path[128], buf[1024], *p;
+    cpu_set_t cpuset;
+    long first, last;
+    int cpus = 0;
+
+    assert(cpulist);
+
+    if (node < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (numamem_sysfs(path, buf, sizeof(buf)) < 0)
+        return -1;
+    strlcpy(cpulist, buf, len);
+
+    CPU_ZERO(&cpuset);
+    p = buf;
+    while (*p != '\0') {
+        first = last = strtol(p, &p, 10);
+        if (*p == '-')
+            last = strtol(p + 1, &p, 10);
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, &cpuset);
+            cpus++;
+        }
+        if (*p != ',')
+            break;
+        p++;
+    }
+
+    /* pid 0 is the calling thread, not the whole process */
+    if (cpus == 0 || sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0)
+        return -1;
+    return cpus;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Allocates size bytes, rounded up to NUMAMEM_CHUNK, preferably from huge
+ * pages and preferably on node (NUMAMEM_ANY for wherever).  The memory is
+ * zeroed and already faulted in.  *huge is set if it came from the huge
+ * page pool.  Returns NULL if no memory is left.
+ */
+void *
+numamem_alloc(size_t size, int node, int *huge)
+{
+    void *ptr = NULL;
+#if defined __linux__ && defined SYS_mbind
+    unsigned long nodemask[NUMAMEM_MAX_NODES / (8 * sizeof(unsigned long))];
+#endif
+
+    assert(huge);
+
+    *huge = 0;
+    size = NUMAMEM_ROUND(size, NUMAMEM_CHUNK);
+
+#ifdef HAVE_MMAP
+#ifdef MAP_HUGETLB
+    /* needs pages reserved in /proc/sys/vm/nr_hugepages */
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+        *huge = 1;
+#endif
+    if (! *huge) {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        /* transparent huge pages, if the kernel has them */
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    }
+#else
+    ptr = safe_malloc(size);
+#endif
+
+#if defined __linux__ && defined SYS_mbind
+    /* preferred rather than bound, so a full node falls back to another */
+    if (node >= 0 && node < NUMAMEM_MAX_NODES) {
+        memset(nodemask, 0, sizeof(nodemask));
+        nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, nodemask, NUMAMEM_MAX_NODES, 0) < 0)
+            dbgx(1, "mbind() to node %d failed: %s", node, strerror(errno));
+    }
+#endif
+
+    /* fault the pages in now rather than while sending */
+    memset(ptr, 0, size);
+
+    dbgx(2, "numamem: %zu bytes of %s pages for node %d", size, 
+            *huge ? "huge" : "normal", node);
+    return ptr;
+}
+
+/**
+ * Frees memory from numamem_alloc(), size must be what was asked for
+ */
+void
+numamem_free(void *ptr, size_t size)
+{
+    assert(ptr);
+
+#ifdef HAVE_MMAP
+    munmap(ptr, NUMAMEM_ROUND(size, NUMAMEM_CHUNK));
+#else
+    safe_free(ptr);
+#endif
+}
+
+/**
+ * Returns the node the page at ptr is on, or NUMAMEM_ANY if unknown
+ */
+int
+numamem_node_of(const void *ptr)
+{
+#if defined __linux__ && defined SYS_get_mempolicy
+    int node;
+
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, ptr, MPOL_F_NODE | MPOL_F_ADDR) == 0)
+        return node;
+#endif
+    return NUMAMEM_ANY;
+}
+
+/**
+ * Creates an arena handing out memory preferably from node
+ */
+numamem_arena_t *
+numamem_arena_new(int node)
+{
+    numamem_arena_t *arena;
+
+    arena = (numamem_arena_t *)safe_malloc(sizeof(numamem_arena_t));
+    arena->node = node;
+    return arena;
+}
+
+/**
+ * Returns size bytes of zeroed memory from arena, which is never freed
+ */
+void *
+numamem_arena_alloc(numamem_arena_t *arena, size_t size)
+{
+    void *ptr;
+    size_t chunksize;
+    int huge, node;
+
+    assert(arena);
+
+    size = NUMAMEM_ROUND(size, NUMAMEM_ALIGN);
+    if (arena->chunk == NULL || arena->size - arena->used < size) {
+        chunksize = NUMAMEM_ROUND(size, NUMAMEM_CHUNK);
+        if ((arena->chunk = numamem_alloc(chunksize, arena->node, &huge)) == NULL)
+            errx(-1, "Unable to allocate %zu bytes: %s", chunksize, strerror(errno));
+        arena->size = chunksize;
+        arena->used = 0;
+        arena->chunks++;
+        if (huge)
+            arena->huge++;
+        if (arena->node >= 0 && (node = numamem_node_of(arena->chunk)) >= 0 && 
+                node != arena->node)
+            arena->remote++;
+    }
+
+    ptr = arena->chunk + arena->used;
+    arena->used += size;
+    arena->bytes += size;
+    return ptr;
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
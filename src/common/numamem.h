@@ -0,0 +1,80 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _NUMAMEM_H_
+#define _NUMAMEM_H_
+
+#include "config.h"
+#include "defines.h"
+
+/* 
+ * unit of numamem_alloc(): one x86 huge page, so the arenas below fill
+ * exactly one per chunk
+ */
+#define NUMAMEM_CHUNK   (2 * 1024 * 1024)
+
+/* node number for "not known" or "don't care" */
+#define NUMAMEM_ANY     -1
+
+/*
+ * Bump allocator for memory which lives as long as the process, like the
+ * --preload-pcap cache.  Chunks of NUMAMEM_CHUNK bytes come from
+ * numamem_alloc() and are never freed.
+ */
+typedef struct {
+    int node;                   /* where we want the memory */
+    u_char *chunk;
+    size_t used;
+    size_t size;
+    COUNTER bytes;              /* handed out so far */
+    COUNTER chunks;
+    COUNTER huge;               /* chunks backed by huge pages */
+    COUNTER remote;             /* chunks which ended up on another node */
+} numamem_arena_t;
+
+int numamem_intf_node(const char *device);
+int numamem_bind_node(int node, char *cpulist, size_t len);
+void *numamem_alloc(size_t size, int node, int *huge);
+void numamem_free(void *ptr, size_t size);
+int numamem_node_of(const void *ptr);
+numamem_arena_t *numamem_arena_new(int node);
+void *numamem_arena_alloc(numamem_arena_t *arena, size_t size);
+
+#endif /* _NUMAMEM_H_ */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,715 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Native pcap/pcapng reader.  libpcap hands out packets with a struct
+ * timeval and forgets which pcapng interface they came from, so tcpreplay
+ * reads its input files itself: pcap files with microsecond or nanosecond
+ * timestamps (and Kuznetzov's modified headers) in either byte order, and
+ * pcapng files with any if_tsresol/if_tsoffset, any number of interfaces
+ * and sections, and enhanced, simple and obsolete packet blocks.
+ */
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "pcapreader.h"
+
+#define TCPDUMP_MAGIC           0xa1b2c3d4
+#define KUZNETZOV_TCPDUMP_MAGIC 0xa1b2cd34
+#define NAVTEL_TCPDUMP_MAGIC    0xa12b3c4d
+#define NSEC_TCPDUMP_MAGIC      0xa1b23c4d
+
+/* how to read each pcap magic number */
+static const struct {
+    u_int32_t magic;
+    int swapped;
+    int pkthdrlen;
+    int nsec;
+} pcapreader_magics[] = {
+    { TCPDUMP_MAGIC,                        0, 16, 0 },
+    { SWAPLONG(TCPDUMP_MAGIC),              1, 16, 0 },
+    { KUZNETZOV_TCPDUMP_MAGIC,              0, 24, 0 },
+    { SWAPLONG(KUZNETZOV_TCPDUMP_MAGIC),    1, 24, 0 },
+    { NAVTEL_TCPDUMP_MAGIC,                 0, 16, 1 },
+    { SWAPLONG(NAVTEL_TCPDUMP_MAGIC),       1, 16, 1 },
+    { NSEC_TCPDUMP_MAGIC,                   0, 16, 1 },
+    { SWAPLONG(NSEC_TCPDUMP_MAGIC),         1, 16, 1 },
+    { 0, 0, 0, 0 }
+};
+
+/* pcapng block types and option codes */
+#define PCAPNG_SHB              0x0a0d0d0a
+#define PCAPNG_IDB              0x00000001
+#define PCAPNG_PB               0x00000002
+#define PCAPNG_SPB              0x00000003
+#define PCAPNG_EPB              0x00000006
+#define PCAPNG_BOM              0x1a2b3c4d
+#define PCAPNG_OPT_END          0
+#define PCAPNG_IF_NAME          2
+#define PCAPNG_IF_TSRESOL       9
+#define PCAPNG_IF_TSOFFSET      14
+
+/* largest caplen we read whatever the snaplen says, and the largest pcapng block */
+#define PCAPREADER_MAX_CAPLEN   262144
+#define PCAPREADER_MAX_BLOCK    (16 * 1024 * 1024)
+
+static int pcapreader_open_pcapng(pcapreader_t *reader);
+static int pcapreader_block(pcapreader_t *reader, u_int32_t have, u_int32_t *type, 
+        u_int32_t *bodylen);
+static int pcapreader_section(pcapreader_t *reader, u_int32_t bodylen);
+static int pcapreader_interface(pcapreader_t *reader, u_int32_t bodylen);
+static const u_char *pcapreader_next_pcapng(pcapreader_t *reader, 
+        struct pcap_pkthdr *pkthdr, pcapreader_meta_t *meta);
+static int pcapreader_grow(pcapreader_t *reader, size_t len);
+static int pcapreader_error(pcapreader_t *reader, const char *fmt, ...);
+
+/**
+ * Returns the 32bit word at p in host byte order
+ */
+static inline u_int32_t
+pcapreader_word(const pcapreader_t *reader, const u_char *p)
+{
+    u_int32_t word;
+
+    memcpy(&word, p, sizeof(word));
+    return reader->swapped ? SWAPLONG(word) : word;
+}
+
+/**
+ * Returns the 16bit word at p in host byte order
+ */
+static inline u_int16_t
+pcapreader_short(const pcapreader_t *reader, const u_char *p)
+{
+    u_int16_t word;
+
+    memcpy(&word, p, sizeof(word));
+    return reader->swapped ? SWAPSHORT(word) : word;
+}
+
+/**
+ * Returns the 64bit pcapng timestamp split in two 32bit words at p
+ */
+static inline u_int64_t
+pcapreader_ts64(const pcapreader_t *reader, const u_char *p)
+{
+    return ((u_int64_t)pcapreader_word(reader, p) << 32) | pcapreader_word(reader, p + 4);
+}
+
+/**
+ * Returns the 64bit pcapng option value at p in host byte order
+ */
+static inline u_int64_t
+pcapreader_int64(const pcapreader_t *reader, const u_char *p)
+{
+    u_int64_t word;
+
+    memcpy(&word, p, sizeof(word));
+    if (reader->swapped)
+        word = ((u_int64_t)SWAPLONG((u_int32_t)word) << 32) | SWAPLONG((u_int32_t)(word >> 32));
+    return word;
+}
+
+/**
+ * Maps a LINKTYPE_ value from a file to the DLT_ value libpcap uses, 
+ * they only differ for a few old types
+ */
+static int
+pcapreader_dlt(u_int32_t linktype)
+{
+    /* the upper bits only say whether there's an FCS */
+    switch (linktype & 0x03ffffff) {
+#ifdef DLT_ATM_RFC1483
+    case 100:
+        return DLT_ATM_RFC1483;
+#endif
+    case 101:
+        return DLT_RAW;
+#ifdef DLT_SLIP_BSDOS
+    case 102:
+        return DLT_SLIP_BSDOS;
+#endif
+#ifdef DLT_PPP_BSDOS
+    case 103:
+        return DLT_PPP_BSDOS;
+#endif
+    default:
+        return (int)(linktype & 0x03ffffff);
+    }
+}
+
+/**
+ * Opens a pcap or pcapng file, "-" for stdin.  Returns NULL and fills out
+ * errbuf (PCAPREADER_ERRBUF_SIZE bytes) on error.
+ */
+pcapreader_t *
+pcapreader_open(const char *path, char *errbuf)
+{
+    pcapreader_t *reader;
+    u_char fh[24];
+    u_int32_t magic;
+    int i;
+
+    assert(path);
+    assert(errbuf);
+
+    reader = (pcapreader_t *)safe_malloc(sizeof(pcapreader_t));
+    reader->path = safe_strdup(path);
+
+    if ((reader->fp = zpcap_fopen(path, errbuf)) == NULL) {
+        safe_free(reader->path);
+        safe_free(reader);
+        return NULL;
+    }
+    if (reader->fp != stdin)
+        setvbuf(reader->fp, NULL, _IOFBF, PCAPREADER_BUFSIZE);
+
+    if (fread(fh, 1, 4, reader->fp) != 4) {
+        pcapreader_error(reader, "%s: truncated file header", path);
+        goto failed;
+    }
+    memcpy(&magic, fh, sizeof(magic));
+
+    if (magic == PCAPNG_SHB) {
+        reader->pcapng = 1;
+        if (pcapreader_open_pcapng(reader) < 0)
+            goto failed;
+        return reader;
+    }
+
+    for (i = 0; pcapreader_magics[i].magic != 0; i++) {
+        if (pcapreader_magics[i].magic == magic)
+            break;
+    }
+    if (pcapreader_magics[i].magic == 0) {
+        pcapreader_error(reader, "%s: unknown file format (magic 0x%08x)", path, magic);
+        goto failed;
+    }
+    reader->swapped = pcapreader_magics[i].swapped;
+    reader->pkthdrlen = pcapreader_magics[i].pkthdrlen;
+    reader->nsec = pcapreader_magics[i].nsec;
+
+    if (fread(fh + 4, 1, sizeof(fh) - 4, reader->fp) != sizeof(fh) - 4) {
+        pcapreader_error(reader, "%s: truncated file header", path);
+        goto failed;
+    }
+    reader->snaplen = pcapreader_word(reader, fh + 16);
+    reader->dlt = pcapreader_dlt(pcapreader_word(reader, fh + 20));
+    return reader;
+
+failed:
+    strlcpy(errbuf, reader->errbuf, PCAPREADER_ERRBUF_SIZE);
+    pcapreader_close(reader);
+    return NULL;
+}
+
+/**
+ * Returns the next packet and fills out pkthdr (with the timestamp cut
+ * to microseconds) and meta, or NULL at the end of the file or on error,
+ * see pcapreader_geterr().  The data is only valid until the next call.
+ */
+const u_char *
+pcapreader_next(pcapreader_t *reader, struct pcap_pkthdr *pkthdr, 
+        pcapreader_meta_t *meta)
+{
+    u_char hdr[24];
+    u_int32_t frac;
+    size_t len;
+
+    assert(reader);
+    assert(pkthdr);
+    assert(meta);
+
+    if (reader->pcapng)
+        return pcapreader_next_pcapng(reader, pkthdr, meta);
+
+    if ((len = fread(hdr, 1, reader->pkthdrlen, reader->fp)) != (size_t)reader->pkthdrlen) {
+        if (len > 0)
+            pcapreader_error(reader, "%s: truncated packet header", reader->path);
+        return NULL;
+    }
+
+    pkthdr->caplen = pcapreader_word(reader, hdr + 8);
+    pkthdr->len = pcapreader_word(reader, hdr + 12);
+    if (pkthdr->caplen > PCAPREADER_MAX_CAPLEN) {
+        pcapreader_error(reader, "%s: bogus packet length %u", reader->path, pkthdr->caplen);
+        return NULL;
+    }
+    if (pcapreader_grow(reader, pkthdr->caplen) < 0)
+        return NULL;
+    if (fread(reader->buf, 1, pkthdr->caplen, reader->fp) != pkthdr->caplen) {
+        pcapreader_error(reader, "%s: truncated packet", reader->path);
+        return NULL;
+    }
+
+    meta->ts.tv_sec = pcapreader_word(reader, hdr);
+    frac = pcapreader_word(reader, hdr + 4);
+    meta->ts.tv_nsec = reader->nsec ? frac : frac * 1000;
+    meta->ifid = 0;
+    meta->dlt = reader->dlt;
+
+    /* OpenBSD's bpf_timeval can't be assigned a struct timeval */
+    pkthdr->ts.tv_sec = meta->ts.tv_sec;
+    pkthdr->ts.tv_usec = meta->ts.tv_nsec / 1000;
+    return reader->buf;
+}
+
+/**
+ * The DLT of a pcap file or of the first interface of a pcapng file
+ */
+int
+pcapreader_datalink(pcapreader_t *reader)
+{
+    assert(reader);
+    return reader->dlt;
+}
+
+/**
+ * The snaplen of a pcap file or of the first interface of a pcapng file
+ */
+int
+pcapreader_snapshot(pcapreader_t *reader)
+{
+    assert(reader);
+    return (int)reader->snaplen;
+}
+
+/**
+ * File descriptor being read, e.g. for posix_fadvise()
+ */
+int
+pcapreader_fileno(pcapreader_t *reader)
+{
+    assert(reader);
+    return fileno(reader->fp);
+}
+
+/**
+ * The if_name of a pcapng interface in the current section, or NULL
+ */
+const char *
+pcapreader_ifname(pcapreader_t *reader, u_int32_t ifid)
+{
+    assert(reader);
+    return ifid < reader->nifs ? reader->ifs[ifid].name : NULL;
+}
+
+/**
+ * Why pcapreader_next() returned NULL, an empty string at the end of the
+ * file
+ */
+char *
+pcapreader_geterr(pcapreader_t *reader)
+{
+    assert(reader);
+    return reader->errbuf;
+}
+
+/**
+ * Closes the file and frees the reader
+ */
+void
+pcapreader_close(pcapreader_t *reader)
+{
+    u_int32_t i;
+
+    assert(reader);
+
+    if (reader->fp != NULL && reader->fp != stdin)
+        fclose(reader->fp);
+    for (i = 0; i < reader->nifs; i++) {
+        if (reader->ifs[i].name != NULL)
+            safe_free(reader->ifs[i].name);
+    }
+    if (reader->ifs != NULL)
+        safe_free(reader->ifs);
+    if (reader->buf != NULL)
+        safe_free(reader->buf);
+    safe_free(reader->path);
+    safe_free(reader);
+}
+
+/**
+ * Reads the rest of the first section header and the blocks up to the
+ * first interface, so pcapreader_datalink() is known
+ */
+static int
+pcapreader_open_pcapng(pcapreader_t *reader)
+{
+    u_int32_t type, bodylen;
+    int ret;
+
+    /* the magic we already read is the first block's type */
+    if (pcapreader_grow(reader, 4) < 0)
+        return -1;
+    memcpy(reader->buf, "\n\r\r\n", 4);
+    if ((ret = pcapreader_block(reader, 4, &type, &bodylen)) <= 0) {
+        if (ret == 0)
+            pcapreader_error(reader, "%s: truncated section header", reader->path);
+        return -1;
+    }
+    if (pcapreader_section(reader, bodylen) < 0)
+        return -1;
+
+    /* without any interfaces there are no packets either */
+    reader->dlt = DLT_EN10MB;
+
+    while ((ret = pcapreader_block(reader, 0, &type, &bodylen)) > 0) {
+        switch (type) {
+        case PCAPNG_IDB:
+            return pcapreader_interface(reader, bodylen);
+
+        case PCAPNG_SHB:
+            if (pcapreader_section(reader, bodylen) < 0)
+                return -1;
+            break;
+
+        case PCAPNG_EPB:
+        case PCAPNG_SPB:
+        case PCAPNG_PB:
+            return pcapreader_error(reader, "%s: packet before any interface", reader->path);
+
+        default:
+            break;
+        }
+    }
+    return ret;
+}
+
+/**
+ * Reads the next pcapng block into reader->buf and returns 1, or 0 at
+ * the end of the file or -1 on error.  The body starts at buf + 8.  The 
+ * first have bytes of the block are already in buf.
+ */
+static int
+pcapreader_block(pcapreader_t *reader, u_int32_t have, u_int32_t *type, 
+        u_int32_t *bodylen)
+{
+    u_int32_t blocklen, bom;
+    size_t len;
+
+    if (pcapreader_grow(reader, 12) < 0)
+        return -1;
+    if ((len = fread(reader->buf + have, 1, 8 - have, reader->fp)) != 8 - have) {
+        if (len > 0 || have > 0)
+            return pcapreader_error(reader, "%s: truncated block header", reader->path);
+        return 0;
+    }
+
+    /* a new section may switch byte order */
+    if (memcmp(reader->buf, "\n\r\r\n", 4) == 0) {
+        if (fread(reader->buf + 8, 1, 4, reader->fp) != 4)
+            return pcapreader_error(reader, "%s: truncated section header", reader->path);
+        memcpy(&bom, reader->buf + 8, sizeof(bom));
+        if (bom == PCAPNG_BOM)
+            reader->swapped = 0;
+        else if (bom == SWAPLONG(PCAPNG_BOM))
+            reader->swapped = 1;
+        else
+            return pcapreader_error(reader, "%s: bad section byte order magic", reader->path);
+        have = 12;
+    } else {
+        have = 8;
+    }
+
+    *type = pcapreader_word(reader, reader->buf);
+    blocklen = pcapreader_word(reader, reader->buf + 4);
+    if (blocklen < 12 || blocklen % 4 != 0 || blocklen > PCAPREADER_MAX_BLOCK || blocklen < have)
+        return pcapreader_error(reader, "%s: bad block length %u", reader->path, blocklen);
+
+    if (pcapreader_grow(reader, blocklen) < 0)
+        return -1;
+    if (fread(reader->buf + have, 1, blocklen - have, reader->fp) != blocklen - have)
+        return pcapreader_error(reader, "%s: truncated block", reader->path);
+    if (pcapreader_word(reader, reader->buf + blocklen - 4) != blocklen)
+        return pcapreader_error(reader, "%s: block lengths don't match", reader->path);
+
+    *bodylen = blocklen - 12;
+    return 1;
+}
+
+/**
+ * Starts a new section: the interfaces of the last one are forgotten
+ */
+static int
+pcapreader_section(pcapreader_t *reader, u_int32_t bodylen)
+{
+    u_int32_t i;
+
+    if (bodylen < 16)
+        return pcapreader_error(reader, "%s: short section header", reader->path);
+    if (pcapreader_short(reader, reader->buf + 12) != 1)
+        return pcapreader_error(reader, "%s: unsupported pcapng version %u", reader->path,
+                pcapreader_short(reader, reader->buf + 12));
+
+    for (i = 0; i < reader->nifs; i++) {
+        if (reader->ifs[i].name != NULL)
+            safe_free(reader->ifs[i].name);
+    }
+    reader->nifs = 0;
+    return 0;
+}
+
+/**
+ * Adds an interface to the current section
+ */
+static int
+pcapreader_interface(pcapreader_t *reader, u_int32_t bodylen)
+{
+    pcapreader_if_t *ifp;
+    const u_char *opt, *end;
+    u_int16_t code, len;
+    int i, exp;
+
+    if (bodylen < 8)
+        return pcapreader_error(reader, "%s: short interface description", reader->path);
+
+    if (reader->nifs == reader->ifs_size) {
+        reader->ifs_size = reader->ifs_size ? reader->ifs_size * 2 : 4;
+        reader->ifs = safe_realloc(reader->ifs, reader->ifs_size * sizeof(pcapreader_if_t));
+    }
+    ifp = &reader->ifs[reader->nifs];
+    memset(ifp, 0, sizeof(*ifp));
+    ifp->dlt = pcapreader_dlt(pcapreader_short(reader, reader->buf + 8));
+    ifp->snaplen = pcapreader_word(reader, reader->buf + 12);
+    ifp->units = 1000000;
+
+    opt = reader->buf + 16;
+    end = reader->buf + 8 + bodylen;
+    while (opt + 4 <= end) {
+        code = pcapreader_short(reader, opt);
+        len = pcapreader_short(reader, opt + 2);
+        opt += 4;
+        if (code == PCAPNG_OPT_END || opt + len > end)
+            break;
+
+        switch (code) {
+        case PCAPNG_IF_NAME:
+            ifp->name = (char *)safe_malloc(len + 1);
+            memcpy(ifp->name, opt, len);
+            break;
+
+        case PCAPNG_IF_TSRESOL:
+            if (len < 1)
+                break;
+            exp = opt[0] & 0x7f;
+            if (opt[0] & 0x80) {
+                /* a power of two */
+                if (exp > 63)
+                    return pcapreader_error(reader, "%s: bad if_tsresol 0x%02x", reader->path, opt[0]);
+                ifp->units = (u_int64_t)1 << exp;
+            } else {
+                /* a power of ten */
+                if (exp > 19)
+                    return pcapreader_error(reader, "%s: bad if_tsresol 0x%02x", reader->path, opt[0]);
+                for (ifp->units = 1, i = 0; i < exp; i++)
+                    ifp->units *= 10;
+            }
+            break;
+
+        case PCAPNG_IF_TSOFFSET:
+            if (len < 8)
+                break;
+            ifp->offset = (int64_t)pcapreader_int64(reader, opt);
+            break;
+
+        default:
+            break;
+        }
+        opt += (len + 3) & ~3;
+    }
+
+    if (reader->nifs == 0) {
+        reader->dlt = ifp->dlt;
+        reader->snaplen = ifp->snaplen;
+    }
+    reader->nifs++;
+    return 0;
+}
+
+/**
+ * Converts a timestamp in ifp's units to a timespec
+ */
+static void
+pcapreader_ts(const pcapreader_if_t *ifp, u_int64_t t, struct timespec *ts)
+{
+    u_int64_t frac = t % ifp->units;
+
+    ts->tv_sec = (time_t)((int64_t)(t / ifp->units) + ifp->offset);
+    if (ifp->units == 1000000000)
+        ts->tv_nsec = (long)frac;
+    else if (ifp->units <= ((u_int64_t)1 << 34))
+        ts->tv_nsec = (long)(frac * 1000000000 / ifp->units);
+    else
+        ts->tv_nsec = (long)((long double)frac * 1000000000.0L / (long double)ifp->units);
+}
+
+/**
+ * pcapreader_next() for pcapng: skips everything but packets, keeping
+ * track of sections and interfaces along the way
+ */
+static const u_char *
+pcapreader_next_pcapng(pcapreader_t *reader, struct pcap_pkthdr *pkthdr,
+        pcapreader_meta_t *meta)
+{
+    const pcapreader_if_t *ifp;
+    const u_char *body;
+    u_int32_t type, bodylen, ifid, hdrlen;
+    u_int64_t ts;
+
+    while (pcapreader_block(reader, 0, &type, &bodylen) > 0) {
+        body = reader->buf + 8;
+
+        switch (type) {
+        case PCAPNG_SHB:
+            if (pcapreader_section(reader, bodylen) < 0)
+                return NULL;
+            continue;
+
+        case PCAPNG_IDB:
+            if (pcapreader_interface(reader, bodylen) < 0)
+                return NULL;
+            continue;
+
+        case PCAPNG_EPB:
+            if (bodylen < 20)
+                break;
+            hdrlen = 20;
+            ifid = pcapreader_word(reader, body);
+            ts = pcapreader_ts64(reader, body + 4);
+            pkthdr->caplen = pcapreader_word(reader, body + 12);
+            pkthdr->len = pcapreader_word(reader, body + 16);
+            goto packet;
+
+        case PCAPNG_PB:
+            if (bodylen < 20)
+                break;
+            hdrlen = 20;
+            ifid = pcapreader_short(reader, body);
+            ts = pcapreader_ts64(reader, body + 4);
+            pkthdr->caplen = pcapreader_word(reader, body + 12);
+            pkthdr->len = pcapreader_word(reader, body + 16);
+            goto packet;
+
+        case PCAPNG_SPB:
+            /* no timestamp, so it's sent right after the last packet */
+            if (bodylen < 4 || reader->nifs == 0)
+                break;
+            hdrlen = 4;
+            ifid = 0;
+            pkthdr->len = pcapreader_word(reader, body);
+            pkthdr->caplen = pkthdr->len;
+            if (reader->ifs[0].snaplen > 0 && pkthdr->caplen > reader->ifs[0].snaplen)
+                pkthdr->caplen = reader->ifs[0].snaplen;
+            if (pkthdr->caplen > bodylen - hdrlen)
+                pkthdr->caplen = bodylen - hdrlen;
+            if (pkthdr->caplen > PCAPREADER_MAX_CAPLEN)
+                pkthdr->caplen = PCAPREADER_MAX_CAPLEN;
+            memcpy(&meta->ts, &reader->last, sizeof(meta->ts));
+            goto found;
+
+        default:
+            continue;
+        }
+
+        pcapreader_error(reader, "%s: short packet block", reader->path);
+        return NULL;
+
+packet:
+        if (ifid >= reader->nifs) {
+            pcapreader_error(reader, "%s: packet for unknown interface %u", reader->path, ifid);
+            return NULL;
+        }
+        if (pkthdr->caplen > bodylen - hdrlen || pkthdr->caplen > PCAPREADER_MAX_CAPLEN) {
+            pcapreader_error(reader, "%s: bogus packet length %u", reader->path, pkthdr->caplen);
+            return NULL;
+        }
+        pcapreader_ts(&reader->ifs[ifid], ts, &meta->ts);
+        memcpy(&reader->last, &meta->ts, sizeof(reader->last));
+
+found:
+        ifp = &reader->ifs[ifid];
+        meta->ifid = ifid;
+        meta->dlt = ifp->dlt;
+        pkthdr->ts.tv_sec = meta->ts.tv_sec;
+        pkthdr->ts.tv_usec = meta->ts.tv_nsec / 1000;
+        return body + hdrlen;
+    }
+    return NULL;
+}
+
+/**
+ * Makes sure buf holds at least len bytes
+ */
+static int
+pcapreader_grow(pcapreader_t *reader, size_t len)
+{
+    size_t size;
+
+    if (len <= reader->bufsize)
+        return 0;
+
+    for (size = reader->bufsize ? reader->bufsize : 65536; size < len; size <<= 1)
+        ;
+    reader->buf = safe_realloc(reader->buf, size);
+    reader->bufsize = size;
+    return 0;
+}
+
+/**
+ * Formats an error into reader->errbuf and returns -1
+ */
+static int
+pcapreader_error(pcapreader_t *reader, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(reader->errbuf, sizeof(reader->errbuf), fmt, ap);
+    va_end(ap);
+    return -1;
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,107 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PCAPREADER_H_
+#define _PCAPREADER_H_
+
+#include "config.h"
+#include "defines.h"
+
+#define PCAPREADER_ERRBUF_SIZE PCAP_ERRBUF_SIZE
+
+/* stdio buffer for the input file */
+#define PCAPREADER_BUFSIZE (256 * 1024)
+
+/* 
+ * what pcapreader_next() knows about a packet which struct pcap_pkthdr
+ * can't hold
+ */
+typedef struct {
+    struct timespec ts;         /* full resolution timestamp */
+    u_int32_t ifid;             /* pcapng interface, always 0 for pcap */
+    int dlt;                    /* DLT of that interface */
+} pcapreader_meta_t;
+
+/* a pcapng Interface Description Block */
+typedef struct {
+    int dlt;
+    u_int32_t snaplen;
+    u_int64_t units;            /* timestamp units per second */
+    int64_t offset;             /* seconds to add to every timestamp */
+    char *name;                 /* NULL unless if_name was given */
+} pcapreader_if_t;
+
+/*
+ * Streaming reader for pcap files (microsecond or nanosecond, either byte
+ * order) and pcapng files, which unlike libpcap keeps nanosecond
+ * timestamps and the pcapng interface of each packet.  Compressed files
+ * are read through zpcap_fopen().
+ */
+struct pcapreader_s {
+    FILE *fp;
+    char *path;
+    int pcapng;
+    int swapped;
+    int nsec;                   /* pcap: nanosecond timestamps */
+    int pkthdrlen;              /* pcap: on-disk packet header size */
+    int dlt;                    /* of the file or of interface 0 */
+    u_int32_t snaplen;
+    pcapreader_if_t *ifs;       /* pcapng: interfaces of this section */
+    u_int32_t nifs;
+    u_int32_t ifs_size;
+    u_char *buf;                /* the current packet or pcapng block */
+    size_t bufsize;
+    struct timespec last;       /* for pcapng blocks without a timestamp */
+    char errbuf[PCAPREADER_ERRBUF_SIZE];
+};
+
+typedef struct pcapreader_s pcapreader_t;
+
+pcapreader_t *pcapreader_open(const char *path, char *errbuf);
+const u_char *pcapreader_next(pcapreader_t *reader, struct pcap_pkthdr *pkthdr,
+        pcapreader_meta_t *meta);
+int pcapreader_datalink(pcapreader_t *reader);
+int pcapreader_snapshot(pcapreader_t *reader);
+int pcapreader_fileno(pcapreader_t *reader);
+const char *pcapreader_ifname(pcapreader_t *reader, u_int32_t ifid);
+char *pcapreader_geterr(pcapreader_t *reader);
+void pcapreader_close(pcapreader_t *reader);
+
+#endif /* _PCAPREADER_H_ */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
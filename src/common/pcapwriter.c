@@ -0,0 +1,362 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* glibc only defines O_DIRECT with _GNU_SOURCE */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pcapwriter.h"
+
+/* O_DIRECT requires the buffer, file offset & length to be aligned */
+#define PCAPWRITER_ALIGN 4096
+
+#define TCPDUMP_MAGIC 0xa1b2c3d4
+
+/* 
+ * on-disk packet header; unlike struct pcap_pkthdr the timestamp
+ * is always 32 bits
+ */
+struct pcapwriter_pkthdr {
+    u_int32_t ts_sec;
+    u_int32_t ts_usec;
+    u_int32_t caplen;
+    u_int32_t len;
+};
+
+static void pcapwriter_seterr(pcapwriter_t *writer, const char *fmt, ...);
+static int pcapwriter_writeall(pcapwriter_t *writer, const u_char *data, size_t len);
+
+/**
+ * Maps the DLT_ value libpcap uses to the LINKTYPE_ value that goes in 
+ * the file, they only differ for a few old types
+ */
+static u_int32_t
+pcapwriter_linktype(int dlt)
+{
+    switch (dlt) {
+#ifdef DLT_ATM_RFC1483
+    case DLT_ATM_RFC1483:
+        return 100;
+#endif
+    case DLT_RAW:
+        return 101;
+#ifdef DLT_SLIP_BSDOS
+    case DLT_SLIP_BSDOS:
+        return 102;
+#endif
+#ifdef DLT_PPP_BSDOS
+    case DLT_PPP_BSDOS:
+        return 103;
+#endif
+    default:
+        return (u_int32_t)dlt;
+    }
+}
+
+/**
+ * Opens path for writing as a pcap file of the given DLT.  bufsize is the
+ * number of bytes to buffer between writes (0 for the default).  Returns 
+ * NULL and fills out errbuf on error.
+ */
+pcapwriter_t *
+pcapwriter_open(const char *path, int dlt, int snaplen, size_t bufsize, int flags,
+        char *errbuf)
+{
+    pcapwriter_t *writer;
+    struct pcap_file_header filehdr;
+    int fd, openflags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    assert(path);
+    assert(errbuf);
+
+    if (strcmp(path, "-") == 0) {
+        snprintf(errbuf, PCAPWRITER_ERRBUF_SIZE, "Unable to write pcap to STDOUT");
+        return NULL;
+    }
+
+    /* 
+     * build the file header ourselves rather then having libpcap write it 
+     * and reading it back, which doesn't work for /dev/null or a FIFO
+     */
+    memset(&filehdr, 0, sizeof(filehdr));
+    filehdr.magic = TCPDUMP_MAGIC;
+    filehdr.version_major = PCAP_VERSION_MAJOR;
+    filehdr.version_minor = PCAP_VERSION_MINOR;
+    filehdr.snaplen = snaplen;
+    filehdr.linktype = pcapwriter_linktype(dlt);
+
+    if (flags & PCAPWRITER_DIRECT) {
+#ifdef O_DIRECT
+        openflags |= O_DIRECT;
+#else
+        snprintf(errbuf, PCAPWRITER_ERRBUF_SIZE, "O_DIRECT is not supported on this platform");
+        return NULL;
+#endif
+    }
+
+    if ((fd = open(path, openflags, 0666)) < 0) {
+        snprintf(errbuf, PCAPWRITER_ERRBUF_SIZE, "Unable to open %s: %s", path, 
+                strerror(errno));
+        return NULL;
+    }
+
+    writer = (pcapwriter_t *)safe_malloc(sizeof(pcapwriter_t));
+    writer->fd = fd;
+    writer->flags = flags;
+    writer->align = (flags & PCAPWRITER_DIRECT) ? PCAPWRITER_ALIGN : 1;
+
+    /* must be able to hold at least one max sized packet + header */
+    if (bufsize == 0)
+        bufsize = PCAPWRITER_BUFSIZE;
+    if (bufsize < MAXPACKET + sizeof(struct pcapwriter_pkthdr) + PCAPWRITER_ALIGN)
+        bufsize = MAXPACKET + sizeof(struct pcapwriter_pkthdr) + PCAPWRITER_ALIGN;
+    writer->bufsize = (bufsize + PCAPWRITER_ALIGN - 1) & ~((size_t)PCAPWRITER_ALIGN - 1);
+
+    writer->rawbuf = (u_char *)safe_malloc(writer->bufsize + PCAPWRITER_ALIGN);
+    writer->buf = (u_char *)(((unsigned long)writer->rawbuf + PCAPWRITER_ALIGN - 1) & 
+            ~((unsigned long)PCAPWRITER_ALIGN - 1));
+
+    memcpy(writer->buf, &filehdr, sizeof(filehdr));
+    writer->len = sizeof(filehdr);
+
+    dbgx(1, "Writing %s via a %zu byte buffer%s", path, writer->bufsize, 
+            (flags & PCAPWRITER_DIRECT) ? " with O_DIRECT" : "");
+
+    return writer;
+}
+
+/**
+ * Returns a pointer to len bytes in the write buffer where the caller
+ * can build the next packet.  If the next call to pcapwriter_write() is
+ * for this pointer, the packet is written without being copied.
+ */
+u_char *
+pcapwriter_getbuf(pcapwriter_t *writer, size_t len)
+{
+    assert(writer);
+    assert(len <= MAXPACKET);
+
+    if (writer->len + sizeof(struct pcapwriter_pkthdr) + len > writer->bufsize) {
+        if (pcapwriter_flush(writer) < 0)
+            return NULL;
+    }
+
+    writer->pending = writer->buf + writer->len + sizeof(struct pcapwriter_pkthdr);
+    return writer->pending;
+}
+
+/**
+ * Adds the packet to the write buffer, flushing it first if it's full.
+ * Returns 0 on success or -1 on error
+ */
+int
+pcapwriter_write(pcapwriter_t *writer, const struct pcap_pkthdr *pkthdr, 
+        const u_char *pktdata)
+{
+    struct pcapwriter_pkthdr hdr;
+    size_t needed;
+
+    assert(writer);
+    assert(pkthdr);
+    assert(pktdata);
+
+    needed = sizeof(hdr) + pkthdr->caplen;
+    if (needed > writer->bufsize - writer->align) {
+        pcapwriter_seterr(writer, "Packet is too large: %u bytes", pkthdr->caplen);
+        return -1;
+    }
+
+    /* packets built in place already have room reserved */
+    if (pktdata != writer->pending && writer->len + needed > writer->bufsize) {
+        if (pcapwriter_flush(writer) < 0)
+            return -1;
+    }
+
+    hdr.ts_sec = (u_int32_t)pkthdr->ts.tv_sec;
+    hdr.ts_usec = (u_int32_t)pkthdr->ts.tv_usec;
+    hdr.caplen = pkthdr->caplen;
+    hdr.len = pkthdr->len;
+    memcpy(writer->buf + writer->len, &hdr, sizeof(hdr));
+
+    if (pktdata != writer->pending)
+        memcpy(writer->buf + writer->len + sizeof(hdr), pktdata, pkthdr->caplen);
+
+    writer->len += needed;
+    writer->pending = NULL;
+    writer->packets ++;
+    writer->bytes += pkthdr->caplen;
+
+    return 0;
+}
+
+/**
+ * Writes out the buffer.  With O_DIRECT, only whole blocks are written
+ * and the remainder is moved to the front of the buffer.
+ * Returns 0 on success or -1 on error
+ */
+int
+pcapwriter_flush(pcapwriter_t *writer)
+{
+    size_t towrite;
+
+    assert(writer);
+
+    towrite = writer->len & ~(writer->align - 1);
+    if (towrite == 0)
+        return 0;
+
+    if (pcapwriter_writeall(writer, writer->buf, towrite) < 0)
+        return -1;
+
+    writer->len -= towrite;
+    if (writer->len > 0)
+        memmove(writer->buf, writer->buf + towrite, writer->len);
+
+    writer->pending = NULL;
+    writer->flushes ++;
+    return 0;
+}
+
+/**
+ * Flushes any remaining packets and closes the file.
+ * Returns 0 on success or -1 on error
+ */
+int
+pcapwriter_close(pcapwriter_t *writer)
+{
+    int ret = 0;
+#ifdef O_DIRECT
+    int fdflags;
+#endif
+
+    assert(writer);
+
+    if (pcapwriter_flush(writer) < 0)
+        ret = -1;
+
+    /* with O_DIRECT there may be a partial block left over */
+    if (ret == 0 && writer->len > 0) {
+#ifdef O_DIRECT
+        if ((fdflags = fcntl(writer->fd, F_GETFL)) < 0 ||
+                fcntl(writer->fd, F_SETFL, fdflags & ~O_DIRECT) < 0) {
+            pcapwriter_seterr(writer, "Unable to disable O_DIRECT: %s", strerror(errno));
+            ret = -1;
+        }
+#endif
+        if (ret == 0 && pcapwriter_writeall(writer, writer->buf, writer->len) < 0)
+            ret = -1;
+    }
+
+    if (close(writer->fd) < 0 && ret == 0) {
+        pcapwriter_seterr(writer, "Error closing file: %s", strerror(errno));
+        ret = -1;
+    }
+
+    dbgx(1, "Wrote " COUNTER_SPEC " packets (" COUNTER_SPEC " bytes) in " 
+            COUNTER_SPEC " flushes", writer->packets, writer->bytes, writer->flushes);
+
+    safe_free(writer->rawbuf);
+    safe_free(writer);
+    return ret;
+}
+
+/**
+ * Returns the last error message
+ */
+char *
+pcapwriter_geterr(pcapwriter_t *writer)
+{
+    assert(writer);
+    return writer->errbuf;
+}
+
+/**
+ * write(2)'s all of data, handling short writes
+ */
+static int
+pcapwriter_writeall(pcapwriter_t *writer, const u_char *data, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0) {
+        if ((ret = write(writer->fd, data, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            pcapwriter_seterr(writer, "Error writing pcap file: %s", strerror(errno));
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Set's the error string
+ */
+static void
+pcapwriter_seterr(pcapwriter_t *writer, const char *fmt, ...)
+{
+    va_list ap;
+
+    assert(writer);
+
+    va_start(ap, fmt);
+    if (fmt != NULL)
+        (void)vsnprintf(writer->errbuf, PCAPWRITER_ERRBUF_SIZE, fmt, ap);
+    va_end(ap);
+
+    writer->errbuf[(PCAPWRITER_ERRBUF_SIZE-1)] = '\0'; // be safe
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
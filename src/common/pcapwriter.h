@@ -0,0 +1,87 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PCAPWRITER_H_
+#define _PCAPWRITER_H_
+
+#include "config.h"
+#include "defines.h"
+
+#define PCAPWRITER_ERRBUF_SIZE 1024
+
+/* default size of the write buffer */
+#define PCAPWRITER_BUFSIZE (4 * 1024 * 1024)
+
+/* flags for pcapwriter_open() */
+#define PCAPWRITER_DIRECT  0x01     /* bypass the page cache via O_DIRECT */
+
+/*
+ * Writes pcap files by building the packet headers and data directly in a
+ * large buffer and flushing it with a single write(2), rather then going 
+ * through stdio for every pcap_dump().  Packets can be built in place in
+ * the buffer via pcapwriter_getbuf() to avoid copying them at all.
+ */
+struct pcapwriter_s {
+    int fd;
+    int flags;
+    char errbuf[PCAPWRITER_ERRBUF_SIZE];
+    u_char *rawbuf;             /* what we malloc'd */
+    u_char *buf;                /* rawbuf, aligned for O_DIRECT */
+    size_t bufsize;
+    size_t len;                 /* bytes in buf waiting to be written */
+    u_char *pending;            /* last pointer returned by pcapwriter_getbuf() */
+    size_t align;               /* O_DIRECT write size/offset alignment */
+    COUNTER packets;
+    COUNTER bytes;
+    COUNTER flushes;
+};
+
+typedef struct pcapwriter_s pcapwriter_t;
+
+pcapwriter_t *pcapwriter_open(const char *path, int dlt, int snaplen, size_t bufsize, 
+        int flags, char *errbuf);
+u_char *pcapwriter_getbuf(pcapwriter_t *writer, size_t len);
+int pcapwriter_write(pcapwriter_t *writer, const struct pcap_pkthdr *pkthdr, 
+        const u_char *pktdata);
+int pcapwriter_flush(pcapwriter_t *writer);
+int pcapwriter_close(pcapwriter_t *writer);
+char *pcapwriter_geterr(pcapwriter_t *writer);
+
+#endif /* _PCAPWRITER_H_ */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
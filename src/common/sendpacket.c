@@ -244,15 +244,19 @@ static struct tcpr_ether_addr *sendpacket_get_hwaddr_pcap(sendpacket_t *) _U_;
 #endif
 
 #if defined HAVE_NETMAP
+#include <poll.h>
 #undef INJECT_METHOD
 #define INJECT_METHOD "netmap_send_packet"
 static int netmap_send_packet(sendpacket_t *,  char *, int );
+static int netmap_tx_wait(sendpacket_t *);
+static int netmap_send_batch(sendpacket_t *, const u_char **, const size_t *, int);
 static sendpacket_t * sendpacket_open_netmap(const char *, char *, int );
 #endif
 
 static void sendpacket_seterr(sendpacket_t *sp, const char *fmt, ...);
 static sendpacket_t * sendpacket_open_chardev(const char *, char *) _U_;
 static struct tcpr_ether_addr * sendpacket_get_hwaddr_chardev(sendpacket_t *) _U_;
+static sendpacket_t *sendpacket_open_pseudo(const char *, char *);
 
 /* You need to define didsig in your main .c file.  Set to 1 if CTRL-C was pressed */
 extern volatile int didsig;
@@ -464,6 +468,29 @@ TRY_SEND_AGAIN:
 #endif
 			break;
 
+        /* pseudo devices */
+        case SP_TYPE_NULL:
+            retcode = (int)len;
+            break;
+
+        case SP_TYPE_MEMRING:
+            retcode = memring_put(sp->handle.memring, data, len, pkthdr);
+
+            /* ring is full: wait for the consumer to catch up */
+            if (retcode < 0 && !didsig) {
+                switch (errno) {
+                    case EAGAIN:
+                        sp->retry_eagain ++;
+                        goto TRY_SEND_AGAIN;
+                        break;
+
+                    default:
+                        sendpacket_seterr(sp, "Error with %s [" COUNTER_SPEC "]: %s (errno = %d)",
+                                "memring", sp->sent + sp->failed + 1, strerror(errno), errno);
+                }
+            }
+            break;
+
         default:
             errx(1, "Unsupported sp->handle_type = %d", sp->handle_type);
     } /* end case */
@@ -481,6 +508,45 @@ TRY_SEND_AGAIN:
     return retcode;
 }
 
+/**
+ * Sends count packets back to back, all with the same pkthdr.  netmap
+ * queues the whole batch on one TX ring and syncs it once; the other
+ * methods fall back to calling sendpacket() for each packet.
+ * Returns the number of packets sent.
+ */
+int
+sendpacket_batch(sendpacket_t *sp, const u_char **data, const size_t *len, int count,
+        struct pcap_pkthdr *pkthdr)
+{
+    int i, sent = 0;
+
+    assert(sp);
+    assert(data);
+    assert(len);
+
+#ifdef HAVE_NETMAP
+    /* never mix in sendpacket(), which could pick another TX ring */
+    if (sp->handle_type == SP_TYPE_NETMAP)
+        return netmap_send_batch(sp, data, len, count);
+#endif
+
+    if (sp->handle_type == SP_TYPE_NULL) {
+        for (i = 0; i < count; i++)
+            sp->bytes_sent += len[i];
+        sp->attempt += count;
+        sp->sent += count;
+        return count;
+    }
+
+    /* every other method sends the batch one packet at a time */
+    for (i = 0; i < count; i++) {
+        if (sendpacket(sp, data[i], len[i], pkthdr) == (int)len[i])
+            sent++;
+    }
+
+    return sent;
+}
+
 /**
  * Open the given network device name and returns a sendpacket_t struct
  * pass the error buffer (in case there's a problem) and the direction
@@ -495,8 +561,11 @@ sendpacket_open(void *options, const char *device, char *errbuf, tcpr_dir_t dire
     assert(device);
     assert(errbuf);
 
-    /* chardev is universal */
-    if (stat(device, &sdata) == 0) {
+    /* so are the pseudo devices */
+    if (strcmp(device, SP_NULL_DEVICE) == 0 || 
+            strncmp(device, SP_MEMRING_DEVICE, strlen(SP_MEMRING_DEVICE)) == 0) {
+        sp = sendpacket_open_pseudo(device, errbuf);
+    } else if (stat(device, &sdata) == 0) {
         if (((sdata.st_mode & S_IFMT) == S_IFCHR) &&
                 (major(sdata.st_dev) == SP_CHARDEV_MAJOR)) {
 
@@ -530,6 +599,27 @@ sendpacket_open(void *options, const char *device, char *errbuf, tcpr_dir_t dire
     return sp;
 }
 
+/**
+ * Returns 1 if device is one that sendpacket_open() accepts even though
+ * it isn't in the system's interface list (and so shouldn't be checked
+ * against it), else 0
+ */
+int
+sendpacket_is_pseudo(const char *device)
+{
+    assert(device);
+
+    if (strcmp(device, SP_NULL_DEVICE) == 0 ||
+            strncmp(device, SP_MEMRING_DEVICE, strlen(SP_MEMRING_DEVICE)) == 0)
+        return 1;
+#ifdef HAVE_NETMAP
+    /* ports on a VALE switch are created on demand */
+    if (strncmp(device, "vale", 4) == 0)
+        return 1;
+#endif
+    return 0;
+}
+
 /**
  * Get packet stats for the given sendpacket_t
  */
@@ -537,6 +627,7 @@ char *
 sendpacket_getstat(sendpacket_t *sp)
 {
     static char buf[1024];
+    memring_t *ring;
 
     assert(sp);
 
@@ -550,6 +641,16 @@ sendpacket_getstat(sendpacket_t *sp)
             "\tRetried packets (EAGAIN):  " COUNTER_SPEC "\n",
             sp->device, sp->attempt, sp->sent, sp->failed, sp->trunc_packets,
             sp->retry_enobufs, sp->retry_eagain);
+
+    if (sp->handle_type == SP_TYPE_MEMRING) {
+        ring = sp->handle.memring;
+        memring_sync(ring);
+        sprintf(buf + strlen(buf),
+                "\tDrained packets:           " COUNTER_SPEC "\n"
+                "\tDrained bytes:             " COUNTER_SPEC "\n"
+                "\tPcap write errors:         " COUNTER_SPEC "\n",
+                ring->drained, ring->drained_bytes, ring->write_errors);
+    }
     return(buf);
 }
 
@@ -599,6 +700,13 @@ sendpacket_close(sendpacket_t *sp)
 			close(sp->handle.fd);
 #endif
 			break;
+
+        case SP_TYPE_NULL:
+            break;
+
+        case SP_TYPE_MEMRING:
+            memring_close(sp->handle.memring);
+            break;
     }
     safe_free(sp);
     return 0;
@@ -620,6 +728,9 @@ sendpacket_get_hwaddr(sendpacket_t *sp)
 
     if (sp->handle_type == SP_TYPE_CHARDEV) {
         addr = sendpacket_get_hwaddr_chardev(sp);
+    } else if (sp->handle_type == SP_TYPE_NULL || sp->handle_type == SP_TYPE_MEMRING) {
+        sendpacket_seterr(sp, "Error: %s has no hardware address", sp->device);
+        addr = NULL;
     } else {    
 #if (defined HAVE_PF_PACKET || defined HAVE_NETMAP)
         addr = sendpacket_get_hwaddr_pf(sp);
@@ -1128,6 +1239,13 @@ sendpacket_get_dlt(sendpacket_t *sp)
     int dlt;
 #if defined HAVE_BPF
     int rcode;
+#endif
+
+    /* pseudo devices take whatever they're given; call it Ethernet */
+    if (sp->handle_type == SP_TYPE_NULL || sp->handle_type == SP_TYPE_MEMRING)
+        return DLT_EN10MB;
+
+#if defined HAVE_BPF
 
     if ((rcode = ioctl(sp->handle.fd, BIOCGDLT, &dlt)) < 0) {
         warnx("Unable to get DLT value for BPF device (%s): %s", sp->device, strerror(errno));
@@ -1159,6 +1277,10 @@ sendpacket_get_method(sendpacket_t *sp)
         return INJECT_METHOD;
     } else if (sp->handle_type == SP_TYPE_CHARDEV) {
         return "chardev";
+    } else if (sp->handle_type == SP_TYPE_NULL) {
+        return "null";
+    } else if (sp->handle_type == SP_TYPE_MEMRING) {
+        return "memring";
     } else {
         return INJECT_METHOD;
     }
@@ -1189,6 +1311,44 @@ sendpacket_open_chardev(const char *device, char *errbuf)
     return sp;
 }
 
+/**
+ * Opens one of the pseudo devices: "null", which drops every packet, or
+ * "memring", which copies them into a memring_t.  "memring:<file>" also
+ * writes whatever the ring's consumer drains to the pcap file <file>.
+ */
+static sendpacket_t *
+sendpacket_open_pseudo(const char *device, char *errbuf)
+{
+    sendpacket_t *sp;
+    memring_t *ring = NULL;
+    const char *path = NULL;
+
+    assert(device);
+    assert(errbuf);
+
+    if (strcmp(device, SP_NULL_DEVICE) != 0) {
+        if (device[strlen(SP_MEMRING_DEVICE)] == ':')
+            path = device + strlen(SP_MEMRING_DEVICE) + 1;
+        else if (device[strlen(SP_MEMRING_DEVICE)] != '\0') {
+            snprintf(errbuf, SENDPACKET_ERRBUF_SIZE, "Invalid memring device: %s", device);
+            return NULL;
+        }
+
+        if ((ring = memring_open(0, path, errbuf)) == NULL)
+            return NULL;
+    }
+
+    sp = (sendpacket_t *)safe_malloc(sizeof(sendpacket_t));
+    strlcpy(sp->device, device, sizeof(sp->device));
+    if (ring != NULL) {
+        sp->handle.memring = ring;
+        sp->handle_type = SP_TYPE_MEMRING;
+    } else {
+        sp->handle_type = SP_TYPE_NULL;
+    }
+    return sp;
+}
+
 /**
  * Get the hardware MAC address for the given interface using chardev
  */
@@ -1216,8 +1376,8 @@ netmap_send_packet(sendpacket_t *sp,  char *data, int len)
 	for (i = 0; i < nifp->ni_tx_queues; i++) {
 
 		tx_ring = NETMAP_TXRING(nifp, i);
-		if (tx_ring->avail == 0)
-			continue;
+		if (tx_ring->avail > 0)
+			break;
 	}
 
 	if (tx_ring->avail == 0) {
@@ -1247,6 +1407,100 @@ netmap_send_packet(sendpacket_t *sp,  char *data, int len)
 	return 0;
 } 
 
+/**
+ * Waits (up to a second) for the NIC to free up TX slots; poll() on a netmap
+ * fd syncs the TX rings.  Returns -1 on error or if we got a signal.
+ */
+static int
+netmap_tx_wait(sendpacket_t *sp)
+{
+	struct pollfd pfd;
+
+	if (didsig) {
+		sendpacket_seterr(sp, "Interrupted while waiting for a TX ring");
+		return -1;
+	}
+
+	pfd.fd = sp->handle.fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+		sendpacket_seterr(sp, "poll() on TX rings failed: %s", strerror(errno));
+		return -1;
+	}
+
+	sp->accum = 0;
+	return 0;
+}
+
+/**
+ * Queues the whole batch on a single TX ring so the NIC can't reorder it,
+ * waiting until some ring has room for all of it.  A batch which is larger
+ * than a ring goes out in ring sized pieces, still all on the same ring.
+ * Returns the number of packets queued; the rest are counted as failed.
+ */
+static int
+netmap_send_batch(sendpacket_t *sp, const u_char **data, const size_t *len, int count)
+{
+	struct netmap_if *nifp = sp->nifp;
+	struct netmap_ring *tx_ring = NULL;
+	struct netmap_slot *slot;
+	int i, n, cur, need, sent = 0;
+
+	sp->attempt += count;
+
+	need = count;
+	if (need > (int)NETMAP_TXRING(nifp, 0)->num_slots - 1)
+		need = (int)NETMAP_TXRING(nifp, 0)->num_slots - 1;
+
+	while (tx_ring == NULL) {
+		for (i = 0; i < (int)nifp->ni_tx_queues; i++) {
+			if ((int)NETMAP_TXRING(nifp, i)->avail >= need) {
+				tx_ring = NETMAP_TXRING(nifp, i);
+				break;
+			}
+		}
+
+		if (tx_ring == NULL && netmap_tx_wait(sp) < 0) {
+			sp->failed += count;
+			return 0;
+		}
+	}
+
+	while (sent < count) {
+		n = ((int)tx_ring->avail < count - sent) ? (int)tx_ring->avail : count - sent;
+		cur = tx_ring->cur;
+		for (i = sent; i < sent + n; i++) {
+			slot = &tx_ring->slot[cur];
+			memcpy(NETMAP_BUF(tx_ring, slot->buf_idx), data[i], len[i]);
+			slot->len = len[i];
+			cur = NETMAP_RING_NEXT(tx_ring, cur);
+			sp->bytes_sent += len[i];
+		}
+		tx_ring->cur = cur;
+		tx_ring->avail -= n;
+		sp->sent += n;
+		sp->accum += n;
+		sent += n;
+
+		/* only a batch bigger than the ring has to wait for it to drain */
+		if (sent < count && netmap_tx_wait(sp) < 0)
+			break;
+	}
+
+	sp->failed += count - sent;
+
+	if (sp->accum >= sp->batch_count) {
+		if (ioctl(sp->handle.fd, NIOCTXSYNC, NULL) < 0) {
+			sendpacket_seterr(sp, "NIOCTXSYNC failed: %s", strerror(errno));
+			return sent;
+		}
+		sp->accum = 0;
+	}
+
+	return sent;
+}
+
 static sendpacket_t *
 sendpacket_open_netmap(const char *device, char *errbuf, int batch)
 {
@@ -63,6 +63,8 @@
 #ifndef _SENDPACKET_H_
 #define _SENDPACKET_H_
 
+#include "memring.h"
+
 enum sendpacket_type_t {
     SP_TYPE_LIBNET,
     SP_TYPE_LIBDNET,
@@ -71,17 +73,27 @@ enum sendpacket_type_t {
     SP_TYPE_PF_PACKET,
     SP_TYPE_TX_RING,
     SP_TYPE_CHARDEV,
-	SP_TYPE_NETMAP
+	SP_TYPE_NETMAP,
+    SP_TYPE_NULL,
+    SP_TYPE_MEMRING
 };
 
 #define SP_CHARDEV_MAJOR 666
 
+/* 
+ * pseudo devices available with every injection method: "null" counts and
+ * drops packets, "memring[:file.pcap]" copies them into a memring_t
+ */
+#define SP_NULL_DEVICE "null"
+#define SP_MEMRING_DEVICE "memring"
+
 union sendpacket_handle {
     pcap_t *pcap;
     int fd;
 #ifdef HAVE_LIBDNET
     eth_t *ldnet;
 #endif
+    memring_t *memring;
 };
 
 #define SENDPACKET_ERRBUF_SIZE 1024
@@ -117,6 +129,7 @@ struct sendpacket_s {
 typedef struct sendpacket_s sendpacket_t;
 
 int sendpacket(sendpacket_t *, const u_char *, size_t, struct pcap_pkthdr *);
+int sendpacket_batch(sendpacket_t *, const u_char **, const size_t *, int, struct pcap_pkthdr *);
 int sendpacket_close(sendpacket_t *);
 char *sendpacket_geterr(sendpacket_t *);
 char *sendpacket_getstat(sendpacket_t *);
@@ -124,6 +137,7 @@ sendpacket_t *sendpacket_open(void *options, const char *, char *, tcpr_dir_t);
 struct tcpr_ether_addr *sendpacket_get_hwaddr(sendpacket_t *);
 int sendpacket_get_dlt(sendpacket_t *);
 const char *sendpacket_get_method(sendpacket_t *);
+int sendpacket_is_pseudo(const char *);
 
 #endif /* _SENDPACKET_H_ */
 
@@ -33,6 +33,7 @@
 #include "err.h"
 #include "utils.h"
 #include "txring.h"
+#include "cpusched.h"
 #include <unistd.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -51,6 +52,11 @@ txring_send(void *arg)
     int ec_send;
     static int total = 0;
     int fd_socket = (int)arg;
+    char errbuf[CPUSCHED_ERRBUF_SIZE];
+    int cpu;
+
+    if (cpusched_apply(&cpusched_helper, &cpu, errbuf) < 0)
+        warnx("TX ring thread: %s", errbuf);
 
     do {
         /* send all buffers with TP_STATUS_SEND_REQUEST */
@@ -181,18 +187,17 @@ txring_mkreq(struct tpacket_req* treq, unsigned int mtu)
 /**
  * \brief Create TX ring for socket and init indexes
  *
- * Creates our pthread for sending, currently hardcoded for priority = 20
+ * Creates our pthread for sending, which runs with the cpusched_helper
+ * affinity and priority
  */
 txring_t *
 txring_init(int fd, unsigned int mtu)
 {
-    pthread_attr_t t_attr_send;
-    struct sched_param para_send;
     int mode_loss = 0;
     txring_t *txp;
 
     /* allocate memory for structure and fill it with different stuff*/
-    *txp = (txring_t *)safe_malloc(sizeof(txring_t));
+    txp = (txring_t *)safe_malloc(sizeof(txring_t));
     txp->treq = (struct tpacket_req *)safe_malloc(sizeof(struct tpacket_req));
 
     txring_mkreq(txp->treq, mtu);
@@ -222,12 +227,7 @@ txring_init(int fd, unsigned int mtu)
     }
 
     /* Start poll thread*/
-    pthread_attr_init(&t_attr_send);
-    pthread_attr_setschedpolicy(&t_attr_send, SCHED_RR);
-    para_send.sched_priority = 20;
-    pthread_attr_setschedparam(&t_attr_send, &para_send);
-
-    if (pthread_create(&txp->tx_send, &t_attr_send, txring_send, (void *)fd) != 0) {
+    if (pthread_create(&txp->tx_send, NULL, txring_send, (void *)fd) != 0) {
         perror("pthread_create() failed\n");
         abort();
     }
@@ -211,6 +211,47 @@ read_hexstring(const char *l2string, u_char *hex, const int hexlen)
     return (numbytes);
 }
 
+/**
+ * Returns the ones-compliment difference between the old and new data
+ * for use with checksum_adjust() (RFC 1624).  Both buffers are compared
+ * 16 bits at a time in network byte order, so len must be even.
+ */
+u_int32_t
+checksum_delta(const u_int16_t *old, const u_int16_t *new, int len)
+{
+    u_int32_t delta = 0;
+
+    assert((len & 1) == 0);
+
+    while (len > 1) {
+        delta += (u_int16_t)~*old++;
+        delta += *new++;
+        len -= 2;
+    }
+
+    /* fold so the delta can be accumulated with other deltas */
+    delta = (delta >> 16) + (delta & 0xffff);
+    delta += delta >> 16;
+    return (delta & 0xffff);
+}
+
+/**
+ * Incrementally updates the checksum pointed to by sum with a
+ * delta computed by checksum_delta(), rather then recalculating
+ * the checksum over the whole packet
+ */
+void
+checksum_adjust(u_int16_t *sum, u_int32_t delta)
+{
+    u_int32_t x;
+
+    x = (u_int16_t)~*sum;
+    x += (delta >> 16) + (delta & 0xffff);
+    x = (x >> 16) + (x & 0xffff);
+    x += x >> 16;
+    *sum = (u_int16_t)~x;
+}
+
 #ifdef USE_CUSTOM_INET_ATON
 int
 inet_aton(const char *name, struct in_addr *addr)
@@ -41,6 +41,8 @@
 int read_hexstring(const char *l2string, u_char *hex, const int hexlen);
 void packet_stats(struct timeval *begin, struct timeval *end, 
                   COUNTER bytes_sent, COUNTER pkts_sent, COUNTER failed);
+u_int32_t checksum_delta(const u_int16_t *old, const u_int16_t *new, int len);
+void checksum_adjust(u_int16_t *sum, u_int32_t delta);
 
 /* our "safe" implimentations of functions which allocate memory */
 #define safe_malloc(x) _our_safe_malloc(x, __FUNCTION__, __LINE__, __FILE__)
@@ -0,0 +1,302 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Transparent reading of compressed pcap files.  libpcap can only read
+ * raw files, so a compressed file is fed through the matching command
+ * line decompressor, run as a process of its own so decompression
+ * happens in parallel with whatever reads the pcap, and the pcap is read
+ * from the other end of a pipe.  The format is detected from the magic
+ * number, not the file name.
+ */
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "zpcap.h"
+
+#define ZPCAP_MAGIC_LEN 6
+
+typedef struct {
+    const char *name;
+    u_char magic[ZPCAP_MAGIC_LEN];
+    size_t magic_len;
+    /* decompressors to try in order, reading stdin and writing stdout */
+    const char *argv[2][4];
+} zpcap_format_t;
+
+static const zpcap_format_t zpcap_formats[] = {
+    { "gzip",  { 0x1f, 0x8b }, 2, 
+        { { "pigz", "-dc", NULL }, { "gzip", "-dc", NULL } } },
+    { "zstd",  { 0x28, 0xb5, 0x2f, 0xfd }, 4, 
+        { { "zstd", "-dcq", NULL }, { NULL } } },
+    { "lz4",   { 0x04, 0x22, 0x4d, 0x18 }, 4, 
+        { { "lz4", "-dcq", NULL }, { NULL } } },
+    { "xz",    { 0xfd, '7', 'z', 'X', 'Z', 0x00 }, 6, 
+        { { "xz", "-dc", "-T0", NULL }, { "xz", "-dc", NULL } } },
+    { "bzip2", { 'B', 'Z', 'h' }, 3, 
+        { { "pbzip2", "-dc", NULL }, { "bzip2", "-dc", NULL } } },
+    { NULL, { 0 }, 0, { { NULL } } }
+};
+
+static const zpcap_format_t *zpcap_detect(int fd);
+static FILE *zpcap_spawn(int fd, const zpcap_format_t *format, const char *path, char *ebuf);
+
+/**
+ * Returns the compression format of path ("gzip", "zstd", ...) or NULL
+ * if it isn't compressed or can't be read
+ */
+const char *
+zpcap_format(const char *path)
+{
+    const zpcap_format_t *format;
+    int fd;
+
+    assert(path);
+
+    if (strcmp(path, "-") == 0 || (fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+    format = zpcap_detect(fd);
+    close(fd);
+    return format == NULL ? NULL : format->name;
+}
+
+/**
+ * Drop in replacement for pcap_open_offline() which also reads gzip,
+ * zstd, lz4, xz and bzip2 compressed files.  ebuf must be
+ * PCAP_ERRBUF_SIZE bytes.  The decompressor goes away by itself once the
+ * pcap is closed, so just use pcap_close().
+ */
+pcap_t *
+zpcap_open_offline(const char *path, char *ebuf)
+{
+    const zpcap_format_t *format;
+    pcap_t *pcap;
+    FILE *fp;
+    int fd;
+
+    assert(path);
+    assert(ebuf);
+
+    /* stdin can't be rewound after peeking at it */
+    if (strcmp(path, "-") == 0)
+        return pcap_open_offline(path, ebuf);
+
+    if ((fd = open(path, O_RDONLY)) < 0 || (format = zpcap_detect(fd)) == NULL) {
+        if (fd >= 0)
+            close(fd);
+        return pcap_open_offline(path, ebuf);
+    }
+
+#ifndef HAVE_PCAP_FOPEN_OFFLINE
+    close(fd);
+    snprintf(ebuf, PCAP_ERRBUF_SIZE, "%s is %s compressed, which requires libpcap >= 0.9.0",
+            path, format->name);
+    return NULL;
+#else
+    if ((fp = zpcap_spawn(fd, format, path, ebuf)) == NULL)
+        return NULL;
+    if ((pcap = pcap_fopen_offline(fp, ebuf)) == NULL)
+        fclose(fp);
+    return pcap;
+#endif
+}
+
+/**
+ * Opens path for reading, decompressing it on the fly if need be, for 
+ * code which parses pcap files itself.  "-" is stdin.  Returns NULL and
+ * fills out ebuf (PCAP_ERRBUF_SIZE bytes) on error.
+ */
+FILE *
+zpcap_fopen(const char *path, char *ebuf)
+{
+    const zpcap_format_t *format;
+    FILE *fp;
+    int fd;
+
+    assert(path);
+    assert(ebuf);
+
+    if (strcmp(path, "-") == 0)
+        return stdin;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        snprintf(ebuf, PCAP_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+        return NULL;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if ((format = zpcap_detect(fd)) != NULL)
+        return zpcap_spawn(fd, format, path, ebuf);
+
+    if ((fp = fdopen(fd, "r")) == NULL) {
+        snprintf(ebuf, PCAP_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+        close(fd);
+    }
+    return fp;
+}
+
+/**
+ * Starts the decompressor for the file open on fd (which it takes over)
+ * and returns the read end of its output
+ */
+static FILE *
+zpcap_spawn(int fd, const zpcap_format_t *format, const char *path, char *ebuf)
+{
+    FILE *fp;
+    pid_t pid;
+    int data[2], status[2], i, error;
+    ssize_t len;
+
+    if (pipe(data) < 0 || pipe(status) < 0) {
+        snprintf(ebuf, PCAP_ERRBUF_SIZE, "Unable to create pipe: %s", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    /* 
+     * only the decompressor may hold these open, or it never sees us
+     * close the pipe.  status tells us whether the exec worked: it's
+     * closed on a successful exec, else the child writes errno to it.
+     */
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(data[0], F_SETFD, FD_CLOEXEC);
+    fcntl(data[1], F_SETFD, FD_CLOEXEC);
+    fcntl(status[0], F_SETFD, FD_CLOEXEC);
+    fcntl(status[1], F_SETFD, FD_CLOEXEC);
+
+    if ((pid = fork()) < 0) {
+        snprintf(ebuf, PCAP_ERRBUF_SIZE, "Unable to fork: %s", strerror(errno));
+        close(fd);
+        close(data[0]);
+        close(data[1]);
+        close(status[0]);
+        close(status[1]);
+        return NULL;
+    }
+
+    if (pid == 0) {
+        /* fork again so the decompressor is reaped by init, not us */
+        if ((pid = fork()) < 0) {
+            error = errno;
+            if (write(status[1], &error, sizeof(error)) < 0)
+                _exit(127);
+            _exit(127);
+        }
+        if (pid != 0)
+            _exit(0);
+
+        dup2(fd, STDIN_FILENO);
+        dup2(data[1], STDOUT_FILENO);
+        error = ENOENT;
+        for (i = 0; i < 2 && format->argv[i][0] != NULL; i++) {
+            execvp(format->argv[i][0], (char * const *)format->argv[i]);
+            error = errno;
+        }
+        if (write(status[1], &error, sizeof(error)) < 0)
+            _exit(127);
+        _exit(127);
+    }
+
+    close(fd);
+    close(data[1]);
+    close(status[1]);
+    waitpid(pid, NULL, 0);
+
+    len = read(status[0], &error, sizeof(error));
+    close(status[0]);
+    if (len == sizeof(error)) {
+        snprintf(ebuf, PCAP_ERRBUF_SIZE, "Unable to run a %s decompressor (%s) for %s: %s",
+                format->name, format->argv[0][0], path, strerror(error));
+        close(data[0]);
+        return NULL;
+    }
+
+#ifdef F_SETPIPE_SZ
+    /* let the decompressor run further ahead than the default 64KB */
+    fcntl(data[0], F_SETPIPE_SZ, ZPCAP_PIPE_SIZE);
+#endif
+
+    dbgx(1, "Reading %s through %s", path, format->argv[0][0]);
+
+    if ((fp = fdopen(data[0], "r")) == NULL) {
+        snprintf(ebuf, PCAP_ERRBUF_SIZE, "Unable to fdopen pipe: %s", strerror(errno));
+        close(data[0]);
+    }
+    return fp;
+}
+
+/**
+ * Returns the compression format of the file open on fd, or NULL.
+ * Leaves the file offset at the start.
+ */
+static const zpcap_format_t *
+zpcap_detect(int fd)
+{
+    u_char magic[ZPCAP_MAGIC_LEN];
+    struct stat statinfo;
+    ssize_t len;
+    int i;
+
+    /* peeking at a FIFO would eat the start of the pcap */
+    if (fstat(fd, &statinfo) < 0 || ! S_ISREG(statinfo.st_mode))
+        return NULL;
+
+    len = read(fd, magic, sizeof(magic));
+    if (lseek(fd, 0, SEEK_SET) < 0 || len <= 0)
+        return NULL;
+
+    for (i = 0; zpcap_formats[i].name != NULL; i++) {
+        if ((size_t)len >= zpcap_formats[i].magic_len &&
+                memcmp(magic, zpcap_formats[i].magic, zpcap_formats[i].magic_len) == 0)
+            return &zpcap_formats[i];
+    }
+    return NULL;
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
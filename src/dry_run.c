@@ -0,0 +1,474 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * --dry-run: read the pcap(s) the way tcpreplay would send them and
+ * report what the replay needs (memory to preload, packet and bit rates
+ * at the selected speed, the closest packets and the worst burst) instead
+ * of sending them.  With --dry-run-bench the output interface is timed
+ * with real packets so the report can say whether the box will keep up.
+ */
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tcpreplay.h"
+
+#ifdef TCPREPLAY_EDIT
+#include "tcpreplay_edit_opts.h"
+#else
+#include "tcpreplay_opts.h"
+#endif
+
+#include "dry_run.h"
+
+extern tcpreplay_opt_t options;
+
+/* packets kept from the first file to benchmark the interface with */
+#define DRY_RUN_BENCH_PKTS      1024
+
+/* without a benchmark, packets closer than this are a burst */
+#define DRY_RUN_BURST_GAP       0.000001
+
+/*
+ * Bytes malloc() really uses for a request of n bytes, assuming a
+ * glibc-like allocator: a size_t of overhead and 2 * sizeof(size_t)
+ * alignment, with a minimum chunk of 4 words
+ */
+#define DRY_RUN_MALLOC(n)                                                   \
+    ((n) + sizeof(size_t) <= 4 * sizeof(size_t) ? 4 * sizeof(size_t) :     \
+     ((n) + sizeof(size_t) + 2 * sizeof(size_t) - 1) & ~(2 * sizeof(size_t) - 1))
+
+typedef struct {
+    COUNTER pkts;
+    COUNTER bytes;
+    COUNTER cache_bytes;        /* what --preload-pcap would malloc() */
+    double duration;            /* seconds to replay one pass */
+    double min_gap;             /* closest two packets, or < 0 if none */
+
+    /* packets & bytes sent during each second of the replay */
+    COUNTER *sec_pkts;
+    COUNTER *sec_bytes;
+    size_t secs;
+
+    /* longest run of packets closer than burst_gap */
+    double burst_gap;
+    COUNTER burst_pkts, burst_bytes;
+    double burst_start;
+    COUNTER max_burst_pkts, max_burst_bytes;
+    double max_burst_time;
+
+} dry_run_t;
+
+/**
+ * Bytes tcpreplay sends for the packet: the original length with --pktlen,
+ * like send_packets()
+ */
+static u_int32_t
+dry_run_pktlen(const struct pcap_pkthdr *pkthdr)
+{
+    return HAVE_OPT(PKTLEN) ? pkthdr->len : pkthdr->caplen;
+}
+
+/**
+ * How long tcpreplay sleeps before sending a pktlen byte packet stamped ts
+ * at the selected speed, mirroring do_sleep().  pktnum counts from 0 at
+ * the start of each file
+ */
+static double
+dry_run_gap(const struct timespec *last, const struct timespec *ts, u_int32_t pktlen,
+        COUNTER pktnum)
+{
+    struct timespec diff;
+    double gap = 0.0;
+    int multi;
+
+    if (pktnum == 0)
+        return 0.0;
+
+    switch (options.speed.mode) {
+    case SPEED_MULTIPLIER:
+        if (timescmp(ts, last, <))
+            return 0.0;
+        timessub(ts, last, &diff);
+        gap = ((double)diff.tv_sec + (double)diff.tv_nsec / 1000000000.0) /
+            options.speed.speed;
+        break;
+
+    case SPEED_MBPSRATE:
+        gap = (double)pktlen * 8.0 / (options.speed.speed * 1000000.0);
+        break;
+
+    case SPEED_PACKETRATE:
+        /* --pps-multi sends that many packets back to back per nap */
+        multi = options.speed.pps_multi > 0 ? options.speed.pps_multi : 1;
+        if (pktnum % multi == 0)
+            gap = (double)multi / options.speed.speed;
+        break;
+
+    default:
+        /* --topspeed and --oneatatime don't sleep */
+        break;
+    }
+
+    if (timesisset(&options.maxsleep)) {
+        double maxsleep = (double)options.maxsleep.tv_sec +
+            (double)options.maxsleep.tv_nsec / 1000000000.0;
+        if (gap > maxsleep)
+            gap = maxsleep;
+    }
+    return gap;
+}
+
+/**
+ * Accounts for one packet sent at offset now (seconds) into the replay.
+ * Generated packets aren't preloaded.
+ */
+static void
+dry_run_packet(dry_run_t *dr, const struct pcap_pkthdr *pkthdr, double now,
+        double gap, COUNTER pktnum, int generated)
+{
+    size_t sec = (size_t)now;
+    u_int32_t pktlen = dry_run_pktlen(pkthdr);
+
+    dr->pkts++;
+    dr->bytes += pktlen;
+    if (! generated) {
+        /* the cache zero pads packets out to their --pktlen */
+        dr->cache_bytes += DRY_RUN_MALLOC(sizeof(packet_cache_t)) +
+            DRY_RUN_MALLOC(pktlen > pkthdr->caplen ? pktlen : pkthdr->caplen);
+    }
+
+    if (sec >= dr->secs) {
+        size_t secs = dr->secs ? dr->secs : 64;
+        while (secs <= sec)
+            secs <<= 1;
+        dr->sec_pkts = safe_realloc(dr->sec_pkts, secs * sizeof(COUNTER));
+        dr->sec_bytes = safe_realloc(dr->sec_bytes, secs * sizeof(COUNTER));
+        memset(&dr->sec_pkts[dr->secs], 0, (secs - dr->secs) * sizeof(COUNTER));
+        memset(&dr->sec_bytes[dr->secs], 0, (secs - dr->secs) * sizeof(COUNTER));
+        dr->secs = secs;
+    }
+    dr->sec_pkts[sec]++;
+    dr->sec_bytes[sec] += pktlen;
+
+    if (pktnum > 0 && (dr->min_gap < 0.0 || gap < dr->min_gap))
+        dr->min_gap = gap;
+
+    /* bursts don't span files since each file starts with a clean slate */
+    if (pktnum > 0 && gap < dr->burst_gap) {
+        dr->burst_pkts++;
+        dr->burst_bytes += pktlen;
+    } else {
+        dr->burst_pkts = 1;
+        dr->burst_bytes = pktlen;
+        dr->burst_start = now;
+    }
+    if (dr->burst_pkts > dr->max_burst_pkts) {
+        dr->max_burst_pkts = dr->burst_pkts;
+        dr->max_burst_bytes = dr->burst_bytes;
+        dr->max_burst_time = now - dr->burst_start;
+    }
+
+}
+
+/**
+ * Next packet of file_idx, from its pcap or its generator
+ */
+static const u_char *
+dry_run_next(pcapreader_t *pcap, int file_idx, struct pcap_pkthdr *pkthdr,
+        pcapreader_meta_t *meta)
+{
+    const u_char *pktdata;
+
+    if (options.gen[file_idx] != NULL) {
+        pktdata = gen_next_packet(options.gen[file_idx], pkthdr);
+        TIMEVAL_TO_TIMESPEC(&pkthdr->ts, &meta->ts);
+        return pktdata;
+    }
+    return pcapreader_next(pcap, pkthdr, meta);
+}
+
+/**
+ * Reads one file, a --dualfile pair or all the --merge files in timestamp
+ * order like send_dual_packets(), starting at offset *now into the replay
+ */
+static void
+dry_run_files(dry_run_t *dr, int file_idx, int nfiles, double *now)
+{
+    pcapreader_t **pcap;
+    struct pcap_pkthdr *pkthdr;
+    pcapreader_meta_t *meta;
+    struct timespec last;
+    const u_char **pktdata;
+    char ebuf[PCAPREADER_ERRBUF_SIZE];
+    COUNTER pktnum = 0;
+    double gap;
+    int i, next;
+
+    pcap = (pcapreader_t **)safe_malloc(nfiles * sizeof(pcapreader_t *));
+    pkthdr = (struct pcap_pkthdr *)safe_malloc(nfiles * sizeof(struct pcap_pkthdr));
+    meta = (pcapreader_meta_t *)safe_malloc(nfiles * sizeof(pcapreader_meta_t));
+    pktdata = (const u_char **)safe_malloc(nfiles * sizeof(u_char *));
+
+    for (i = 0; i < nfiles; i++) {
+        if (options.gen[file_idx + i] != NULL)
+            gen_rewind(options.gen[file_idx + i]);
+        else if ((pcap[i] = pcapreader_open(options.files[file_idx + i], ebuf)) == NULL)
+            errx(-1, "Error opening pcap file: %s", ebuf);
+        pktdata[i] = dry_run_next(pcap[i], file_idx + i, &pkthdr[i], &meta[i]);
+    }
+
+    memset(&last, 0, sizeof(last));
+    while (1) {
+        next = -1;
+        for (i = 0; i < nfiles; i++) {
+            if (pktdata[i] != NULL && (next < 0 ||
+                        timescmp(&meta[i].ts, &meta[next].ts, <)))
+                next = i;
+        }
+        if (next < 0)
+            break;
+        if (options.limit_send > 0 && dr->pkts >= (COUNTER)options.limit_send)
+            break;
+
+        gap = dry_run_gap(&last, &meta[next].ts, dry_run_pktlen(&pkthdr[next]), pktnum);
+        *now += gap;
+        dry_run_packet(dr, &pkthdr[next], *now, gap, pktnum, 
+                options.gen[file_idx + next] != NULL);
+        memcpy(&last, &meta[next].ts, sizeof(last));
+        pktnum++;
+
+        pktdata[next] = dry_run_next(pcap[next], file_idx + next, &pkthdr[next], &meta[next]);
+    }
+
+    for (i = 0; i < nfiles; i++) {
+        if (pcap[i] != NULL)
+            pcapreader_close(pcap[i]);
+    }
+    safe_free(pktdata);
+    safe_free(meta);
+    safe_free(pkthdr);
+    safe_free(pcap);
+}
+
+/**
+ * Sends options.dry_run_bench packets, cycling through the first
+ * DRY_RUN_BENCH_PKTS of the first file, as fast as possible and returns
+ * the time each one took in seconds
+ */
+static double
+dry_run_bench(void)
+{
+    u_char *data[DRY_RUN_BENCH_PKTS];
+    size_t len[DRY_RUN_BENCH_PKTS];
+    struct pcap_pkthdr pkthdr;
+    pcapreader_meta_t meta;
+    const u_char *pktdata;
+    struct timeval start, stop, diff;
+    char ebuf[PCAPREADER_ERRBUF_SIZE];
+    pcapreader_t *pcap;
+    COUNTER i, bytes = 0;
+    double elapsed;
+    int n, count = 0;
+
+    pcap = NULL;
+    if (options.gen[0] != NULL)
+        gen_rewind(options.gen[0]);
+    else if ((pcap = pcapreader_open(options.files[0], ebuf)) == NULL)
+        errx(-1, "Error opening pcap file: %s", ebuf);
+
+    while (count < DRY_RUN_BENCH_PKTS && (pktdata = dry_run_next(pcap, 0, &pkthdr, &meta)) != NULL) {
+        data[count] = safe_malloc(pkthdr.caplen);
+        memcpy(data[count], pktdata, pkthdr.caplen);
+        len[count++] = pkthdr.caplen;
+    }
+    if (pcap != NULL)
+        pcapreader_close(pcap);
+
+    if (count == 0)
+        return 0.0;
+
+    memset(&pkthdr, 0, sizeof(pkthdr));
+    gettimeofday(&start, NULL);
+    for (i = 0; i < options.dry_run_bench; i++) {
+        n = (int)(i % count);
+        pkthdr.caplen = pkthdr.len = len[n];
+        if (sendpacket(options.intf1, data[n], len[n], &pkthdr) < 0)
+            warnx("Unable to send packet: %s", sendpacket_geterr(options.intf1));
+        bytes += len[n];
+    }
+    gettimeofday(&stop, NULL);
+
+    for (n = 0; n < count; n++)
+        safe_free(data[n]);
+
+    /* timer2float() only has 10msec resolution */
+    timersub(&stop, &start, &diff);
+    elapsed = (double)diff.tv_sec + (double)diff.tv_usec / 1000000.0;
+
+    printf("Benchmark: " COUNTER_SPEC " packets (" COUNTER_SPEC " bytes) via %s in %.03f seconds\n",
+            options.dry_run_bench, bytes, sendpacket_get_method(options.intf1), elapsed);
+    if (elapsed > 0.0) {
+        printf("Benchmark rate: %.2f pps, %.2f Mbps\n",
+                (double)options.dry_run_bench / elapsed,
+                (double)bytes * 8.0 / elapsed / 1000000.0);
+    }
+    printf("%s", sendpacket_getstat(options.intf1));
+
+    return elapsed / (double)options.dry_run_bench;
+}
+
+/**
+ * Prints the replay requirements of the pcap files in options.files
+ */
+void
+dry_run(int argc)
+{
+    dry_run_t *dr;
+    double now = 0.0, per_pkt = 0.0, peak_bps, avail = 0.0, phys = 0.0;
+    COUNTER peak_pkts = 0, peak_bytes = 0;
+    size_t sec, peak_pkts_sec = 0, peak_bytes_sec = 0;
+    long pagesize;
+    int i, step, fast;
+
+    dr = (dry_run_t *)safe_malloc(sizeof(dry_run_t));
+    dr->min_gap = -1.0;
+    dr->burst_gap = DRY_RUN_BURST_GAP;
+
+    /* time the interface first so we know what counts as a burst */
+    if (options.dry_run_bench > 0) {
+        per_pkt = dry_run_bench();
+        if (per_pkt > 0.0)
+            dr->burst_gap = per_pkt;
+    }
+
+    step = options.merge ? argc : options.dualfile ? 2 : 1;
+    for (i = 0; i < argc; i += step) {
+        if (options.limit_send > 0 && dr->pkts >= (COUNTER)options.limit_send)
+            break;
+        dry_run_files(dr, i, step, &now);
+    }
+    dr->duration = now;
+
+    for (sec = 0; sec < dr->secs; sec++) {
+        if (dr->sec_pkts[sec] > peak_pkts) {
+            peak_pkts = dr->sec_pkts[sec];
+            peak_pkts_sec = sec;
+        }
+        if (dr->sec_bytes[sec] > peak_bytes) {
+            peak_bytes = dr->sec_bytes[sec];
+            peak_bytes_sec = sec;
+        }
+    }
+    peak_bps = (double)peak_bytes * 8.0;
+
+    printf("Dry run: " COUNTER_SPEC " packets (" COUNTER_SPEC " bytes) in %d file(s)\n",
+            dr->pkts, dr->bytes, argc);
+
+    /* --preload-pcap keeps a packet_cache_t and a copy of every packet */
+    pagesize = sysconf(_SC_PAGESIZE);
+    phys = (double)sysconf(_SC_PHYS_PAGES) * pagesize;
+#ifdef _SC_AVPHYS_PAGES
+    avail = (double)sysconf(_SC_AVPHYS_PAGES) * pagesize;
+#endif
+    printf("Preload memory: " COUNTER_SPEC " bytes (%.1f MB)", dr->cache_bytes,
+            (double)dr->cache_bytes / 1048576.0);
+    if (avail > 0.0) {
+        printf(", %.1f MB free of %.1f MB: %s\n", avail / 1048576.0, phys / 1048576.0,
+                (double)dr->cache_bytes < avail ? "fits" : "DOES NOT FIT");
+    } else {
+        printf("\n");
+    }
+
+    if (options.speed.mode == SPEED_TOPSPEED || options.speed.mode == SPEED_ONEATATIME) {
+        printf("Replay rate: %s, no pacing required\n",
+                options.speed.mode == SPEED_TOPSPEED ? "--topspeed" : "--oneatatime");
+    } else {
+        printf("Replay time: %.03f seconds per loop", dr->duration);
+        if (options.loop > 1)
+            printf(" (%.03f seconds for %u loops)", dr->duration * options.loop, options.loop);
+        printf("\n");
+
+        if (dr->duration > 0.0) {
+            printf("Average rate: %.2f pps, %.2f Mbps\n",
+                    (double)dr->pkts / dr->duration,
+                    (double)dr->bytes * 8.0 / dr->duration / 1000000.0);
+        }
+        printf("Peak second: " COUNTER_SPEC " pps at %zus, %.2f Mbps at %zus\n",
+                peak_pkts, peak_pkts_sec, peak_bps / 1000000.0, peak_bytes_sec);
+        if (dr->min_gap >= 0.0)
+            printf("Smallest gap: %.03f usec\n", dr->min_gap * 1000000.0);
+    }
+
+    printf("Worst burst: " COUNTER_SPEC " packets (" COUNTER_SPEC " bytes) less than %.03f usec apart",
+            dr->max_burst_pkts, dr->max_burst_bytes, dr->burst_gap * 1000000.0);
+    if (dr->max_burst_time > 0.0) {
+        printf(" over %.03f usec (%.2f pps)\n", dr->max_burst_time * 1000000.0,
+                (double)(dr->max_burst_pkts - 1) / dr->max_burst_time);
+    } else {
+        printf("\n");
+    }
+
+    /* can the interface keep up with the busiest second? */
+    if (per_pkt > 0.0) {
+        if (options.speed.mode == SPEED_TOPSPEED || options.speed.mode == SPEED_ONEATATIME) {
+            printf("Prediction: about %.03f seconds per loop at the benchmarked rate\n",
+                    per_pkt * (double)dr->pkts);
+        } else {
+            fast = (double)peak_pkts * per_pkt <= 1.0;
+            printf("Prediction: %s (peak second needs %.1f%% of the benchmarked rate)\n",
+                    fast ? "keeps up" : "WILL FALL BEHIND",
+                    (double)peak_pkts * per_pkt * 100.0);
+        }
+    }
+
+    safe_free(dr->sec_pkts);
+    safe_free(dr->sec_bytes);
+    safe_free(dr);
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
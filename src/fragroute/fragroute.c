@@ -38,6 +38,11 @@
 void
 fragroute_close(fragroute_t *ctx)
 {
+    mod_close(ctx);
+    if (ctx->pool != NULL) {
+        pkt_pool_recycle(ctx->pktq);
+        pkt_pool_free(ctx->pool);
+    }
     free(ctx->pktq);
     free(ctx);
     ctx = NULL;
@@ -51,19 +56,21 @@ fragroute_process(fragroute_t *ctx, void *buf, size_t len)
     assert(ctx);
     assert(buf);
     
-    ctx->first_packet = 0;
+    /* fragments the caller never fetched go back to the pool */
+    pkt_pool_recycle(ctx->pktq);
+
     /* save the l2 header of the original packet for later */
     ctx->l2len = get_l2len(buf, len, ctx->dlt);
     memcpy(ctx->l2header, buf, ctx->l2len);
 
-    if ((pkt = pkt_new()) == NULL) {
-        strcpy(ctx->errbuf, "unable to pkt_new()");
-        return -1;
-    }
     if (len > PKT_BUF_LEN) {
         sprintf(ctx->errbuf, "skipping oversized packet: %zu", len);
         return -1;
     }
+    if ((pkt = pkt_new(ctx->pool)) == NULL) {
+        strcpy(ctx->errbuf, "unable to pkt_new()");
+        return -1;
+    }
 
     memcpy(pkt->pkt_data, buf, len);
     pkt->pkt_end = pkt->pkt_data + len;
@@ -71,6 +78,7 @@ fragroute_process(fragroute_t *ctx, void *buf, size_t len)
     pkt_decorate(pkt);
 
     if (pkt->pkt_ip == NULL) {
+        pkt_free(pkt);
         strcpy(ctx->errbuf, "skipping non-IP packet");
         return -1;
     }
@@ -80,10 +88,9 @@ fragroute_process(fragroute_t *ctx, void *buf, size_t len)
     }
 */
 
-    TAILQ_INIT(ctx->pktq);
     TAILQ_INSERT_TAIL(ctx->pktq, pkt, pkt_next);
 
-    mod_apply(ctx->pktq);
+    mod_apply(ctx, ctx->pktq);
 
     return 0;
 }
@@ -91,35 +98,30 @@ fragroute_process(fragroute_t *ctx, void *buf, size_t len)
 /*
  * keep calling this after fragroute_process() to get all the fragments.
  * Each call returns the fragment length which is stored in **packet.
- * Returns 0 when no more fragments remain or -1 on error
+ * Returns 0 when no more fragments remain or -1 on error.
+ * Each fragment goes back to the pool as soon as it has been copied out,
+ * so the queue is empty again once this returns 0.
  */
 int
 fragroute_getfragment(fragroute_t *ctx, char **packet)
 {
-    static struct pkt *pkt = NULL;
-    static struct pkt *next = NULL;
+    struct pkt *pkt;
     char *pkt_data = *packet;
     u_int32_t length;
     
-    if (ctx->first_packet != 0) {
-        pkt = next;
-    } else {
-        ctx->first_packet = 1;
-        pkt = TAILQ_FIRST(ctx->pktq);
-    }
-    
-    if (pkt != TAILQ_END(&(ctx->pktq))) {
-        next = TAILQ_NEXT(pkt, pkt_next);
-        memcpy(pkt_data, pkt->pkt_data, pkt->pkt_end - pkt->pkt_data);
+    pkt = TAILQ_FIRST(ctx->pktq);
+    if (pkt == TAILQ_END(ctx->pktq))
+        return 0; // nothing
+
+    TAILQ_REMOVE(ctx->pktq, pkt, pkt_next);
+    length = pkt->pkt_end - pkt->pkt_data;
+    memcpy(pkt_data, pkt->pkt_data, length);
         
-        /* return the original L2 header */
-        memcpy(pkt_data, ctx->l2header, ctx->l2len);
-        length = pkt->pkt_end - pkt->pkt_data;
-        pkt = next;
-        return length;
-    }
+    /* return the original L2 header */
+    memcpy(pkt_data, ctx->l2header, ctx->l2len);
+    pkt_free(pkt);
 
-    return 0; // nothing
+    return length;
 }
 
 fragroute_t *
@@ -135,14 +137,20 @@ fragroute_init(const int mtu, const int dlt, const char *config, char *errbuf)
 
     ctx = (fragroute_t *)safe_malloc(sizeof(fragroute_t));
     ctx->pktq = (struct pktq *)safe_malloc(sizeof(struct pktq));
+    TAILQ_INIT(ctx->pktq);
+    TAILQ_INIT(&ctx->rules);
     ctx->dlt = dlt;
 
-    pkt_init(128);
+    if ((ctx->pool = pkt_pool_new(FRAGROUTE_POOL_CHUNK)) == NULL) {
+        sprintf(errbuf, "unable to allocate fragroute packet pool");
+        fragroute_close(ctx);
+        return NULL;
+    }
 
     ctx->mtu = mtu;
 
     /* parse the config */
-    if (mod_open(config, errbuf) < 0) {
+    if (mod_open(ctx, config, errbuf) < 0) {
         fragroute_close(ctx);
         return NULL;
     }
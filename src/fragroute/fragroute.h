@@ -33,13 +33,18 @@
 
 #include "config.h"
 #include "pkt.h"
+#include "mod.h"
 
 #ifndef __FRAGROUTE_H__
 #define __FRAGROUTE_H__
 
 #define FRAGROUTE_ERRBUF_LEN 1024
+#define FRAGROUTE_POOL_CHUNK 128
 
-/* Fragroute context. */
+/*
+ * Fragroute context.  Everything fragroute needs lives here, so each
+ * thread can run its own context without any locking.
+ */
 struct fragroute_s {
 	struct addr	 src;
 	struct addr	 dst;
@@ -47,7 +52,6 @@ struct fragroute_s {
 	struct addr	 dmac;
     int     dlt;
 	int		mtu;
-    int     first_packet; /* have we called getfragment() yet after process()? */
     int     l2len;
     u_char  l2header[50];
 //	arp_t		*arp;
@@ -57,6 +61,8 @@ struct fragroute_s {
 //	tun_t		*tun;
     char        errbuf[FRAGROUTE_ERRBUF_LEN];
 	struct pktq *pktq; /* packet chain */    
+	struct pkt_pool *pool; /* recycled packets for pktq */
+	struct rule_list rules; /* parsed config, applied in order */
 };
 
 typedef struct fragroute_s fragroute_t;
@@ -96,6 +96,36 @@ inet_checksum(uint16_t eth_type, void *buf, size_t len)
     }
 }
 
+/*
+ * memcpy() which also returns the folded ones' complement sum of the data,
+ * as ip_cksum_add() would, so a segment's payload is only read once
+ */
+int
+inet_cksum_copy(void *dst, const void *src, size_t len)
+{
+    const u_char *s = (const u_char *)src;
+    u_char *d = (u_char *)dst;
+    uint32_t sum = 0;
+    uint16_t w;
+
+    for (; len > 1; len -= 2, s += 2, d += 2) {
+        memcpy(&w, s, sizeof(w));
+        memcpy(d, &w, sizeof(w));
+        sum += w;
+    }
+    if (len == 1) {
+        /* odd byte is padded with a zero, like ip_cksum_add() */
+        w = 0;
+        *d = *s;
+        memcpy(&w, s, 1);
+        sum += w;
+    }
+
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return (int)(sum & 0xffff);
+}
+
 int
 raw_ip_opt_parse(int argc, char *argv[], uint8_t *opt_type, uint8_t *opt_len,
         uint8_t *buff, int buff_len)
@@ -4,6 +4,10 @@
 ssize_t inet_add_option(uint16_t eth_type, void *buf, size_t len,
                 int proto, const void *optbuf, size_t optlen);
 void    inet_checksum(uint16_t eth_type, void *buf, size_t len);
+int     inet_cksum_copy(void *dst, const void *src, size_t len);
+
+/* ones' complement sum of data placed at an odd offset */
+#define inet_cksum_swap(sum)    ((((sum) & 0xff) << 8) | (((sum) >> 8) & 0xff))
 
 int raw_ip_opt_parse(int argc, char *argv[], uint8_t *type, uint8_t *len,
         uint8_t *buff, int buff_len);
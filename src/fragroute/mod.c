@@ -18,6 +18,7 @@
 
 #include "argv.h"
 #include "mod.h"
+#include "fragroute.h"
 
 #define MAX_ARGS		 128	/* XXX */
 
@@ -67,8 +68,6 @@ static struct mod *mods[] = {
 	NULL
 };
 
-static TAILQ_HEAD(head, rule) rules;
-
 void
 mod_usage(void)
 {
@@ -80,7 +79,7 @@ mod_usage(void)
 }
 
 int
-mod_open(const char *script, char *errbuf)
+mod_open(fragroute_t *ctx, const char *script, char *errbuf)
 {
 	FILE *fp;
 	struct mod **m;
@@ -88,7 +87,7 @@ mod_open(const char *script, char *errbuf)
 	char *argv[MAX_ARGS], buf[BUFSIZ];
 	int i, argc, ret = 0;
 
-	TAILQ_INIT(&rules);
+	TAILQ_INIT(&ctx->rules);
 	
 	/* open the config/script file */
 	if ((fp = fopen(script, "r")) == NULL) {
@@ -136,14 +135,15 @@ mod_open(const char *script, char *errbuf)
 
         /* pass the remaining args to the rule */
 		if (rule->mod->open != NULL &&
-		    (rule->data = rule->mod->open(argc, argv)) == NULL) {
+		    (rule->data = rule->mod->open(ctx, argc, argv)) == NULL) {
 			sprintf(errbuf, "invalid argument to directive '%s' (line %d)",
 			    rule->mod->name, i);
+			free(rule);
 			ret = -1;
 			break;
 		}
 		/* append the rule to the rule list */
-		TAILQ_INSERT_TAIL(&rules, rule, next);
+		TAILQ_INSERT_TAIL(&ctx->rules, rule, next);
 	}
 	
 	/* close the file */
@@ -152,7 +152,7 @@ mod_open(const char *script, char *errbuf)
     
 	if (ret == 0) {
 		buf[0] = '\0';
-		TAILQ_FOREACH(rule, &rules, next) {
+		TAILQ_FOREACH(rule, &ctx->rules, next) {
 			strlcat(buf, rule->mod->name, sizeof(buf));
 			strlcat(buf, " -> ", sizeof(buf));
 		}
@@ -164,24 +164,24 @@ mod_open(const char *script, char *errbuf)
 }
 
 void
-mod_apply(struct pktq *pktq)
+mod_apply(fragroute_t *ctx, struct pktq *pktq)
 {
 	struct rule *rule;
 	
-	TAILQ_FOREACH(rule, &rules, next) {
-		rule->mod->apply(rule->data, pktq);
+	TAILQ_FOREACH(rule, &ctx->rules, next) {
+		rule->mod->apply(ctx, rule->data, pktq);
 	}
 }
 
 void
-mod_close(void)
+mod_close(fragroute_t *ctx)
 {
 	struct rule *rule;
 	
-	TAILQ_FOREACH_REVERSE(rule, &rules, next, head) {
+	while ((rule = TAILQ_LAST(&ctx->rules, rule_list)) != NULL) {
 		if (rule->mod->close != NULL)
 			rule->data = rule->mod->close(rule->data);
-		TAILQ_REMOVE(&rules, rule, next);
+		TAILQ_REMOVE(&ctx->rules, rule, next);
 		free(rule);
 	}
 }
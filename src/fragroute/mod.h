@@ -11,17 +11,23 @@
 
 #include "pkt.h"
 
+struct fragroute_s;
+
+/* modules keep all their state in data, so contexts can run in parallel */
 struct mod {
 	char	 *name;
 	char	 *usage;
-	void	*(*open)(int argc, char *argv[]);
-	int	 (*apply)(void *data, struct pktq *pktq);
+	void	*(*open)(struct fragroute_s *ctx, int argc, char *argv[]);
+	int	 (*apply)(struct fragroute_s *ctx, void *data, struct pktq *pktq);
 	void	*(*close)(void *data);
 };
 
+struct rule;
+TAILQ_HEAD(rule_list, rule);
+
 void	mod_usage(void);
-int	mod_open(const char *script, char *errbuf);
-void	mod_apply(struct pktq *pktq);
-void	mod_close(void);
+int	mod_open(struct fragroute_s *ctx, const char *script, char *errbuf);
+void	mod_apply(struct fragroute_s *ctx, struct pktq *pktq);
+void	mod_close(struct fragroute_s *ctx);
 
 #endif /* MOD_H */
@@ -38,7 +38,7 @@ delay_close(void *d)
 }
 
 void *
-delay_open(int argc, char *argv[])
+delay_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct delay_data *data;
 	uint64_t usec;
@@ -71,7 +71,7 @@ delay_open(int argc, char *argv[])
 }
 
 int
-delay_apply(void *d, struct pktq *pktq)
+delay_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct delay_data *data = (struct delay_data *)d;
 	struct pkt *pkt;
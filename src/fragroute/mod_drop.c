@@ -38,7 +38,7 @@ drop_close(void *d)
 }
 
 void *
-drop_open(int argc, char *argv[])
+drop_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct drop_data *data;
 	
@@ -66,7 +66,7 @@ drop_open(int argc, char *argv[])
 }
 
 int
-drop_apply(void *d, struct pktq *pktq)
+drop_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct drop_data *data = (struct drop_data *)d;
 	struct pkt *pkt;
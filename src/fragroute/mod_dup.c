@@ -38,7 +38,7 @@ dup_close(void *d)
 }
 
 void *
-dup_open(int argc, char *argv[])
+dup_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct dup_data *data;
 	
@@ -66,7 +66,7 @@ dup_open(int argc, char *argv[])
 }
 
 int
-dup_apply(void *d, struct pktq *pktq)
+dup_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct dup_data *data = (struct dup_data *)d;
 	struct pkt *pkt, *new;
@@ -75,9 +75,6 @@ dup_apply(void *d, struct pktq *pktq)
 	    (rand_uint16(data->rnd) % 100) > data->percent)
 		return (0);
 	
-	if ((new = pkt_new()) == NULL)
-		return (-1);
-	
 	if (data->which == DUP_FIRST)
 		pkt = TAILQ_FIRST(pktq);
 	else if (data->which == DUP_LAST)
@@ -85,7 +82,8 @@ dup_apply(void *d, struct pktq *pktq)
 	else
 		pkt = pktq_random(data->rnd, pktq);
 	
-	new = pkt_dup(pkt);
+	if ((new = pkt_dup(pkt)) == NULL)
+		return (-1);
 	TAILQ_INSERT_AFTER(pktq, pkt, new, pkt_next);
 	
 	return (0);
@@ -18,7 +18,7 @@
 #include "mod.h"
 
 void *
-echo_open(int argc, char *argv[])
+echo_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	char *p;
 	
@@ -32,7 +32,7 @@ echo_open(int argc, char *argv[])
 }
 
 int
-echo_apply(void *d, struct pktq *pktq)
+echo_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	char *p = (char *)d;
 
@@ -53,7 +53,7 @@ ip6_opt_close(void *d)
 }
 
 void *
-ip6_opt_open(int argc, char *argv[])
+ip6_opt_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct ip6_opt_data *opt;
 	int i, j;
@@ -69,7 +69,7 @@ ip6_opt_open(int argc, char *argv[])
 
 		if ((opt->u.route.segments = atoi(argv[2])) < 1 ||
 				opt->u.route.segments > MAX_ADDRS) {
-			warnx("<segments> must be >= 1");
+			warnx("<segments> must be >= 1 and <= %d", MAX_ADDRS);
 			return (ip6_opt_close(opt));
 		}
 
@@ -104,7 +104,7 @@ ip6_opt_open(int argc, char *argv[])
 }
 
 int
-ip6_opt_apply(void *d, struct pktq *pktq)
+ip6_opt_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct ip6_opt_data *opt = (struct ip6_opt_data *)d;
 	struct __ip6_ext_data_routing* route;
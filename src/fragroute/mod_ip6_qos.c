@@ -30,7 +30,7 @@ ip6_qos_close(void *d)
 }
 
 static void *
-ip6_qos_open(int argc, char *argv[])
+ip6_qos_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct ip6_qos_data *data;
 
@@ -55,7 +55,7 @@ ip6_qos_open(int argc, char *argv[])
 }
 
 static int
-ip6_qos_apply(void *d, struct pktq *pktq)
+ip6_qos_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct ip6_qos_data *data = (struct ip6_qos_data *)d;
 	struct pkt *pkt;
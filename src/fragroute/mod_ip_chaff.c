@@ -40,7 +40,7 @@ ip_chaff_close(void *d)
 }
 
 void *
-ip_chaff_open(int argc, char *argv[])
+ip_chaff_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct ip_chaff_data *data;
 
@@ -65,7 +65,7 @@ ip_chaff_open(int argc, char *argv[])
 }
 
 int
-ip_chaff_apply(void *d, struct pktq *pktq)
+ip_chaff_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct ip_chaff_data *data = (struct ip_chaff_data *)d;
 	struct pkt *pkt, *new, *next;
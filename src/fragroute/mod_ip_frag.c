@@ -31,55 +31,64 @@ ip_frag_apply_ipv4(void *d, struct pktq *pktq);
 static int
 ip_frag_apply_ipv6(void *d, struct pktq *pktq);
 
-static struct ip_frag_data
+struct ip_frag_data
 {
 	rand_t	*rnd;
 	int	 size;
 	int	 overlap;
 	uint32_t ident;
-} ip_frag_data;
+};
 
 void *
 ip_frag_close(void *d)
 {
-	if (ip_frag_data.rnd != NULL)
-		rand_close(ip_frag_data.rnd);
-	ip_frag_data.size = 0;
+	struct ip_frag_data *data = (struct ip_frag_data *)d;
+
+	if (data != NULL) {
+		if (data->rnd != NULL)
+			rand_close(data->rnd);
+		free(data);
+	}
 	return (NULL);
 }
 
 void *
-ip_frag_open(int argc, char *argv[])
+ip_frag_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
+	struct ip_frag_data *data;
+
 	if (argc < 2) {
 		warn("need fragment <size> in bytes");
 		return (NULL);
 	}
-	ip_frag_data.rnd = rand_open();
-	ip_frag_data.size = atoi(argv[1]);
+	if ((data = calloc(1, sizeof(*data))) == NULL)
+		return (NULL);
+
+	data->rnd = rand_open();
+	data->size = atoi(argv[1]);
 	
-	if (ip_frag_data.size == 0 || (ip_frag_data.size % 8) != 0) {
+	if (data->size == 0 || (data->size % 8) != 0) {
 		warn("fragment size must be a multiple of 8");
-		return (ip_frag_close(&ip_frag_data));
+		return (ip_frag_close(data));
 	}
 	if (argc == 3) {
 		if (strcmp(argv[2], "old") == 0 ||
 		    strcmp(argv[2], "win32") == 0)
-			ip_frag_data.overlap = FAVOR_OLD;
+			data->overlap = FAVOR_OLD;
 		else if (strcmp(argv[2], "new") == 0 ||
 		    strcmp(argv[2], "unix") == 0)
-			ip_frag_data.overlap = FAVOR_NEW;
+			data->overlap = FAVOR_NEW;
 		else
-			return (ip_frag_close(&ip_frag_data));
+			return (ip_frag_close(data));
 	}
 
-	ip_frag_data.ident = rand_uint32(ip_frag_data.rnd);
+	data->ident = rand_uint32(data->rnd);
 
-	return (&ip_frag_data);
+	return (data);
 }
 
 int
-ip_frag_apply(void *d, struct pktq *pktq)
+ip_frag_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct pkt *pkt;
 
@@ -98,11 +107,26 @@ ip_frag_apply(void *d, struct pktq *pktq)
 	return 0;
 }
 
+/*
+ * Finish a fragment's IPv4 header: every fragment carries the template
+ * header with only ip_off, ip_len and ip_sum changed, so the checksum is
+ * the template's partial sum plus those two fields.
+ */
+static void
+ip_frag_hdr(struct ip_hdr *ip, int sum, uint16_t off, int len)
+{
+	ip->ip_off = htons(off);
+	ip->ip_len = htons(len);
+	sum += ip->ip_off + ip->ip_len;
+	ip->ip_sum = ip_cksum_carry(sum);
+}
+
 static int
 ip_frag_apply_ipv4(void *d, struct pktq *pktq)
 {
+	struct ip_frag_data *data = (struct ip_frag_data *)d;
 	struct pkt *pkt, *new, *next, tmp;
-	int hl, fraglen, off;
+	int hl, fraglen, off, sum;
 	u_char *p, *p1, *p2;
 
 	for (pkt = TAILQ_FIRST(pktq); pkt != TAILQ_END(pktq); pkt = next) {
@@ -119,17 +143,17 @@ ip_frag_apply_ipv4(void *d, struct pktq *pktq)
 		 */
 		switch (pkt->pkt_ip->ip_p) {
 		case IP_PROTO_ICMP:
-			fraglen = MAX(ICMP_LEN_MIN, ip_frag_data.size);
+			fraglen = MAX(ICMP_LEN_MIN, data->size);
 			break;
 		case IP_PROTO_UDP:
-			fraglen = MAX(UDP_HDR_LEN, ip_frag_data.size);
+			fraglen = MAX(UDP_HDR_LEN, data->size);
 			break;
 		case IP_PROTO_TCP:
 			fraglen = MAX(pkt->pkt_tcp->th_off << 2,
-			    ip_frag_data.size);
+			    data->size);
 			break;
 		default:
-			fraglen = ip_frag_data.size;
+			fraglen = data->size;
 			break;
 		}
 		if (fraglen & 7)
@@ -137,46 +161,54 @@ ip_frag_apply_ipv4(void *d, struct pktq *pktq)
 		
 		if (pkt->pkt_end - pkt->pkt_ip_data < fraglen)
 			continue;
+
+		/*
+		 * The original's L2 and IP headers are the template for
+		 * every fragment, so sum the header once without the
+		 * fields ip_frag_hdr() fills in.
+		 */
+		pkt->pkt_ip->ip_off = pkt->pkt_ip->ip_len = 0;
+		pkt->pkt_ip->ip_sum = 0;
+		sum = ip_cksum_add(pkt->pkt_ip, hl, 0);
 		
 		for (p = pkt->pkt_ip_data; p < pkt->pkt_end; ) {
-			new = pkt_new();
-			memcpy(new->pkt_eth, pkt->pkt_eth, (u_char*)pkt->pkt_eth_data - (u_char*)pkt->pkt_eth);
-			memcpy(new->pkt_ip, pkt->pkt_ip, hl);
+			new = pkt_new(pkt->pkt_pool);
+			memcpy(new->pkt_eth, pkt->pkt_eth, ETH_HDR_LEN + hl);
 			new->pkt_ip_data = new->pkt_eth_data + hl;
 			
 			p1 = p, p2 = NULL;
 			off = (p - pkt->pkt_ip_data) >> 3;
 
-			if (ip_frag_data.overlap != 0 && (off & 1) != 0 &&
+			if (data->overlap != 0 && (off & 1) != 0 &&
 			    p + (fraglen << 1) < pkt->pkt_end) {
-				rand_strset(ip_frag_data.rnd, tmp.pkt_buf,
+				rand_strset(data->rnd, tmp.pkt_buf,
 				    fraglen);
-				if (ip_frag_data.overlap == FAVOR_OLD) {
+				if (data->overlap == FAVOR_OLD) {
 					p1 = p + fraglen;
 					p2 = tmp.pkt_buf;
-				} else if (ip_frag_data.overlap == FAVOR_NEW) {
+				} else if (data->overlap == FAVOR_NEW) {
 					p1 = tmp.pkt_buf;
 					p2 = p + fraglen;
 				}
-				new->pkt_ip->ip_off = htons(IP_MF |
-				    (off + (fraglen >> 3)));
+				ip_frag_hdr(new->pkt_ip, sum,
+				    IP_MF | (off + (fraglen >> 3)), hl + fraglen);
 			} else {
-				new->pkt_ip->ip_off = htons(off |
-				    ((p + fraglen < pkt->pkt_end) ? IP_MF: 0));
+				ip_frag_hdr(new->pkt_ip, sum, off |
+				    ((p + fraglen < pkt->pkt_end) ? IP_MF: 0),
+				    hl + fraglen);
 			}
-			new->pkt_ip->ip_len = htons(hl + fraglen);
-			ip_checksum(new->pkt_ip, hl + fraglen);
 			
 			memcpy(new->pkt_ip_data, p1, fraglen);
 			new->pkt_end = new->pkt_ip_data + fraglen;
 			TAILQ_INSERT_BEFORE(pkt, new, pkt_next);
 
 			if (p2 != NULL) {
-				new = pkt_dup(new);
+				new = pkt_new(pkt->pkt_pool);
+				memcpy(new->pkt_eth, pkt->pkt_eth, ETH_HDR_LEN + hl);
+				new->pkt_ip_data = new->pkt_eth_data + hl;
 				new->pkt_ts.tv_usec = 1;
-				new->pkt_ip->ip_off = htons(IP_MF | off);
-				new->pkt_ip->ip_len = htons(hl + (fraglen<<1));
-				ip_checksum(new->pkt_ip, hl + (fraglen<<1));
+				ip_frag_hdr(new->pkt_ip, sum, IP_MF | off,
+				    hl + (fraglen << 1));
 				
 				memcpy(new->pkt_ip_data, p, fraglen);
 				memcpy(new->pkt_ip_data+fraglen, p2, fraglen);
@@ -186,8 +218,8 @@ ip_frag_apply_ipv4(void *d, struct pktq *pktq)
 			} else
 				p += fraglen;
 			
-			if ((fraglen = pkt->pkt_end - p) > ip_frag_data.size)
-				fraglen = ip_frag_data.size;
+			if ((fraglen = pkt->pkt_end - p) > data->size)
+				fraglen = data->size;
 		}
 		TAILQ_REMOVE(pktq, pkt, pkt_next);
 		pkt_free(pkt);
@@ -195,17 +227,18 @@ ip_frag_apply_ipv4(void *d, struct pktq *pktq)
 	return (0);
 }
 
+#define IP6_FRAG_HDR_LEN	(2 + sizeof(struct ip6_ext_data_fragment))
 
 static int
 ip_frag_apply_ipv6(void *d, struct pktq *pktq)
 {
-	struct pkt *pkt, *new, *next, tmp;
+	struct ip_frag_data *data = (struct ip_frag_data *)d;
+	struct pkt *pkt, *new, *next, tmp, tmpl;
 	struct ip6_ext_hdr *ext;
-	int hl, fraglen, off;
+	int hl, tmpl_len, fraglen, off;
 	u_char *p, *p1, *p2;
-	uint8_t next_hdr;
 
-	ip_frag_data.ident++;
+	data->ident++;
 
 	for (pkt = TAILQ_FIRST(pktq); pkt != TAILQ_END(pktq); pkt = next) {
 		next = TAILQ_NEXT(pkt, pkt_next);
@@ -221,17 +254,17 @@ ip_frag_apply_ipv6(void *d, struct pktq *pktq)
 		 */
 		switch (pkt->pkt_ip->ip_p) {
 		case IP_PROTO_ICMP:
-			fraglen = MAX(ICMP_LEN_MIN, ip_frag_data.size);
+			fraglen = MAX(ICMP_LEN_MIN, data->size);
 			break;
 		case IP_PROTO_UDP:
-			fraglen = MAX(UDP_HDR_LEN, ip_frag_data.size);
+			fraglen = MAX(UDP_HDR_LEN, data->size);
 			break;
 		case IP_PROTO_TCP:
 			fraglen = MAX(pkt->pkt_tcp->th_off << 2,
-			    ip_frag_data.size);
+			    data->size);
 			break;
 		default:
-			fraglen = ip_frag_data.size;
+			fraglen = data->size;
 			break;
 		}
 		if (fraglen & 7)
@@ -240,33 +273,37 @@ ip_frag_apply_ipv6(void *d, struct pktq *pktq)
 		if (pkt->pkt_end - pkt->pkt_ip_data < fraglen)
 			continue;
 
-		next_hdr = pkt->pkt_ip6->ip6_nxt;
+		/*
+		 * Build the L2, IPv6 and fragment headers once; each
+		 * fragment copies them and only sets offlg and ip6_plen.
+		 */
+		tmpl_len = ETH_HDR_LEN + hl + IP6_FRAG_HDR_LEN;
+		memcpy(tmpl.pkt_buf, pkt->pkt_eth, ETH_HDR_LEN + hl);
+		((struct ip6_hdr *)(tmpl.pkt_buf + ETH_HDR_LEN))->ip6_nxt =
+		    IP_PROTO_FRAGMENT;
+		ext = (struct ip6_ext_hdr *)(tmpl.pkt_buf + ETH_HDR_LEN + hl);
+		ext->ext_nxt = pkt->pkt_ip6->ip6_nxt;
+		ext->ext_len = 0; /* ip6 fragf reserved */
+		ext->ext_data.fragment.ident = data->ident;
 
 		for (p = pkt->pkt_ip_data; p < pkt->pkt_end; ) {
-			new = pkt_new();
-			memcpy(new->pkt_eth, pkt->pkt_eth, (u_char*)pkt->pkt_eth_data - (u_char*)pkt->pkt_eth);
-			memcpy(new->pkt_ip, pkt->pkt_ip, hl);
-			ext = (struct ip6_ext_hdr *)((u_char*)new->pkt_eth_data + hl);
-			new->pkt_ip_data = (u_char *)(ext) + 2 + 
-				sizeof(struct ip6_ext_data_fragment);
-			new->pkt_ip6->ip6_nxt = IP_PROTO_FRAGMENT;
-
-			ext->ext_nxt = next_hdr;
-			ext->ext_len = 0; /* ip6 fragf reserved */
-			ext->ext_data.fragment.ident = ip_frag_data.ident;
-
+			new = pkt_new(pkt->pkt_pool);
+			memcpy(new->pkt_eth, tmpl.pkt_buf, tmpl_len);
+			ext = (struct ip6_ext_hdr *)(new->pkt_eth_data + hl);
+			new->pkt_ip_data = new->pkt_eth_data + hl +
+			    IP6_FRAG_HDR_LEN;
 
 			p1 = p, p2 = NULL;
 			off = (p - pkt->pkt_ip_data) >> 3;
 
-			if (ip_frag_data.overlap != 0 && (off & 1) != 0 &&
+			if (data->overlap != 0 && (off & 1) != 0 &&
 			    p + (fraglen << 1) < pkt->pkt_end) {
-				rand_strset(ip_frag_data.rnd, tmp.pkt_buf,
+				rand_strset(data->rnd, tmp.pkt_buf,
 				    fraglen);
-				if (ip_frag_data.overlap == FAVOR_OLD) {
+				if (data->overlap == FAVOR_OLD) {
 					p1 = p + fraglen;
 					p2 = tmp.pkt_buf;
-				} else if (ip_frag_data.overlap == FAVOR_NEW) {
+				} else if (data->overlap == FAVOR_NEW) {
 					p1 = tmp.pkt_buf;
 					p2 = p + fraglen;
 				}
@@ -283,7 +320,11 @@ ip_frag_apply_ipv6(void *d, struct pktq *pktq)
 			TAILQ_INSERT_BEFORE(pkt, new, pkt_next);
 
 			if (p2 != NULL) {
-				new = pkt_dup(new);
+				new = pkt_new(pkt->pkt_pool);
+				memcpy(new->pkt_eth, tmpl.pkt_buf, tmpl_len);
+				ext = (struct ip6_ext_hdr *)(new->pkt_eth_data + hl);
+				new->pkt_ip_data = new->pkt_eth_data + hl +
+				    IP6_FRAG_HDR_LEN;
 				new->pkt_ts.tv_usec = 1;
 
 				ext->ext_data.fragment.offlg = htons(off << 3) | IP6_MORE_FRAG;
@@ -298,8 +339,8 @@ ip_frag_apply_ipv6(void *d, struct pktq *pktq)
 				p += fraglen;
 			}
 
-			if ((fraglen = pkt->pkt_end - p) > ip_frag_data.size)
-				fraglen = ip_frag_data.size;
+			if ((fraglen = pkt->pkt_end - p) > data->size)
+				fraglen = data->size;
 		}
 		TAILQ_REMOVE(pktq, pkt, pkt_next);
 		pkt_free(pkt);
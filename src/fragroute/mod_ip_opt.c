@@ -27,7 +27,7 @@ ip_opt_close(void *d)
 }
 
 void *
-ip_opt_open(int argc, char *argv[])
+ip_opt_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct ip_opt *opt;
 	struct addr addr;
@@ -69,7 +69,7 @@ ip_opt_open(int argc, char *argv[])
 }
 
 int
-ip_opt_apply(void *d, struct pktq *pktq)
+ip_opt_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct ip_opt *opt = (struct ip_opt *)d;
 	struct pkt *pkt;
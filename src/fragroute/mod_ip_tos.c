@@ -29,7 +29,7 @@ ip_tos_close(void *d)
 }
 
 void *
-ip_tos_open(int argc, char *argv[])
+ip_tos_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct ip_tos_data *data;
 
@@ -47,7 +47,7 @@ ip_tos_open(int argc, char *argv[])
 }
 
 int
-ip_tos_apply(void *d, struct pktq *pktq)
+ip_tos_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct ip_tos_data *data = (struct ip_tos_data *)d;
 	struct pkt *pkt;
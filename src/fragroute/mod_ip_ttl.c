@@ -29,7 +29,7 @@ ip_ttl_close(void *d)
 }
 
 void *
-ip_ttl_open(int argc, char *argv[])
+ip_ttl_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct ip_ttl_data *data;
 
@@ -46,7 +46,7 @@ ip_ttl_open(int argc, char *argv[])
 }
 
 int
-ip_ttl_apply(void *d, struct pktq *pktq)
+ip_ttl_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct ip_ttl_data *data = (struct ip_ttl_data *)d;
 	struct pkt *pkt;
@@ -35,7 +35,7 @@ order_close(void *d)
 }
 
 void *
-order_open(int argc, char *argv[])
+order_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct order_data *data;
 	
@@ -58,7 +58,7 @@ order_open(int argc, char *argv[])
 }
 
 int
-order_apply(void *d, struct pktq *pktq)
+order_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct order_data *data = (struct order_data *)d;
 	
@@ -403,23 +403,23 @@ _print_eth(struct eth_hdr* e, int length)
 }
 
 static char *
-timerntoa(struct timeval *tv)
+timerntoa(struct timeval *tv, char *buf, size_t len)
 {
-	static char buf[128];
 	uint64_t usec;
 
 	usec = (tv->tv_sec * 1000000) + tv->tv_usec;
 	
-	snprintf(buf, sizeof(buf), "%d.%03d ms",
+	snprintf(buf, len, "%d.%03d ms",
 	    (int)(usec / 1000), (int)(usec % 1000));
 	
 	return (buf);
 }
 
 int
-print_apply(void *d, struct pktq *pktq)
+print_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct pkt *pkt;
+	char buf[128];
 
 	TAILQ_FOREACH(pkt, pktq, pkt_next) {
 		uint16_t eth_type = htons(pkt->pkt_eth->eth_type);
@@ -431,7 +431,7 @@ print_apply(void *d, struct pktq *pktq)
 		else
 			_print_eth(pkt->pkt_eth, pkt->pkt_end - pkt->pkt_data);
 		if (timerisset(&pkt->pkt_ts))
-			printf(" [delay %s]", timerntoa(&pkt->pkt_ts));
+			printf(" [delay %s]", timerntoa(&pkt->pkt_ts, buf, sizeof(buf)));
 		printf("\n");
 	}
 	return (0);
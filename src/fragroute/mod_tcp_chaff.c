@@ -44,7 +44,7 @@ tcp_chaff_close(void *d)
 }
 
 void *
-tcp_chaff_open(int argc, char *argv[])
+tcp_chaff_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct tcp_chaff_data *data;
 	
@@ -77,7 +77,7 @@ tcp_chaff_open(int argc, char *argv[])
 }
 
 int
-tcp_chaff_apply(void *d, struct pktq *pktq)
+tcp_chaff_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct tcp_chaff_data *data = (struct tcp_chaff_data *)d;
 	struct pkt *pkt, *new, *next;
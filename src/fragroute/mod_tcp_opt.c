@@ -27,7 +27,7 @@ tcp_opt_close(void *d)
 }
 
 void *
-tcp_opt_open(int argc, char *argv[])
+tcp_opt_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
 	struct tcp_opt *opt;
 	int i;
@@ -67,7 +67,7 @@ tcp_opt_open(int argc, char *argv[])
 }
 
 int
-tcp_opt_apply(void *d, struct pktq *pktq)
+tcp_opt_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
 	struct tcp_opt *opt = (struct tcp_opt *)d;
 	struct pkt *pkt;
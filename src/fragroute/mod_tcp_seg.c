@@ -26,53 +26,138 @@
 #define FAVOR_OLD	1
 #define FAVOR_NEW	2
 
-static struct tcp_seg_data {
+struct tcp_seg_data {
 	rand_t	*rnd;
 	int	 size;
 	int	 overlap;
-} tcp_seg_data;
+};
 
 void *
 tcp_seg_close(void *d)
 {
-	if (tcp_seg_data.rnd != NULL)
-		rand_close(tcp_seg_data.rnd);
-	tcp_seg_data.size = 0;
+	struct tcp_seg_data *data = (struct tcp_seg_data *)d;
+
+	if (data != NULL) {
+		if (data->rnd != NULL)
+			rand_close(data->rnd);
+		free(data);
+	}
 	return (NULL);
 }
 
 void *
-tcp_seg_open(int argc, char *argv[])
+tcp_seg_open(struct fragroute_s *ctx, int argc, char *argv[])
 {
+	struct tcp_seg_data *data;
+
 	if (argc < 2) {
 		warn("need segment <size> in bytes");
 		return (NULL);
 	}
-	tcp_seg_data.rnd = rand_open();
+	if ((data = calloc(1, sizeof(*data))) == NULL)
+		return (NULL);
+
+	data->rnd = rand_open();
 	
-	if ((tcp_seg_data.size = atoi(argv[1])) == 0) {
+	if ((data->size = atoi(argv[1])) == 0) {
 		warnx("invalid segment size '%s'", argv[1]);
-		return (tcp_seg_close(&tcp_seg_data));
+		return (tcp_seg_close(data));
 	}
 	if (argc == 3) {
 		if (strcmp(argv[2], "old") == 0 ||
 		    strcmp(argv[2], "win32") == 0)
-			tcp_seg_data.overlap = FAVOR_OLD;
+			data->overlap = FAVOR_OLD;
 		else if (strcmp(argv[2], "new") == 0 ||
 		    strcmp(argv[2], "unix") == 0)
-			tcp_seg_data.overlap = FAVOR_NEW;
+			data->overlap = FAVOR_NEW;
 		else
-			return (tcp_seg_close(&tcp_seg_data));
+			return (tcp_seg_close(data));
+	}
+	return (data);
+}
+
+/*
+ * Every segment is the original's headers with only the IP length/ID, the
+ * sequence number and the checksums changed.  Keep the partial sums of the
+ * unchanged parts so a segment costs one header copy plus a single pass
+ * over its payload.
+ */
+struct tcp_seg_tmpl {
+	uint16_t eth_type;
+	int	 hl;
+	int	 tl;
+	int	 ip_sum;	/* IPv4 header, ip_id/ip_len/ip_sum zeroed */
+	int	 th_sum;	/* pseudo header + TCP header, th_seq zeroed */
+};
+
+static void
+tcp_seg_tmpl_init(struct tcp_seg_tmpl *t, uint16_t eth_type, struct pkt *pkt)
+{
+	t->eth_type = eth_type;
+	t->tl = pkt->pkt_tcp->th_off << 2;
+	pkt->pkt_tcp->th_sum = pkt->pkt_tcp->th_seq = 0;
+	t->th_sum = ip_cksum_add(pkt->pkt_tcp, t->tl, 0) +
+	    htons(IP_PROTO_TCP);
+
+	if (eth_type == ETH_TYPE_IP) {
+		t->hl = pkt->pkt_ip->ip_hl << 2;
+		pkt->pkt_ip->ip_id = pkt->pkt_ip->ip_len = 0;
+		pkt->pkt_ip->ip_sum = 0;
+		t->ip_sum = ip_cksum_add(pkt->pkt_ip, t->hl, 0);
+		t->th_sum = ip_cksum_add(&pkt->pkt_ip->ip_src,
+		    IP_ADDR_LEN << 1, t->th_sum);
+	} else {
+		t->hl = IP6_HDR_LEN;
+		t->ip_sum = 0;
+		t->th_sum = ip_cksum_add(&pkt->pkt_ip6->ip6_src,
+		    IP6_ADDR_LEN << 1, t->th_sum);
 	}
-	return (&tcp_seg_data);
+}
+
+/*
+ * Finish a segment's headers; psum is the ones' complement sum of its
+ * len bytes of payload.
+ */
+static void
+tcp_seg_hdr(struct tcp_seg_tmpl *t, struct pkt *new, uint16_t ip_id,
+    uint32_t seq, int len, int psum)
+{
+	int sum;
+
+	if (t->eth_type == ETH_TYPE_IP) {
+		new->pkt_ip->ip_id = ip_id;
+		new->pkt_ip->ip_len = htons(t->hl + t->tl + len);
+		sum = t->ip_sum + new->pkt_ip->ip_id + new->pkt_ip->ip_len;
+		new->pkt_ip->ip_sum = ip_cksum_carry(sum);
+	} else {
+		new->pkt_ip6->ip6_plen = htons(t->tl + len);
+	}
+	new->pkt_tcp->th_seq = htonl(seq);
+	sum = t->th_sum + htons(t->tl + len) + psum +
+	    (new->pkt_tcp->th_seq >> 16) + (new->pkt_tcp->th_seq & 0xffff);
+	new->pkt_tcp->th_sum = ip_cksum_carry(sum);
+}
+
+static struct pkt *
+tcp_seg_new(struct tcp_seg_tmpl *t, struct pkt *pkt)
+{
+	struct pkt *new;
+
+	new = pkt_new(pkt->pkt_pool);
+	memcpy(new->pkt_eth, pkt->pkt_eth, ETH_HDR_LEN + t->hl + t->tl);
+	new->pkt_ip_data = new->pkt_eth_data + t->hl;
+	new->pkt_tcp_data = new->pkt_ip_data + t->tl;
+	return (new);
 }
 
 int
-tcp_seg_apply(void *d, struct pktq *pktq)
+tcp_seg_apply(struct fragroute_s *ctx, void *d, struct pktq *pktq)
 {
+	struct tcp_seg_data *data = (struct tcp_seg_data *)d;
 	struct pkt *pkt, *new, *next, tmp;
+	struct tcp_seg_tmpl tmpl;
 	uint32_t seq;
-	int hl, tl, len;	
+	int len, psum, psum2;
 	u_char *p, *p1, *p2;
 	uint16_t eth_type;
 	uint8_t nxt;
@@ -96,72 +181,49 @@ tcp_seg_apply(void *d, struct pktq *pktq)
 		if (nxt != IP_PROTO_TCP ||
 		    pkt->pkt_tcp == NULL || pkt->pkt_tcp_data == NULL ||
 		    (pkt->pkt_tcp->th_flags & TH_ACK) == 0 ||
-		    pkt->pkt_end - pkt->pkt_tcp_data <= tcp_seg_data.size)
+		    pkt->pkt_end - pkt->pkt_tcp_data <= data->size)
 			continue;
 		
-		if (eth_type == ETH_TYPE_IP) {
-		hl = pkt->pkt_ip->ip_hl << 2;
-		} else if (eth_type == ETH_TYPE_IPV6) {
-			hl = IP6_HDR_LEN;
-		} else {
-			continue;
-		}
-
-		tl = pkt->pkt_tcp->th_off << 2;
 		seq = ntohl(pkt->pkt_tcp->th_seq);
+		tcp_seg_tmpl_init(&tmpl, eth_type, pkt);
 	
 		for (p = pkt->pkt_tcp_data; p < pkt->pkt_end; p += len) {
-			new = pkt_new();
-			memcpy(new->pkt_eth, pkt->pkt_eth, (u_char*)pkt->pkt_eth_data - (u_char*)pkt->pkt_eth);
+			new = tcp_seg_new(&tmpl, pkt);
 			p1 = p, p2 = NULL;
-			len = MIN(pkt->pkt_end - p, tcp_seg_data.size);
+			len = MIN(pkt->pkt_end - p, data->size);
 		
-			if (tcp_seg_data.overlap != 0 &&
+			if (data->overlap != 0 &&
 			    p + (len << 1) < pkt->pkt_end) {
-				rand_strset(tcp_seg_data.rnd, tmp.pkt_buf,len);
+				rand_strset(data->rnd, tmp.pkt_buf,len);
 				
-				if (tcp_seg_data.overlap == FAVOR_OLD) {
+				if (data->overlap == FAVOR_OLD) {
 					p1 = p + len;
 					p2 = tmp.pkt_buf;
-				} else if (tcp_seg_data.overlap == FAVOR_NEW) {
+				} else if (data->overlap == FAVOR_NEW) {
 					p1 = tmp.pkt_buf;
 					p2 = p + len;
 				}
-				len = tcp_seg_data.size;
-				seq += tcp_seg_data.size;
+				len = data->size;
+				seq += data->size;
 			}
-			memcpy(new->pkt_ip, pkt->pkt_ip, hl + tl);
-			new->pkt_ip_data = new->pkt_eth_data + hl;
-			new->pkt_tcp_data = new->pkt_ip_data + tl;
-			memcpy(new->pkt_tcp_data, p1, len);
+			psum = inet_cksum_copy(new->pkt_tcp_data, p1, len);
 			new->pkt_end = new->pkt_tcp_data + len;
-			
-			if (eth_type == ETH_TYPE_IP) {
-			new->pkt_ip->ip_id = rand_uint16(tcp_seg_data.rnd);
-			new->pkt_ip->ip_len = htons(hl + tl + len);
-			} else {
-				new->pkt_ip6->ip6_plen = htons(tl + len);
-			}
-
-			new->pkt_tcp->th_seq = htonl(seq);
-			inet_checksum(eth_type, new->pkt_ip, hl + tl + len);
+			tcp_seg_hdr(&tmpl, new, rand_uint16(data->rnd), seq,
+			    len, psum);
 			TAILQ_INSERT_BEFORE(pkt, new, pkt_next);
 			
 			if (p2 != NULL) {
-				new = pkt_dup(new);
+				new = tcp_seg_new(&tmpl, pkt);
 				new->pkt_ts.tv_usec = 1;
-				if (eth_type == ETH_TYPE_IP) {
-					new->pkt_ip->ip_id = rand_uint16(tcp_seg_data.rnd);
-					new->pkt_ip->ip_len = htons(hl + tl + (len << 1));
-				} else if (eth_type == ETH_TYPE_IPV6) {
-					new->pkt_ip6->ip6_plen = htons(tl + (len << 1));
-				}
-				new->pkt_tcp->th_seq = htonl(seq - len);
 				
-				memcpy(new->pkt_tcp_data, p, len);
-				memcpy(new->pkt_tcp_data + len, p2, len);
+				psum = inet_cksum_copy(new->pkt_tcp_data, p, len);
+				psum2 = inet_cksum_copy(new->pkt_tcp_data + len,
+				    p2, len);
+				if (len & 1)
+					psum2 = inet_cksum_swap(psum2);
 				new->pkt_end = new->pkt_tcp_data + (len << 1);
-				inet_checksum(eth_type, new->pkt_ip, hl + tl + (len << 1));
+				tcp_seg_hdr(&tmpl, new, rand_uint16(data->rnd),
+				    seq - len, len << 1, psum + psum2);
 				TAILQ_INSERT_BEFORE(pkt, new, pkt_next);
 				p += len;
 			}
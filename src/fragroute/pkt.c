@@ -14,21 +14,99 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "bget.h"
 #include "pkt.h"
 
+struct pkt_chunk {
+	struct pkt_chunk	*pc_next;
+	struct pkt		 pc_pkts[];
+};
+
+static int
+pkt_pool_grow(struct pkt_pool *pool)
+{
+	struct pkt_chunk *chunk;
+	int i;
+
+	if ((chunk = malloc(sizeof(*chunk) +
+	    sizeof(struct pkt) * pool->pp_chunk)) == NULL)
+		return (-1);
+
+	chunk->pc_next = pool->pp_chunks;
+	pool->pp_chunks = chunk;
+
+	for (i = 0; i < pool->pp_chunk; i++) {
+		chunk->pc_pkts[i].pkt_pool = pool;
+		TAILQ_INSERT_TAIL(&pool->pp_free, &chunk->pc_pkts[i], pkt_next);
+	}
+	pool->pp_total += pool->pp_chunk;
+
+	return (0);
+}
+
+static struct pkt *
+pkt_pool_get(struct pkt_pool *pool)
+{
+	struct pkt *pkt;
+
+	if (TAILQ_EMPTY(&pool->pp_free) && pkt_pool_grow(pool) < 0)
+		return (NULL);
+
+	pkt = TAILQ_FIRST(&pool->pp_free);
+	TAILQ_REMOVE(&pool->pp_free, pkt, pkt_next);
+	pool->pp_used++;
+
+	return (pkt);
+}
+
+struct pkt_pool *
+pkt_pool_new(int size)
+{
+	struct pkt_pool *pool;
+
+	if ((pool = calloc(1, sizeof(*pool))) == NULL)
+		return (NULL);
+
+	TAILQ_INIT(&pool->pp_free);
+	pool->pp_chunk = size;
+
+	if (pkt_pool_grow(pool) < 0) {
+		free(pool);
+		return (NULL);
+	}
+	return (pool);
+}
+
+/* Return every packet left on pktq to the pool it came from. */
+void
+pkt_pool_recycle(struct pktq *pktq)
+{
+	struct pkt *pkt;
+
+	while ((pkt = TAILQ_FIRST(pktq)) != TAILQ_END(pktq)) {
+		TAILQ_REMOVE(pktq, pkt, pkt_next);
+		pkt_free(pkt);
+	}
+}
+
 void
-pkt_init(int size)
+pkt_pool_free(struct pkt_pool *pool)
 {
-	bectl(NULL, malloc, free, sizeof(struct pkt) * size);
+	struct pkt_chunk *chunk, *next;
+
+	for (chunk = pool->pp_chunks; chunk != NULL; chunk = next) {
+		next = chunk->pc_next;
+		free(chunk);
+	}
+	free(pool->pp_vec);
+	free(pool);
 }
 
 struct pkt *
-pkt_new(void)
+pkt_new(struct pkt_pool *pool)
 {
 	struct pkt *pkt;
 	
-	if ((pkt = bget(sizeof(*pkt))) == NULL)
+	if ((pkt = pkt_pool_get(pool)) == NULL)
 		return (NULL);
 	
 	timerclear(&pkt->pkt_ts);
@@ -50,7 +128,7 @@ pkt_dup(struct pkt *pkt)
 	struct pkt *new;
 	off_t off;
 	
-	if ((new = bget(sizeof(*new))) == NULL)
+	if ((new = pkt_pool_get(pkt->pkt_pool)) == NULL)
 		return (NULL);
 	
 	off = new->pkt_buf - pkt->pkt_buf;
@@ -243,52 +321,60 @@ pkt_decorate(struct pkt *pkt)
 void
 pkt_free(struct pkt *pkt)
 {
-	brel(pkt);
+	struct pkt_pool *pool = pkt->pkt_pool;
+
+	/* LIFO, so the next pkt_new() gets a cache-warm buffer */
+	TAILQ_INSERT_HEAD(&pool->pp_free, pkt, pkt_next);
+	pool->pp_used--;
 }
 
 void
 pktq_reverse(struct pktq *pktq)
 {
-	struct pktq tmpq;
 	struct pkt *pkt, *next;
 
-	TAILQ_INIT(&tmpq);
+	/* move every packet to the head in turn */
 	for (pkt = TAILQ_FIRST(pktq); pkt != TAILQ_END(pktq); pkt = next) {
 		next = TAILQ_NEXT(pkt, pkt_next);
-		TAILQ_INSERT_HEAD(&tmpq, pkt, pkt_next);
+		TAILQ_REMOVE(pktq, pkt, pkt_next);
+		TAILQ_INSERT_HEAD(pktq, pkt, pkt_next);
 	}
-	*pktq = tmpq;
 }
 
 void
 pktq_shuffle(rand_t *r, struct pktq *pktq)
 {
-	static struct pkt **pvbase;
-	static int pvlen;
+	struct pkt_pool *pool;
 	struct pkt *pkt;
 	int i;
 
+	if ((pkt = TAILQ_FIRST(pktq)) == TAILQ_END(pktq))
+		return;
+
+	/* the scratch vector lives in the pool so contexts don't share it */
+	pool = pkt->pkt_pool;
+
 	i = 0;
 	TAILQ_FOREACH(pkt, pktq, pkt_next) {
 		i++;
 	}
-	if (i > pvlen) {
-		pvlen = i;
-		if (pvbase == NULL)
-			pvbase = malloc(sizeof(pkt) * pvlen);
+	if (i > pool->pp_veclen) {
+		pool->pp_veclen = i;
+		if (pool->pp_vec == NULL)
+			pool->pp_vec = malloc(sizeof(pkt) * pool->pp_veclen);
 		else
-			pvbase = realloc(pvbase, sizeof(pkt) * pvlen);
+			pool->pp_vec = realloc(pool->pp_vec, sizeof(pkt) * pool->pp_veclen);
 	}
 	i = 0;
 	TAILQ_FOREACH(pkt, pktq, pkt_next) {
-		pvbase[i++] = pkt;
+		pool->pp_vec[i++] = pkt;
 	}
 	TAILQ_INIT(pktq);
 	
-	rand_shuffle(r, pvbase, i, sizeof(pkt));
+	rand_shuffle(r, pool->pp_vec, i, sizeof(pkt));
 
 	while (--i >= 0) {
-		TAILQ_INSERT_TAIL(pktq, pvbase[i], pkt_next);
+		TAILQ_INSERT_TAIL(pktq, pool->pp_vec[i], pkt_next);
 	}
 }
 
@@ -56,6 +56,7 @@ struct pkt {
 	u_char		*pkt_data;
 	u_char		*pkt_end;
 
+	struct pkt_pool	*pkt_pool;	/* pool this packet is returned to */
 	TAILQ_ENTRY(pkt) pkt_next;
 };
 #define pkt_ip		 pkt_n_hdr_u.ip
@@ -73,9 +74,28 @@ struct pkt {
 
 TAILQ_HEAD(pktq, pkt);
 
-void		 pkt_init(int size);
+/*
+ * Packet freelist.  Packets are carved out of chunks of pp_chunk packets
+ * which are only released by pkt_pool_free(), so once the pool has grown
+ * to the working set pkt_new() and pkt_free() never touch malloc().
+ */
+struct pkt_chunk;
+
+struct pkt_pool {
+	struct pktq		 pp_free;	/* packets ready for reuse */
+	struct pkt_chunk	*pp_chunks;	/* backing allocations */
+	int			 pp_chunk;	/* packets per chunk */
+	int			 pp_total;	/* packets allocated */
+	int			 pp_used;	/* packets handed out */
+	struct pkt		**pp_vec;	/* scratch for pktq_shuffle() */
+	int			 pp_veclen;
+};
+
+struct pkt_pool	*pkt_pool_new(int size);
+void		 pkt_pool_recycle(struct pktq *pktq);
+void		 pkt_pool_free(struct pkt_pool *pool);
 
-struct pkt	*pkt_new(void);
+struct pkt	*pkt_new(struct pkt_pool *pool);
 struct pkt	*pkt_dup(struct pkt *);
 void		 pkt_decorate(struct pkt *pkt);
 void		 pkt_free(struct pkt *pkt);
@@ -0,0 +1,597 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Synthetic traffic for tcpreplay: a "pcap file" named gen:<spec> is
+ * built on the fly instead of being read.  The spec is a comma separated
+ * list of:
+ *
+ *   udp | tcp              L4 protocol (udp)
+ *   ipv4 | ipv6            address family (from the addresses, else ipv4)
+ *   src=<addr>             source address, a range as a-b or a/len
+ *   dst=<addr>             destination address, same syntax
+ *   sport=<port>[-<port>]  source port range (1024-65535)
+ *   dport=<port>[-<port>]  destination port range (9)
+ *   size=<size>            frame size without FCS: n, n-m (random),
+ *                          imix (7:4:1 of 60, 590 and 1514) or a
+ *                          profile like 60:7/590:4/1514:1 (n:weight)
+ *   flows=<n>              distinct address/port tuples before repeating
+ *   count=<n>              packets per pass (GEN_DEFAULT_COUNT)
+ *   gap=<usec>             timestamp increment per packet (1)
+ *   smac=<mac>, dmac=<mac> Ethernet addresses
+ *
+ * IPv6 address ranges may only differ in the low 32 bits.
+ */
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "gen_packets.h"
+
+#define GEN_IMIX "60:7/590:4/1514:1"
+
+static int gen_parse(gen_t *gen, char *spec, u_char *src6, u_char *dst6, 
+        u_char *smac, u_char *dmac, char *errbuf);
+static int gen_parse_addr(gen_t *gen, gen_range_t *range, u_char *prefix6,
+        const char *value, char *errbuf);
+static int gen_parse_port(gen_range_t *range, const char *value);
+static int gen_parse_size(gen_t *gen, const char *value, char *errbuf);
+static void gen_template(gen_t *gen, const u_char *src6, const u_char *dst6, 
+        const u_char *smac, const u_char *dmac);
+
+/* store v in network byte order at p, which needn't be aligned */
+static inline void
+gen_put16(u_char *p, u_int16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static inline void
+gen_put32(u_char *p, u_int32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+/* host order sum of the 16 bit words of len (even) bytes at p */
+static u_int32_t
+gen_sum(const u_char *p, size_t len)
+{
+    u_int32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < len; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+    return sum;
+}
+
+static inline u_int16_t
+gen_fold(u_int32_t sum)
+{
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    return (u_int16_t)~sum;
+}
+
+/**
+ * Returns 1 if name is a generator spec rather then a pcap file
+ */
+int
+gen_is_spec(const char *name)
+{
+    assert(name);
+    return strncmp(name, GEN_PREFIX, strlen(GEN_PREFIX)) == 0;
+}
+
+/**
+ * Parses spec (including the GEN_PREFIX) and builds the templates.
+ * Returns NULL and fills out errbuf on error.
+ */
+gen_t *
+gen_open(const char *spec, char *errbuf)
+{
+    gen_t *gen;
+    char *copy;
+    u_char src6[16], dst6[16];
+    u_char smac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+    u_char dmac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x02 };
+    int i;
+
+    assert(spec);
+    assert(errbuf);
+
+    gen = (gen_t *)safe_malloc(sizeof(gen_t));
+    gen->spec = safe_strdup(spec);
+    gen->proto = IPPROTO_UDP;
+    gen->ipv6 = -1;
+    gen->count = GEN_DEFAULT_COUNT;
+    gen->gap.tv_usec = 1;
+    memset(src6, 0, sizeof(src6));
+    memset(dst6, 0, sizeof(dst6));
+
+    copy = safe_strdup(spec + strlen(GEN_PREFIX));
+    if (gen_parse(gen, copy, src6, dst6, smac, dmac, errbuf) < 0) {
+        safe_free(copy);
+        gen_close(gen);
+        return NULL;
+    }
+    safe_free(copy);
+
+    gen->l3_off = TCPR_ETH_H;
+    gen->l4_off = gen->l3_off + (gen->ipv6 ? TCPR_IPV6_H : TCPR_IPV4_H);
+    gen->hdrlen = gen->l4_off + (gen->proto == IPPROTO_TCP ? TCPR_TCP_H : TCPR_UDP_H);
+
+    /* frames can't be smaller then their headers */
+    if (gen->profile == NULL && gen->size_lo == 0)
+        gen->size_lo = gen->size_hi = 60;
+    for (i = 0; i < gen->profile_len; i++) {
+        if (gen->profile[i] < gen->hdrlen)
+            gen->profile[i] = gen->hdrlen;
+    }
+    if (gen->size_lo < gen->hdrlen)
+        gen->size_lo = gen->hdrlen;
+    if (gen->size_hi < gen->size_lo)
+        gen->size_hi = gen->size_lo;
+
+    if (gen->flows == 0) {
+        gen->flows = (COUNTER)gen->src.n * gen->dst.n;
+        if (gen->flows * gen->sport.n / gen->sport.n == gen->flows)
+            gen->flows *= gen->sport.n;
+        if (gen->flows * gen->dport.n / gen->dport.n == gen->flows)
+            gen->flows *= gen->dport.n;
+    }
+
+    gen_template(gen, src6, dst6, smac, dmac);
+    /* tcpreplay-edit rewrites the frame in place and may grow its L2 header */
+    gen->buf = (u_char *)safe_malloc(MAXPACKET);
+    gettimeofday(&gen->ts, NULL);
+    gen_rewind(gen);
+    return gen;
+}
+
+/**
+ * Splits the spec into key=value pairs and applies them, filling in the
+ * defaults for whatever is missing
+ */
+static int
+gen_parse(gen_t *gen, char *spec, u_char *src6, u_char *dst6, u_char *smac,
+        u_char *dmac, char *errbuf)
+{
+    char *token, *save = NULL, *value;
+    const char *src = NULL, *dst = NULL;
+
+    for (token = strtok_r(spec, ",", &save); token != NULL; 
+            token = strtok_r(NULL, ",", &save)) {
+        if ((value = strchr(token, '=')) != NULL)
+            *value++ = '\0';
+
+        if (strcmp(token, "udp") == 0) {
+            gen->proto = IPPROTO_UDP;
+        } else if (strcmp(token, "tcp") == 0) {
+            gen->proto = IPPROTO_TCP;
+        } else if (strcmp(token, "ipv4") == 0) {
+            gen->ipv6 = 0;
+        } else if (strcmp(token, "ipv6") == 0) {
+            gen->ipv6 = 1;
+        } else if (value == NULL) {
+            snprintf(errbuf, GEN_ERRBUF_SIZE, "Unknown generator option: %s", token);
+            return -1;
+        } else if (strcmp(token, "src") == 0) {
+            src = value;
+        } else if (strcmp(token, "dst") == 0) {
+            dst = value;
+        } else if (strcmp(token, "sport") == 0) {
+            if (gen_parse_port(&gen->sport, value) < 0)
+                goto bad_value;
+        } else if (strcmp(token, "dport") == 0) {
+            if (gen_parse_port(&gen->dport, value) < 0)
+                goto bad_value;
+        } else if (strcmp(token, "size") == 0) {
+            if (gen_parse_size(gen, value, errbuf) < 0)
+                return -1;
+        } else if (strcmp(token, "flows") == 0) {
+            if ((gen->flows = strtoull(value, NULL, 0)) == 0)
+                goto bad_value;
+        } else if (strcmp(token, "count") == 0) {
+            if ((gen->count = strtoull(value, NULL, 0)) == 0)
+                goto bad_value;
+        } else if (strcmp(token, "gap") == 0) {
+            gen->gap.tv_usec = strtoul(value, NULL, 0);
+            gen->gap.tv_sec = gen->gap.tv_usec / 1000000;
+            gen->gap.tv_usec %= 1000000;
+        } else if (strcmp(token, "smac") == 0) {
+            mac2hex(value, smac, ETHER_ADDR_LEN);
+        } else if (strcmp(token, "dmac") == 0) {
+            mac2hex(value, dmac, ETHER_ADDR_LEN);
+        } else {
+            snprintf(errbuf, GEN_ERRBUF_SIZE, "Unknown generator option: %s", token);
+            return -1;
+        }
+        continue;
+
+bad_value:
+        snprintf(errbuf, GEN_ERRBUF_SIZE, "Invalid generator %s: %s", token, value);
+        return -1;
+    }
+
+    /* the addresses decide the family unless it was given */
+    if (gen->ipv6 < 0)
+        gen->ipv6 = ((src != NULL && strchr(src, ':')) || (dst != NULL && strchr(dst, ':')));
+
+    if (gen_parse_addr(gen, &gen->src, src6, src != NULL ? src : 
+                (gen->ipv6 ? "fd00::1" : "10.0.0.1"), errbuf) < 0 ||
+            gen_parse_addr(gen, &gen->dst, dst6, dst != NULL ? dst :
+                (gen->ipv6 ? "fd00::2" : "10.0.0.2"), errbuf) < 0)
+        return -1;
+
+    if (gen->sport.n == 0)
+        gen_parse_port(&gen->sport, "1024-65535");
+    if (gen->dport.n == 0)
+        gen_parse_port(&gen->dport, "9");
+
+    return 0;
+}
+
+/**
+ * Parses a single address, a range a-b or a CIDR a/len.  For IPv6 the
+ * upper 96 bits go in prefix6 and only the low 32 may vary.
+ */
+static int
+gen_parse_addr(gen_t *gen, gen_range_t *range, u_char *prefix6, const char *value,
+        char *errbuf)
+{
+    char buf[INET6_ADDRSTRLEN * 2 + 2], *last = NULL, *sep;
+    u_char lo[16], hi[16];
+    u_int32_t low, high;
+    int af = gen->ipv6 ? AF_INET6 : AF_INET, bits = -1, addrlen = gen->ipv6 ? 16 : 4;
+
+    strlcpy(buf, value, sizeof(buf));
+    if ((sep = strchr(buf, '-')) != NULL) {
+        *sep = '\0';
+        last = sep + 1;
+    } else if ((sep = strchr(buf, '/')) != NULL) {
+        *sep = '\0';
+        bits = atoi(sep + 1);
+    }
+
+    if (inet_pton(af, buf, lo) != 1 || (last != NULL && inet_pton(af, last, hi) != 1))
+        goto bad_addr;
+    if (last == NULL)
+        memcpy(hi, lo, addrlen);
+
+    /* only the last 32 bits of an IPv6 address may vary */
+    if (memcmp(lo, hi, addrlen - 4) != 0)
+        goto bad_addr;
+    memcpy(&low, lo + addrlen - 4, 4);
+    memcpy(&high, hi + addrlen - 4, 4);
+    low = ntohl(low);
+    high = ntohl(high);
+
+    if (bits >= 0) {
+        bits -= (addrlen - 4) * 8;
+        if (bits < 1 || bits > 32)
+            goto bad_addr;
+        low &= (bits == 32) ? 0xffffffff : ~(0xffffffff >> bits);
+        high = low | ((bits == 32) ? 0 : (0xffffffff >> bits));
+    }
+    if (high < low || high - low == 0xffffffff)
+        goto bad_addr;
+
+    if (gen->ipv6)
+        memcpy(prefix6, lo, 12);
+    range->lo = low;
+    range->n = high - low + 1;
+    return 0;
+
+bad_addr:
+    snprintf(errbuf, GEN_ERRBUF_SIZE, "Invalid generator %s address: %s", 
+            gen->ipv6 ? "IPv6" : "IPv4", value);
+    return -1;
+}
+
+/**
+ * Parses a port or port range lo-hi
+ */
+static int
+gen_parse_port(gen_range_t *range, const char *value)
+{
+    unsigned long lo, hi;
+    char *end;
+
+    lo = strtoul(value, &end, 10);
+    hi = (*end == '-') ? strtoul(end + 1, &end, 10) : lo;
+    if (*end != '\0' || hi < lo || hi > 65535)
+        return -1;
+
+    range->lo = lo;
+    range->n = hi - lo + 1;
+    return 0;
+}
+
+/**
+ * Parses size=: a fixed size, a random range lo-hi, imix or a profile
+ * of size:weight pairs separated by '/'.  Profiles are expanded into a
+ * cycle which spreads each size out evenly (smooth weighted round robin).
+ */
+static int
+gen_parse_size(gen_t *gen, const char *value, char *errbuf)
+{
+    u_int32_t sizes[GEN_MAX_PROFILE], weights[GEN_MAX_PROFILE];
+    long current[GEN_MAX_PROFILE];
+    int n = 0, total = 0, i, j, best;
+    const char *p;
+    char *end;
+
+    if (strcmp(value, "imix") == 0)
+        value = GEN_IMIX;
+
+    if (strchr(value, ':') == NULL) {
+        gen->size_lo = strtoul(value, &end, 10);
+        gen->size_hi = (*end == '-') ? strtoul(end + 1, &end, 10) : gen->size_lo;
+        if (*end != '\0' || gen->size_lo == 0 || gen->size_hi < gen->size_lo ||
+                gen->size_hi > GEN_MAX_SIZE)
+            goto bad_size;
+        return 0;
+    }
+
+    for (p = value; *p != '\0' && n < GEN_MAX_PROFILE; n++) {
+        sizes[n] = strtoul(p, &end, 10);
+        if (*end != ':')
+            goto bad_size;
+        weights[n] = strtoul(end + 1, &end, 10);
+        if (sizes[n] == 0 || sizes[n] > GEN_MAX_SIZE || weights[n] == 0 || 
+                (*end != '/' && *end != '\0'))
+            goto bad_size;
+        total += weights[n];
+        if (total > GEN_MAX_PROFILE)
+            goto bad_size;
+        p = (*end == '/') ? end + 1 : end;
+    }
+
+    if (gen->profile != NULL)
+        safe_free(gen->profile);
+    gen->profile = (u_int16_t *)safe_malloc(total * sizeof(u_int16_t));
+    gen->profile_len = total;
+    memset(current, 0, sizeof(current));
+    for (i = 0; i < total; i++) {
+        best = 0;
+        for (j = 0; j < n; j++) {
+            current[j] += weights[j];
+            if (current[j] > current[best])
+                best = j;
+        }
+        current[best] -= total;
+        gen->profile[i] = sizes[best];
+    }
+    return 0;
+
+bad_size:
+    snprintf(errbuf, GEN_ERRBUF_SIZE, "Invalid generator size: %s (sizes are 1-%d bytes)",
+            value, GEN_MAX_SIZE);
+    return -1;
+}
+
+/**
+ * Builds the header template with the per packet fields (lengths, IP ID,
+ * the low 32 bits of the addresses, ports and checksums) set to zero and
+ * sums up everything else
+ */
+static void
+gen_template(gen_t *gen, const u_char *src6, const u_char *dst6, const u_char *smac,
+        const u_char *dmac)
+{
+    u_char *eth = gen->tmpl, *l3 = gen->tmpl + gen->l3_off, *l4 = gen->tmpl + gen->l4_off;
+
+    memset(gen->tmpl, 0, sizeof(gen->tmpl));
+    memcpy(eth, dmac, ETHER_ADDR_LEN);
+    memcpy(eth + ETHER_ADDR_LEN, smac, ETHER_ADDR_LEN);
+
+    if (gen->ipv6) {
+        gen_put16(eth + 12, ETHERTYPE_IP6);
+        l3[0] = 0x60;
+        l3[6] = gen->proto;
+        l3[7] = 64;
+        memcpy(l3 + 8, src6, 12);
+        memcpy(l3 + 24, dst6, 12);
+        gen->l4_sum = gen_sum(l3 + 8, 32);
+    } else {
+        gen_put16(eth + 12, ETHERTYPE_IP);
+        l3[0] = 0x45;
+        gen_put16(l3 + 6, IP_DF);
+        l3[8] = 64;
+        l3[9] = gen->proto;
+        gen->ip_sum = gen_sum(l3, TCPR_IPV4_H);
+        gen->l4_sum = 0;
+    }
+
+    if (gen->proto == IPPROTO_TCP) {
+        gen_put32(l4 + 4, 1);
+        gen_put32(l4 + 8, 1);
+        l4[12] = (TCPR_TCP_H / 4) << 4;
+        l4[13] = TH_PUSH | TH_ACK;
+        gen_put16(l4 + 14, 65535);
+        gen->l4_sum += gen_sum(l4, TCPR_TCP_H);
+    }
+    gen->l4_sum += gen->proto;
+}
+
+/**
+ * Starts a new pass: the same packets come out again, with later
+ * timestamps
+ */
+void
+gen_rewind(gen_t *gen)
+{
+    assert(gen);
+
+    gen->sent = 0;
+    gen->flow = 0;
+    gen->src.cur = gen->dst.cur = gen->sport.cur = gen->dport.cur = 0;
+    gen->profile_idx = 0;
+    gen->ip_id = 0;
+    gen->seed = 0x9e3779b9;
+}
+
+/**
+ * Builds the next packet and returns it, or NULL at the end of the pass.
+ * The packet is only valid until the next call.
+ */
+const u_char *
+gen_next_packet(gen_t *gen, struct pcap_pkthdr *pkthdr)
+{
+    u_char *l3, *l4;
+    u_int32_t size, src, dst, sum;
+    u_int16_t l3len, l4len, sport, dport;
+
+    assert(gen);
+    assert(pkthdr);
+
+    if (gen->sent == gen->count)
+        return NULL;
+
+    if (gen->profile != NULL) {
+        size = gen->profile[gen->profile_idx];
+        if (++gen->profile_idx == gen->profile_len)
+            gen->profile_idx = 0;
+    } else if (gen->size_lo == gen->size_hi) {
+        size = gen->size_lo;
+    } else {
+        /* xorshift32: cheap and the same sizes every pass */
+        gen->seed ^= gen->seed << 13;
+        gen->seed ^= gen->seed >> 17;
+        gen->seed ^= gen->seed << 5;
+        size = gen->size_lo + gen->seed % (gen->size_hi - gen->size_lo + 1);
+    }
+
+    src = gen->src.lo + gen->src.cur;
+    dst = gen->dst.lo + gen->dst.cur;
+    sport = gen->sport.lo + gen->sport.cur;
+    dport = gen->dport.lo + gen->dport.cur;
+    l3len = size - gen->l3_off;
+    l4len = size - gen->l4_off;
+
+    /* edits of the last packet (tcpreplay-edit) don't carry over */
+    memcpy(gen->buf, gen->tmpl, gen->hdrlen);
+#ifdef TCPREPLAY_EDIT
+    /* an L2 edit shifts header bytes into the payload the checksum assumes is zero */
+    memset(gen->buf + gen->hdrlen, 0, size - gen->hdrlen);
+#endif
+    l3 = gen->buf + gen->l3_off;
+    l4 = gen->buf + gen->l4_off;
+
+    if (gen->ipv6) {
+        gen_put16(l3 + 4, l4len);
+        gen_put32(l3 + 20, src);
+        gen_put32(l3 + 36, dst);
+    } else {
+        gen_put16(l3 + 2, l3len);
+        gen_put16(l3 + 4, gen->ip_id);
+        gen_put32(l3 + 12, src);
+        gen_put32(l3 + 16, dst);
+        sum = gen->ip_sum + l3len + gen->ip_id + (src >> 16) + (src & 0xffff) + 
+            (dst >> 16) + (dst & 0xffff);
+        gen_put16(l3 + 10, gen_fold(sum));
+        gen->ip_id++;
+    }
+
+    /* the payload is zeros, so only the headers count */
+    gen_put16(l4, sport);
+    gen_put16(l4 + 2, dport);
+    sum = gen->l4_sum + l4len + sport + dport + (src >> 16) + (src & 0xffff) + 
+        (dst >> 16) + (dst & 0xffff);
+    if (gen->proto == IPPROTO_TCP) {
+        gen_put16(l4 + 16, gen_fold(sum));
+    } else {
+        gen_put16(l4 + 4, l4len);
+        sum = gen_fold(sum + l4len);
+        gen_put16(l4 + 6, sum == 0 ? 0xffff : sum);
+    }
+
+    /* next flow: count through the tuples like an odometer */
+    if (++gen->flow == gen->flows) {
+        gen->flow = 0;
+        gen->src.cur = gen->dst.cur = gen->sport.cur = gen->dport.cur = 0;
+    } else if (++gen->src.cur == gen->src.n) {
+        gen->src.cur = 0;
+        if (++gen->dst.cur == gen->dst.n) {
+            gen->dst.cur = 0;
+            if (++gen->sport.cur == gen->sport.n) {
+                gen->sport.cur = 0;
+                if (++gen->dport.cur == gen->dport.n)
+                    gen->dport.cur = 0;
+            }
+        }
+    }
+
+    pkthdr->caplen = pkthdr->len = size;
+    pkthdr->ts.tv_sec = gen->ts.tv_sec;
+    pkthdr->ts.tv_usec = gen->ts.tv_usec;
+    timeradd(&gen->ts, &gen->gap, &gen->ts);
+    gen->sent++;
+    return gen->buf;
+}
+
+/**
+ * Frees the generator
+ */
+void
+gen_close(gen_t *gen)
+{
+    assert(gen);
+
+    if (gen->profile != NULL)
+        safe_free(gen->profile);
+    if (gen->buf != NULL)
+        safe_free(gen->buf);
+    safe_free(gen->spec);
+    safe_free(gen);
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
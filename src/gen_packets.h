@@ -0,0 +1,114 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __GEN_PACKETS_H__
+#define __GEN_PACKETS_H__
+
+/* 
+ * pcap file names starting with this are generator specs rather then
+ * files, e.g. "gen:udp,src=10.0.0.0/16,dport=53,size=imix"
+ */
+#define GEN_PREFIX          "gen:"
+#define GEN_ERRBUF_SIZE     256
+
+/* packets per pass through a generator unless count= says otherwise */
+#define GEN_DEFAULT_COUNT   1000000
+
+/* largest frame size= accepts: a 9000 byte MTU plus the Ethernet header */
+#define GEN_MAX_SIZE        9014
+
+/* longest size= profile, after expanding the weights */
+#define GEN_MAX_PROFILE     4096
+
+/* room for Ethernet + IPv6 + TCP */
+#define GEN_MAX_HDR         (TCPR_ETH_H + TCPR_IPV6_H + TCPR_TCP_H)
+
+/* a field which counts through lo .. lo + n - 1 */
+typedef struct {
+    u_int32_t lo;
+    u_int32_t n;
+    u_int32_t cur;              /* offset of the current value from lo */
+} gen_range_t;
+
+/*
+ * Builds Ethernet/IPv4 or IPv6/UDP or TCP packets from a header template.
+ * Only the headers are rewritten for each packet: the payload is all
+ * zeros so it never changes the checksums, and the sums of the constant
+ * header fields are computed once so each checksum only needs the fields
+ * which change from packet to packet.
+ */
+struct gen_s {
+    char *spec;
+    int ipv6;
+    int proto;                  /* IPPROTO_UDP or IPPROTO_TCP */
+    size_t l3_off, l4_off, hdrlen;
+    u_char tmpl[GEN_MAX_HDR];   /* headers, variable fields zeroed */
+    u_char *buf;                /* where packets are built */
+
+    /* addresses vary in their low 32 bits (all of them for IPv4) */
+    gen_range_t src, dst, sport, dport;
+    COUNTER flows;              /* distinct src/dst/sport/dport tuples */
+    COUNTER flow;
+
+    u_int32_t ip_sum;           /* IPv4 header sum of the constant fields */
+    u_int32_t l4_sum;           /* same for the UDP/TCP header + pseudo header */
+    u_int16_t ip_id;
+
+    /* frame sizes: a cycle through a profile or random in a range */
+    u_int16_t *profile;
+    int profile_len;
+    int profile_idx;
+    u_int32_t size_lo, size_hi;
+    u_int32_t seed;
+
+    COUNTER count;              /* packets per pass */
+    COUNTER sent;               /* packets this pass */
+    struct timeval ts, gap;
+};
+
+typedef struct gen_s gen_t;
+
+int gen_is_spec(const char *name);
+gen_t *gen_open(const char *spec, char *errbuf);
+void gen_rewind(gen_t *gen);
+const u_char *gen_next_packet(gen_t *gen, struct pcap_pkthdr *pkthdr);
+void gen_close(gen_t *gen);
+
+#endif
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
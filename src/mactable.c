@@ -0,0 +1,295 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cache friendly MAC learning table for tcpbridge.  See mactable.h
+ */
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mactable.h"
+
+#define MACTABLE_CACHELINE 64
+#define MACTABLE_MIN_BUCKETS 16
+#define MACTABLE_MAX_LOCKS 64
+
+#ifdef HAVE_LIBPTHREAD
+#define MACTABLE_LOCK(t, b, how) \
+    pthread_rwlock_##how##lock(&(t)->locks[(b) & ((t)->nlocks - 1)])
+#define MACTABLE_UNLOCK(t, b) \
+    pthread_rwlock_unlock(&(t)->locks[(b) & ((t)->nlocks - 1)])
+#else
+#define MACTABLE_LOCK(t, b, how)
+#define MACTABLE_UNLOCK(t, b)
+#endif
+
+/**
+ * Creates a table big enough for at least max_entries MAC's.  The size
+ * is rounded up to a power of 2 number of buckets.  Entries not seen for
+ * max_age seconds are aged out, or never if max_age is 0
+ */
+mactable_t *
+mactable_init(u_int32_t max_entries, u_int32_t max_age)
+{
+    mactable_t *table;
+#ifdef HAVE_LIBPTHREAD
+    u_int32_t i;
+#endif
+
+    table = (mactable_t *)safe_malloc(sizeof(mactable_t));
+    table->max_age = max_age;
+
+    table->nbuckets = MACTABLE_MIN_BUCKETS;
+    table->hashbits = 4;
+    while ((u_int64_t)table->nbuckets * MACTABLE_WAYS < max_entries) {
+        table->nbuckets <<= 1;
+        table->hashbits++;
+    }
+
+    /* everything is allocated up front, one cache line per bucket */
+    table->rawbuf = (u_char *)safe_malloc(table->nbuckets * sizeof(mactable_bucket_t) + 
+            MACTABLE_CACHELINE);
+    table->buckets = (mactable_bucket_t *)(((unsigned long)table->rawbuf + 
+                MACTABLE_CACHELINE - 1) & ~((unsigned long)MACTABLE_CACHELINE - 1));
+
+#ifdef HAVE_LIBPTHREAD
+    table->nlocks = table->nbuckets < MACTABLE_MAX_LOCKS ? table->nbuckets : MACTABLE_MAX_LOCKS;
+    table->locks = (pthread_rwlock_t *)safe_malloc(table->nlocks * sizeof(pthread_rwlock_t));
+    for (i = 0; i < table->nlocks; i++)
+        pthread_rwlock_init(&table->locks[i], NULL);
+#endif
+
+    dbgx(1, "MAC table: %u buckets of %d entries, max age %u sec",
+            table->nbuckets, MACTABLE_WAYS, table->max_age);
+
+    return table;
+}
+
+/**
+ * Fibonacci hash of the 48 bit MAC into a bucket index
+ */
+static inline u_int32_t
+mactable_hash(const mactable_t *table, const u_char *mac)
+{
+    u_int64_t key = 0;
+    int i;
+
+    for (i = 0; i < ETHER_ADDR_LEN; i++)
+        key = (key << 8) | mac[i];
+
+    return (u_int32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - table->hashbits));
+}
+
+static inline int
+mactable_expired(const mactable_t *table, const struct mactable_entry_s *entry,
+        u_int32_t now)
+{
+    return table->max_age > 0 && now > entry->last_seen && 
+        now - entry->last_seen > table->max_age;
+}
+
+/**
+ * Returns the entry for mac in bucket or NULL if it isn't there
+ */
+static inline struct mactable_entry_s *
+mactable_find(mactable_bucket_t *bucket, const u_char *mac, mactable_stats_t *stats)
+{
+    struct mactable_entry_s *entry;
+    int i;
+
+    for (i = 0; i < MACTABLE_WAYS; i++) {
+        entry = &bucket->entry[i];
+        if (stats != NULL)
+            stats->probes++;
+        if (entry->used && memcmp(entry->mac, mac, ETHER_ADDR_LEN) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/**
+ * Picks the entry to learn a new MAC into: a free one, an aged out one
+ * or the least recently seen one, in that order
+ */
+static struct mactable_entry_s *
+mactable_victim(const mactable_t *table, mactable_bucket_t *bucket, u_int32_t now,
+        mactable_stats_t *stats)
+{
+    struct mactable_entry_s *entry, *oldest = &bucket->entry[0];
+    int i;
+
+    for (i = 0; i < MACTABLE_WAYS; i++) {
+        entry = &bucket->entry[i];
+        if (! entry->used)
+            return entry;
+
+        if (mactable_expired(table, entry, now)) {
+            stats->expired++;
+            return entry;
+        }
+
+        if (entry->last_seen < oldest->last_seen)
+            oldest = entry;
+    }
+
+    dbgx(2, "MAC table bucket full, evicting " MAC_FORMAT, MAC_STR(oldest->mac));
+    stats->evicted++;
+    return oldest;
+}
+
+/**
+ * Looks up which interface the given MAC lives on, learning it as living
+ * on source if we haven't seen it (recently).  now is the current time in
+ * seconds.  Lookups of MAC's already seen this second only take a shared
+ * lock, so they don't block each other.
+ */
+u_char
+mactable_learn(mactable_t *table, const u_char *mac, u_char source, u_int32_t now,
+        mactable_stats_t *stats)
+{
+    mactable_bucket_t *bucket;
+    struct mactable_entry_s *entry;
+    u_int32_t idx;
+    u_char owner = source;
+    int fresh = 0;
+
+    assert(table);
+    assert(mac);
+    assert(stats);
+
+    idx = mactable_hash(table, mac);
+    bucket = &table->buckets[idx];
+    stats->lookups++;
+
+    MACTABLE_LOCK(table, idx, rd);
+    entry = mactable_find(bucket, mac, stats);
+    if (entry != NULL && entry->last_seen == now) {
+        owner = entry->source;
+        fresh = 1;
+    }
+    MACTABLE_UNLOCK(table, idx);
+
+    if (fresh) {
+        stats->hits++;
+        return owner;
+    }
+
+    /* need to update the timestamp or learn the MAC */
+    MACTABLE_LOCK(table, idx, wr);
+    entry = mactable_find(bucket, mac, NULL);
+    if (entry != NULL && ! mactable_expired(table, entry, now)) {
+        stats->hits++;
+        entry->last_seen = now;
+        owner = entry->source;
+    } else {
+        if (entry != NULL) {
+            stats->expired++;
+        } else {
+            entry = mactable_victim(table, bucket, now, stats);
+        }
+
+        dbgx(1, "Learned " MAC_FORMAT " on interface %d", MAC_STR(mac), source);
+        memcpy(entry->mac, mac, ETHER_ADDR_LEN);
+        entry->source = source;
+        entry->used = 1;
+        entry->last_seen = now;
+        stats->learned++;
+    }
+    MACTABLE_UNLOCK(table, idx);
+
+    return owner;
+}
+
+/**
+ * Adds the counters in src to dst
+ */
+void
+mactable_stats_add(mactable_stats_t *dst, const mactable_stats_t *src)
+{
+    assert(dst);
+    assert(src);
+
+    dst->lookups += src->lookups;
+    dst->hits += src->hits;
+    dst->learned += src->learned;
+    dst->expired += src->expired;
+    dst->evicted += src->evicted;
+    dst->probes += src->probes;
+}
+
+void
+mactable_stats_print(const mactable_t *table, const mactable_stats_t *stats)
+{
+    assert(table);
+    assert(stats);
+
+    printf("MAC table (%u entries): " COUNTER_SPEC " lookups, " COUNTER_SPEC " hits, "
+            COUNTER_SPEC " learned (" COUNTER_SPEC " aged out, " COUNTER_SPEC " evicted)\n",
+            table->nbuckets * MACTABLE_WAYS, stats->lookups, stats->hits,
+            stats->learned, stats->expired, stats->evicted);
+
+    if (stats->lookups)
+        printf("MAC table lookups compared %.2f entries on average\n",
+                (double)stats->probes / stats->lookups);
+}
+
+void
+mactable_free(mactable_t *table)
+{
+#ifdef HAVE_LIBPTHREAD
+    u_int32_t i;
+#endif
+
+    assert(table);
+
+#ifdef HAVE_LIBPTHREAD
+    for (i = 0; i < table->nlocks; i++)
+        pthread_rwlock_destroy(&table->locks[i]);
+    safe_free(table->locks);
+#endif
+    safe_free(table->rawbuf);
+    safe_free(table);
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,112 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MACTABLE_H__
+#define __MACTABLE_H__
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * Fixed size hash table which tracks which side of tcpbridge each source
+ * MAC lives on.  Each bucket is exactly one cache line holding
+ * MACTABLE_WAYS entries, and a MAC can only live in the bucket it hashes
+ * to, so a lookup never touches more than one cache line.  When a bucket
+ * is full, expired entries are reused first, then the least recently
+ * seen one is evicted.
+ */
+
+#define MACTABLE_WAYS 5
+#define MACTABLE_DEFAULT_SIZE 65536     /* entries */
+#define MACTABLE_DEFAULT_AGE 300        /* seconds */
+
+struct mactable_entry_s {
+    u_char mac[ETHER_ADDR_LEN];
+    u_char source;              /* interface we first saw the MAC on */
+    u_char used;
+    u_int32_t last_seen;        /* seconds, from the packet timestamps */
+};
+
+struct mactable_bucket_s {
+    struct mactable_entry_s entry[MACTABLE_WAYS];
+    u_int32_t pad;              /* 5 * 12 + 4 = 64 bytes */
+};
+
+typedef struct mactable_bucket_s mactable_bucket_t;
+
+/* lookup stats, kept per caller so threads don't share counters */
+struct mactable_stats_s {
+    COUNTER lookups;
+    COUNTER hits;
+    COUNTER learned;
+    COUNTER expired;            /* learned by reusing an aged out entry */
+    COUNTER evicted;            /* learned by evicting a live entry */
+    COUNTER probes;             /* entries compared across all lookups */
+};
+
+typedef struct mactable_stats_s mactable_stats_t;
+
+struct mactable_s {
+    u_char *rawbuf;
+    mactable_bucket_t *buckets; /* cache line aligned */
+    u_int32_t nbuckets;         /* always a power of 2 */
+    int hashbits;
+    u_int32_t max_age;          /* 0 to never age entries out */
+#ifdef HAVE_LIBPTHREAD
+    pthread_rwlock_t *locks;    /* striped over the buckets */
+    u_int32_t nlocks;
+#endif
+};
+
+typedef struct mactable_s mactable_t;
+
+mactable_t *mactable_init(u_int32_t max_entries, u_int32_t max_age);
+u_char mactable_learn(mactable_t *, const u_char *mac, u_char source,
+        u_int32_t now, mactable_stats_t *);
+void mactable_stats_add(mactable_stats_t *, const mactable_stats_t *);
+void mactable_stats_print(const mactable_t *, const mactable_stats_t *);
+void mactable_free(mactable_t *);
+
+#endif
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -0,0 +1,291 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Read-ahead for replaying pcap files too large for --preload-pcap: a
+ * reader thread per file parses packets into a ring well ahead of the
+ * sender and keeps asking the kernel to read ahead of itself with
+ * posix_fadvise(), so the sender only ever touches memory.
+ */
+
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+
+#include "readahead.h"
+
+#ifdef HAVE_LIBPTHREAD
+
+/*
+ * every packet is stored as a pcap_pkthdr and its pcapreader_meta_t
+ * followed by caplen bytes of data, padded so the next header is aligned.
+ * A header with this caplen (or less room than a header before the end of
+ * the buffer) means the reader skipped to the start of the buffer.
+ */
+#define READAHEAD_WRAP   0xffffffff
+#define READAHEAD_ALIGN  8
+#define READAHEAD_HDRLEN (sizeof(struct pcap_pkthdr) + sizeof(pcapreader_meta_t))
+#define READAHEAD_RECLEN(caplen) \
+    ((READAHEAD_HDRLEN + (caplen) + READAHEAD_ALIGN - 1) & ~(size_t)(READAHEAD_ALIGN - 1))
+
+/* the largest caplen current libpcap will read from a file */
+#define READAHEAD_MAX_CAPLEN 262144
+
+static void *readahead_reader(void *arg);
+static void readahead_free(readahead_t *ra);
+
+/**
+ * Starts reading pcap ahead into a ring of size bytes (rounded up to a
+ * power of two).  Unless node is NUMAMEM_ANY, the ring is allocated on
+ * that NUMA node and the reader runs there.  The caller must not touch
+ * pcap again until readahead_close().  Returns NULL if the reader can't
+ * be started.
+ */
+readahead_t *
+readahead_open(pcapreader_t *pcap, size_t size, int node)
+{
+    readahead_t *ra;
+    size_t bufsize = 4096;
+    int huge;
+
+    assert(pcap);
+
+    /* always room for two of the largest packets */
+    while (bufsize < size || bufsize < 2 * READAHEAD_RECLEN(READAHEAD_MAX_CAPLEN))
+        bufsize <<= 1;
+
+    ra = (readahead_t *)safe_malloc(sizeof(readahead_t));
+    ra->pcap = pcap;
+    ra->size = bufsize;
+    ra->node = node;
+    if (node == NUMAMEM_ANY)
+        ra->buf = (u_char *)safe_malloc(bufsize);
+    else if ((ra->buf = (u_char *)numamem_alloc(bufsize, node, &huge)) == NULL)
+        errx(-1, "Unable to allocate %zu byte read-ahead buffer: %s", bufsize, strerror(errno));
+
+    ra->fd = pcapreader_fileno(pcap);
+#ifdef HAVE_POSIX_FADVISE
+    /* fails harmlessly on pipes, e.g. stdin */
+    if (ra->fd >= 0)
+        posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (pthread_create(&ra->reader, NULL, readahead_reader, ra) != 0) {
+        warnx("Unable to start read-ahead thread: %s", strerror(errno));
+        readahead_free(ra);
+        return NULL;
+    }
+
+    return ra;
+}
+
+/**
+ * Returns the next packet and fills out pkthdr and meta, or NULL at the end
+ * of the file.  Like pcapreader_next() the data is only valid until the
+ * next call.
+ */
+const u_char *
+readahead_next(readahead_t *ra, struct pcap_pkthdr *pkthdr, pcapreader_meta_t *meta)
+{
+    size_t head, tail, off;
+    int eof, stalled = 0;
+
+    assert(ra);
+    assert(pkthdr);
+    assert(meta);
+
+    /* the sender is done with the previous packet */
+    __sync_synchronize();
+    ra->tail = tail = ra->next;
+
+    while (1) {
+        /* eof is set after the last packet, so check it first */
+        eof = ra->eof;
+        __sync_synchronize();
+        head = ra->head;
+        __sync_synchronize();
+
+        if (head != tail)
+            break;
+        if (eof)
+            return NULL;
+
+        /* the reader fell behind, every one of these may be a gap */
+        if (! stalled && ra->packets > 0) {
+            ra->stalls ++;
+            stalled = 1;
+        }
+        sched_yield();
+    }
+
+    off = tail & (ra->size - 1);
+    if (ra->size - off < READAHEAD_HDRLEN ||
+            ((struct pcap_pkthdr *)(ra->buf + off))->caplen == READAHEAD_WRAP) {
+        tail += ra->size - off;
+        off = 0;
+    }
+
+    memcpy(pkthdr, ra->buf + off, sizeof(struct pcap_pkthdr));
+    memcpy(meta, ra->buf + off + sizeof(struct pcap_pkthdr), sizeof(pcapreader_meta_t));
+    ra->next = tail + READAHEAD_RECLEN(pkthdr->caplen);
+    ra->packets ++;
+
+#ifdef __GNUC__
+    /* pull the next packet's header and start of data into the cache */
+    if (ra->next != head) {
+        off = ra->next & (ra->size - 1);
+        __builtin_prefetch(ra->buf + off, 0, 3);
+        __builtin_prefetch(ra->buf + off + 64, 0, 3);
+    }
+#endif
+
+    return ra->buf + (tail & (ra->size - 1)) + READAHEAD_HDRLEN;
+}
+
+/**
+ * Stops the reader and frees the ring.  The pcap is still open.
+ */
+void
+readahead_close(readahead_t *ra)
+{
+    assert(ra);
+
+    ra->done = 1;
+    pthread_join(ra->reader, NULL);
+
+    dbgx(1, "read-ahead: " COUNTER_SPEC " packets, " COUNTER_SPEC " stalls",
+            ra->packets, ra->stalls);
+
+    readahead_free(ra);
+}
+
+/**
+ * Frees the ring and ra itself
+ */
+static void
+readahead_free(readahead_t *ra)
+{
+    if (ra->node == NUMAMEM_ANY)
+        safe_free(ra->buf);
+    else
+        numamem_free(ra->buf, ra->size);
+    safe_free(ra);
+}
+
+/**
+ * Reader thread: copies packets from the pcap into the ring until the end
+ * of the file or readahead_close()
+ */
+static void *
+readahead_reader(void *arg)
+{
+    readahead_t *ra = (readahead_t *)arg;
+    struct pcap_pkthdr hdr;
+    pcapreader_meta_t meta;
+    const u_char *pktdata;
+    size_t head, off, needed, skip;
+    size_t bytes_read = 0, advised = 0;
+    char cpulist[256], errbuf[CPUSCHED_ERRBUF_SIZE];
+    int cpu;
+
+    /* an explicit --helper-cpus wins over the NUMA node */
+    if (cpusched_apply(&cpusched_helper, &cpu, errbuf) < 0)
+        warnx("read-ahead thread: %s", errbuf);
+    if (cpusched_helper.ncpus == 0 && ra->node != NUMAMEM_ANY &&
+            numamem_bind_node(ra->node, cpulist, sizeof(cpulist)) < 0)
+        warnx("NUMA: unable to pin the read-ahead thread to node %d", ra->node);
+
+    while (! ra->done) {
+#ifdef HAVE_POSIX_FADVISE
+        /* 
+         * keep the kernel a window ahead of us.  bytes_read only 
+         * approximates the file offset, so ask stdio where we really are.
+         */
+        if (ra->fd >= 0 && bytes_read >= advised) {
+            off_t pos = ftello(ra->pcap->fp);
+            if (pos >= 0)
+                posix_fadvise(ra->fd, pos, READAHEAD_ADVISE_WINDOW, POSIX_FADV_WILLNEED);
+            advised = bytes_read + READAHEAD_ADVISE_WINDOW / 2;
+        }
+#endif
+
+        if ((pktdata = pcapreader_next(ra->pcap, &hdr, &meta)) == NULL)
+            break;
+        bytes_read += sizeof(struct pcap_pkthdr) + hdr.caplen;
+
+        head = ra->head;
+        off = head & (ra->size - 1);
+        needed = READAHEAD_RECLEN(hdr.caplen);
+        skip = (ra->size - off < needed) ? ra->size - off : 0;
+
+        /* wait for the sender to make room */
+        while (head + skip + needed - ra->tail > ra->size) {
+            if (ra->done)
+                return NULL;
+            sched_yield();
+        }
+
+        if (skip > 0) {
+            if (skip >= READAHEAD_HDRLEN)
+                ((struct pcap_pkthdr *)(ra->buf + off))->caplen = READAHEAD_WRAP;
+            off = 0;
+        }
+
+        memcpy(ra->buf + off, &hdr, sizeof(hdr));
+        memcpy(ra->buf + off + sizeof(hdr), &meta, sizeof(meta));
+        memcpy(ra->buf + off + READAHEAD_HDRLEN, pktdata, hdr.caplen);
+
+        /* the packet must be visible before the sender sees the new head */
+        __sync_synchronize();
+        ra->head = head + skip + needed;
+    }
+
+    __sync_synchronize();
+    ra->eof = 1;
+    return NULL;
+}
+
+#endif /* HAVE_LIBPTHREAD */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
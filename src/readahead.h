@@ -0,0 +1,87 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __READAHEAD_H__
+#define __READAHEAD_H__
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+/* --readahead is in megabytes */
+#define READAHEAD_MB            (1024 * 1024)
+
+/* how far ahead of the reader to ask the kernel to start reading */
+#define READAHEAD_ADVISE_WINDOW (8 * 1024 * 1024)
+
+/*
+ * Reads a pcap file in a thread of its own, ahead of the sender, so disk
+ * stalls and page faults are absorbed by a ring of packets instead of
+ * showing up as gaps on the wire.  The reader copies each packet into buf
+ * as a pcap_pkthdr and pcapreader_meta_t followed by the data, like
+ * memring_t.  head and tail
+ * only ever grow, so the buffered bytes are head - tail and neither side
+ * needs a lock.
+ */
+struct readahead_s {
+    pcapreader_t *pcap;
+    int fd;                     /* for posix_fadvise(), -1 if unknown */
+    int node;                   /* --numa node of buf, or NUMAMEM_ANY */
+    u_char *buf;
+    size_t size;
+    volatile size_t head;       /* next byte the reader writes */
+    volatile size_t tail;       /* next byte the sender reads */
+    size_t next;                /* end of the packet the sender has now */
+    volatile int eof;
+    volatile int done;
+#ifdef HAVE_LIBPTHREAD
+    pthread_t reader;
+#endif
+    COUNTER packets;
+    COUNTER stalls;             /* times the sender found the ring empty */
+};
+
+typedef struct readahead_s readahead_t;
+
+readahead_t *readahead_open(pcapreader_t *pcap, size_t size, int node);
+const u_char *readahead_next(readahead_t *ra, struct pcap_pkthdr *pkthdr, pcapreader_meta_t *meta);
+void readahead_close(readahead_t *ra);
+
+#endif /* __READAHEAD_H__ */
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
@@ -44,6 +44,11 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "tcpreplay.h"
 
 #ifdef TCPREPLAY
@@ -70,17 +75,72 @@ extern volatile int didsig;
 extern int debug;
 #endif
 
+static void loop_offset_packet(u_char *pktdata, u_int32_t pktlen, int datalink, 
+        int undo);
+
+#ifdef TCPREPLAY_FRAGROUTE
+/* the fragments of one packet, sent with a single sendpacket_batch() */
+typedef struct {
+    u_char *buf;                /* fragments, back to back */
+    size_t bufsize;
+    const u_char **data;
+    size_t *len;
+    int count;
+    int max;
+    u_int32_t bytes;            /* total length of all the fragments */
+} frag_batch_t;
+
+static frag_batch_t frag_batch;
+
+static int fragroute_wanted(const u_char *pktdata, u_int32_t pktlen);
+static frag_batch_t *fragroute_packet(const u_char *pktdata, u_int32_t pktlen);
+static void send_fragments(sendpacket_t *sp, frag_batch_t *frags, struct pcap_pkthdr *pkthdr);
+#endif
+
+/*
+ * the train of packets the next --burst sends.  Packets which won't stay
+ * where they are until the train goes out (anything not served from the
+ * file cache, or edited by tcpedit) are copied into buf.
+ */
+typedef struct {
+    sendpacket_t *sp;
+    struct pcap_pkthdr pkthdr;  /* of the first packet */
+    const u_char *data[BURST_MAX];
+    size_t len[BURST_MAX];
+    int count;
+    int want;                   /* burst_size() when the train started */
+    COUNTER bytes;
+    int copy;
+    u_char *buf;
+    size_t bufsize;
+    size_t used;
+    int datalink;
+    int loop_offset;
+} burst_queue_t;
+
+static burst_queue_t burst_queue;
+
+static void burst_packet(burst_queue_t *queue, sendpacket_t *sp, const u_char *pktdata,
+        u_int32_t pktlen, struct pcap_pkthdr *pkthdr);
+static void burst_flush(burst_queue_t *queue);
+#ifdef TCPREPLAY_FRAGROUTE
+static void burst_fragments(burst_queue_t *queue, sendpacket_t *sp, frag_batch_t *frags,
+        struct pcap_pkthdr *pkthdr);
+#endif
+
 
 /**
  * the main loop function for tcpreplay.  This is where we figure out
  * what to do with each packet
  */
 void
-send_packets(pcap_t *pcap, int cache_file_idx)
+send_packets(pcapreader_t *pcap, int cache_file_idx)
 {
-    struct timeval last = { 0, 0 }, last_print_time = { 0, 0 }, print_delta, now;
+    struct timespec last = { 0, 0 };
+    struct timeval last_print_time = { 0, 0 }, print_delta, now;
     COUNTER packetnum = 0;
     struct pcap_pkthdr pkthdr;
+    pcapreader_meta_t meta;
     const u_char *pktdata = NULL;
     sendpacket_t *sp = options.intf1;
     u_int32_t pktlen;
@@ -90,6 +150,11 @@ send_packets(pcap_t *pcap, int cache_file_idx)
     struct pcap_pkthdr *pkthdr_ptr;
 #endif
     delta_t delta_ctx;
+    int datalink = -1, loop_offset = 0;
+    burst_queue_t *queue = NULL;
+#ifdef TCPREPLAY_FRAGROUTE
+    frag_batch_t *frags;
+#endif
 
     init_delta_time(&delta_ctx);
 
@@ -107,19 +172,49 @@ send_packets(pcap_t *pcap, int cache_file_idx)
         prev_packet = NULL;
     }
 
+    /* only offset the addresses after the first pass through the file */
+    if (options.loop_cidr != NULL && options.loop_iteration > 0) {
+        loop_offset = 1;
+        if (pcap != NULL)
+            datalink = pcapreader_datalink(pcap);
+        else if (options.gen[cache_file_idx] != NULL)
+            datalink = DLT_EN10MB;
+        else
+            datalink = options.file_cache[cache_file_idx].dlt;
+    }
+
+    if (options.burst != NULL) {
+        queue = &burst_queue;
+        queue->count = 0;
+        queue->datalink = datalink;
+        queue->loop_offset = loop_offset;
+#ifdef TCPREPLAY_EDIT
+        /* tcpedit may hand back a buffer of its own */
+        queue->copy = 1;
+#else
+        queue->copy = prev_packet == NULL || options.gen[cache_file_idx] != NULL ||
+                ! options.file_cache[cache_file_idx].cached;
+#endif
+        burst_start(options.burst);
+    }
+
 
     /* MAIN LOOP 
      * Keep sending while we have packets or until
      * we've sent enough packets
      */
-    while ((pktdata = get_next_packet(pcap, &pkthdr, cache_file_idx, prev_packet)) != NULL) {
+    while ((pktdata = get_next_packet(pcap, &pkthdr, &meta, cache_file_idx, prev_packet)) != NULL) {
         /* die? */
         if (didsig)
             break_now(0);
 
         /* stop sending based on the limit -L? */
-        if (options.limit_send > 0 && pkts_sent >= options.limit_send)
+        if (options.limit_send > 0 &&
+                pkts_sent + (queue != NULL ? queue->count : 0) >= options.limit_send) {
+            if (queue != NULL)
+                burst_flush(queue);
             return;
+        }
 
         packetnum++;
 
@@ -158,39 +253,77 @@ send_packets(pcap_t *pcap, int cache_file_idx)
         pktlen = HAVE_OPT(PKTLEN) ? pkthdr_ptr->len : pkthdr_ptr->caplen;
 #endif
 
-        /*
-         * we have to cast the ts, since OpenBSD sucks
-         * had to be special and use bpf_timeval.
-         * Only sleep if we're not in top speed mode (-t)
-         */
-        if (options.speed.mode != SPEED_TOPSPEED) {
-            if (options.sleep_mode == REPLAY_V325) {
-                do_sleep_325((struct timeval *)&pkthdr.ts, &last, pktlen, options.accurate, sp, packetnum);
-            } else {
-                do_sleep((struct timeval *)&pkthdr.ts, &last, pktlen, options.accurate, sp, packetnum, &delta_ctx);
+#ifdef TCPREPLAY_FRAGROUTE
+        /* fragroute replaces the packet with a batch of fragments */
+        frags = NULL;
+        if (options.frag_ctx != NULL && fragroute_wanted(pktdata, pktlen)) {
+            if (loop_offset)
+                loop_offset_packet((u_char *)pktdata, pktlen, datalink, 0);
+            frags = fragroute_packet(pktdata, pktlen);
+            if (loop_offset && prev_packet != NULL)
+                loop_offset_packet((u_char *)pktdata, pktlen, datalink, 1);
+            pktlen = frags->bytes;
+        }
+#endif
+
+        if (queue != NULL) {
+            /* --burst times whole trains, see burst.c */
+#ifdef TCPREPLAY_FRAGROUTE
+            if (frags != NULL)
+                burst_fragments(queue, sp, frags, &pkthdr);
+            else
+#endif
+            burst_packet(queue, sp, pktdata, pktlen, &pkthdr);
+        } else {
+            /*
+             * pace by the full resolution timestamp, pkthdr.ts is only
+             * microseconds.  Only sleep if we're not in top speed mode (-t)
+             */
+            if (options.speed.mode != SPEED_TOPSPEED) {
+                if (options.sleep_mode == REPLAY_V325) {
+                    do_sleep_325(&meta.ts, &last, pktlen, options.accurate, sp, packetnum);
+                } else {
+                    do_sleep(&meta.ts, &last, pktlen, options.accurate, sp, packetnum, &delta_ctx);
         
-                /* mark the time when we send the last packet */
-                start_delta_time(&delta_ctx);
-                dbgx(2, "Sending packet #" COUNTER_SPEC, packetnum);
+                    /* mark the time when we send the last packet */
+                    start_delta_time(&delta_ctx);
+                    dbgx(2, "Sending packet #" COUNTER_SPEC, packetnum);
+                }
             }
-        }
 
 
-        /* write packet out on network */
-        if (sendpacket(sp, pktdata, pktlen, &pkthdr) < (int)pktlen)
-            warnx("Unable to send packet: %s", sendpacket_geterr(sp));
+#ifdef TCPREPLAY_FRAGROUTE
+            if (frags != NULL) {
+                /* fragments are copies, so the loop offset is already undone */
+                send_fragments(sp, frags, &pkthdr);
+            } else {
+#endif
+            if (loop_offset)
+                loop_offset_packet((u_char *)pktdata, pktlen, datalink, 0);
+
+            /* write packet out on network */
+            if (sendpacket(sp, pktdata, pktlen, &pkthdr) < (int)pktlen)
+                warnx("Unable to send packet: %s", sendpacket_geterr(sp));
+
+            /* cached packets get resent on the next loop, so put them back */
+            if (loop_offset && prev_packet != NULL)
+                loop_offset_packet((u_char *)pktdata, pktlen, datalink, 1);
+#ifdef TCPREPLAY_FRAGROUTE
+            }
+#endif
+
+            pkts_sent ++;
+            bytes_sent += pktlen;
+        }
 
         /*
-         * track the time of the "last packet sent".  Again, because of OpenBSD
-         * we have to do a memcpy rather then assignment.
+         * track the time of the "last packet sent".
          *
          * A number of 3rd party tools generate bad timestamps which go backwards
-         * in time.  Hence, don't update the "last" unless pkthdr.ts > last
+         * in time.  Hence, don't update the "last" unless the packet's ts > last
          */
-        if (timercmp(&last, &pkthdr.ts, <))
-            memcpy(&last, &pkthdr.ts, sizeof(struct timeval));
-        pkts_sent ++;
-        bytes_sent += pktlen;
+        if (timescmp(&last, &meta.ts, <))
+            memcpy(&last, &meta.ts, sizeof(struct timespec));
 
         /* print stats during the run? */
         if (options.stats > 0) {
@@ -209,6 +342,9 @@ send_packets(pcap_t *pcap, int cache_file_idx)
         }
     } /* while */
 
+    if (queue != NULL)
+        burst_flush(queue);
+
     if (options.enable_file_cache) {
         options.file_cache[cache_file_idx].cached = TRUE;
     }
@@ -219,13 +355,15 @@ send_packets(pcap_t *pcap, int cache_file_idx)
  * what to do with each packet when processing two files a the same time
  */
 void
-send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_file_idx2)
+send_dual_packets(pcapreader_t *pcap1, int cache_file_idx1, pcapreader_t *pcap2, int cache_file_idx2)
 {
-    struct timeval last = { 0, 0 }, last_print_time = { 0, 0 }, print_delta, now;
+    struct timespec last = { 0, 0 };
+    struct timeval last_print_time = { 0, 0 }, print_delta, now;
     COUNTER packetnum = 0;
     int cache_file_idx;
-    pcap_t *pcap;
+    pcapreader_t *pcap;
     struct pcap_pkthdr pkthdr1, pkthdr2;
+    pcapreader_meta_t meta1, meta2, *meta_ptr;
     const u_char *pktdata1 = NULL, *pktdata2 = NULL, *pktdata = NULL;
     sendpacket_t *sp = options.intf1;
     u_int32_t pktlen;
@@ -233,6 +371,10 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
     packet_cache_t **prev_packet1 = NULL, **prev_packet2 = NULL, **prev_packet = NULL;
     struct pcap_pkthdr *pkthdr_ptr;
     delta_t delta_ctx;
+    int datalink = -1, loop_offset = 0;
+#ifdef TCPREPLAY_FRAGROUTE
+    frag_batch_t *frags;
+#endif
 
     init_delta_time(&delta_ctx);
 
@@ -252,9 +394,19 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
         prev_packet2 = NULL;
     }
 
+    /* 
+     * only offset the addresses after the first pass through the files.
+     * both files must have the same DLT, see replay_two_files()
+     */
+    if (options.loop_cidr != NULL && options.loop_iteration > 0) {
+        loop_offset = 1;
+        datalink = pcap1 != NULL ? pcapreader_datalink(pcap1) : 
+                options.file_cache[cache_file_idx1].dlt;
+    }
+
 
-    pktdata1 = get_next_packet(pcap1, &pkthdr1, cache_file_idx1, prev_packet1);
-    pktdata2 = get_next_packet(pcap2, &pkthdr2, cache_file_idx2, prev_packet2);
+    pktdata1 = get_next_packet(pcap1, &pkthdr1, &meta1, cache_file_idx1, prev_packet1);
+    pktdata2 = get_next_packet(pcap2, &pkthdr2, &meta2, cache_file_idx2, prev_packet2);
 
     /* MAIN LOOP 
      * Keep sending while we have packets or until
@@ -282,6 +434,7 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
             sp = options.intf2;
             pcap = pcap2;
             pkthdr_ptr = &pkthdr2;
+            meta_ptr = &meta2;
             prev_packet = prev_packet2;
             cache_file_idx = cache_file_idx2;
             pktdata = pktdata2;
@@ -290,14 +443,16 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
             sp = options.intf1;
             pcap = pcap1;
             pkthdr_ptr = &pkthdr1;
+            meta_ptr = &meta1;
             prev_packet = prev_packet1;
             cache_file_idx = cache_file_idx1;
             pktdata = pktdata1;
-        } else if (timercmp(&pkthdr1.ts, &pkthdr2.ts, <=)) {
+        } else if (timescmp(&meta1.ts, &meta2.ts, <=)) {
             /* file 1 is next */
             sp = options.intf1;
             pcap = pcap1;
             pkthdr_ptr = &pkthdr1;
+            meta_ptr = &meta1;
             prev_packet = prev_packet1;
             cache_file_idx = cache_file_idx1;
             pktdata = pktdata1;
@@ -306,6 +461,7 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
             sp = options.intf2;
             pcap = pcap2;
             pkthdr_ptr = &pkthdr2;
+            meta_ptr = &meta2;
             prev_packet = prev_packet2;
             cache_file_idx = cache_file_idx2;
             pktdata = pktdata2;
@@ -330,6 +486,19 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
         pktlen = HAVE_OPT(PKTLEN) ? pkthdr_ptr->len : pkthdr_ptr->caplen;
 #endif
 
+#ifdef TCPREPLAY_FRAGROUTE
+        /* fragroute replaces the packet with a batch of fragments */
+        frags = NULL;
+        if (options.frag_ctx != NULL && fragroute_wanted(pktdata, pktlen)) {
+            if (loop_offset)
+                loop_offset_packet((u_char *)pktdata, pktlen, datalink, 0);
+            frags = fragroute_packet(pktdata, pktlen);
+            if (loop_offset && prev_packet != NULL)
+                loop_offset_packet((u_char *)pktdata, pktlen, datalink, 1);
+            pktlen = frags->bytes;
+        }
+#endif
+
         /* do we need to print the packet via tcpdump? */
 #ifdef ENABLE_VERBOSE
         if (options.verbose)
@@ -337,15 +506,14 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
 #endif
 
         /*
-         * we have to cast the ts, since OpenBSD sucks
-         * had to be special and use bpf_timeval.
-         * Only sleep if we're not in top speed mode (-t)
+         * pace by the full resolution timestamp, pkthdr.ts is only
+         * microseconds.  Only sleep if we're not in top speed mode (-t)
          */
         if (options.speed.mode != SPEED_TOPSPEED) {
             if (options.sleep_mode == REPLAY_V325) {
-                do_sleep_325((struct timeval *)&pkthdr_ptr->ts, &last, pktlen, options.accurate, sp, packetnum);
+                do_sleep_325(&meta_ptr->ts, &last, pktlen, options.accurate, sp, packetnum);
             } else {
-                do_sleep((struct timeval *)&pkthdr_ptr->ts, &last, pktlen, options.accurate, sp, packetnum, &delta_ctx);
+                do_sleep(&meta_ptr->ts, &last, pktlen, options.accurate, sp, packetnum, &delta_ctx);
         
                 /* mark the time when we send the last packet */
                 start_delta_time(&delta_ctx);
@@ -353,19 +521,33 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
             }
         }
 
+#ifdef TCPREPLAY_FRAGROUTE
+        if (frags != NULL) {
+            send_fragments(sp, frags, pkthdr_ptr);
+        } else {
+#endif
+        if (loop_offset)
+            loop_offset_packet((u_char *)pktdata, pktlen, datalink, 0);
+
         /* write packet out on network */
         if (sendpacket(sp, pktdata, pktlen, pkthdr_ptr) < (int)pktlen)
             warnx("Unable to send packet: %s", sendpacket_geterr(sp));
 
+        /* cached packets get resent on the next loop, so put them back */
+        if (loop_offset && prev_packet != NULL)
+            loop_offset_packet((u_char *)pktdata, pktlen, datalink, 1);
+#ifdef TCPREPLAY_FRAGROUTE
+        }
+#endif
+
         /*
-         * track the time of the "last packet sent".  Again, because of OpenBSD
-         * we have to do a memcpy rather then assignment.
+         * track the time of the "last packet sent".
          *
          * A number of 3rd party tools generate bad timestamps which go backwards
-         * in time.  Hence, don't update the "last" unless pkthdr.ts > last
+         * in time.  Hence, don't update the "last" unless the packet's ts > last
          */
-        if (timercmp(&last, &pkthdr_ptr->ts, <))
-            memcpy(&last, &pkthdr_ptr->ts, sizeof(struct timeval));
+        if (timescmp(&last, &meta_ptr->ts, <))
+            memcpy(&last, &meta_ptr->ts, sizeof(struct timespec));
         pkts_sent ++;
         bytes_sent += pktlen;
 
@@ -387,9 +569,9 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
 
         /* get the next packet for this file handle depending on which we last used */
         if (sp == options.intf2) {
-            pktdata2 = get_next_packet(pcap2, &pkthdr2, cache_file_idx2, prev_packet2);
+            pktdata2 = get_next_packet(pcap2, &pkthdr2, &meta2, cache_file_idx2, prev_packet2);
         } else {
-            pktdata1 = get_next_packet(pcap1, &pkthdr1, cache_file_idx1, prev_packet1);
+            pktdata1 = get_next_packet(pcap1, &pkthdr1, &meta1, cache_file_idx1, prev_packet1);
         }
     } /* while */
 
@@ -399,7 +581,420 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
     }
 }
 
+/* one input file of send_merged_packets() */
+typedef struct {
+    pcapreader_t *pcap;
+    int file_idx;
+    packet_cache_t *cached_packet;
+    packet_cache_t **prev_packet;
+    struct pcap_pkthdr pkthdr;
+    pcapreader_meta_t meta;
+    const u_char *pktdata;
+    int datalink;
+} merge_input_t;
+
+/**
+ * Returns true if input a's packet goes before input b's: the older
+ * timestamp, or the lower file on a tie like send_dual_packets()
+ */
+static inline int
+merge_before(const merge_input_t *input, int a, int b)
+{
+    if (timescmp(&input[a].meta.ts, &input[b].meta.ts, ==))
+        return a < b;
+    return timescmp(&input[a].meta.ts, &input[b].meta.ts, <);
+}
+
+/**
+ * Restores the min-heap order of heap[0..count-1] after heap[pos] got
+ * a later timestamp
+ */
+static void
+merge_sift_down(const merge_input_t *input, int *heap, int count, int pos)
+{
+    int child, top = heap[pos];
+
+    while ((child = 2 * pos + 1) < count) {
+        if (child + 1 < count && merge_before(input, heap[child + 1], heap[child]))
+            child++;
+        if (! merge_before(input, heap[child], top))
+            break;
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = top;
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* packets in flight to each --merge-threads sender */
+#define MERGE_QUEUE_LEN 4096
 
+typedef struct {
+    struct pcap_pkthdr pkthdr;
+    const u_char *pktdata;
+    u_int32_t pktlen;
+    int datalink;
+} merge_slot_t;
+
+/*
+ * A sender thread and the single producer/single consumer queue feeding
+ * it.  Packets are preloaded, so only pointers to them are queued.
+ */
+typedef struct {
+    sendpacket_t *sp;
+    pthread_t thread;
+    int node;                   /* --numa node of sp, or NUMAMEM_ANY */
+    merge_slot_t slot[MERGE_QUEUE_LEN];
+    volatile u_int32_t head;    /* written by the merge thread */
+    volatile u_int32_t tail;    /* written by the sender */
+    volatile int done;
+    int loop_offset;
+} merge_sender_t;
+
+/**
+ * Sender thread: sends whatever the merge thread queues until told to stop
+ */
+static void *
+merge_sender_run(void *arg)
+{
+    merge_sender_t *sender = (merge_sender_t *)arg;
+    merge_slot_t *slot;
+    char cpulist[256], errbuf[CPUSCHED_ERRBUF_SIZE];
+    int cpu;
+
+    /* an explicit --sender-cpus wins over the NUMA node */
+    if (sender->node != NUMAMEM_ANY && 
+            numamem_bind_node(sender->node, cpulist, sizeof(cpulist)) < 0)
+        warnx("NUMA: unable to pin the sender for %s to node %d", sender->sp->device, sender->node);
+    if (cpusched_apply(&cpusched_sender, &cpu, errbuf) < 0)
+        warnx("sender thread for %s: %s", sender->sp->device, errbuf);
+    else if (cpu >= 0)
+        dbgx(1, "sender thread for %s on CPU %d", sender->sp->device, cpu);
+
+    while (! sender->done || sender->tail != sender->head) {
+        if (sender->tail == sender->head) {
+            sched_yield();
+            continue;
+        }
+        __sync_synchronize();
+        slot = &sender->slot[sender->tail % MERGE_QUEUE_LEN];
+
+        if (sender->loop_offset)
+            loop_offset_packet((u_char *)slot->pktdata, slot->pktlen, slot->datalink, 0);
+
+        if (sendpacket(sender->sp, slot->pktdata, slot->pktlen, &slot->pkthdr) < (int)slot->pktlen)
+            warnx("Unable to send packet: %s", sendpacket_geterr(sender->sp));
+
+        /* the packet is preloaded and gets resent on the next loop */
+        if (sender->loop_offset)
+            loop_offset_packet((u_char *)slot->pktdata, slot->pktlen, slot->datalink, 1);
+
+        __sync_synchronize();
+        sender->tail++;
+    }
+    return NULL;
+}
+
+/**
+ * Allocates a sender for sp, with --numa on sp's node
+ */
+static merge_sender_t *
+merge_sender_new(sendpacket_t *sp)
+{
+    merge_sender_t *sender;
+    int node = options.numa ? numamem_intf_node(sp->device) : NUMAMEM_ANY;
+    int huge;
+
+    if (node == NUMAMEM_ANY)
+        sender = (merge_sender_t *)safe_malloc(sizeof(merge_sender_t));
+    else if ((sender = (merge_sender_t *)numamem_alloc(sizeof(merge_sender_t), node, &huge)) == NULL)
+        errx(-1, "Unable to allocate the sender for %s: %s", sp->device, strerror(errno));
+    sender->sp = sp;
+    sender->node = node;
+    return sender;
+}
+
+/**
+ * Frees a sender from merge_sender_new() once its thread has exited
+ */
+static void
+merge_sender_free(merge_sender_t *sender)
+{
+    if (sender->node == NUMAMEM_ANY)
+        safe_free(sender);
+    else
+        numamem_free(sender, sizeof(merge_sender_t));
+}
+
+/**
+ * Queues a packet for a sender thread, waiting for room if need be
+ */
+static void
+merge_sender_put(merge_sender_t *sender, const u_char *pktdata, u_int32_t pktlen, 
+        const struct pcap_pkthdr *pkthdr, int datalink)
+{
+    merge_slot_t *slot;
+
+    while (sender->head - sender->tail == MERGE_QUEUE_LEN)
+        sched_yield();
+
+    slot = &sender->slot[sender->head % MERGE_QUEUE_LEN];
+    memcpy(&slot->pkthdr, pkthdr, sizeof(struct pcap_pkthdr));
+    slot->pktdata = pktdata;
+    slot->pktlen = pktlen;
+    slot->datalink = datalink;
+    __sync_synchronize();
+    sender->head++;
+}
+#endif /* HAVE_LIBPTHREAD */
+
+/**
+ * The main loop for --merge: replays nfiles files at once in timestamp
+ * order, keeping the next packet of each in a min-heap so picking the
+ * next one to send is O(log nfiles).  File i goes out 
+ * options.merge_intf[i % options.merge_count], or with --split-ifid the
+ * packets of pcapng interface i do.  With --merge-threads the
+ * packets are paced here and sent by a thread per interface.
+ */
+void
+send_merged_packets(pcapreader_t **pcap, int nfiles)
+{
+    struct timespec last = { 0, 0 };
+    struct timeval last_print_time = { 0, 0 }, print_delta, now;
+    COUNTER packetnum = 0;
+    merge_input_t *input, *next;
+    int *heap, count = 0, i, intf, loop_offset = 0;
+    const u_char *pktdata;
+    struct pcap_pkthdr *pkthdr_ptr;
+    pcapreader_meta_t *meta_ptr;
+    sendpacket_t *sp;
+    u_int32_t pktlen;
+    delta_t delta_ctx;
+#ifdef HAVE_LIBPTHREAD
+    merge_sender_t **senders = NULL;
+    int intf_sender[MAX_FILES];     /* --merge interface to sender thread */
+    int nsenders = 0, j;
+#endif
+#ifdef TCPREPLAY_FRAGROUTE
+    frag_batch_t *frags;
+#endif
+
+    init_delta_time(&delta_ctx);
+
+    /* register signals */
+    didsig = 0;
+    (void)signal(SIGINT, catcher);
+
+    /* only offset the addresses after the first pass through the files */
+    if (options.loop_cidr != NULL && options.loop_iteration > 0)
+        loop_offset = 1;
+
+    input = (merge_input_t *)safe_malloc(nfiles * sizeof(merge_input_t));
+    heap = (int *)safe_malloc(nfiles * sizeof(int));
+
+    for (i = 0; i < nfiles; i++) {
+        input[i].pcap = pcap[i];
+        input[i].file_idx = i;
+        input[i].prev_packet = options.enable_file_cache ? &input[i].cached_packet : NULL;
+        if (pcap[i] != NULL)
+            input[i].datalink = pcapreader_datalink(pcap[i]);
+        else if (options.gen[i] != NULL)
+            input[i].datalink = DLT_EN10MB;
+        else
+            input[i].datalink = options.file_cache[i].dlt;
+
+        input[i].pktdata = get_next_packet(pcap[i], &input[i].pkthdr, &input[i].meta, i, 
+                input[i].prev_packet);
+        if (input[i].pktdata != NULL)
+            heap[count++] = i;
+    }
+    for (i = count / 2 - 1; i >= 0; i--)
+        merge_sift_down(input, heap, count, i);
+
+#ifdef HAVE_LIBPTHREAD
+    if (options.merge_threads) {
+        /* one thread per distinct interface */
+        senders = (merge_sender_t **)safe_malloc(options.merge_count * sizeof(merge_sender_t *));
+        for (i = 0; i < options.merge_count; i++) {
+            for (j = 0; j < nsenders && senders[j]->sp != options.merge_intf[i]; j++)
+                ;
+            if (j == nsenders) {
+                senders[j] = merge_sender_new(options.merge_intf[i]);
+                senders[j]->loop_offset = loop_offset;
+                if (pthread_create(&senders[j]->thread, NULL, merge_sender_run, senders[j]) != 0)
+                    errx(-1, "Unable to start sender thread for %s", senders[j]->sp->device);
+                nsenders++;
+            }
+            intf_sender[i] = j;
+        }
+    }
+#endif
+
+    /* MAIN LOOP 
+     * Keep sending while we have packets or until
+     * we've sent enough packets
+     */
+    while (count > 0) {
+        /* die? */
+        if (didsig)
+            break_now(0);
+
+        /* stop sending based on the limit -L? */
+        if (options.limit_send > 0 && pkts_sent >= options.limit_send)
+            break;
+
+        packetnum++;
+        next = &input[heap[0]];
+        pkthdr_ptr = &next->pkthdr;
+        meta_ptr = &next->meta;
+
+        /* --split-ifid picks the interface by pcapng interface, not file */
+        intf = (options.split_ifid ? (int)(meta_ptr->ifid % options.merge_count) : 
+                next->file_idx % options.merge_count);
+        sp = options.merge_intf[intf];
+        pktdata = next->pktdata;
+
+        /* do we use the snaplen (caplen) or the "actual" packet len? */
+        pktlen = HAVE_OPT(PKTLEN) ? pkthdr_ptr->len : pkthdr_ptr->caplen;
+
+        dbgx(2, "packet " COUNTER_SPEC " file %d caplen %d", packetnum, next->file_idx, pktlen);
+
+#if defined TCPREPLAY && defined TCPREPLAY_EDIT
+        if (tcpedit_packet(tcpedit, &pkthdr_ptr, (u_char **)&pktdata, sp->cache_dir) == -1) {
+            errx(-1, "Error editing packet #" COUNTER_SPEC ": %s", packetnum, tcpedit_geterr(tcpedit));
+        }
+        pktlen = HAVE_OPT(PKTLEN) ? pkthdr_ptr->len : pkthdr_ptr->caplen;
+#endif
+
+#ifdef TCPREPLAY_FRAGROUTE
+        /* fragroute replaces the packet with a batch of fragments */
+        frags = NULL;
+        if (options.frag_ctx != NULL && fragroute_wanted(pktdata, pktlen)) {
+            if (loop_offset)
+                loop_offset_packet((u_char *)pktdata, pktlen, next->datalink, 0);
+            frags = fragroute_packet(pktdata, pktlen);
+            if (loop_offset && next->prev_packet != NULL)
+                loop_offset_packet((u_char *)pktdata, pktlen, next->datalink, 1);
+            pktlen = frags->bytes;
+        }
+#endif
+
+        /* do we need to print the packet via tcpdump? */
+#ifdef ENABLE_VERBOSE
+        if (options.verbose)
+            tcpdump_print(options.tcpdump, pkthdr_ptr, pktdata);
+#endif
+
+        /*
+         * pace by the full resolution timestamp, pkthdr.ts is only
+         * microseconds.  Only sleep if we're not in top speed mode (-t)
+         */
+        if (options.speed.mode != SPEED_TOPSPEED) {
+            if (options.sleep_mode == REPLAY_V325) {
+                do_sleep_325(&meta_ptr->ts, &last, pktlen, options.accurate, sp, packetnum);
+            } else {
+                do_sleep(&meta_ptr->ts, &last, pktlen, options.accurate, sp, packetnum, &delta_ctx);
+        
+                /* mark the time when we send the last packet */
+                start_delta_time(&delta_ctx);
+                dbgx(2, "Sending packet #" COUNTER_SPEC, packetnum);
+            }
+        }
+
+#ifdef HAVE_LIBPTHREAD
+        if (senders != NULL) {
+            merge_sender_put(senders[intf_sender[intf]], pktdata, pktlen, pkthdr_ptr, next->datalink);
+        } else {
+#endif
+#ifdef TCPREPLAY_FRAGROUTE
+        if (frags != NULL) {
+            send_fragments(sp, frags, pkthdr_ptr);
+        } else {
+#endif
+        if (loop_offset)
+            loop_offset_packet((u_char *)pktdata, pktlen, next->datalink, 0);
+
+        /* write packet out on network */
+        if (sendpacket(sp, pktdata, pktlen, pkthdr_ptr) < (int)pktlen)
+            warnx("Unable to send packet: %s", sendpacket_geterr(sp));
+
+        /* cached packets get resent on the next loop, so put them back */
+        if (loop_offset && next->prev_packet != NULL)
+            loop_offset_packet((u_char *)pktdata, pktlen, next->datalink, 1);
+#ifdef TCPREPLAY_FRAGROUTE
+        }
+#endif
+#ifdef HAVE_LIBPTHREAD
+        }
+#endif
+
+        /*
+         * track the time of the "last packet sent".
+         *
+         * A number of 3rd party tools generate bad timestamps which go backwards
+         * in time.  Hence, don't update the "last" unless the packet's ts > last
+         */
+        if (timescmp(&last, &meta_ptr->ts, <))
+            memcpy(&last, &meta_ptr->ts, sizeof(struct timespec));
+        pkts_sent ++;
+        bytes_sent += pktlen;
+
+        /* print stats during the run? */
+        if (options.stats > 0) {
+            if (gettimeofday(&now, NULL) < 0)
+                errx(-1, "gettimeofday() failed: %s",  strerror(errno));
+
+            if (! timerisset(&last_print_time)) {
+                memcpy(&last_print_time, &now, sizeof(struct timeval));
+            } else {
+                timersub(&now, &last_print_time, &print_delta);
+                if (print_delta.tv_sec >= options.stats) {
+                    packet_stats(&begin, &now, bytes_sent, pkts_sent, failed);
+                    memcpy(&last_print_time, &now, sizeof(struct timeval));
+                }
+            }
+        }
+
+        /* refill from the file we just sent from, or drop it from the heap */
+        next->pktdata = get_next_packet(next->pcap, &next->pkthdr, &next->meta, next->file_idx, 
+                next->prev_packet);
+        if (next->pktdata == NULL)
+            heap[0] = heap[--count];
+        merge_sift_down(input, heap, count, 0);
+    } /* while */
+
+#ifdef HAVE_LIBPTHREAD
+    /* let the senders drain their queues */
+    for (j = 0; j < nsenders; j++) {
+        senders[j]->done = 1;
+        pthread_join(senders[j]->thread, NULL);
+        merge_sender_free(senders[j]);
+    }
+    if (senders != NULL)
+        safe_free(senders);
+#endif
+
+    if (options.enable_file_cache) {
+        for (i = 0; i < nfiles; i++)
+            options.file_cache[i].cached = TRUE;
+    }
+    safe_free(heap);
+    safe_free(input);
+}
+
+
+
+/**
+ * Memory for the file cache, from the NUMA node of the file's interface
+ * with --numa
+ */
+static void *
+cache_alloc(int file_idx, size_t len)
+{
+    if (options.arena[file_idx] != NULL)
+        return numamem_arena_alloc(options.arena[file_idx], len);
+    return safe_malloc(len);
+}
 
 /**
  * Gets the next packet to be sent out. This will either read from the pcap file
@@ -410,8 +1005,8 @@ send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_f
  * will be updated as new entries are added (or retrieved) from the cache list.
  */
 const u_char *
-get_next_packet(pcap_t *pcap, struct pcap_pkthdr *pkthdr, int file_idx, 
-    packet_cache_t **prev_packet)
+get_next_packet(pcapreader_t *pcap, struct pcap_pkthdr *pkthdr, pcapreader_meta_t *meta,
+    int file_idx, packet_cache_t **prev_packet)
 {
     u_char *pktdata = NULL;
     u_int32_t pktlen;
@@ -419,6 +1014,16 @@ get_next_packet(pcap_t *pcap, struct pcap_pkthdr *pkthdr, int file_idx,
     /* pcap may be null in cache mode! */
     /* packet_cache_t may be null in file read mode! */
     assert(pkthdr);
+    assert(meta);
+
+    /* generated traffic is never cached, building it is cheaper */
+    if (options.gen[file_idx] != NULL) {
+        pktdata = (u_char *)gen_next_packet(options.gen[file_idx], pkthdr);
+        TIMEVAL_TO_TIMESPEC(&pkthdr->ts, &meta->ts);
+        meta->ifid = 0;
+        meta->dlt = DLT_EN10MB;
+        return pktdata;
+    }
 
     /*
      * Check if we're caching files
@@ -443,34 +1048,44 @@ get_next_packet(pcap_t *pcap, struct pcap_pkthdr *pkthdr, int file_idx,
             if (*prev_packet != NULL) {
                 pktdata = (*prev_packet)->pktdata;
                 memcpy(pkthdr, &((*prev_packet)->pkthdr), sizeof(struct pcap_pkthdr));
+                memcpy(meta, &((*prev_packet)->meta), sizeof(pcapreader_meta_t));
             }
         } else {
             /*
              * We should read the pcap file, and cache the results
              */
-            pktdata = (u_char *)pcap_next(pcap, pkthdr);
+            pktdata = (u_char *)pcapreader_next(pcap, pkthdr, meta);
             if (pktdata != NULL) {
                 if (*prev_packet == NULL) {
                     /*
                      * Create the first packet in the list
                      */
-                    *prev_packet = safe_malloc(sizeof(packet_cache_t));
+                    *prev_packet = cache_alloc(file_idx, sizeof(packet_cache_t));
                     options.file_cache[file_idx].packet_cache = *prev_packet;
+                    options.file_cache[file_idx].dlt = pcapreader_datalink(pcap);
                 } else {
                     /*
                      * Add a packet to the end of the list
                      */
-                    (*prev_packet)->next = safe_malloc(sizeof(packet_cache_t));
+                    (*prev_packet)->next = cache_alloc(file_idx, sizeof(packet_cache_t));
                     *prev_packet = (*prev_packet)->next;
                 }
 
                 if (*prev_packet != NULL) {
                     (*prev_packet)->next = NULL;
-                    pktlen = pkthdr->len;
 
-                    (*prev_packet)->pktdata = safe_malloc(pktlen);
-                    memcpy((*prev_packet)->pktdata, pktdata, pktlen);
+                    /* --pktlen sends the original length, zero padded past caplen */
+                    pktlen = pkthdr->caplen;
+                    if (HAVE_OPT(PKTLEN) && pkthdr->len > pktlen)
+                        pktlen = pkthdr->len;
+
+                    (*prev_packet)->pktdata = cache_alloc(file_idx, pktlen);
+                    memcpy((*prev_packet)->pktdata, pktdata, pkthdr->caplen);
+                    if (pktlen > pkthdr->caplen)
+                        memset((*prev_packet)->pktdata + pkthdr->caplen, 0, 
+                                pktlen - pkthdr->caplen);
                     memcpy(&((*prev_packet)->pkthdr), pkthdr, sizeof(struct pcap_pkthdr));
+                    memcpy(&((*prev_packet)->meta), meta, sizeof(pcapreader_meta_t));
                 }
             }
         }
@@ -478,13 +1093,157 @@ get_next_packet(pcap_t *pcap, struct pcap_pkthdr *pkthdr, int file_idx,
         /*
          * Read pcap file as normal
          */
-        pktdata = (u_char *)pcap_next(pcap, pkthdr);
+#ifdef HAVE_LIBPTHREAD
+        if (options.reader[file_idx] != NULL)
+            pktdata = (u_char *)readahead_next(options.reader[file_idx], pkthdr, meta);
+        else
+#endif
+        pktdata = (u_char *)pcapreader_next(pcap, pkthdr, meta);
     }
 
     /* this get's casted to a const on the way out */
     return pktdata;
 }
 
+/**
+ * Returns the new address for ip (network byte order) after offsetting
+ * it by --loop-ipstep * loop within cidr, wrapping around inside of
+ * the CIDR block.  If undo is set, reverses the offset.
+ */
+static u_int32_t
+loop_offset_ip(const tcpr_cidr_t *cidr, u_int32_t ip, int undo)
+{
+    u_int32_t hostmask, offset;
+
+    if (cidr->masklen == 0) {
+        hostmask = 0xffffffff;
+    } else {
+        hostmask = ((u_int32_t)1 << (32 - cidr->masklen)) - 1;
+    }
+
+    /* the CIDR is a power of two in size, so the mask is our modulo */
+    offset = (u_int32_t)options.loop_ipoffset & hostmask;
+    if (undo)
+        offset = -offset;
+
+    return htonl((ntohl(ip) & ~hostmask) | ((ntohl(ip) + offset) & hostmask));
+}
+
+/**
+ * Returns the new port (network byte order) after offsetting it by 
+ * --loop-portstep * loop.  Only non-privileged ports are changed and they
+ * wrap around in the range 1024-65535.  If undo is set, reverses the offset.
+ */
+static u_int16_t
+loop_offset_port(u_int16_t port, int undo)
+{
+    u_int32_t p = ntohs(port), offset = options.loop_portoffset;
+
+    if (p < 1024 || offset == 0)
+        return port;
+
+    if (undo)
+        offset = 64512 - offset;
+
+    return htons((u_int16_t)(1024 + ((p - 1024 + offset) % 64512)));
+}
+
+/**
+ * Offsets the IPv4 source/destination addresses (and TCP/UDP ports if 
+ * --loop-portstep was given) which are inside of --loop-cidr so that each
+ * pass through the pcap looks like a new set of flows.  The IPv4 and TCP/UDP
+ * checksums are incrementally updated rather then recalculated.  If undo is
+ * set, restores the packet to what it was before, which is required for 
+ * packets in the file cache since we're editing them in place.
+ */
+static void
+loop_offset_packet(u_char *pktdata, u_int32_t pktlen, int datalink, int undo)
+{
+#ifdef FORCE_ALIGN
+    /* not static: --merge-threads senders call this concurrently */
+    u_char alignbuff[MAXPACKET];
+    u_char *ipbuff = alignbuff;
+#else
+    u_char *ipbuff = pktdata;   /* get_ipv4() only copies with FORCE_ALIGN */
+#endif
+    ipv4_hdr_t *ip_hdr;
+    tcp_hdr_t *tcp_hdr;
+    udp_hdr_t *udp_hdr;
+    tcpr_cidr_t *cidr;
+    u_int16_t *sum = NULL, *ports = NULL;
+    u_int32_t oldip[2], newip[2], delta;
+    u_int16_t oldports[2], newports[2];
+    int l2len, l3len, i, changed[2] = { 0, 0 };
+
+    if ((ip_hdr = (ipv4_hdr_t *)get_ipv4(pktdata, pktlen, datalink, &ipbuff)) == NULL)
+        return;
+
+    l2len = get_l2len(pktdata, pktlen, datalink);
+
+    /* figure out which addresses are in our CIDR(s) and offset them */
+    oldip[0] = newip[0] = ip_hdr->ip_src.s_addr;
+    oldip[1] = newip[1] = ip_hdr->ip_dst.s_addr;
+    for (i = 0; i < 2; i++) {
+        for (cidr = options.loop_cidr; cidr != NULL; cidr = cidr->next) {
+            if (ip_in_cidr(cidr, oldip[i])) {
+                newip[i] = loop_offset_ip(cidr, oldip[i], undo);
+                changed[i] = 1;
+                break;
+            }
+        }
+    }
+
+    if (! (changed[0] || changed[1]))
+        return;
+
+    ip_hdr->ip_src.s_addr = newip[0];
+    ip_hdr->ip_dst.s_addr = newip[1];
+    delta = checksum_delta((u_int16_t *)oldip, (u_int16_t *)newip, sizeof(oldip));
+    checksum_adjust(&ip_hdr->ip_sum, delta);
+
+    /* 
+     * the TCP/UDP checksum covers the addresses via the pseudo header, but
+     * only the first fragment actually has the TCP/UDP header
+     */
+    l3len = ip_hdr->ip_hl << 2;
+    if ((ntohs(ip_hdr->ip_off) & IP_OFFMASK) == 0) {
+        if (ip_hdr->ip_p == IPPROTO_TCP && 
+                (u_int32_t)(l2len + l3len + TCPR_TCP_H) <= pktlen) {
+            tcp_hdr = (tcp_hdr_t *)get_layer4_v4(ip_hdr);
+            ports = &tcp_hdr->th_sport;
+            sum = &tcp_hdr->th_sum;
+        } else if (ip_hdr->ip_p == IPPROTO_UDP && 
+                (u_int32_t)(l2len + l3len + TCPR_UDP_H) <= pktlen) {
+            udp_hdr = (udp_hdr_t *)get_layer4_v4(ip_hdr);
+            ports = &udp_hdr->uh_sport;
+            /* a zero UDP checksum means none was calculated */
+            if (udp_hdr->uh_sum != 0)
+                sum = &udp_hdr->uh_sum;
+        }
+    }
+
+    if (ports != NULL && options.loop_portoffset > 0) {
+        for (i = 0; i < 2; i++) {
+            oldports[i] = ports[i];
+            newports[i] = changed[i] ? loop_offset_port(ports[i], undo) : ports[i];
+            ports[i] = newports[i];
+        }
+        delta += checksum_delta(oldports, newports, sizeof(oldports));
+    }
+
+    if (sum != NULL) {
+        checksum_adjust(sum, delta);
+        if (ip_hdr->ip_p == IPPROTO_UDP && *sum == 0)
+            *sum = 0xffff;
+    }
+
+#ifdef FORCE_ALIGN
+    /* copy the edited IP packet back if get_ipv4() had to realign it */
+    if ((u_char *)ip_hdr == ipbuff)
+        memcpy(pktdata + l2len, ipbuff, pktlen - l2len);
+#endif
+}
+
 /**
  * determines based upon the cachedata which interface the given packet 
  * should go out.  Also rewrites any layer 2 data we might need to adjust.
@@ -520,6 +1279,193 @@ cache_mode(char *cachedata, COUNTER packet_num)
     return sp;
 }
 
+#ifdef TCPREPLAY_FRAGROUTE
+/**
+ * Returns true if the edited packet is IPv4/IPv6 and so can be fragrouted
+ */
+static int
+fragroute_wanted(const u_char *pktdata, u_int32_t pktlen)
+{
+    int proto;
+
+    proto = tcpedit_l3proto(tcpedit, AFTER_PROCESS, pktdata, pktlen);
+    return (proto == ETHERTYPE_IP || proto == ETHERTYPE_IP6);
+}
+
+/**
+ * Runs the packet through fragroute and collects the fragments into
+ * frag_batch, which is reused for every packet
+ */
+static frag_batch_t *
+fragroute_packet(const u_char *pktdata, u_int32_t pktlen)
+{
+    frag_batch_t *frags = &frag_batch;
+    size_t off = 0;
+    char *p;
+    int len, i;
+
+    if (fragroute_process(options.frag_ctx, (void *)pktdata, pktlen) < 0)
+        errx(-1, "Error processing packet via fragroute: %s", options.frag_ctx->errbuf);
+
+    frags->count = 0;
+    frags->bytes = 0;
+    while (1) {
+        /* make room for one more full sized fragment */
+        if (off + MAXPACKET > frags->bufsize) {
+            frags->bufsize = frags->bufsize == 0 ? 16 * MAXPACKET : frags->bufsize * 2;
+            frags->buf = (u_char *)safe_realloc(frags->buf, frags->bufsize);
+        }
+        if (frags->count == frags->max) {
+            frags->max = frags->max == 0 ? 64 : frags->max * 2;
+            frags->data = (const u_char **)safe_realloc(frags->data, 
+                    frags->max * sizeof(*frags->data));
+            frags->len = (size_t *)safe_realloc(frags->len, frags->max * sizeof(*frags->len));
+        }
+
+        p = (char *)&frags->buf[off];
+        if ((len = fragroute_getfragment(options.frag_ctx, &p)) <= 0)
+            break;
+
+        frags->len[frags->count++] = len;
+        frags->bytes += len;
+        off += len;
+    }
+
+    /* buf may have moved while growing, so only now point at the fragments */
+    for (i = 0, off = 0; i < frags->count; i++) {
+        frags->data[i] = &frags->buf[off];
+        off += frags->len[i];
+    }
+
+    return frags;
+}
+
+/**
+ * Sends all the fragments of a packet as one batch
+ */
+static void
+send_fragments(sendpacket_t *sp, frag_batch_t *frags, struct pcap_pkthdr *pkthdr)
+{
+    int sent;
+
+    /* fragroute may have dropped the whole packet */
+    if (frags->count == 0)
+        return;
+
+    sent = sendpacket_batch(sp, frags->data, frags->len, frags->count, pkthdr);
+    if (sent < frags->count)
+        warnx("Unable to send %d of %d fragments: %s", frags->count - sent, frags->count,
+                sendpacket_geterr(sp));
+}
+#endif /* TCPREPLAY_FRAGROUTE */
+
+/**
+ * Adds a packet to the --burst train, sending the train first if the packet
+ * goes out of another interface and afterwards if that makes it long enough
+ */
+static void
+burst_packet(burst_queue_t *queue, sendpacket_t *sp, const u_char *pktdata,
+        u_int32_t pktlen, struct pcap_pkthdr *pkthdr)
+{
+    u_char *data;
+
+    if (queue->count > 0 && sp != queue->sp)
+        burst_flush(queue);
+
+    if (queue->count == 0) {
+        queue->sp = sp;
+        queue->want = burst_size(options.burst, pktlen);
+        queue->bytes = 0;
+        queue->used = 0;
+        memcpy(&queue->pkthdr, pkthdr, sizeof(struct pcap_pkthdr));
+    }
+
+    if (queue->copy) {
+        if (queue->used + pktlen > queue->bufsize) {
+            queue->bufsize = queue->bufsize == 0 ? 16 * MAXPACKET : queue->bufsize * 2;
+            if (queue->bufsize < queue->used + pktlen)
+                queue->bufsize = queue->used + pktlen;
+            queue->buf = (u_char *)safe_realloc(queue->buf, queue->bufsize);
+        }
+        data = &queue->buf[queue->used];
+        memcpy(data, pktdata, pktlen);
+        queue->used += pktlen;
+    } else {
+        data = (u_char *)pktdata;
+    }
+
+    if (queue->loop_offset)
+        loop_offset_packet(data, pktlen, queue->datalink, 0);
+
+    queue->data[queue->count] = data;
+    queue->len[queue->count] = pktlen;
+    queue->bytes += pktlen;
+
+    if (++queue->count >= queue->want)
+        burst_flush(queue);
+}
+
+/**
+ * Waits for the --burst train to be due and sends it
+ */
+static void
+burst_flush(burst_queue_t *queue)
+{
+    int sent, i;
+    size_t off;
+
+    if (queue->count == 0)
+        return;
+
+    /* buf may have moved while growing, so only now point at the copies */
+    if (queue->copy) {
+        for (i = 0, off = 0; i < queue->count; i++) {
+            queue->data[i] = &queue->buf[off];
+            off += queue->len[i];
+        }
+    }
+
+    burst_wait(options.burst);
+
+    dbgx(2, "Sending burst of %d packets", queue->count);
+    sent = sendpacket_batch(queue->sp, queue->data, queue->len, queue->count, &queue->pkthdr);
+    if (sent < queue->count)
+        warnx("Unable to send %d of %d packets: %s", queue->count - sent, queue->count,
+                sendpacket_geterr(queue->sp));
+
+    /* cached packets get resent on the next loop, so put them back */
+    if (queue->loop_offset && ! queue->copy) {
+        for (i = 0; i < queue->count; i++)
+            loop_offset_packet((u_char *)queue->data[i], queue->len[i], queue->datalink, 1);
+    }
+
+    burst_sent(options.burst, queue->count, queue->bytes);
+    pkts_sent += queue->count;
+    bytes_sent += queue->bytes;
+    queue->count = 0;
+}
+
+#ifdef TCPREPLAY_FRAGROUTE
+/**
+ * Sends the fragments of a packet as a --burst train of their own
+ */
+static void
+burst_fragments(burst_queue_t *queue, sendpacket_t *sp, frag_batch_t *frags,
+        struct pcap_pkthdr *pkthdr)
+{
+    burst_flush(queue);
+
+    if (frags->count == 0)
+        return;
+
+    burst_wait(options.burst);
+    send_fragments(sp, frags, pkthdr);
+    burst_sent(options.burst, frags->count, frags->bytes);
+    pkts_sent ++;
+    bytes_sent += frags->bytes;
+}
+#endif
+
 /*
  Local Variables:
  mode:c
@@ -33,11 +33,12 @@
 #ifndef __SEND_PACKETS_H__
 #define __SEND_PACKETS_H__
 
-void send_packets(pcap_t *pcap, int cache_file_idx);
-void send_dual_packets(pcap_t *pcap1, int cache_file_idx1, pcap_t *pcap2, int cache_file_idx2);
+void send_packets(pcapreader_t *pcap, int cache_file_idx);
+void send_dual_packets(pcapreader_t *pcap1, int cache_file_idx1, pcapreader_t *pcap2, int cache_file_idx2);
+void send_merged_packets(pcapreader_t **pcap, int nfiles);
 void *cache_mode(char *, COUNTER);
-const u_char * get_next_packet(pcap_t *pcap, struct pcap_pkthdr *pkthdr, 
-        int file_idx, packet_cache_t **prev_packet);
+const u_char * get_next_packet(pcapreader_t *pcap, struct pcap_pkthdr *pkthdr, 
+        pcapreader_meta_t *meta, int file_idx, packet_cache_t **prev_packet);
 
 #endif
 
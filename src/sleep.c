@@ -114,7 +114,7 @@ ioport_sleep(const struct timespec nap)
  * the new method as of v3.3.0
  */
 void
-do_sleep(struct timeval *time, struct timeval *last, int len, int accurate, 
+do_sleep(struct timespec *time, struct timespec *last, int len, int accurate, 
     sendpacket_t *sp, COUNTER counter, delta_t *delta_ctx)
 {
     static struct timeval didsleep = { 0, 0 };
@@ -124,7 +124,7 @@ do_sleep(struct timeval *time, struct timeval *last, int len, int accurate,
 #endif
     struct timespec adjuster = { 0, 0 };
     static struct timespec nap = { 0, 0 }, delta_time = {0, 0};
-    struct timeval nap_for, now, sleep_until;
+    struct timeval now, sleep_until;
     struct timespec nap_this_time;
     static int32_t nsec_adjuster = -1, nsec_times = -1;
     float n;
@@ -158,8 +158,8 @@ do_sleep(struct timeval *time, struct timeval *last, int len, int accurate,
         }
     }
 
-    dbgx(4, "This packet time: " TIMEVAL_FORMAT, time->tv_sec, time->tv_usec);
-    dbgx(4, "Last packet time: " TIMEVAL_FORMAT, last->tv_sec, last->tv_usec);
+    dbgx(4, "This packet time: " TIMESPEC_FORMAT, time->tv_sec, time->tv_nsec);
+    dbgx(4, "Last packet time: " TIMESPEC_FORMAT, last->tv_sec, last->tv_nsec);
 
     if (gettimeofday(&now, NULL) < 0)
         errx(-1, "Error gettimeofday: %s", strerror(errno));
@@ -187,18 +187,15 @@ do_sleep(struct timeval *time, struct timeval *last, int len, int accurate,
         /*
          * Replay packets a factor of the time they were originally sent.
          */
-        if (timerisset(last)) {
-            if (timercmp(time, last, <)) {
+        if (timesisset(last)) {
+            if (timescmp(time, last, <)) {
                 /* Packet has gone back in time!  Don't sleep and warn user */
                 warnx("Packet #" COUNTER_SPEC " has gone back in time!", counter);
                 timesclear(&nap); 
             } else {
                 /* time has increased or is the same, so handle normally */
-                timersub(time, last, &nap_for);
-                dbgx(3, "original packet delta time: " TIMEVAL_FORMAT, nap_for.tv_sec, nap_for.tv_usec);
-
-                TIMEVAL_TO_TIMESPEC(&nap_for, &nap);
-                dbgx(3, "original packet delta timv: " TIMESPEC_FORMAT, nap.tv_sec, nap.tv_nsec);
+                timessub(time, last, &nap);
+                dbgx(3, "original packet delta time: " TIMESPEC_FORMAT, nap.tv_sec, nap.tv_nsec);
                 timesdiv(&nap, options.speed.speed);
                 dbgx(3, "original packet delta/div: " TIMESPEC_FORMAT, nap.tv_sec, nap.tv_nsec);
             }
@@ -417,10 +414,10 @@ do_sleep(struct timeval *time, struct timeval *last, int len, int accurate,
  * Given the timestamp on the current packet and the last packet sent,
  * calculate the appropriate amount of time to sleep and do so.
  *
- * This is the old method from v3.2.5
+ * This is the old method from v3.2.5, which only has microsecond resolution
  */
 void
-do_sleep_325(struct timeval *time, struct timeval *last, int len, 
+do_sleep_325(struct timespec *time_ns, struct timespec *last_ns, int len, 
         int accurate, sendpacket_t *sp, COUNTER counter)
 {
     static struct timeval didsleep = { 0, 0 };
@@ -435,11 +432,16 @@ do_sleep_325(struct timeval *time, struct timeval *last, int len,
     char input[EBUF_SIZE];
     static u_int32_t send = 0;      /* remember # of packets to send btw calls */
     u_int32_t loop;
+    struct timeval time_us, last_us;
+    struct timeval *time = &time_us, *last = &last_us;
 
     /* just return if topspeed */
     if (options.speed.mode == SPEED_TOPSPEED)
         return;
 
+    TIMESPEC_TO_TIMEVAL(time, time_ns);
+    TIMESPEC_TO_TIMEVAL(last, last_ns);
+
     dbgx(3, "Last time: " TIMEVAL_FORMAT, last->tv_sec, last->tv_usec);
 
     if (gettimeofday(&now, NULL) < 0) {
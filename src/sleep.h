@@ -143,9 +143,9 @@ void ioport_sleep_init(void);
 
 void ioport_sleep(const struct timespec nap);
 
-void do_sleep(struct timeval *time, struct timeval *last, int len, 
+void do_sleep(struct timespec *time, struct timespec *last, int len, 
         int accurate, sendpacket_t *sp, COUNTER counter, delta_t *delta_ctx);
-void do_sleep_325(struct timeval *time, struct timeval *last, int len, 
+void do_sleep_325(struct timespec *time, struct timespec *last, int len, 
         int accurate, sendpacket_t *sp, COUNTER counter);
 
 #endif /* __SLEEP_H__ */
@@ -53,6 +53,7 @@
 #include "tcpbridge.h"
 #include "tcpbridge_opts.h"
 #include "bridge.h"
+#include "mactable.h"
 #include "tcpedit/tcpedit.h"
 
 #ifdef DEBUG
@@ -141,6 +142,8 @@ init(void)
     options.snaplen = 65535;
     options.promisc = 1;
     options.to_ms = 1;
+    options.mac_table_size = MACTABLE_DEFAULT_SIZE;
+    options.mac_age = MACTABLE_DEFAULT_AGE;
 
     total_bytes = 0;
 
@@ -187,6 +190,12 @@ post_args(_U_ int argc, _U_ char *argv[])
     if (HAVE_OPT(LIMIT))
         options.limit_send = OPT_VALUE_LIMIT; /* default is -1 */
 
+    if (HAVE_OPT(MAC_TABLE_SIZE))
+        options.mac_table_size = OPT_VALUE_MAC_TABLE_SIZE;
+
+    if (HAVE_OPT(MAC_AGE))
+        options.mac_age = OPT_VALUE_MAC_AGE;
+
 
     if ((intname = get_interface(intlist, OPT_ARG(INTF1))) == NULL)
         errx(-1, "Invalid interface name/alias: %s", OPT_ARG(INTF1));
@@ -243,10 +252,43 @@ post_args(_U_ int argc, _U_ char *argv[])
         memcpy(options.intf2_mac, eth_buff, ETHER_ADDR_LEN);        
     }
 
+#ifdef HAVE_NETMAP
+    if (HAVE_OPT(NETMAP))
+        options.netmap = 1;
+
+    if (HAVE_OPT(MULTIQUEUE)) {
+        options.multiqueue = 1;
+#ifdef ENABLE_VERBOSE
+        if (options.verbose)
+            err(-1, "--verbose can not be used with --multiqueue");
+#endif
+    }
+
+    if (HAVE_OPT(CPUS)) {
+        char *cpulist = safe_strdup(OPT_ARG(CPUS));
+        if (! parse_list(&options.cpus, cpulist))
+            errx(-1, "Unable to parse --cpus: %s", OPT_ARG(CPUS));
+        safe_free(cpulist);
+    }
+#endif
+
+#ifdef HAVE_TPACKET_V3
+    if (HAVE_OPT(TPACKET)) {
+        options.tpacket = 1;
+        options.block_timeout = OPT_VALUE_BLOCK_TIMEOUT;
+    }
+#endif
+
     /* 
-     * Open interfaces for sending & receiving 
+     * Open interfaces for sending & receiving.  netmap & TPACKET_V3 don't
+     * use libpcap, so we only need handles for the DLT & BPF compiler
      */
-    if ((options.pcap1 = pcap_open_live(options.intf1, options.snaplen, 
+    if (options.netmap || options.tpacket) {
+        options.pcap1 = pcap_open_dead(DLT_EN10MB, options.snaplen);
+        options.pcap2 = pcap_open_dead(DLT_EN10MB, options.snaplen);
+    }
+
+    if (options.pcap1 == NULL && (options.pcap1 = pcap_open_live(options.intf1, options.snaplen, 
                                           options.promisc, options.to_ms, ebuf)) == NULL)
         errx(-1, "Unable to open interface %s: %s", options.intf1, ebuf);
 
@@ -256,7 +298,7 @@ post_args(_U_ int argc, _U_ char *argv[])
 
 
     /* we always have to open the other pcap handle to send, but we may not listen */
-    if ((options.pcap2 = pcap_open_live(options.intf2, options.snaplen,
+    if (options.pcap2 == NULL && (options.pcap2 = pcap_open_live(options.intf2, options.snaplen,
                                           options.promisc, options.to_ms, ebuf)) == NULL)
         errx(-1, "Unable to open interface %s: %s", options.intf2, ebuf);
     
@@ -72,6 +72,15 @@ struct tcpbridge_opt_s {
     int to_ms;
     int promisc;
     int poll_timeout;
+    int netmap;         /* bridge via netmap buffer swapping */
+    int multiqueue;     /* one netmap worker thread per queue pair */
+    tcpr_list_t *cpus;  /* CPUs to pin the netmap workers to */
+    int tpacket;        /* bridge via TPACKET_V3 RX rings */
+    int block_timeout;  /* msec before the kernel retires a partial block */
+
+    /* MAC learning table */
+    u_int32_t mac_table_size;
+    u_int32_t mac_age;
 
 #ifdef ENABLE_VERBOSE
     /* tcpdump verbose printing */
@@ -37,17 +37,24 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <pcap.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
 #define __STDC_FORMAT_MACROS 1
 #include <inttypes.h>
 
-static int do_checksum_math(u_int16_t *data, int len);
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+static int do_checksum_math(const u_char *data, int len);
 
 #ifdef DEBUG
 int debug = 0;
@@ -61,8 +68,6 @@ char is_not_swapped[] = "little-endian";
 char is_swapped[] = "big-endian";
 #endif
 
-int read_packet(int fd, uint32_t len, char *fname);
-
 /*
  * Standard libpcap format.
  */
@@ -103,246 +108,741 @@ struct pcap_sf_patched_pkthdr {
  */
 #define NSEC_TCPDUMP_MAGIC      0xa1b23c4d
 
+
+/*
+ * How to read each of the magic numbers above
+ */
+static const struct {
+    uint32_t magic;
+    const char *name;
+    int swapped;
+    int patched;                /* Kuznetzov packet headers */
+    int nsec;                   /* nanosecond timestamps */
+} capinfo_magics[] = {
+    { TCPDUMP_MAGIC,                    "tcpdump",              0, 0, 0 },
+    { SWAPLONG(TCPDUMP_MAGIC),          "tcpdump/swapped",      1, 0, 0 },
+    { KUZNETZOV_TCPDUMP_MAGIC,          "Kuznetzov",            0, 1, 0 },
+    { SWAPLONG(KUZNETZOV_TCPDUMP_MAGIC), "Kuznetzov/swapped",   1, 1, 0 },
+    { FMESQUITA_TCPDUMP_MAGIC,          "Fmesquita",            0, 0, 0 },
+    { SWAPLONG(FMESQUITA_TCPDUMP_MAGIC), "Fmesquita",           1, 0, 0 },
+    { NAVTEL_TCPDUMP_MAGIC,             "Navtel",               0, 0, 1 },
+    { SWAPLONG(NAVTEL_TCPDUMP_MAGIC),   "Navtel/swapped",       1, 0, 1 },
+    { NSEC_TCPDUMP_MAGIC,               "Nsec",                 0, 0, 1 },
+    { SWAPLONG(NSEC_TCPDUMP_MAGIC),     "Nsec/swapped",         1, 0, 1 },
+    { 0, NULL, 0, 0, 0 }
+};
+
+/* pcap_pkthdr isn't the actual on-disk format for 64bit systems! */
+#define PCAP_PKTHDR_LEN         16
+
+/* largest caplen we believe when looking for a record mid-file */
+#define CAPINFO_MAX_CAPLEN      262144
+
+/* consecutive records which must parse before we trust a resync point */
+#define CAPINFO_RESYNC_DEPTH    4
+
+/* never split a file into chunks smaller than this */
+#define CAPINFO_MIN_CHUNK       (64 * 1024 * 1024)
+
+/* packet size histogram: the RFC 2819 etherStats buckets plus jumbos */
+#define CAPINFO_HIST_BUCKETS    8
+static const uint32_t capinfo_hist_max[CAPINFO_HIST_BUCKETS] = {
+    64, 127, 255, 511, 1023, 1518, 9216, 0xffffffff
+};
+static const char *capinfo_hist_name[CAPINFO_HIST_BUCKETS] = {
+    "<= 64", "65-127", "128-255", "256-511", "512-1023", "1024-1518",
+    "1519-9216", "> 9216"
+};
+
+typedef struct capinfo_stats_s {
+    uint64_t pkts;
+    uint64_t bytes;             /* original (wire) length */
+    uint64_t capbytes;          /* captured length */
+    uint64_t toobig;
+    uint64_t backwards;
+    uint64_t first_ts;          /* nsec */
+    uint64_t last_ts;
+    uint64_t gaps;
+    uint64_t gap_min;           /* nsec */
+    uint64_t gap_max;
+    uint64_t gap_sum;
+    uint64_t hist[CAPINFO_HIST_BUCKETS];
+} capinfo_stats_t;
+
+struct capinfo_file_s;
+
+/*
+ * A range of a file which is walked by one thread.  The walk begins with
+ * the record at start and stops at the first record which begins at or
+ * past end, so chunks line up exactly when every start is a real record.
+ */
+typedef struct capinfo_chunk_s {
+    struct capinfo_file_s *file;
+    int index;
+    size_t start;
+    size_t end;
+    size_t stop;                /* offset the walk actually stopped at */
+    int truncated;
+    struct timeval begin;
+    struct timeval done;
+    capinfo_stats_t stats;
+} capinfo_chunk_t;
+
+typedef struct capinfo_file_s {
+    const char *name;
+    int fd;
+    const u_char *map;
+    size_t size;
+    struct pcap_file_header fh;
+    int magic;                  /* index into capinfo_magics or -1 */
+    int swapped;
+    int pkthdrlen;
+    int nsec;
+    int supported;
+    FILE *out;                  /* per packet listing or NULL */
+    capinfo_chunk_t *chunks;
+    int nchunks;
+} capinfo_file_t;
+
+typedef struct capinfo_queue_s {
+    capinfo_chunk_t **chunks;
+    int count;
+    int next;
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_t lock;
+#endif
+} capinfo_queue_t;
+
 void
 usage(void)
 {
-    printf("pcapinfo <files>\n");
+    printf("tcpcapinfo [-s] [-j <threads>] <files>\n"
+            "  -s            Only print a summary of each file, not every packet\n"
+            "  -j <threads>  Analyse files (or with -s, chunks of files) in parallel\n");
     exit(0);
 }
 
-int
-main(int argc, char *argv[])
+/**
+ * Returns the 32bit word at p in host byte order
+ */
+static inline uint32_t
+capinfo_word(const capinfo_file_t *file, const u_char *p)
 {
-    int i, fd, swapped, pkthdrlen, ret, backwards, caplentoobig;
-    struct pcap_file_header pcap_fh;
-    struct pcap_pkthdr pcap_ph;
-    struct pcap_sf_patched_pkthdr pcap_patched_ph; /* Kuznetzov */
-    char buf[10000];
-    struct stat statinfo;
-    uint64_t pktcnt;
-    uint32_t readword;
-    int32_t last_sec, last_usec, caplen;
+    uint32_t word;
 
-    if (argc < 2)
-        usage();
+    memcpy(&word, p, sizeof(word));
+    return file->swapped ? SWAPLONG(word) : word;
+}
 
-    for (i = 1; i < argc; i++) {
-        dbgx(1, "processing:  %s\n", argv[i]);
-        if ((fd = open(argv[i], O_RDONLY)) < 0)
-            errx(-1, "Error opening file %s: %s", argv[i], strerror(errno));
+/**
+ * Opens and maps a file and reads its pcap file header
+ */
+static void
+capinfo_open(capinfo_file_t *file, const char *name)
+{
+    struct stat statinfo;
+    int i;
 
-        if (fstat(fd, &statinfo) < 0)
-            errx(-1, "Error getting file stat info %s: %s", argv[i], strerror(errno));
+    memset(file, 0, sizeof(*file));
+    file->name = name;
+    file->magic = -1;
+    file->pkthdrlen = PCAP_PKTHDR_LEN;
 
-        printf("file size   = %"PRIu64" bytes\n", (uint64_t)statinfo.st_size);
+    dbgx(1, "processing:  %s\n", name);
+    if ((file->fd = open(name, O_RDONLY)) < 0)
+        errx(-1, "Error opening file %s: %s", name, strerror(errno));
 
-        if ((ret = read(fd, &buf, sizeof(pcap_fh))) != sizeof(pcap_fh))
-            errx(-1, "File too small.  Unable to read pcap_file_header from %s", argv[i]);
+    if (fstat(file->fd, &statinfo) < 0)
+        errx(-1, "Error getting file stat info %s: %s", name, strerror(errno));
 
-        dbgx(3, "Read %d bytes for file header", ret);
+    if ((uint64_t)statinfo.st_size < sizeof(file->fh))
+        errx(-1, "File too small.  Unable to read pcap_file_header from %s", name);
 
-        swapped = 0;
+    if ((uint64_t)statinfo.st_size > (size_t)-1)
+        errx(-1, "File %s is too large to map into memory", name);
 
-        memcpy(&pcap_fh, &buf, sizeof(pcap_fh));
+    file->size = (size_t)statinfo.st_size;
+    file->map = (const u_char *)mmap(NULL, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (file->map == MAP_FAILED)
+        errx(-1, "Unable to mmap %s: %s", name, strerror(errno));
 
-        pkthdrlen = 16; /* pcap_pkthdr isn't the actual on-disk format for 64bit systems! */
+#ifdef MADV_SEQUENTIAL
+    madvise((void *)file->map, file->size, MADV_SEQUENTIAL);
+#endif
 
-        switch (pcap_fh.magic) {
-            case TCPDUMP_MAGIC:
-            printf("magic       = 0x%08"PRIx32" (tcpdump) (%s)\n", pcap_fh.magic, is_not_swapped);
-            break;
+    memcpy(&file->fh, file->map, sizeof(file->fh));
 
-            case SWAPLONG(TCPDUMP_MAGIC):
-            printf("magic       = 0x%08"PRIx32" (tcpdump/swapped) (%s)\n", pcap_fh.magic, is_swapped);
-            swapped = 1;
+    for (i = 0; capinfo_magics[i].name != NULL; i++) {
+        if (capinfo_magics[i].magic == file->fh.magic) {
+            file->magic = i;
+            file->swapped = capinfo_magics[i].swapped;
+            file->nsec = capinfo_magics[i].nsec;
+            if (capinfo_magics[i].patched)
+                file->pkthdrlen = sizeof(struct pcap_sf_patched_pkthdr);
             break;
+        }
+    }
 
-            case KUZNETZOV_TCPDUMP_MAGIC:
-            pkthdrlen = sizeof(pcap_patched_ph);
-            printf("magic       = 0x%08"PRIx32" (Kuznetzov) (%s)\n", pcap_fh.magic, is_not_swapped);
-            break;
+    if (file->swapped) {
+        file->fh.version_major = SWAPSHORT(file->fh.version_major);
+        file->fh.version_minor = SWAPSHORT(file->fh.version_minor);
+        file->fh.thiszone = SWAPLONG(file->fh.thiszone);
+        file->fh.sigfigs = SWAPLONG(file->fh.sigfigs);
+        file->fh.snaplen = SWAPLONG(file->fh.snaplen);
+        file->fh.linktype = SWAPLONG(file->fh.linktype);
+    }
 
-            case SWAPLONG(KUZNETZOV_TCPDUMP_MAGIC):
-            pkthdrlen = sizeof(pcap_patched_ph);
-            printf("magic       = 0x%08"PRIx32" (Kuznetzov/swapped) (%s)\n", pcap_fh.magic, is_swapped);
-            swapped = 1;
-            break;
+    file->supported = file->fh.version_major == 2 && file->fh.version_minor == 4;
+}
 
-            case FMESQUITA_TCPDUMP_MAGIC:
-            printf("magic       = 0x%08"PRIx32" (Fmesquita) (%s)\n", pcap_fh.magic, is_not_swapped);
-            break;
+static void
+capinfo_close(capinfo_file_t *file)
+{
+    munmap((void *)file->map, file->size);
+    close(file->fd);
+    if (file->out != NULL && file->out != stdout)
+        fclose(file->out);
+    safe_free(file->chunks);
+}
 
-            case SWAPLONG(FMESQUITA_TCPDUMP_MAGIC):
-            printf("magic       = 0x%08"PRIx32" (Fmesquita) (%s)\n", pcap_fh.magic, is_swapped);
-            swapped = 1;
-            break;
+/**
+ * Splits a file into nchunks roughly equal chunks.  Only the first chunk
+ * is known to begin with a record; the others are resynced by the thread
+ * which walks them
+ */
+static void
+capinfo_split(capinfo_file_t *file, int nchunks)
+{
+    size_t data, len;
+    int i;
+
+    file->nchunks = nchunks;
+    file->chunks = (capinfo_chunk_t *)safe_malloc(nchunks * sizeof(capinfo_chunk_t));
+
+    data = file->size - sizeof(file->fh);
+    len = data / nchunks;
+    for (i = 0; i < nchunks; i++) {
+        file->chunks[i].file = file;
+        file->chunks[i].index = i;
+        file->chunks[i].start = sizeof(file->fh) + i * len;
+        file->chunks[i].end = (i == nchunks - 1) ? file->size :
+            file->chunks[i].start + len;
+    }
+}
 
-            case NAVTEL_TCPDUMP_MAGIC:
-            printf("magic       = 0x%08"PRIx32" (Navtel) (%s)\n", pcap_fh.magic, is_not_swapped);
-            break;
+/**
+ * Could a record begin at offset off?  If so, returns its caplen in *caplen
+ */
+static int
+capinfo_plausible(const capinfo_file_t *file, size_t off, uint32_t *caplen)
+{
+    const u_char *rec;
+    uint32_t frac, len;
 
-            case SWAPLONG(NAVTEL_TCPDUMP_MAGIC):
-            printf("magic       = 0x%08"PRIx32" (Navtel/swapped) (%s)\n", pcap_fh.magic, is_swapped);
-            swapped = 1;
-            break;
+    if (off + file->pkthdrlen > file->size)
+        return 0;
 
-            case NSEC_TCPDUMP_MAGIC:
-            printf("magic       = 0x%08"PRIx32" (Nsec) (%s)\n", pcap_fh.magic, is_not_swapped);
-            break;
+    rec = file->map + off;
+    frac = capinfo_word(file, rec + 4);
+    *caplen = capinfo_word(file, rec + 8);
+    len = capinfo_word(file, rec + 12);
 
-            case SWAPLONG(NSEC_TCPDUMP_MAGIC):
-            printf("magic       = 0x%08"PRIx32" (Nsec/swapped) (%s)\n", pcap_fh.magic, is_swapped);
-            swapped = 1;
-            break;
+    if (frac >= (file->nsec ? 1000000000U : 1000000U))
+        return 0;
 
-            default:
-            printf("magic       = 0x%08"PRIx32" (unknown)\n", pcap_fh.magic);
-        }
+    if (*caplen == 0 || *caplen > len || len > CAPINFO_MAX_CAPLEN)
+        return 0;
 
-        if (swapped == 1) {
-            pcap_fh.version_major = SWAPSHORT(pcap_fh.version_major);
-            pcap_fh.version_minor = SWAPSHORT(pcap_fh.version_minor);
-            pcap_fh.thiszone = SWAPLONG(pcap_fh.thiszone);
-            pcap_fh.sigfigs = SWAPLONG(pcap_fh.sigfigs);
-            pcap_fh.snaplen = SWAPLONG(pcap_fh.snaplen);
-            pcap_fh.linktype = SWAPLONG(pcap_fh.linktype);
+    return off + file->pkthdrlen + *caplen <= file->size;
+}
+
+/**
+ * Returns the first offset in [off, end) which looks like the start of a
+ * run of records, or end if there isn't one.  A wrong guess only costs
+ * time: capinfo_stitch() re-walks any chunk which doesn't line up with
+ * the one before it
+ */
+static size_t
+capinfo_resync(const capinfo_file_t *file, size_t off, size_t end)
+{
+    size_t rec;
+    uint32_t caplen;
+    int depth;
+
+    for (; off < end; off++) {
+        rec = off;
+        for (depth = 0; depth < CAPINFO_RESYNC_DEPTH; depth++) {
+            if (! capinfo_plausible(file, rec, &caplen))
+                break;
+
+            rec += file->pkthdrlen + caplen;
+            if (rec == file->size)
+                return off;
         }
+        if (depth == CAPINFO_RESYNC_DEPTH)
+            return off;
+    }
+    return end;
+}
 
-        printf("version     = %hu.%hu\n", pcap_fh.version_major, pcap_fh.version_minor);
-        printf("thiszone    = 0x%08"PRIx32"\n", pcap_fh.thiszone);
-        printf("sigfigs     = 0x%08"PRIx32"\n", pcap_fh.sigfigs);
-        printf("snaplen     = %"PRIu32"\n", pcap_fh.snaplen);
-        printf("linktype    = 0x%08"PRIx32"\n", pcap_fh.linktype);
+/**
+ * Accounts for the gap between two timestamps, returns 1 if time went
+ * backwards
+ */
+static int
+capinfo_gap(capinfo_stats_t *stats, uint64_t prev, uint64_t ts)
+{
+    uint64_t gap;
 
-        if (pcap_fh.version_major != 2 && pcap_fh.version_minor != 4) {
-            printf("Sorry, we only support file format version 2.4\n");
-            close(fd);
-            continue;
-        }
+    if (ts < prev) {
+        stats->backwards++;
+        return 1;
+    }
+
+    gap = ts - prev;
+    if (stats->gaps == 0 || gap < stats->gap_min)
+        stats->gap_min = gap;
+    if (gap > stats->gap_max)
+        stats->gap_max = gap;
+    stats->gap_sum += gap;
+    stats->gaps++;
+    return 0;
+}
+
+/**
+ * Adds the stats of the chunk which follows dst in the file to dst
+ */
+static void
+capinfo_merge(capinfo_stats_t *dst, const capinfo_stats_t *src)
+{
+    int i;
+
+    if (src->pkts == 0)
+        return;
+
+    if (dst->pkts == 0) {
+        memcpy(dst, src, sizeof(*dst));
+        return;
+    }
+
+    /* the gap across the seam between the two chunks */
+    capinfo_gap(dst, dst->last_ts, src->first_ts);
+
+    if (src->gaps > 0) {
+        if (dst->gaps == 0 || src->gap_min < dst->gap_min)
+            dst->gap_min = src->gap_min;
+        if (src->gap_max > dst->gap_max)
+            dst->gap_max = src->gap_max;
+        dst->gap_sum += src->gap_sum;
+        dst->gaps += src->gaps;
+    }
+
+    dst->pkts += src->pkts;
+    dst->bytes += src->bytes;
+    dst->capbytes += src->capbytes;
+    dst->toobig += src->toobig;
+    dst->backwards += src->backwards;
+    dst->last_ts = src->last_ts;
+    for (i = 0; i < CAPINFO_HIST_BUCKETS; i++)
+        dst->hist[i] += src->hist[i];
+}
+
+/**
+ * Prints one line of the per packet listing
+ */
+static void
+capinfo_print_packet(const capinfo_file_t *file, const u_char *rec, uint64_t pktcnt,
+        int backwards, int toobig)
+{
+    uint32_t sec, frac, caplen, len, index;
+    uint16_t protocol;
+
+    sec = capinfo_word(file, rec);
+    frac = capinfo_word(file, rec + 4);
+    caplen = capinfo_word(file, rec + 8);
+    len = capinfo_word(file, rec + 12);
+
+    if (file->pkthdrlen == sizeof(struct pcap_sf_patched_pkthdr)) {
+        index = capinfo_word(file, rec + 16);
+        memcpy(&protocol, rec + 20, sizeof(protocol));
+        if (file->swapped)
+            protocol = SWAPSHORT(protocol);
+        fprintf(file->out, "%"PRIu64"\t%4"PRIu32"\t\t%4"PRIu32"\t\t%"
+                PRIx32".%"PRIx32"\t\t%4"PRIu32"\t%4hu\t%4hhu",
+                pktcnt, len, caplen, sec, frac, index, protocol, rec[22]);
+    } else {
+        fprintf(file->out, "%"PRIu64"\t%4"PRIu32"\t\t%4"PRIu32"\t\t%"
+                PRIx32".%"PRIx32,
+                pktcnt, len, caplen, sec, frac);
+    }
 
-        dbgx(5, "Packet header len: %d", pkthdrlen);
+    /* print the frame checksum */
+    fprintf(file->out, "\t%x\t", do_checksum_math(rec + file->pkthdrlen, caplen));
+
+    /* print the Note */
+    if (! backwards && ! toobig) {
+        fprintf(file->out, "OK\n");
+    } else if (backwards && ! toobig) {
+        fprintf(file->out, "BAD_TS\n");
+    } else if (toobig && ! backwards) {
+        fprintf(file->out, "TOOBIG\n");
+    } else {
+        fprintf(file->out, "BAD_TS|TOOBIG\n");
+    }
+}
 
-        if (pkthdrlen == 24) {
-            printf("Packet\tOrigLen\t\tCaplen\t\tTimestamp\t\tIndex\tProto\tPktType\tPktCsum\tNote\n");
-        } else {
-            printf("Packet\tOrigLen\t\tCaplen\t\tTimestamp\tCsum\tNote\n");
+/**
+ * Walks every record of a chunk straight out of the mapped file
+ */
+static void
+capinfo_walk(capinfo_chunk_t *chunk)
+{
+    const capinfo_file_t *file = chunk->file;
+    capinfo_stats_t *stats = &chunk->stats;
+    const u_char *rec;
+    size_t off;
+    uint32_t caplen, len;
+    uint64_t ts;
+    int backwards, toobig, i;
+
+    memset(stats, 0, sizeof(*stats));
+    chunk->truncated = 0;
+    gettimeofday(&chunk->begin, NULL);
+
+    for (off = chunk->start; off < chunk->end; off += file->pkthdrlen + caplen) {
+        if (off + file->pkthdrlen > file->size) {
+            chunk->truncated = 1;
+            break;
         }
 
-        pktcnt = 0;
-        last_sec = 0;
-        last_usec = 0;
-        while ((ret = read(fd, &buf, pkthdrlen)) == pkthdrlen) {
-            pktcnt ++;
-            backwards = 0;
-            caplentoobig = 0;
-            dbgx(3, "Read %d bytes for packet %"PRIu64" header", ret, pktcnt);
-
-            /* see what packet header we're using */
-            if (pkthdrlen == sizeof(pcap_patched_ph)) {
-                memcpy(&pcap_patched_ph, &buf, sizeof(pcap_patched_ph));
-
-                if (swapped == 1) {
-                    dbg(3, "Swapping packet header bytes...");
-                    pcap_patched_ph.caplen = SWAPLONG(pcap_ph.caplen);
-                    pcap_patched_ph.len = SWAPLONG(pcap_ph.len);
-                    pcap_patched_ph.ts.tv_sec = SWAPLONG(pcap_patched_ph.ts.tv_sec);
-                    pcap_patched_ph.ts.tv_usec = SWAPLONG(pcap_patched_ph.ts.tv_usec);
-                    pcap_patched_ph.index = SWAPLONG(pcap_patched_ph.index);
-                    pcap_patched_ph.protocol = SWAPSHORT(pcap_patched_ph.protocol);
-                }
-                printf("%"PRIu64"\t%4"PRIu32"\t\t%4"PRIu32"\t\t%"
-                        PRIx32".%"PRIx32"\t\t%4"PRIu32"\t%4hu\t%4hhu", 
-                        pktcnt, pcap_patched_ph.len, pcap_patched_ph.caplen, 
-                        pcap_patched_ph.ts.tv_sec, pcap_patched_ph.ts.tv_usec,
-                        pcap_patched_ph.index, pcap_patched_ph.protocol, pcap_patched_ph.pkt_type);
-
-                if (pcap_fh.snaplen < pcap_patched_ph.caplen) {
-                    caplentoobig = 1;
-                }
-
-                caplen = pcap_patched_ph.caplen;
-
-            } else {
-                /* manually map on-disk bytes to our memory structure */
-                memcpy(&readword, buf, 4);
-                pcap_ph.ts.tv_sec = readword;
-                memcpy(&readword, &buf[4], 4);
-                pcap_ph.ts.tv_usec = readword;
-                memcpy(&pcap_ph.caplen, &buf[8], 4);
-                memcpy(&pcap_ph.len, &buf[12], 4);
-
-                if (swapped == 1) {
-                    dbg(3, "Swapping packet header bytes...");
-                    pcap_ph.caplen = SWAPLONG(pcap_ph.caplen);
-                    pcap_ph.len = SWAPLONG(pcap_ph.len);
-                    pcap_ph.ts.tv_sec = SWAPLONG(pcap_ph.ts.tv_sec);
-                    pcap_ph.ts.tv_usec = SWAPLONG(pcap_ph.ts.tv_usec);
-                }
-                printf("%"PRIu64"\t%4"PRIu32"\t\t%4"PRIu32"\t\t%"
-                        PRIx32".%"PRIx32,
-                        pktcnt, pcap_ph.len, pcap_ph.caplen, 
-                        pcap_ph.ts.tv_sec, pcap_ph.ts.tv_usec);
-                if (pcap_fh.snaplen < pcap_ph.caplen) {
-                    caplentoobig = 1;
-                }
-                caplen = pcap_ph.caplen;
-            }
+        rec = file->map + off;
+        caplen = capinfo_word(file, rec + 8);
+        len = capinfo_word(file, rec + 12);
+        if (caplen > file->size - off - file->pkthdrlen) {
+            chunk->truncated = 1;
+            break;
+        }
 
-            /* check to make sure timestamps don't go backwards */
-            if (last_sec > 0 && last_usec > 0) {
-                if ((pcap_ph.ts.tv_sec == last_sec) ? 
-                        (pcap_ph.ts.tv_usec < last_usec) : 
-                        (pcap_ph.ts.tv_sec < last_sec)) {
-                    backwards = 1;
-                }
-            }
-            if (pkthdrlen == sizeof(pcap_patched_ph)) {
-                last_sec = pcap_patched_ph.ts.tv_sec;
-                last_usec = pcap_patched_ph.ts.tv_usec;
-            } else {
-                last_sec = pcap_ph.ts.tv_sec;
-                last_usec = pcap_ph.ts.tv_usec;
-            }
+        ts = (uint64_t)capinfo_word(file, rec) * 1000000000 +
+            (uint64_t)capinfo_word(file, rec + 4) * (file->nsec ? 1 : 1000);
+
+        backwards = 0;
+        if (stats->pkts == 0)
+            stats->first_ts = ts;
+        else
+            backwards = capinfo_gap(stats, stats->last_ts, ts);
+        stats->last_ts = ts;
+
+        toobig = file->fh.snaplen < caplen;
+        stats->toobig += toobig;
+        stats->pkts++;
+        stats->bytes += len;
+        stats->capbytes += caplen;
+        for (i = 0; len > capinfo_hist_max[i]; i++)
+            ;
+        stats->hist[i]++;
+
+        if (file->out != NULL)
+            capinfo_print_packet(file, rec, stats->pkts, backwards, toobig);
+    }
 
-            /* read the frame */
-            if ((ret = read(fd, &buf, caplen)) != caplen) {
-                if (ret < 0) {
-                    printf("Error reading file: %s: %s\n", argv[i], strerror(errno));
-                } else {
-                    printf("File truncated!  Unable to jump to next packet.\n");
-                }
+    chunk->stop = off;
+    gettimeofday(&chunk->done, NULL);
+}
+
+static capinfo_chunk_t *
+capinfo_queue_next(capinfo_queue_t *queue)
+{
+    capinfo_chunk_t *chunk = NULL;
 
-                close(fd);
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_lock(&queue->lock);
+#endif
+    if (queue->next < queue->count)
+        chunk = queue->chunks[queue->next++];
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_unlock(&queue->lock);
+#endif
+    return chunk;
+}
+
+static void *
+capinfo_worker(void *arg)
+{
+    capinfo_queue_t *queue = (capinfo_queue_t *)arg;
+    capinfo_chunk_t *chunk;
+
+    while ((chunk = capinfo_queue_next(queue)) != NULL) {
+        if (chunk->index > 0)
+            chunk->start = capinfo_resync(chunk->file, chunk->start, chunk->end);
+        capinfo_walk(chunk);
+    }
+    return NULL;
+}
+
+/**
+ * Makes sure every chunk began where the one before it stopped, re-walking
+ * those which didn't, and returns the stats for the whole file
+ */
+static void
+capinfo_stitch(capinfo_file_t *file, capinfo_stats_t *total, int *truncated)
+{
+    capinfo_chunk_t *prev, *chunk;
+    int i;
+
+    memset(total, 0, sizeof(*total));
+    *truncated = 0;
+
+    for (i = 0; i < file->nchunks; i++) {
+        chunk = &file->chunks[i];
+        if (i > 0) {
+            prev = &file->chunks[i - 1];
+            if (prev->truncated) {
+                /* nothing after a broken record can be trusted */
+                memset(&chunk->stats, 0, sizeof(chunk->stats));
+                chunk->truncated = 1;
+                chunk->stop = prev->stop;
                 continue;
             }
+            if (chunk->start != prev->stop) {
+                dbgx(1, "%s: chunk %d resynced at %zu, not %zu; rescanning",
+                        file->name, i, chunk->start, prev->stop);
+                chunk->start = prev->stop;
+                capinfo_walk(chunk);
+            }
+        }
+        capinfo_merge(total, &chunk->stats);
+        *truncated |= chunk->truncated;
+    }
+}
+
+static void
+capinfo_print_header(const capinfo_file_t *file)
+{
+    printf("file size   = %"PRIu64" bytes\n", (uint64_t)file->size);
+
+    if (file->magic < 0) {
+        printf("magic       = 0x%08"PRIx32" (unknown)\n", file->fh.magic);
+    } else {
+        printf("magic       = 0x%08"PRIx32" (%s) (%s)\n", file->fh.magic,
+                capinfo_magics[file->magic].name,
+                file->swapped ? is_swapped : is_not_swapped);
+    }
+
+    printf("version     = %hu.%hu\n", file->fh.version_major, file->fh.version_minor);
+    printf("thiszone    = 0x%08"PRIx32"\n", file->fh.thiszone);
+    printf("sigfigs     = 0x%08"PRIx32"\n", file->fh.sigfigs);
+    printf("snaplen     = %"PRIu32"\n", file->fh.snaplen);
+    printf("linktype    = 0x%08"PRIx32"\n", file->fh.linktype);
+
+    if (! file->supported) {
+        printf("Sorry, we only support file format version 2.4\n");
+        return;
+    }
+
+    dbgx(5, "Packet header len: %d", file->pkthdrlen);
+
+    if (file->out == NULL)
+        return;
+
+    if (file->pkthdrlen == sizeof(struct pcap_sf_patched_pkthdr)) {
+        printf("Packet\tOrigLen\t\tCaplen\t\tTimestamp\t\tIndex\tProto\tPktType\tPktCsum\tNote\n");
+    } else {
+        printf("Packet\tOrigLen\t\tCaplen\t\tTimestamp\tCsum\tNote\n");
+    }
+}
+
+/**
+ * Copies a listing which a worker thread wrote to a temp file
+ */
+static void
+capinfo_print_listing(capinfo_file_t *file)
+{
+    char buf[BUFSIZ];
+    size_t len;
+
+    if (file->out == NULL || file->out == stdout)
+        return;
+
+    rewind(file->out);
+    while ((len = fread(buf, 1, sizeof(buf), file->out)) > 0)
+        fwrite(buf, 1, len, stdout);
+}
+
+static void
+capinfo_print_summary(capinfo_file_t *file)
+{
+    capinfo_stats_t stats;
+    struct timeval begin, done, elapsed;
+    double duration, scan;
+    int truncated, i;
+
+    capinfo_stitch(file, &stats, &truncated);
+
+    begin = file->chunks[0].begin;
+    done = file->chunks[0].done;
+    for (i = 1; i < file->nchunks; i++) {
+        if (timercmp(&file->chunks[i].begin, &begin, <))
+            begin = file->chunks[i].begin;
+        if (timercmp(&file->chunks[i].done, &done, >))
+            done = file->chunks[i].done;
+    }
+    timersub(&done, &begin, &elapsed);
+    scan = (double)elapsed.tv_sec + (double)elapsed.tv_usec / 1000000.0;
+
+    duration = stats.pkts > 1 ? (double)(stats.last_ts - stats.first_ts) / 1000000000.0 : 0.0;
+
+    printf("packets     = %"PRIu64"%s\n", stats.pkts, truncated ? " (file truncated)" : "");
+    printf("bytes       = %"PRIu64" (%"PRIu64" captured)\n", stats.bytes, stats.capbytes);
+    printf("duration    = %.6f sec\n", duration);
+    if (duration > 0.0) {
+        printf("rate        = %.2f pps, %.2f Mbps\n", (double)stats.pkts / duration,
+                (double)stats.bytes * 8.0 / duration / 1000000.0);
+    }
 
-            /* print the frame checksum */
-            printf("\t%x\t", do_checksum_math((u_int16_t *)buf, caplen));
+    if (stats.gaps > 0) {
+        printf("gaps        = min %.3f, avg %.3f, max %.3f usec\n",
+                (double)stats.gap_min / 1000.0,
+                (double)stats.gap_sum / (double)stats.gaps / 1000.0,
+                (double)stats.gap_max / 1000.0);
+    }
+    printf("bad ts      = %"PRIu64"\n", stats.backwards);
+    printf("too big     = %"PRIu64"\n", stats.toobig);
 
-            /* print the Note */
-            if (! backwards && ! caplentoobig) {
-                printf("OK\n");
-            } else if (backwards && ! caplentoobig) {
-                printf("BAD_TS\n");
-            } else if (caplentoobig && ! backwards) {
-                printf("TOOBIG\n");
-            } else if (backwards && caplentoobig) {
-                printf("BAD_TS|TOOBIG");
-            } 
+    printf("sizes       =\n");
+    for (i = 0; i < CAPINFO_HIST_BUCKETS; i++) {
+        printf("  %-10s%12"PRIu64" (%5.1f%%)\n", capinfo_hist_name[i], stats.hist[i],
+                stats.pkts ? (double)stats.hist[i] * 100.0 / (double)stats.pkts : 0.0);
+    }
 
+    printf("scanned     = %.1f MB in %.3f sec", (double)file->size / 1048576.0, scan);
+    if (scan > 0.0)
+        printf(" (%.1f MB/s)", (double)file->size / 1048576.0 / scan);
+    printf(", %d chunk%s\n\n", file->nchunks, file->nchunks == 1 ? "" : "s");
+}
+
+int
+main(int argc, char *argv[])
+{
+    capinfo_file_t *files;
+    capinfo_queue_t queue;
+    int i, j, opt, nfiles, nchunks, nthreads = 1, summary = 0;
+#ifdef HAVE_LIBPTHREAD
+    pthread_t *threads;
+#endif
+
+    while ((opt = getopt(argc, argv, "sj:h")) != -1) {
+        switch (opt) {
+        case 's':
+            summary = 1;
+            break;
+        case 'j':
+            if ((nthreads = atoi(optarg)) < 1)
+                errx(-1, "Invalid number of threads: %s", optarg);
+            break;
+        default:
+            usage();
         }
+    }
 
+    nfiles = argc - optind;
+    if (nfiles < 1)
+        usage();
+
+#ifndef HAVE_LIBPTHREAD
+    if (nthreads > 1)
+        warnx("No thread support, ignoring -j %d", nthreads);
+    nthreads = 1;
+#endif
+
+    files = (capinfo_file_t *)safe_malloc(nfiles * sizeof(capinfo_file_t));
+
+    /* one thread: walk each file in order straight to stdout */
+    if (nthreads == 1) {
+        for (i = 0; i < nfiles; i++) {
+            capinfo_open(&files[i], argv[optind + i]);
+            files[i].out = summary ? NULL : stdout;
+            capinfo_print_header(&files[i]);
+            if (files[i].supported) {
+                capinfo_split(&files[i], 1);
+                capinfo_walk(&files[i].chunks[0]);
+                capinfo_print_summary(&files[i]);
+            }
+            capinfo_close(&files[i]);
+        }
+        safe_free(files);
+        exit(0);
     }
 
-    exit(0);
+    /*
+     * Otherwise every file is queued as one chunk per thread (at least
+     * CAPINFO_MIN_CHUNK long), or as a single chunk when listing packets
+     * since the listing has to come out in order
+     */
+    memset(&queue, 0, sizeof(queue));
+    for (i = 0; i < nfiles; i++) {
+        capinfo_open(&files[i], argv[optind + i]);
+        if (! files[i].supported)
+            continue;
+
+        nchunks = 1;
+        if (summary) {
+            nchunks = (int)(files[i].size / CAPINFO_MIN_CHUNK);
+            if (nchunks > nthreads)
+                nchunks = nthreads;
+            if (nchunks < 1)
+                nchunks = 1;
+        } else if ((files[i].out = tmpfile()) == NULL) {
+            errx(-1, "Unable to create temp file for %s: %s", files[i].name, strerror(errno));
+        }
+
+        capinfo_split(&files[i], nchunks);
+        queue.count += nchunks;
+    }
 
+    queue.chunks = (capinfo_chunk_t **)safe_malloc((queue.count + 1) * sizeof(capinfo_chunk_t *));
+    queue.count = 0;
+    for (i = 0; i < nfiles; i++) {
+        for (j = 0; j < files[i].nchunks; j++)
+            queue.chunks[queue.count++] = &files[i].chunks[j];
+    }
+
+#ifdef HAVE_LIBPTHREAD
+    if (nthreads > queue.count)
+        nthreads = queue.count;
+
+    dbgx(1, "Analysing %d chunks of %d files on %d threads", queue.count, nfiles, nthreads);
+    pthread_mutex_init(&queue.lock, NULL);
+    threads = (pthread_t *)safe_malloc((nthreads + 1) * sizeof(pthread_t));
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, capinfo_worker, &queue) != 0)
+            errx(-1, "Unable to create worker thread: %s", strerror(errno));
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&queue.lock);
+    safe_free(threads);
+#endif
+
+    for (i = 0; i < nfiles; i++) {
+        capinfo_print_header(&files[i]);
+        if (files[i].supported) {
+            capinfo_print_listing(&files[i]);
+            capinfo_print_summary(&files[i]);
+        }
+        capinfo_close(&files[i]);
+    }
+
+    safe_free(queue.chunks);
+    safe_free(files);
+    exit(0);
 }
 
 /**
  * code to do a ones-compliment checksum
  */
 static int
-do_checksum_math(u_int16_t *data, int len)
+do_checksum_math(const u_char *data, int len)
 {
     int sum = 0;
     union {
@@ -350,13 +850,16 @@ do_checksum_math(u_int16_t *data, int len)
         u_int8_t b[2];
     } pad;
 
+    /* records in the mapped file aren't necessarily aligned */
     while (len > 1) {
-        sum += *data++;
+        memcpy(&pad.s, data, sizeof(pad.s));
+        sum += pad.s;
+        data += 2;
         len -= 2;
     }
 
     if (len == 1) {
-        pad.b[0] = *(u_int8_t *)data;
+        pad.b[0] = *data;
         pad.b[1] = 0;
         sum += pad.s;
     }
@@ -0,0 +1,297 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The flow cache remembers how the first packet of each IPv4 TCP/UDP
+ * flow was rewritten by --portmap, --pnat, --srcipmap/--dstipmap,
+ * --endpoints and --seed so that the rest of the packets in the flow
+ * can just have the new addresses & ports copied in and their checksums
+ * incrementally updated instead of re-evaluating every rule and
+ * re-checksumming the entire packet.
+ */
+#include "config.h"
+#include "defines.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcpedit-int.h"
+#include "checksum.h"
+#include "flowcache.h"
+
+static u_int32_t flowcache_hash(const tcpedit_flowkey_t *key);
+
+/**
+ * Allocates a flow cache which will hold at most max_flows flows
+ */
+tcpedit_flowcache_t *
+flowcache_init(int max_flows)
+{
+    tcpedit_flowcache_t *flowcache;
+    u_int32_t buckets = 1;
+
+    assert(max_flows > 0);
+
+    /* keep the load factor <= 1 and use a mask rather then modulo */
+    while (buckets < (u_int32_t)max_flows)
+        buckets <<= 1;
+
+    flowcache = (tcpedit_flowcache_t *)safe_malloc(sizeof(tcpedit_flowcache_t));
+    flowcache->max_flows = max_flows;
+    flowcache->hash_mask = buckets - 1;
+    flowcache->buckets = (tcpedit_flow_t **)safe_malloc(buckets * sizeof(tcpedit_flow_t *));
+    flowcache->flows = (tcpedit_flow_t *)safe_malloc(max_flows * sizeof(tcpedit_flow_t));
+    TAILQ_INIT(&flowcache->lru);
+
+    dbgx(1, "Flow cache: %d flows, %u buckets", max_flows, buckets);
+    return flowcache;
+}
+
+/**
+ * Free's all the memory associated with the flow cache
+ */
+void
+flowcache_free(tcpedit_flowcache_t *flowcache)
+{
+    assert(flowcache);
+
+    dbgx(1, "Flow cache: " COUNTER_SPEC " hits, " COUNTER_SPEC " misses, "
+            COUNTER_SPEC " evictions", flowcache->hits, flowcache->misses,
+            flowcache->evictions);
+
+    safe_free(flowcache->flows);
+    safe_free(flowcache->buckets);
+    safe_free(flowcache);
+}
+
+/**
+ * Fills out the flow key for the given packet.  Returns 1 if the packet
+ * can use the flow cache or 0 if it has to be edited the slow way:
+ * only complete, unfragmented IPv4 TCP/UDP packets are cached.
+ */
+int
+flowcache_key(const struct pcap_pkthdr *pkthdr, const ipv4_hdr_t *ip_hdr,
+        tcpr_dir_t direction, tcpedit_flowkey_t *key)
+{
+    const tcp_hdr_t *tcp_hdr;
+    const udp_hdr_t *udp_hdr;
+
+    assert(pkthdr);
+    assert(ip_hdr);
+    assert(key);
+
+    if (pkthdr->caplen != pkthdr->len)
+        return 0;
+
+    if ((ntohs(ip_hdr->ip_off) & (IP_MF | IP_OFFMASK)) != 0)
+        return 0;
+
+    memset(key, 0, sizeof(tcpedit_flowkey_t));
+    key->src_ip = ip_hdr->ip_src.s_addr;
+    key->dst_ip = ip_hdr->ip_dst.s_addr;
+    key->proto = ip_hdr->ip_p;
+    key->direction = (u_int8_t)direction;
+
+    if (ip_hdr->ip_p == IPPROTO_TCP) {
+        tcp_hdr = (tcp_hdr_t *)get_layer4_v4(ip_hdr);
+        key->src_port = tcp_hdr->th_sport;
+        key->dst_port = tcp_hdr->th_dport;
+    } else if (ip_hdr->ip_p == IPPROTO_UDP) {
+        udp_hdr = (udp_hdr_t *)get_layer4_v4(ip_hdr);
+        key->src_port = udp_hdr->uh_sport;
+        key->dst_port = udp_hdr->uh_dport;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Returns the cached flow for the given key or NULL if we haven't seen
+ * it (or it has been evicted).  A hit makes it the most recently used flow.
+ */
+tcpedit_flow_t *
+flowcache_lookup(tcpedit_flowcache_t *flowcache, const tcpedit_flowkey_t *key)
+{
+    tcpedit_flow_t *flow;
+
+    assert(flowcache);
+    assert(key);
+
+    flow = flowcache->buckets[flowcache_hash(key) & flowcache->hash_mask];
+    while (flow != NULL) {
+        if (memcmp(&flow->key, key, sizeof(tcpedit_flowkey_t)) == 0) {
+            if (flow != TAILQ_FIRST(&flowcache->lru)) {
+                TAILQ_REMOVE(&flowcache->lru, flow, lru);
+                TAILQ_INSERT_HEAD(&flowcache->lru, flow, lru);
+            }
+            flowcache->hits ++;
+            return flow;
+        }
+        flow = flow->hash_next;
+    }
+
+    flowcache->misses ++;
+    return NULL;
+}
+
+/**
+ * Records how the packet which produced key was edited.  Call after all
+ * the address & port rewriting has been done to ip_hdr.  If the cache is
+ * full, the least recently used flow is evicted to make room.
+ */
+void
+flowcache_add(tcpedit_flowcache_t *flowcache, const tcpedit_flowkey_t *key,
+        ipv4_hdr_t *ip_hdr)
+{
+    tcpedit_flow_t *flow, **bucket;
+    u_int16_t old_ports[2], new_ports[2];
+    const tcp_hdr_t *tcp_hdr;
+    const udp_hdr_t *udp_hdr;
+
+    assert(flowcache);
+    assert(key);
+    assert(ip_hdr);
+
+    if (flowcache->num_flows < flowcache->max_flows) {
+        flow = &flowcache->flows[flowcache->num_flows++];
+    } else {
+        /* recycle the LRU flow, unlinking it from its hash chain */
+        flow = TAILQ_LAST(&flowcache->lru, tcpedit_flowlru_s);
+        TAILQ_REMOVE(&flowcache->lru, flow, lru);
+        bucket = &flowcache->buckets[flowcache_hash(&flow->key) & flowcache->hash_mask];
+        while (*bucket != flow)
+            bucket = &(*bucket)->hash_next;
+        *bucket = flow->hash_next;
+        flowcache->evictions ++;
+    }
+
+    memcpy(&flow->key, key, sizeof(tcpedit_flowkey_t));
+    flow->src_ip = ip_hdr->ip_src.s_addr;
+    flow->dst_ip = ip_hdr->ip_dst.s_addr;
+
+    if (key->proto == IPPROTO_TCP) {
+        tcp_hdr = (tcp_hdr_t *)get_layer4_v4(ip_hdr);
+        flow->src_port = tcp_hdr->th_sport;
+        flow->dst_port = tcp_hdr->th_dport;
+    } else {
+        udp_hdr = (udp_hdr_t *)get_layer4_v4(ip_hdr);
+        flow->src_port = udp_hdr->uh_sport;
+        flow->dst_port = udp_hdr->uh_dport;
+    }
+
+    /* 
+     * the IP checksum only covers the addresses, while TCP/UDP also
+     * covers them via the pseudo header, plus the ports
+     */
+    flow->ip_delta = checksum_delta((u_int16_t *)&key->src_ip,
+            (u_int16_t *)&flow->src_ip, 8);
+
+    old_ports[0] = key->src_port;
+    old_ports[1] = key->dst_port;
+    new_ports[0] = flow->src_port;
+    new_ports[1] = flow->dst_port;
+    flow->l4_delta = flow->ip_delta + 
+            checksum_delta(old_ports, new_ports, sizeof(old_ports));
+
+    bucket = &flowcache->buckets[flowcache_hash(key) & flowcache->hash_mask];
+    flow->hash_next = *bucket;
+    *bucket = flow;
+    TAILQ_INSERT_HEAD(&flowcache->lru, flow, lru);
+}
+
+/**
+ * Rewrites the packet the same way as the first packet of the flow was.
+ * If fixcsum is set, the IPv4 and TCP/UDP checksums are incrementally
+ * updated for the new addresses & ports.
+ */
+void
+flowcache_apply(const tcpedit_flow_t *flow, ipv4_hdr_t *ip_hdr, int fixcsum)
+{
+    tcp_hdr_t *tcp_hdr;
+    udp_hdr_t *udp_hdr;
+
+    assert(flow);
+    assert(ip_hdr);
+
+    ip_hdr->ip_src.s_addr = flow->src_ip;
+    ip_hdr->ip_dst.s_addr = flow->dst_ip;
+    if (fixcsum)
+        checksum_adjust(&ip_hdr->ip_sum, flow->ip_delta);
+
+    if (flow->key.proto == IPPROTO_TCP) {
+        tcp_hdr = (tcp_hdr_t *)get_layer4_v4(ip_hdr);
+        tcp_hdr->th_sport = flow->src_port;
+        tcp_hdr->th_dport = flow->dst_port;
+        if (fixcsum)
+            checksum_adjust(&tcp_hdr->th_sum, flow->l4_delta);
+    } else {
+        udp_hdr = (udp_hdr_t *)get_layer4_v4(ip_hdr);
+        udp_hdr->uh_sport = flow->src_port;
+        udp_hdr->uh_dport = flow->dst_port;
+
+        /* a zero UDP checksum means none was calculated */
+        if (fixcsum && udp_hdr->uh_sum != 0) {
+            checksum_adjust(&udp_hdr->uh_sum, flow->l4_delta);
+            if (udp_hdr->uh_sum == 0)
+                udp_hdr->uh_sum = 0xffff;
+        }
+    }
+}
+
+/**
+ * Hashes the flow key, mixing in each field
+ */
+static u_int32_t
+flowcache_hash(const tcpedit_flowkey_t *key)
+{
+    u_int32_t hash;
+
+    hash = key->src_ip * 0x9e3779b1;
+    hash ^= key->dst_ip + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= (((u_int32_t)key->src_port << 16) | key->dst_port) + 0x9e3779b9 + 
+            (hash << 6) + (hash >> 2);
+    hash ^= (((u_int32_t)key->proto << 8) | key->direction) + 0x9e3779b9 + 
+            (hash << 6) + (hash >> 2);
+
+    return hash;
+}
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
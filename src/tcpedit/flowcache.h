@@ -0,0 +1,110 @@
+/* $Id$ */
+
+/*
+ * Copyright (c) 2012 Aaron Turner.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the names of the copyright owners nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FLOWCACHE_H__
+#define __FLOWCACHE_H__
+
+#include "lib/queue.h"
+
+/*
+ * Identifies a unidirectional IPv4 TCP/UDP flow as seen *before* editing.
+ * The direction is part of the key since --pnat/--endpoints rewrite
+ * differently for each side of the connection.  Always zero the key before
+ * filling it in so that it can be compared with memcmp()
+ */
+struct tcpedit_flowkey_s {
+    u_int32_t src_ip;
+    u_int32_t dst_ip;
+    u_int16_t src_port;
+    u_int16_t dst_port;
+    u_int8_t proto;
+    u_int8_t direction;
+    u_int16_t unused;
+};
+typedef struct tcpedit_flowkey_s tcpedit_flowkey_t;
+
+/*
+ * the cached result of editing the first packet of a flow: the new
+ * addresses/ports (network byte order) and the ones-compliment deltas
+ * to apply to the IPv4 and TCP/UDP checksums
+ */
+struct tcpedit_flow_s {
+    tcpedit_flowkey_t key;
+    u_int32_t src_ip;
+    u_int32_t dst_ip;
+    u_int16_t src_port;
+    u_int16_t dst_port;
+    u_int32_t ip_delta;
+    u_int32_t l4_delta;
+    struct tcpedit_flow_s *hash_next;
+    TAILQ_ENTRY(tcpedit_flow_s) lru;
+};
+typedef struct tcpedit_flow_s tcpedit_flow_t;
+
+TAILQ_HEAD(tcpedit_flowlru_s, tcpedit_flow_s);
+
+/*
+ * Fixed size flow table.  All the entries are allocated up front and
+ * once they're all in use, the least recently used flow is recycled
+ */
+struct tcpedit_flowcache_s {
+    int max_flows;
+    int num_flows;
+    u_int32_t hash_mask;
+    tcpedit_flow_t **buckets;
+    tcpedit_flow_t *flows;
+    struct tcpedit_flowlru_s lru;
+    COUNTER hits;
+    COUNTER misses;
+    COUNTER evictions;
+};
+typedef struct tcpedit_flowcache_s tcpedit_flowcache_t;
+
+tcpedit_flowcache_t *flowcache_init(int max_flows);
+void flowcache_free(tcpedit_flowcache_t *flowcache);
+int flowcache_key(const struct pcap_pkthdr *pkthdr, const ipv4_hdr_t *ip_hdr,
+        tcpr_dir_t direction, tcpedit_flowkey_t *key);
+tcpedit_flow_t *flowcache_lookup(tcpedit_flowcache_t *flowcache,
+        const tcpedit_flowkey_t *key);
+void flowcache_add(tcpedit_flowcache_t *flowcache, const tcpedit_flowkey_t *key,
+        ipv4_hdr_t *ip_hdr);
+void flowcache_apply(const tcpedit_flow_t *flow, ipv4_hdr_t *ip_hdr, int fixcsum);
+
+#endif
+
+/*
+ Local Variables:
+ mode:c
+ indent-tabs-mode:nil
+ c-basic-offset:4
+ End:
+*/
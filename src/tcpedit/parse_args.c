@@ -37,6 +37,7 @@
 #include "tcpedit_stub.h"
 #include "parse_args.h"
 #include "portmap.h"
+#include "flowcache.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -206,6 +207,9 @@ tcpedit_post_args(tcpedit_t **tcpedit_ex) {
             }
             first = 0;
         } while (--ct > 0);
+
+        /* flatten the chain into a lookup table for rewrite_ports() */
+        tcpedit->porttable = compile_portmap(tcpedit->portmap);
     }
 
     /*
@@ -230,6 +234,17 @@ tcpedit_post_args(tcpedit_t **tcpedit_ex) {
         }
     }
 
+    /* --flowcache is only useful if we're rewriting IPv4 addresses or ports */
+    if (HAVE_OPT(FLOWCACHE)) {
+        if (tcpedit->rewrite_ip || tcpedit->portmap != NULL) {
+            tcpedit->flowcache = flowcache_init(OPT_VALUE_FLOWCACHE);
+        } else {
+            tcpedit_seterr(tcpedit, "%s", 
+                    "--flowcache has no effect without rewriting IP addresses or ports");
+            rcode = 1;
+        }
+    }
+
     /* 
      * figure out the max packet len
     if (tcpedit->l2.enabled) {
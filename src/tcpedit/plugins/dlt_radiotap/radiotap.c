@@ -352,12 +352,11 @@ static u_char *
 dlt_radiotap_get_80211(tcpeditdlt_t *ctx, const u_char *packet, const int pktlen, const int radiolen)
 {
     radiotap_extra_t *extra;
-    static COUNTER lastpacket = 0;
 
     extra = (radiotap_extra_t *)(ctx->decoded_extra);
-    if (lastpacket != ctx->tcpedit->runtime.packetnum) {
+    if (extra->lastpacket != ctx->tcpedit->runtime.packetnum) {
         memcpy(extra->packet, &packet[radiolen], pktlen - radiolen);
-        lastpacket = ctx->tcpedit->runtime.packetnum;
+        extra->lastpacket = ctx->tcpedit->runtime.packetnum;
     }
     return extra->packet;
 }
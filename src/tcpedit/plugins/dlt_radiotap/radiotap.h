@@ -56,6 +56,7 @@ u_char *dlt_radiotap_get_mac(tcpeditdlt_t *ctx, tcpeditdlt_mac_type_t mac, const
  */
 struct radiotap_extra_s {
     u_char packet[MAXPACKET];
+    COUNTER lastpacket;         /* packetnum of the copy in packet */
 };
 typedef struct radiotap_extra_s radiotap_extra_t;
 
@@ -284,6 +284,36 @@ map_port(tcpedit_portmap_t *portmap_data, long port)
     return(newport);
 }
 
+/**
+ * \brief Compiles a portmap chain into a direct lookup table
+ *
+ * Returns a NUM_PORTS entry table indexed by the original port which
+ * holds the rewritten port (both in network byte order) so that each
+ * lookup is a single array access no matter how many mappings or ranges
+ * were specified.  Nodes are applied in order, so when a port is mapped
+ * more then once the last mapping wins, just like map_port()
+ */
+tcpedit_porttable_t *
+compile_portmap(tcpedit_portmap_t *portmap_data)
+{
+    tcpedit_porttable_t *porttable;
+    tcpedit_portmap_t *portmap_ptr;
+    long port;
+
+    assert(portmap_data);
+
+    porttable = (tcpedit_porttable_t *)safe_malloc(NUM_PORTS * sizeof(tcpedit_porttable_t));
+
+    /* by default every port maps to itself */
+    for (port = 0; port < NUM_PORTS; port++)
+        porttable[port] = (tcpedit_porttable_t)port;
+
+    for (portmap_ptr = portmap_data; portmap_ptr != NULL; portmap_ptr = portmap_ptr->next)
+        porttable[(u_int16_t)portmap_ptr->from] = (tcpedit_porttable_t)portmap_ptr->to;
+
+    return porttable;
+}
+
 /**
  * rewrites the TCP or UDP ports based on a portmap
  * returns 1 for changes made or 0 for none
@@ -296,24 +326,24 @@ rewrite_ports(tcpedit_t *tcpedit, u_char protocol, u_char *layer4)
     udp_hdr_t *udp_hdr = NULL;
     int changes = 0;
     u_int16_t newport;
-    tcpedit_portmap_t *portmap;
+    tcpedit_porttable_t *porttable;
 
     assert(tcpedit);
-    assert(tcpedit->portmap);
-    portmap = tcpedit->portmap;
+    assert(tcpedit->porttable);
+    porttable = tcpedit->porttable;
 
     if (protocol == IPPROTO_TCP) {
         tcp_hdr = (tcp_hdr_t *)layer4;
 
         /* check if we need to remap the destination port */
-        newport = map_port(portmap, tcp_hdr->th_dport);
+        newport = porttable[tcp_hdr->th_dport];
         if (newport != tcp_hdr->th_dport) {
             tcp_hdr->th_dport = newport;
             changes ++;
         }
 
         /* check if we need to remap the source port */
-        newport = map_port(portmap, tcp_hdr->th_sport);
+        newport = porttable[tcp_hdr->th_sport];
         if (newport != tcp_hdr->th_sport) {
             tcp_hdr->th_sport = newport;
             changes ++;
@@ -323,14 +353,14 @@ rewrite_ports(tcpedit_t *tcpedit, u_char protocol, u_char *layer4)
         udp_hdr = (udp_hdr_t *)layer4;
 
         /* check if we need to remap the destination port */
-        newport = map_port(portmap, udp_hdr->uh_dport);
+        newport = porttable[udp_hdr->uh_dport];
         if (newport != udp_hdr->uh_dport) {
             udp_hdr->uh_dport = newport;
             changes ++;
         }
 
         /* check if we need to remap the source port */
-        newport = map_port(portmap, udp_hdr->uh_sport);
+        newport = porttable[udp_hdr->uh_sport];
         if (newport != udp_hdr->uh_sport) {
             udp_hdr->uh_sport = newport;
             changes ++;
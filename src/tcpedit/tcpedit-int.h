@@ -64,6 +64,13 @@ struct tcpedit_portmap_s {
 };
 typedef struct tcpedit_portmap_s tcpedit_portmap_t;
 
+/*
+ * portmap lookup table: compiled from the tcpedit_portmap_t list, it is
+ * indexed by the original port and holds the new port, both in network
+ * byte order.  Unmapped ports map to themselves.
+ */
+typedef u_int16_t tcpedit_porttable_t;
+
 
 /*
  * all the arguments that the packet editing library supports
@@ -135,9 +142,13 @@ struct tcpedit_s {
 
     /* rewrite tcp/udp ports */
     tcpedit_portmap_t *portmap;
+    tcpedit_porttable_t *porttable;
 
     int mtu;                /* Deal with different MTU's */
     int mtu_truncate;       /* Should frames > MTU be truncated? */
+
+    /* cache of per-flow IPv4 address/port rewrites, NULL if disabled */
+    struct tcpedit_flowcache_s *flowcache;
 };
 
 #define tcpedit_seterr(x, y, ...) __tcpedit_seterr(x, __FUNCTION__, __LINE__, __FILE__, y, __VA_ARGS__)
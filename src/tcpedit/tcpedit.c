@@ -45,6 +45,7 @@
 #include "tcpedit-int.h"
 #include "tcpedit_stub.h"
 #include "portmap.h"
+#include "flowcache.h"
 #include "common.h"
 #include "edit_packet.h"
 #include "parse_args.h"
@@ -76,6 +77,9 @@ tcpedit_packet(tcpedit_t *tcpedit, struct pcap_pkthdr **pkthdr,
     int l2len = 0, l2proto, retval = 0, dst_dlt, src_dlt, pktlen, lendiff;
     int ipflags = 0, tclass = 0;
     int needtorecalc = 0;           /* did the packet change? if so, checksum */
+    int flowcacheable = 0;
+    tcpedit_flowkey_t flowkey;
+    tcpedit_flow_t *flow = NULL;    /* cached rewrite for this flow */
     u_char *packet = *pktdata;
     assert(tcpedit);
     assert(pkthdr);
@@ -150,6 +154,13 @@ tcpedit_packet(tcpedit_t *tcpedit, struct pcap_pkthdr **pkthdr,
 
     /* The following edits only apply for IPv4 */
     if (ip_hdr != NULL) {
+
+        /* have we already rewritten the addresses/ports of this flow? */
+        if (tcpedit->flowcache != NULL) {
+            flowcacheable = flowcache_key(*pkthdr, ip_hdr, direction, &flowkey);
+            if (flowcacheable)
+                flow = flowcache_lookup(tcpedit->flowcache, &flowkey);
+        }
         
         /* set TOS ? */
         if (tcpedit->tos > -1) {
@@ -161,7 +172,7 @@ tcpedit_packet(tcpedit_t *tcpedit, struct pcap_pkthdr **pkthdr,
         needtorecalc += rewrite_ipv4_ttl(tcpedit, ip_hdr);
 
         /* rewrite TCP/UDP ports */
-        if (tcpedit->portmap != NULL) {
+        if (tcpedit->portmap != NULL && flow == NULL) {
             if ((retval = rewrite_ipv4_ports(tcpedit, &ip_hdr)) < 0)
                 return TCPEDIT_ERROR;
             needtorecalc += retval;
@@ -219,9 +230,11 @@ tcpedit_packet(tcpedit_t *tcpedit, struct pcap_pkthdr **pkthdr,
     if (tcpedit->rewrite_ip) {
         /* IP packets */
         if (ip_hdr != NULL) {
-            if ((retval = rewrite_ipv4l3(tcpedit, ip_hdr, direction)) < 0)
-                return TCPEDIT_ERROR;
-            needtorecalc += retval;
+            if (flow == NULL) {
+                if ((retval = rewrite_ipv4l3(tcpedit, ip_hdr, direction)) < 0)
+                    return TCPEDIT_ERROR;
+                needtorecalc += retval;
+            }
         } else if (ip6_hdr != NULL) {
             if ((retval = rewrite_ipv6l3(tcpedit, ip6_hdr, direction)) < 0)
                 return TCPEDIT_ERROR;
@@ -245,10 +258,12 @@ tcpedit_packet(tcpedit_t *tcpedit, struct pcap_pkthdr **pkthdr,
     if (tcpedit->seed) {
         /* IPv4 Packets */
         if (ip_hdr != NULL) {
-            if ((retval = randomize_ipv4(tcpedit, *pkthdr, packet, 
-                    ip_hdr)) < 0)
-                return TCPEDIT_ERROR;
-            needtorecalc += retval;
+            if (flow == NULL) {
+                if ((retval = randomize_ipv4(tcpedit, *pkthdr, packet, 
+                        ip_hdr)) < 0)
+                    return TCPEDIT_ERROR;
+                needtorecalc += retval;
+            }
 
         } else if (ip6_hdr != NULL) {
             if ((retval = randomize_ipv6(tcpedit, *pkthdr, packet,
@@ -270,6 +285,16 @@ tcpedit_packet(tcpedit_t *tcpedit, struct pcap_pkthdr **pkthdr,
         }
     }
 
+    /* 
+     * replay the cached rewrite of this flow (incrementally fixing the
+     * checksums), or remember how we rewrote this new flow
+     */
+    if (flow != NULL) {
+        flowcache_apply(flow, ip_hdr, tcpedit->fixcsum != TCPEDIT_FIXCSUM_DISABLE);
+    } else if (flowcacheable) {
+        flowcache_add(tcpedit->flowcache, &flowkey, ip_hdr);
+    }
+
     /* do we need to fix checksums? -- must always do this last! 
      * We recalc if:
      * user specified --fixcsum
@@ -495,6 +520,14 @@ tcpedit_close(tcpedit_t *tcpedit)
     safe_free(tcpedit->runtime.l3buff);
 #endif
 
+    if (tcpedit->porttable != NULL)
+        safe_free(tcpedit->porttable);
+
+    if (tcpedit->flowcache != NULL) {
+        flowcache_free(tcpedit->flowcache);
+        tcpedit->flowcache = NULL;
+    }
+
     return 0;
 }
 
@@ -42,6 +42,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
+#ifdef HAVE_MLOCKALL
+#include <sys/mman.h>
+#endif
 
 #include "tcpreplay.h"
 
@@ -55,6 +58,7 @@ tcpedit_t *tcpedit;
 
 #include "send_packets.h"
 #include "signal_handler.h"
+#include "dry_run.h"
 
 tcpreplay_opt_t options;
 struct timeval begin, end;
@@ -76,6 +80,20 @@ void replay_two_files(int file_idx1, int file_idx2);
 void usage(void);
 void init(void);
 void post_args(int argc);
+void next_loop_iteration(void);
+void replay_merged_files(int nfiles);
+static void post_args_merge(interface_list_t *intlist, int argc);
+static void post_args_merge_open(void);
+static void post_args_numa(int argc);
+static void post_args_sched(void);
+static void post_args_sender(void);
+static void numa_report(int argc);
+static int merge_intf_first(int idx);
+static void readahead_start(int file_idx, pcapreader_t *pcap);
+static void readahead_stop(int file_idx);
+#ifdef ENABLE_VERBOSE
+static void verbose_open(pcapreader_t *pcap);
+#endif
 
 
 int
@@ -85,6 +103,10 @@ main(int argc, char *argv[])
 #ifdef TCPREPLAY_EDIT
     int rcode;
 #endif
+#ifdef TCPREPLAY_FRAGROUTE
+    char ebuf[FRAGROUTE_ERRBUF_LEN];
+#endif
+    char genbuf[GEN_ERRBUF_SIZE];
 
     init();                     /* init our globals */
 
@@ -112,6 +134,14 @@ main(int argc, char *argv[])
         errx(-1, "Unable to edit packets given options:\n%s",
                 tcpedit_geterr(tcpedit));
     }
+
+#ifdef TCPREPLAY_FRAGROUTE
+    if (options.fragroute_args) {
+        if ((options.frag_ctx = fragroute_init(65535, tcpedit_get_output_dlt(tcpedit),
+                options.fragroute_args, ebuf)) == NULL)
+            errx(-1, "%s", ebuf);
+    }
+#endif
 #endif
 
     if ((options.enable_file_cache || options.preload_pcap) && ! HAVE_OPT(QUIET)) {
@@ -137,12 +167,31 @@ main(int argc, char *argv[])
     for (i = 0; i < argc; i++) {
         options.files[i] = safe_strdup(argv[i]);
 
+        /* generated traffic is built on the fly, there's nothing to preload */
+        if (gen_is_spec(argv[i])) {
+            if (options.dualfile)
+                errx(-1, "Generated traffic can't be used with --dualfile: %s", argv[i]);
+            if (options.merge_threads)
+                errx(-1, "Generated traffic can't be used with --merge-threads: %s", argv[i]);
+            if ((options.gen[i] = gen_open(argv[i], genbuf)) == NULL)
+                errx(-1, "%s", genbuf);
+            continue;
+        }
+
         /* preload our pcap file? */
-        if (options.preload_pcap) {
+        if (options.preload_pcap && ! options.dry_run) {
             preload_pcap_file(i);
         }
     }
 
+    if (options.numa && options.preload_pcap && ! options.dry_run)
+        numa_report(argc);
+
+    if (options.dry_run) {
+        dry_run(argc);
+        return 0;
+    }
+
     /* init the signal handlers */
     init_signal_handlers();
 
@@ -153,8 +202,10 @@ main(int argc, char *argv[])
     if (options.loop > 0) {
         while (options.loop--) {  /* limited loop */
 
-
-            if (options.dualfile) {
+            if (options.merge) {
+                /* all files at once, in timestamp order */
+                replay_merged_files(argc);
+            } else if (options.dualfile) {
                 /* process two files at a time for network taps */
                 for (i = 0; i < argc; i += 2) {
                     replay_two_files(i, (i+1));
@@ -168,17 +219,23 @@ main(int argc, char *argv[])
                     replay_file(i);
                 }
             }
+            next_loop_iteration();
         }
     }
     else {
         /* loop forever */
         while (1) {
-            for (i = 0; i < argc; i++) {
-                /* reset cache markers for each iteration */
-                cache_byte = 0;
-                cache_bit = 0;
-                replay_file(i);
+            if (options.merge) {
+                replay_merged_files(argc);
+            } else {
+                for (i = 0; i < argc; i++) {
+                    /* reset cache markers for each iteration */
+                    cache_byte = 0;
+                    cache_bit = 0;
+                    replay_file(i);
+                }
             }
+            next_loop_iteration();
         }
     }
 
@@ -187,11 +244,40 @@ main(int argc, char *argv[])
             errx(-1, "Unable to gettimeofday(): %s", strerror(errno));
 
         packet_stats(&begin, &end, bytes_sent, pkts_sent, failed);
+        if (options.burst != NULL)
+            burst_report(options.burst);
+
+        if (options.merge) {
+            for (i = 0; i < options.merge_count; i++) {
+                if (merge_intf_first(i))
+                    printf("%s", sendpacket_getstat(options.merge_intf[i]));
+            }
+        } else {
+            printf("%s", sendpacket_getstat(options.intf1));
+            if (options.intf2 != NULL)
+                printf("%s", sendpacket_getstat(options.intf2));
+        }
+    }
 
-        printf("%s", sendpacket_getstat(options.intf1));
+    /* flushes anything still queued, e.g. a memring's pcap file */
+    if (options.merge) {
+        for (i = 0; i < options.merge_count; i++) {
+            if (merge_intf_first(i))
+                sendpacket_close(options.merge_intf[i]);
+        }
+    } else {
+        sendpacket_close(options.intf1);
         if (options.intf2 != NULL)
-            printf("%s", sendpacket_getstat(options.intf2));
+            sendpacket_close(options.intf2);
+    }
+
+    for (i = 0; i < argc; i++) {
+        if (options.gen[i] != NULL)
+            gen_close(options.gen[i]);
     }
+
+    if (options.burst != NULL)
+        burst_free(options.burst);
     return 0;
 }   /* main() */
 
@@ -205,10 +291,11 @@ void
 preload_pcap_file(int file_idx)
 {
     char *path = options.files[file_idx];
-    pcap_t *pcap = NULL;
-    char ebuf[PCAP_ERRBUF_SIZE];
+    pcapreader_t *pcap = NULL;
+    char ebuf[PCAPREADER_ERRBUF_SIZE];
     const u_char *pktdata = NULL;
     struct pcap_pkthdr pkthdr;
+    pcapreader_meta_t meta;
     packet_cache_t *cached_packet = NULL;
     packet_cache_t **prev_packet = &cached_packet;
     COUNTER packetnum = 0;
@@ -218,23 +305,46 @@ preload_pcap_file(int file_idx)
         if (close(1) == -1)
             warnx("unable to close stdin: %s", strerror(errno));
 
-    if ((pcap = pcap_open_offline(path, ebuf)) == NULL)
+    if ((pcap = pcapreader_open(path, ebuf)) == NULL)
         errx(-1, "Error opening pcap file: %s", ebuf);
 
-#ifdef HAVE_PCAP_SNAPSHOT
-    if (pcap_snapshot(pcap) < 65535)
+    if (pcapreader_snapshot(pcap) < 65535)
         warnx("%s was captured using a snaplen of %d bytes.  This may mean you have truncated packets.",
-                path, pcap_snapshot(pcap));
-#endif
+                path, pcapreader_snapshot(pcap));
 
     /* loop through the pcap.  get_next_packet() builds the cache for us! */
-    while ((pktdata = get_next_packet(pcap, &pkthdr, file_idx, prev_packet)) != NULL) {
+    while ((pktdata = get_next_packet(pcap, &pkthdr, &meta, file_idx, prev_packet)) != NULL) {
         packetnum++;
     }
 
+    if (*pcapreader_geterr(pcap) != '\0')
+        warnx("%s", pcapreader_geterr(pcap));
+
     /* mark this file as cached */
     options.file_cache[file_idx].cached = TRUE;
-    pcap_close(pcap);
+    pcapreader_close(pcap);
+}
+
+/**
+ * Called after each pass through the pcap file(s) to compute the
+ * --loop-cidr/--loop-portstep offsets for the next pass.  Ports are
+ * kept in the range 1024-65535, hence the modulo 64512.
+ */
+void
+next_loop_iteration(void)
+{
+    options.loop_iteration ++;
+
+    if (options.loop_cidr == NULL)
+        return;
+
+    options.loop_ipoffset = (u_int64_t)options.loop_iteration * options.loop_ipstep;
+    options.loop_portoffset = (u_int16_t)(((u_int64_t)options.loop_iteration * 
+            options.loop_portstep) % 64512);
+
+    dbgx(1, "Loop %u: offsetting addresses by " COUNTER_SPEC " and ports by %u",
+            options.loop_iteration, (COUNTER)options.loop_ipoffset, 
+            options.loop_portoffset);
 }
 
 /**
@@ -244,10 +354,18 @@ void
 replay_file(int file_idx)
 {
     char *path = options.files[file_idx];
-    pcap_t *pcap = NULL;
-    char ebuf[PCAP_ERRBUF_SIZE];
+    pcapreader_t *pcap = NULL;
+    char ebuf[PCAPREADER_ERRBUF_SIZE];
     int dlt;
 
+    if (options.gen[file_idx] != NULL) {
+        if (! HAVE_OPT(QUIET))
+            notice("generating: %s", path);
+        gen_rewind(options.gen[file_idx]);
+        send_packets(NULL, file_idx);
+        return;
+    }
+
     if (! HAVE_OPT(QUIET))
         notice("processing file: %s", path);
 
@@ -258,11 +376,11 @@ replay_file(int file_idx)
 
     /* read from pcap file if we haven't cached things yet */
     if (! (options.enable_file_cache || options.preload_pcap)) {
-        if ((pcap = pcap_open_offline(path, ebuf)) == NULL)
+        if ((pcap = pcapreader_open(path, ebuf)) == NULL)
             errx(-1, "Error opening pcap file: %s", ebuf);
     } else {
         if (!options.file_cache[file_idx].cached)
-            if ((pcap = pcap_open_offline(path, ebuf)) == NULL)
+            if ((pcap = pcapreader_open(path, ebuf)) == NULL)
                 errx(-1, "Error opening pcap file: %s", ebuf);
 
     }
@@ -272,26 +390,31 @@ replay_file(int file_idx)
 
         /* in cache mode, we may not have opened the file */
         if (pcap == NULL)
-            if ((pcap = pcap_open_offline(path, ebuf)) == NULL)
+            if ((pcap = pcapreader_open(path, ebuf)) == NULL)
                 errx(-1, "Error opening pcap file: %s", ebuf);
 
         /* init tcpdump */
-        tcpdump_open(options.tcpdump, pcap);
+        verbose_open(pcap);
     }
 #endif
 
 
     if (pcap != NULL) {
         dlt = sendpacket_get_dlt(options.intf1);
-        if ((dlt > 0) && (dlt != pcap_datalink(pcap)))
+        if ((dlt > 0) && (dlt != pcapreader_datalink(pcap)))
             warnx("%s DLT (%s) does not match that of the outbound interface: %s (%s)", 
-                path, pcap_datalink_val_to_name(pcap_datalink(pcap)), 
+                path, pcap_datalink_val_to_name(pcapreader_datalink(pcap)), 
                 options.intf1->device, pcap_datalink_val_to_name(dlt));
     }
 
+    readahead_start(file_idx, pcap);
     send_packets(pcap, file_idx);
-    if (pcap != NULL)
-        pcap_close(pcap);
+    readahead_stop(file_idx);
+    if (pcap != NULL) {
+        if (*pcapreader_geterr(pcap) != '\0')
+            warnx("%s", pcapreader_geterr(pcap));
+        pcapreader_close(pcap);
+    }
 
 #ifdef ENABLE_VERBOSE
     tcpdump_close(options.tcpdump);
@@ -299,6 +422,123 @@ replay_file(int file_idx)
 }
 
 
+/**
+ * replay all the pcap files at once, merged by timestamp, each out its
+ * --merge interface
+ */
+void
+replay_merged_files(int nfiles)
+{
+    pcapreader_t **pcap;
+    char ebuf[PCAPREADER_ERRBUF_SIZE];
+    sendpacket_t *sp;
+    int i, dlt;
+
+    pcap = (pcapreader_t **)safe_malloc(nfiles * sizeof(pcapreader_t *));
+
+    for (i = 0; i < nfiles; i++) {
+        if (options.gen[i] != NULL) {
+            gen_rewind(options.gen[i]);
+            continue;
+        }
+
+        /* read from pcap file if we haven't cached things yet */
+        if (! (options.enable_file_cache || options.preload_pcap) ||
+                ! options.file_cache[i].cached) {
+            if ((pcap[i] = pcapreader_open(options.files[i], ebuf)) == NULL)
+                errx(-1, "Error opening pcap file: %s", ebuf);
+
+            sp = options.merge_intf[i % options.merge_count];
+            dlt = sendpacket_get_dlt(sp);
+            if ((dlt > 0) && (dlt != pcapreader_datalink(pcap[i])))
+                warnx("%s DLT (%s) does not match that of the outbound interface: %s (%s)", 
+                    options.files[i], pcap_datalink_val_to_name(pcapreader_datalink(pcap[i])), 
+                    sp->device, pcap_datalink_val_to_name(dlt));
+        }
+    }
+
+    if (! HAVE_OPT(QUIET))
+        notice("merging %d files", nfiles);
+
+    for (i = 0; i < nfiles; i++)
+        readahead_start(i, pcap[i]);
+
+    send_merged_packets(pcap, nfiles);
+
+    for (i = 0; i < nfiles; i++) {
+        readahead_stop(i);
+        if (pcap[i] != NULL) {
+            if (*pcapreader_geterr(pcap[i]) != '\0')
+                warnx("%s", pcapreader_geterr(pcap[i]));
+            pcapreader_close(pcap[i]);
+        }
+    }
+    safe_free(pcap);
+}
+
+/**
+ * Hands pcap over to a read-ahead thread if --readahead was given
+ */
+static void
+readahead_start(int file_idx, pcapreader_t *pcap)
+{
+#ifdef HAVE_LIBPTHREAD
+    if (options.readahead > 0 && pcap != NULL)
+        options.reader[file_idx] = readahead_open(pcap, options.readahead, 
+                options.numa ? options.node[file_idx] : NUMAMEM_ANY);
+#endif
+}
+
+/**
+ * Stops file_idx's read-ahead thread, if any, so its pcap can be closed
+ */
+static void
+readahead_stop(int file_idx)
+{
+#ifdef HAVE_LIBPTHREAD
+    if (options.reader[file_idx] != NULL) {
+        if (options.reader[file_idx]->stalls > 0 && ! HAVE_OPT(QUIET))
+            notice("%s: read-ahead ran dry " COUNTER_SPEC " times",
+                    options.files[file_idx], options.reader[file_idx]->stalls);
+        readahead_close(options.reader[file_idx]);
+        options.reader[file_idx] = NULL;
+    }
+#endif
+}
+
+#ifdef ENABLE_VERBOSE
+/**
+ * Starts tcpdump for --verbose.  tcpdump wants a pcap_t for the file
+ * header, so give it a dead one with the reader's DLT and snaplen.
+ */
+static void
+verbose_open(pcapreader_t *pcap)
+{
+    pcap_t *dead;
+
+    if ((dead = pcap_open_dead(pcapreader_datalink(pcap), pcapreader_snapshot(pcap))) == NULL)
+        err(-1, "Unable to open pcap for tcpdump");
+
+    tcpdump_open(options.tcpdump, dead);
+    pcap_close(dead);
+}
+#endif
+
+/**
+ * Returns 1 unless --merge interface idx is the same as an earlier one
+ */
+static int
+merge_intf_first(int idx)
+{
+    int i;
+
+    for (i = 0; i < idx; i++) {
+        if (options.merge_intf[i] == options.merge_intf[idx])
+            return 0;
+    }
+    return 1;
+}
+
 /**
  * replay two pcap files out two interfaces
  */
@@ -307,8 +547,8 @@ replay_two_files(int file_idx1, int file_idx2)
 {
     char *path1 = options.files[file_idx1];
     char *path2 = options.files[file_idx2];
-    pcap_t *pcap1  = NULL, *pcap2 = NULL;
-    char ebuf[PCAP_ERRBUF_SIZE];
+    pcapreader_t *pcap1  = NULL, *pcap2 = NULL;
+    char ebuf[PCAPREADER_ERRBUF_SIZE];
     int dlt1, dlt2;
 
     if (! HAVE_OPT(QUIET))
@@ -323,36 +563,36 @@ replay_two_files(int file_idx1, int file_idx2)
 
     /* read from first pcap file if we haven't cached things yet */
     if (! (options.enable_file_cache || options.preload_pcap)) {
-        if ((pcap1 = pcap_open_offline(path1, ebuf)) == NULL)
+        if ((pcap1 = pcapreader_open(path1, ebuf)) == NULL)
             errx(-1, "Error opening pcap file: %s", ebuf);
     } else {
         if (!options.file_cache[file_idx1].cached)
-            if ((pcap1 = pcap_open_offline(path1, ebuf)) == NULL)
+            if ((pcap1 = pcapreader_open(path1, ebuf)) == NULL)
                 errx(-1, "Error opening pcap file: %s", ebuf);
     }
 
     /* read from second pcap file if we haven't cached things yet */
     if (! (options.enable_file_cache || options.preload_pcap)) {
-        if ((pcap2 = pcap_open_offline(path2, ebuf)) == NULL)
+        if ((pcap2 = pcapreader_open(path2, ebuf)) == NULL)
             errx(-1, "Error opening pcap file: %s", ebuf);
     } else {
         if (!options.file_cache[file_idx2].cached)
-            if ((pcap2 = pcap_open_offline(path2, ebuf)) == NULL)
+            if ((pcap2 = pcapreader_open(path2, ebuf)) == NULL)
                 errx(-1, "Error opening pcap file: %s", ebuf);
     }
 
 
     if (pcap1 != NULL) {
         dlt1 = sendpacket_get_dlt(options.intf1);
-        if ((dlt1 > 0) && (dlt1 != pcap_datalink(pcap1)))
+        if ((dlt1 > 0) && (dlt1 != pcapreader_datalink(pcap1)))
             warnx("%s DLT (%s) does not match that of the outbound interface: %s (%s)", 
-                path1, pcap_datalink_val_to_name(pcap_datalink(pcap1)), 
+                path1, pcap_datalink_val_to_name(pcapreader_datalink(pcap1)), 
                 options.intf1->device, pcap_datalink_val_to_name(dlt1));
 
         dlt2 = sendpacket_get_dlt(options.intf2);
-        if ((dlt2 > 0) && (dlt2 != pcap_datalink(pcap2)))
+        if ((dlt2 > 0) && (dlt2 != pcapreader_datalink(pcap2)))
             warnx("%s DLT (%s) does not match that of the outbound interface: %s (%s)", 
-                path2, pcap_datalink_val_to_name(pcap_datalink(pcap2)), 
+                path2, pcap_datalink_val_to_name(pcapreader_datalink(pcap2)), 
                 options.intf2->device, pcap_datalink_val_to_name(dlt2));
 
         if (dlt1 != dlt2)
@@ -364,22 +604,32 @@ replay_two_files(int file_idx1, int file_idx2)
 
         /* in cache mode, we may not have opened the file */
         if (pcap1 == NULL)
-            if ((pcap1 = pcap_open_offline(path1, ebuf)) == NULL)
+            if ((pcap1 = pcapreader_open(path1, ebuf)) == NULL)
                 errx(-1, "Error opening pcap file: %s", ebuf);
 
         /* init tcpdump */
-        tcpdump_open(options.tcpdump, pcap1);
+        verbose_open(pcap1);
     }
 #endif
 
 
+    readahead_start(file_idx1, pcap1);
+    readahead_start(file_idx2, pcap2);
     send_dual_packets(pcap1, file_idx1, pcap2, file_idx2);
+    readahead_stop(file_idx1);
+    readahead_stop(file_idx2);
 
-    if (pcap1 != NULL)
-        pcap_close(pcap1);
+    if (pcap1 != NULL) {
+        if (*pcapreader_geterr(pcap1) != '\0')
+            warnx("%s", pcapreader_geterr(pcap1));
+        pcapreader_close(pcap1);
+    }
 
-    if (pcap2 != NULL)
-        pcap_close(pcap2);
+    if (pcap2 != NULL) {
+        if (*pcapreader_geterr(pcap2) != '\0')
+            warnx("%s", pcapreader_geterr(pcap2));
+        pcapreader_close(pcap2);
+    }
 
 #ifdef ENABLE_VERBOSE
     tcpdump_close(options.tcpdump);
@@ -437,6 +687,7 @@ void
 post_args(int argc)
 {
     char *temp, *intname;
+    tcpr_cidr_t *cidr, *other;
     char ebuf[SENDPACKET_ERRBUF_SIZE];
     int int1dlt, int2dlt;
 
@@ -481,6 +732,33 @@ post_args(int argc)
     if (HAVE_OPT(STATS))
         options.stats = OPT_VALUE_STATS;
 
+    if (HAVE_OPT(LOOP_CIDR)) {
+        temp = safe_strdup(OPT_ARG(LOOP_CIDR));
+        if (!parse_cidr(&options.loop_cidr, temp, ","))
+            errx(-1, "Unable to parse --loop-cidr: %s", OPT_ARG(LOOP_CIDR));
+        safe_free(temp);
+
+        /* 
+         * an offset address may land in a different, overlapping block than
+         * the one it came from, and then the undo for the file cache would
+         * pick the wrong block, so each address may only be in one block
+         */
+        for (cidr = options.loop_cidr; cidr != NULL; cidr = cidr->next) {
+            for (other = cidr->next; other != NULL; other = other->next) {
+                if (ip_in_cidr(cidr, other->u.network) || 
+                        ip_in_cidr(other, cidr->u.network))
+                    errx(-1, "--loop-cidr blocks must not overlap: %s", 
+                            OPT_ARG(LOOP_CIDR));
+            }
+        }
+
+        options.loop_ipstep = OPT_VALUE_LOOP_IPSTEP;
+        options.loop_portstep = OPT_VALUE_LOOP_PORTSTEP;
+
+        if (options.loop == 1)
+            warn("--loop-cidr has no effect without --loop");
+    }
+
     if (HAVE_OPT(MAXSLEEP)) {
         options.maxsleep.tv_sec = OPT_VALUE_MAXSLEEP / 1000;
         options.maxsleep.tv_nsec = (OPT_VALUE_MAXSLEEP % 1000) * 1000;
@@ -508,6 +786,17 @@ post_args(int argc)
         options.enable_file_cache = TRUE;
     }
 
+#ifdef HAVE_LIBPTHREAD
+    if (HAVE_OPT(READAHEAD))
+        options.readahead = (size_t)OPT_VALUE_READAHEAD * READAHEAD_MB;
+#endif
+
+    if (HAVE_OPT(DRY_RUN)) {
+        options.dry_run = TRUE;
+        if (HAVE_OPT(DRY_RUN_BENCH))
+            options.dry_run_bench = OPT_VALUE_DRY_RUN_BENCH;
+    }
+
     if (HAVE_OPT(DUALFILE)) {
         options.dualfile = TRUE;
         if (argc < 2)
@@ -568,30 +857,68 @@ post_args(int argc)
     }
 #endif
 
+    /* after --timer and --rdtsc-clicks, the pacer times its waits at startup */
+    if (HAVE_OPT(BURST)) {
+        if (options.speed.mode != SPEED_PACKETRATE && options.speed.mode != SPEED_MBPSRATE)
+            err(-1, "--burst requires --pps or --mbps");
+        options.burst = burst_new(OPT_VALUE_BURST_MAX, options.accurate);
+    }
+
     if (HAVE_OPT(PKTLEN))
         warn("--pktlen may cause problems.  Use with caution.");
 
+#ifdef TCPREPLAY_FRAGROUTE
+    if (HAVE_OPT(FRAGROUTE))
+        options.fragroute_args = safe_strdup(OPT_ARG(FRAGROUTE));
+#endif
 
-    if ((intname = get_interface(intlist, OPT_ARG(INTF1))) == NULL)
-        errx(-1, "Invalid interface name/alias: %s", OPT_ARG(INTF1));
 
-    options.intf1_name = safe_strdup(intname);
+    if (HAVE_OPT(MERGE)) {
+        post_args_merge(intlist, argc);
+    } else {
+        if (! HAVE_OPT(INTF1))
+            err(-1, "Either --intf1 or --merge is required");
 
-    /* open interfaces for writing */
-    if ((options.intf1 = sendpacket_open(&options, options.intf1_name, ebuf, TCPR_DIR_C2S)) == NULL)
-        errx(-1, "Can't open %s: %s", options.intf1_name, ebuf);
+        if (sendpacket_is_pseudo(OPT_ARG(INTF1)))
+            intname = (char *)OPT_ARG(INTF1);
+        else if ((intname = get_interface(intlist, OPT_ARG(INTF1))) == NULL)
+            errx(-1, "Invalid interface name/alias: %s", OPT_ARG(INTF1));
 
-    int1dlt = sendpacket_get_dlt(options.intf1);
+        options.intf1_name = safe_strdup(intname);
+    }
 
     if (HAVE_OPT(INTF2)) {
         if (! HAVE_OPT(CACHEFILE) && ! HAVE_OPT(DUALFILE))
             err(-1, "--intf2 requires either --cachefile or --dualfile");
 
-        if ((intname = get_interface(intlist, OPT_ARG(INTF2))) == NULL)
+        if (sendpacket_is_pseudo(OPT_ARG(INTF2)))
+            intname = (char *)OPT_ARG(INTF2);
+        else if ((intname = get_interface(intlist, OPT_ARG(INTF2))) == NULL)
             errx(-1, "Invalid interface name/alias: %s", OPT_ARG(INTF2));
 
         options.intf2_name = safe_strdup(intname);
+    }
+
+    /* 
+     * sendpacket_open() starts the TX ring and memring helper threads,
+     * which apply cpusched_helper and inherit the --numa pin
+     */
+    if (HAVE_OPT(NUMA))
+        post_args_numa(argc);
 
+    post_args_sched();
+
+    if (options.merge) {
+        post_args_merge_open();
+    } else {
+        /* open interfaces for writing */
+        if ((options.intf1 = sendpacket_open(&options, options.intf1_name, ebuf, TCPR_DIR_C2S)) == NULL)
+            errx(-1, "Can't open %s: %s", options.intf1_name, ebuf);
+    }
+
+    int1dlt = sendpacket_get_dlt(options.intf1);
+
+    if (HAVE_OPT(INTF2)) {
         /* open interface for writing */
         if ((options.intf2 = sendpacket_open(&options, options.intf2_name, ebuf, TCPR_DIR_S2C)) == NULL)
             errx(-1, "Can't open %s: %s", options.intf2_name, ebuf);
@@ -610,9 +937,202 @@ post_args(int argc)
         safe_free(temp);
     }
 
-    if (! HAVE_OPT(QUIET))
+    if (! HAVE_OPT(QUIET) && options.merge) {
+        notice("merging %d files out %s", argc, OPT_ARG(MERGE));
+    } else if (! HAVE_OPT(QUIET)) {
         notice("sending out %s %s", options.intf1_name,
                 options.intf2_name == NULL ? "" : options.intf2_name);
+    }
+
+    post_args_sender();
+}
+
+/**
+ * Reads the --merge interfaces, the first one stands in for --intf1
+ */
+static void
+post_args_merge(interface_list_t *intlist, int argc)
+{
+    char *list, *name, *intname, *token = NULL;
+
+    options.merge = TRUE;
+    list = safe_strdup(OPT_ARG(MERGE));
+    for (name = strtok_r(list, ",", &token); name != NULL; name = strtok_r(NULL, ",", &token)) {
+        if (options.merge_count == MAX_FILES)
+            errx(-1, "Too many --merge interfaces, the limit is %d", MAX_FILES);
+
+        if (sendpacket_is_pseudo(name))
+            intname = name;
+        else if ((intname = get_interface(intlist, name)) == NULL)
+            errx(-1, "Invalid interface name/alias: %s", name);
+
+        options.merge_name[options.merge_count++] = safe_strdup(intname);
+    }
+    safe_free(list);
+
+    if (options.merge_count == 0)
+        err(-1, "--merge needs at least one interface");
+    if (HAVE_OPT(SPLIT_IFID))
+        options.split_ifid = TRUE;
+    else if (options.merge_count > argc)
+        warnx("--merge lists %d interfaces for only %d files", options.merge_count, argc);
+
+    options.intf1_name = safe_strdup(options.merge_name[0]);
+
+#if defined HAVE_LIBPTHREAD && ! defined TCPREPLAY_EDIT
+    if (HAVE_OPT(MERGE_THREADS))
+        options.merge_threads = TRUE;
+#endif
+}
+
+/**
+ * Opens the --merge interfaces.  Interfaces listed more than once share
+ * a sendpacket_t.
+ */
+static void
+post_args_merge_open(void)
+{
+    char ebuf[SENDPACKET_ERRBUF_SIZE];
+    int i, j;
+
+    for (i = 0; i < options.merge_count; i++) {
+        for (j = 0; j < i; j++) {
+            if (strcmp(options.merge_name[j], options.merge_name[i]) == 0) {
+                options.merge_intf[i] = options.merge_intf[j];
+                break;
+            }
+        }
+
+        if (j == i &&
+                (options.merge_intf[i] = sendpacket_open(&options, options.merge_name[i], ebuf, TCPR_DIR_C2S)) == NULL)
+            errx(-1, "Can't open %s: %s", options.merge_name[i], ebuf);
+    }
+
+    options.intf1 = options.merge_intf[0];
+}
+
+/**
+ * --numa: finds the node of each file's output interface, gives every
+ * node a cache arena and pins the main thread, which sends everything
+ * but --merge-threads, to the node of the first interface.  Threads
+ * started later inherit that and re-pin themselves if their interface
+ * is elsewhere.
+ */
+static void
+post_args_numa(int argc)
+{
+    numamem_arena_t *arenas[MAX_FILES];
+    const char *device;
+    char cpulist[256];
+    int i, j, narenas = 0;
+
+    options.numa = TRUE;
+
+    for (i = 0; i < argc; i++) {
+        if (options.merge)
+            device = options.merge_name[i % options.merge_count];
+        else if (options.dualfile && (i % 2) == 1)
+            device = options.intf2_name;
+        else
+            device = options.intf1_name;
+        options.node[i] = numamem_intf_node(device);
+
+        for (j = 0; j < narenas && arenas[j]->node != options.node[i]; j++)
+            ;
+        if (j == narenas) {
+            arenas[narenas++] = numamem_arena_new(options.node[i]);
+            if (! HAVE_OPT(QUIET) && options.node[i] == NUMAMEM_ANY)
+                notice("NUMA: %s has no NUMA node, using local memory", device);
+            else if (! HAVE_OPT(QUIET))
+                notice("NUMA: %s is on node %d", device, options.node[i]);
+        }
+        options.arena[i] = arenas[j];
+    }
+
+    if (options.node[0] == NUMAMEM_ANY)
+        return;
+    if (numamem_bind_node(options.node[0], cpulist, sizeof(cpulist)) < 0)
+        warnx("NUMA: unable to pin to the CPUs of node %d", options.node[0]);
+    else if (! HAVE_OPT(QUIET))
+        notice("NUMA: sending from node %d, CPUs %s", options.node[0], cpulist);
+}
+
+/**
+ * --sender-cpus, --helper-cpus and --sched-fifo.  Threads apply their
+ * cpusched_t when they start, so this comes before anything starts one.
+ */
+static void
+post_args_sched(void)
+{
+    char errbuf[CPUSCHED_ERRBUF_SIZE];
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    if (HAVE_OPT(SENDER_CPUS) && cpusched_parse(&cpusched_sender, OPT_ARG(SENDER_CPUS), errbuf) < 0)
+        errx(-1, "--sender-cpus: %s", errbuf);
+    if (HAVE_OPT(HELPER_CPUS) && cpusched_parse(&cpusched_helper, OPT_ARG(HELPER_CPUS), errbuf) < 0)
+        errx(-1, "--helper-cpus: %s", errbuf);
+
+    /* helpers started once the main thread is pinned mustn't share its CPU */
+    if (HAVE_OPT(SENDER_CPUS) && ! HAVE_OPT(HELPER_CPUS) && cpusched_save(&cpusched_helper, errbuf) < 0)
+        errx(-1, "--sender-cpus: %s", errbuf);
+#endif
+#ifdef HAVE_LIBPTHREAD
+    if (HAVE_OPT(SCHED_FIFO)) {
+        cpusched_sender.priority = OPT_VALUE_SCHED_FIFO;
+        cpusched_helper.priority = OPT_VALUE_SCHED_FIFO;
+    }
+#endif
+}
+
+/**
+ * Applies the sender class to the main thread, and --mlockall
+ */
+static void
+post_args_sender(void)
+{
+    char errbuf[CPUSCHED_ERRBUF_SIZE];
+    int cpu;
+
+    if (cpusched_apply(&cpusched_sender, &cpu, errbuf) < 0)
+        errx(-1, "%s", errbuf);
+    if (cpu >= 0 && ! HAVE_OPT(QUIET))
+        notice("sending from CPU %d", cpu);
+
+#ifdef HAVE_MLOCKALL
+    if (HAVE_OPT(MLOCKALL) && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        errx(-1, "Unable to lock memory: %s", strerror(errno));
+#endif
+}
+
+/**
+ * Reports where the --preload-pcap cache of each node ended up
+ */
+static void
+numa_report(int argc)
+{
+    numamem_arena_t *arena;
+    int i, j;
+
+    for (i = 0; i < argc; i++) {
+        arena = options.arena[i];
+
+        /* files sharing an arena share a line */
+        for (j = 0; j < i && options.arena[j] != arena; j++)
+            ;
+        if (j < i || arena->chunks == 0)
+            continue;
+
+        if (! HAVE_OPT(QUIET))
+            notice("NUMA: preload cache for node %d: %.1f MB in " COUNTER_SPEC " chunks, " 
+                    COUNTER_SPEC " in huge pages", arena->node, 
+                    (double)arena->bytes / (1024 * 1024), arena->chunks, arena->huge);
+        if (arena->huge < arena->chunks)
+            warn("NUMA: not enough huge pages for the preload cache, "
+                    "see /proc/sys/vm/nr_hugepages");
+        if (arena->remote > 0)
+            warnx("NUMA: " COUNTER_SPEC " of " COUNTER_SPEC " preload chunks for node %d "
+                    "fell back to another node", arena->remote, arena->chunks, arena->node);
+    }
 }
 
 /*
@@ -37,6 +37,11 @@
 #include "defines.h"
 #include "common/sendpacket.h"
 #include "common/tcpdump.h"
+#include "common/pcapreader.h"
+#include "common/numamem.h"
+#include "gen_packets.h"
+#include "readahead.h"
+#include "burst.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -46,8 +51,15 @@
 #include <dmalloc.h>
 #endif
 
+/* only tcpreplay-edit links against libfragroute */
+#if defined TCPREPLAY_EDIT && defined ENABLE_FRAGROUTE
+#define TCPREPLAY_FRAGROUTE
+#include "fragroute/fragroute.h"
+#endif
+
 struct packet_cache_s {
     struct pcap_pkthdr pkthdr;
+    pcapreader_meta_t meta;     /* nanosecond timestamp and interface */
     u_char *pktdata;
 
     struct packet_cache_s *next;
@@ -58,6 +70,7 @@ typedef struct packet_cache_s packet_cache_t;
 typedef struct {
     int index;
     int cached;
+    int dlt;
     packet_cache_t *packet_cache;
 } file_cache_t;
 
@@ -78,8 +91,19 @@ struct tcpreplay_opt_s {
     enum sleep_mode_t sleep_mode;
     u_int32_t loop;
     int sleep_accel;
+
+    /* per-loop IPv4 address/port offsetting */
+    tcpr_cidr_t *loop_cidr;
+    u_int32_t loop_ipstep;
+    u_int16_t loop_portstep;
+    u_int32_t loop_iteration;
+    u_int64_t loop_ipoffset;        /* loop_iteration * loop_ipstep */
+    u_int16_t loop_portoffset;      /* loop_iteration * loop_portstep, mod 64512 */
     struct timespec maxsleep;
 
+    /* --burst pacing, NULL when every packet is timed on its own */
+    burst_t *burst;
+
     int stats;
 
     /* tcpprep cache data */
@@ -101,6 +125,16 @@ struct tcpreplay_opt_s {
 #define ACCURATE_ABS_TIME   5
 
     char *files[MAX_FILES];
+    gen_t *gen[MAX_FILES];      /* set for gen: files, see gen_packets.c */
+
+    /* --readahead buffer in bytes, and the reader of each file being sent */
+    size_t readahead;
+    readahead_t *reader[MAX_FILES];
+
+    /* --numa: the node of each file's output interface and its cache arena */
+    int numa;
+    int node[MAX_FILES];
+    numamem_arena_t *arena[MAX_FILES];
     COUNTER limit_send;
 
 #ifdef ENABLE_VERBOSE
@@ -115,8 +149,26 @@ struct tcpreplay_opt_s {
     file_cache_t *file_cache;
     int preload_pcap;
 
+    /* report what a replay needs instead of replaying */
+    int dry_run;
+    COUNTER dry_run_bench;
+
     /* dual file mode */
     int dualfile;
+
+    /* --merge: all files at once, file i goes out merge_intf[i % merge_count] */
+    int merge;
+    int merge_count;
+    sendpacket_t *merge_intf[MAX_FILES];
+    char *merge_name[MAX_FILES];
+    int merge_threads;
+    int split_ifid;             /* pcapng interface i goes out merge_intf[i % merge_count] */
+
+#ifdef TCPREPLAY_FRAGROUTE
+    /* fragment packets on the fly */
+    char *fragroute_args;
+    fragroute_t *frag_ctx;
+#endif
 };
 
 typedef struct tcpreplay_opt_s tcpreplay_opt_t;
@@ -50,6 +50,10 @@
 #include <unistd.h>
 #include <errno.h>
 
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
 #include "tcprewrite.h"
 #include "tcprewrite_opts.h"
 #include "tcpedit/tcpedit.h"
@@ -71,12 +75,82 @@ void tcprewrite_init(void);
 void post_args(int argc, char *argv[]);
 void verify_input_pcap(pcap_t *pcap);
 int rewrite_packets(tcpedit_t *tcpedit, pcap_t *pin, pcap_dumper_t *pout);
+void write_packet(tcpedit_t *tcpedit, pcap_dumper_t *pout, struct pcap_pkthdr *pkthdr_ptr,
+        u_char *pktdata, tcpr_dir_t cache_result, COUNTER packetnum);
+void dump_packet(pcap_dumper_t *pout, struct pcap_pkthdr *pkthdr_ptr, u_char *pktdata);
+
+#ifdef HAVE_LIBPTHREAD
+/* 
+ * Number of packet buffers per edit thread.  This bounds how far the
+ * reader can get ahead of the writer.
+ */
+#define REWRITE_SLOTS_PER_THREAD 64
+
+enum rewrite_slot_state_t {
+    SLOT_FREE = 0,      /* owned by the reader */
+    SLOT_READ,          /* waiting for/owned by an edit thread */
+    SLOT_EDITED         /* waiting for the writer */
+};
+
+/* a packet buffer in the pipeline */
+struct rewrite_slot_s {
+    struct pcap_pkthdr pkthdr;
+    u_char *pktdata;
+    COUNTER packetnum;
+    tcpr_dir_t cache_result;
+    int rcode;                  /* result of tcpedit_packet() */
+    tcpedit_t *tcpedit;         /* context which edited the packet */
+    enum rewrite_slot_state_t state;
+#ifdef ENABLE_FRAGROUTE
+    int fragrouted;             /* write frags instead of pktdata */
+    u_char *frags;              /* u_int32_t length + fragment, back to back */
+    size_t frags_len;
+    size_t frags_size;
+#endif
+};
+typedef struct rewrite_slot_s rewrite_slot_t;
+
+/*
+ * Shared state of the reader -> edit threads -> writer pipeline.  Packet
+ * N always uses slot (N - 1) % numslots, so the slots double as the buffer
+ * pool and the reorder buffer for the writer.
+ */
+struct rewrite_pipeline_s {
+    pthread_mutex_t lock;
+    pthread_cond_t readable;    /* reader waits for a free slot */
+    pthread_cond_t editable;    /* edit threads wait for a packet */
+    pthread_cond_t writable;    /* writer waits for the next packet */
+    rewrite_slot_t *slots;
+    int numslots;
+    COUNTER next_read;          /* packetnum of the next packet to read */
+    COUNTER next_edit;          /* ... to edit */
+    COUNTER next_write;         /* ... to write */
+    int eof;
+    pcap_t *pin;
+};
+typedef struct rewrite_pipeline_s rewrite_pipeline_t;
+
+/* an edit thread and its private tcpedit and fragroute contexts */
+struct rewrite_worker_s {
+    pthread_t thread;
+    tcpedit_t *tcpedit;
+#ifdef ENABLE_FRAGROUTE
+    fragroute_t *frag_ctx;
+    char *frag;
+#endif
+    rewrite_pipeline_t *pipeline;
+};
+typedef struct rewrite_worker_s rewrite_worker_t;
+
+int rewrite_packets_mt(tcpedit_t *tcpedit, pcap_t *pin, pcap_dumper_t *pout, int threads);
+#endif
 
 int 
 main(int argc, char *argv[])
 {
     int optct, rcode;
     pcap_t *dlt_pcap;
+    char werrbuf[PCAPWRITER_ERRBUF_SIZE];
 #ifdef ENABLE_FRAGROUTE
     char ebuf[FRAGROUTE_ERRBUF_LEN];
 #endif
@@ -132,17 +206,39 @@ main(int argc, char *argv[])
     }
 #endif
 
-    if ((options.pout = pcap_dump_open(dlt_pcap, options.outfile)) == NULL)
+    /* 
+     * write files via our own buffering, but libpcap's pcap_dump() 
+     * can still handle STDOUT
+     */
+    if (strcmp(options.outfile, "-") != 0) {
+        if ((options.writer = pcapwriter_open(options.outfile, pcap_datalink(dlt_pcap), 
+                65535, options.write_bufsize, options.write_flags, werrbuf)) == NULL)
+            errx(-1, "Unable to open output pcap file: %s", werrbuf);
+    } else if (options.write_flags & PCAPWRITER_DIRECT) {
+        err(-1, "--direct-io can not be used when writing to STDOUT");
+    } else if ((options.pout = pcap_dump_open(dlt_pcap, options.outfile)) == NULL) {
         errx(-1, "Unable to open output pcap file: %s", pcap_geterr(dlt_pcap));
+    }
     pcap_close(dlt_pcap);
 
     /* rewrite packets */
+#ifdef HAVE_LIBPTHREAD
+    if (options.threads > 1) {
+        if (rewrite_packets_mt(tcpedit, options.pin, options.pout, options.threads) != 0)
+            errx(-1, "Error rewriting packets: %s", tcpedit_geterr(tcpedit));
+    } else
+#endif
     if (rewrite_packets(tcpedit, options.pin, options.pout) != 0)
         errx(-1, "Error rewriting packets: %s", tcpedit_geterr(tcpedit));
 
 
     /* clean up after ourselves */
-    pcap_dump_close(options.pout);
+    if (options.writer != NULL) {
+        if (pcapwriter_close(options.writer) < 0)
+            errx(-1, "Error writing output pcap file: %s", pcapwriter_geterr(options.writer));
+    } else {
+        pcap_dump_close(options.pout);
+    }
     pcap_close(options.pin);
 
 #ifdef ENABLE_VERBOSE
@@ -160,6 +256,7 @@ tcprewrite_init(void)
 {
 
     memset(&options, 0, sizeof(options));
+    options.threads = 1;
 
 #ifdef ENABLE_VERBOSE
     /* clear out tcpdump struct */
@@ -214,6 +311,17 @@ post_args(_U_ int argc, _U_ char *argv[])
     }
 #endif
 
+#ifdef HAVE_LIBPTHREAD
+    if (HAVE_OPT(THREADS))
+        options.threads = OPT_VALUE_THREADS;
+#endif
+
+    if (HAVE_OPT(DIRECT_IO))
+        options.write_flags |= PCAPWRITER_DIRECT;
+
+    if (HAVE_OPT(WRITE_BUFSIZE))
+        options.write_bufsize = (size_t)OPT_VALUE_WRITE_BUFSIZE * 1024;
+
     /* open up the input file */
     options.infile = safe_strdup(OPT_ARG(INFILE));
     if ((options.pin = pcap_open_offline(options.infile, ebuf)) == NULL)
@@ -238,20 +346,16 @@ rewrite_packets(tcpedit_t *tcpedit, pcap_t *pin, pcap_dumper_t *pout)
     const u_char *pktconst = NULL;              /* packet from libpcap */
     u_char **pktdata = NULL;
     static u_char *pktdata_buff;
-    static char *frag = NULL;
     COUNTER packetnum = 0;
-    int rcode, frag_len, i, proto;
+    int rcode;
 
     pkthdr_ptr = &pkthdr;
 
-    if (pktdata_buff == NULL)
+    if (pktdata_buff == NULL && options.writer == NULL)
         pktdata_buff = (u_char *)safe_malloc(MAXPACKET);
 
     pktdata = &pktdata_buff;
 
-    if (frag == NULL)
-        frag = (char *)safe_malloc(MAXPACKET);
-
     /* MAIN LOOP 
      * Keep sending while we have packets or until
      * we've sent enough packets
@@ -260,6 +364,15 @@ rewrite_packets(tcpedit_t *tcpedit, pcap_t *pin, pcap_dumper_t *pout)
         packetnum++;
         dbgx(2, "packet " COUNTER_SPEC " caplen %d", packetnum, pkthdr.caplen);
 
+        /* 
+         * edit the packet in place in the output buffer so it doesn't
+         * need to be copied again when we write it out
+         */
+        if (options.writer != NULL) {
+            if ((pktdata_buff = pcapwriter_getbuf(options.writer, MAXPACKET)) == NULL)
+                errx(-1, "Error writing output pcap file: %s", pcapwriter_geterr(options.writer));
+        }
+
         /* 
          * copy over the packet so we can pad it out if necessary and
          * because pcap_next() returns a const ptr
@@ -282,58 +395,405 @@ rewrite_packets(tcpedit_t *tcpedit, pcap_t *pin, pcap_dumper_t *pout)
          * file will loose it's indexing
          */
 
-        if (cache_result == TCPR_DIR_NOSEND)
-            goto WRITE_PACKET; /* still need to write it so cache stays in sync */
-
-        if ((rcode = tcpedit_packet(tcpedit, &pkthdr_ptr, pktdata, cache_result)) == TCPEDIT_ERROR) {
-            return -1;
-        } else if ((rcode == TCPEDIT_SOFT_ERROR) && HAVE_OPT(SKIP_SOFT_ERRORS)) {
-            /* don't write packet */
-            dbgx(1, "Packet " COUNTER_SPEC " is suppressed from being written due to soft errors", packetnum);
-            continue;
+        if (cache_result != TCPR_DIR_NOSEND) {
+            if ((rcode = tcpedit_packet(tcpedit, &pkthdr_ptr, pktdata, cache_result)) == TCPEDIT_ERROR) {
+                return -1;
+            } else if ((rcode == TCPEDIT_SOFT_ERROR) && HAVE_OPT(SKIP_SOFT_ERRORS)) {
+                /* don't write packet */
+                dbgx(1, "Packet " COUNTER_SPEC " is suppressed from being written due to soft errors", packetnum);
+                continue;
+            }
         }
 
+        /* still need to write NOSEND packets so cache stays in sync */
+        write_packet(tcpedit, pout, pkthdr_ptr, *pktdata, cache_result, packetnum);
+    } /* while() */
+    return 0;
+}
 
-WRITE_PACKET:
 #ifdef ENABLE_FRAGROUTE
-        if (options.frag_ctx == NULL) {
-            /* write the packet when there's no fragrouting to be done */
-            pcap_dump((u_char *)pout, pkthdr_ptr, *pktdata);
-        } else {
-            /* get the L3 protocol of the packet */
-            proto = tcpedit_l3proto(tcpedit, AFTER_PROCESS, *pktdata, pkthdr_ptr->caplen);
-
-            /* packet is IPv4/IPv6 AND needs to be fragmented */
-            if ((proto ==  ETHERTYPE_IP || proto == ETHERTYPE_IP6) &&
-                ((options.fragroute_dir == FRAGROUTE_DIR_BOTH) ||
-                 (cache_result == TCPR_DIR_C2S && options.fragroute_dir == FRAGROUTE_DIR_C2S) ||
-                 (cache_result == TCPR_DIR_S2C && options.fragroute_dir == FRAGROUTE_DIR_S2C))) {
-
-                if (fragroute_process(options.frag_ctx, *pktdata, pkthdr_ptr->caplen) < 0)
-                    errx(-1, "Error processing packet via fragroute: %s", options.frag_ctx->errbuf);
-
-                i = 0;
-                while ((frag_len = fragroute_getfragment(options.frag_ctx, &frag)) > 0) {
-                    /* frags get the same timestamp as the original packet */
-                    dbgx(1, "processing packet " COUNTER_SPEC " frag: %u (%d)", packetnum, i++, frag_len);
-                    pkthdr_ptr->caplen = frag_len;
-                    pkthdr_ptr->len = frag_len;
-                    pcap_dump((u_char *)pout, pkthdr_ptr, (u_char *)frag);
-                }
-            } else {
-                /* write the packet without fragroute */
-                pcap_dump((u_char *)pout, pkthdr_ptr, *pktdata);
+/**
+ * Returns true if the packet is IPv4/IPv6 and in a direction that
+ * --fragdir wants fragmented
+ */
+static int
+want_fragroute(tcpedit_t *tcpedit, struct pcap_pkthdr *pkthdr_ptr, u_char *pktdata,
+        tcpr_dir_t cache_result)
+{
+    int proto;
+
+    /* get the L3 protocol of the packet */
+    proto = tcpedit_l3proto(tcpedit, AFTER_PROCESS, pktdata, pkthdr_ptr->caplen);
+
+    return ((proto ==  ETHERTYPE_IP || proto == ETHERTYPE_IP6) &&
+            ((options.fragroute_dir == FRAGROUTE_DIR_BOTH) ||
+             (cache_result == TCPR_DIR_C2S && options.fragroute_dir == FRAGROUTE_DIR_C2S) ||
+             (cache_result == TCPR_DIR_S2C && options.fragroute_dir == FRAGROUTE_DIR_S2C)));
+}
+#endif
+
+/**
+ * Writes an edited packet to the output file, running it through
+ * fragroute first if required
+ */
+void
+write_packet(_U_ tcpedit_t *tcpedit, pcap_dumper_t *pout, struct pcap_pkthdr *pkthdr_ptr,
+        u_char *pktdata, _U_ tcpr_dir_t cache_result, _U_ COUNTER packetnum)
+{
+#ifdef ENABLE_FRAGROUTE
+    static char *frag = NULL;
+    int frag_len, i;
+
+    if (frag == NULL)
+        frag = (char *)safe_malloc(MAXPACKET);
+
+    if (options.frag_ctx == NULL) {
+        /* write the packet when there's no fragrouting to be done */
+        dump_packet(pout, pkthdr_ptr, pktdata);
+    } else {
+        if (want_fragroute(tcpedit, pkthdr_ptr, pktdata, cache_result)) {
+            if (fragroute_process(options.frag_ctx, pktdata, pkthdr_ptr->caplen) < 0)
+                errx(-1, "Error processing packet via fragroute: %s", options.frag_ctx->errbuf);
+
+            i = 0;
+            while ((frag_len = fragroute_getfragment(options.frag_ctx, &frag)) > 0) {
+                /* frags get the same timestamp as the original packet */
+                dbgx(1, "processing packet " COUNTER_SPEC " frag: %u (%d)", packetnum, i++, frag_len);
+                pkthdr_ptr->caplen = frag_len;
+                pkthdr_ptr->len = frag_len;
+                dump_packet(pout, pkthdr_ptr, (u_char *)frag);
             }
+        } else {
+            /* write the packet without fragroute */
+            dump_packet(pout, pkthdr_ptr, pktdata);
         }
+    }
 #else
     /* write the packet when there's no fragrouting to be done */
-    pcap_dump((u_char *)pout, pkthdr_ptr, *pktdata);
+    dump_packet(pout, pkthdr_ptr, pktdata);
+#endif
+}
+
+/**
+ * Writes a single packet to the output file
+ */
+void
+dump_packet(pcap_dumper_t *pout, struct pcap_pkthdr *pkthdr_ptr, u_char *pktdata)
+{
+    if (options.writer != NULL) {
+        if (pcapwriter_write(options.writer, pkthdr_ptr, pktdata) < 0)
+            errx(-1, "Error writing output pcap file: %s", pcapwriter_geterr(options.writer));
+    } else {
+        pcap_dump((u_char *)pout, pkthdr_ptr, pktdata);
+    }
+}
+
+#ifdef HAVE_LIBPTHREAD
+/**
+ * Reader thread: reads packets from the input file into free slots
+ * in packet order and hands them to the edit threads
+ */
+static void *
+rewrite_reader(void *arg)
+{
+    rewrite_pipeline_t *pipeline = (rewrite_pipeline_t *)arg;
+    rewrite_slot_t *slot;
+    const u_char *pktconst;
+    COUNTER packetnum = 0;
 
+    while (1) {
+        packetnum++;
+        slot = &pipeline->slots[(packetnum - 1) % pipeline->numslots];
+
+        /* wait for the writer to be done with this slot */
+        pthread_mutex_lock(&pipeline->lock);
+        while (slot->state != SLOT_FREE)
+            pthread_cond_wait(&pipeline->readable, &pipeline->lock);
+        pthread_mutex_unlock(&pipeline->lock);
+
+        /* free slots belong to us, so no need to hold the lock */
+        if ((pktconst = pcap_next(pipeline->pin, &slot->pkthdr)) == NULL)
+            break;
+
+        dbgx(2, "packet " COUNTER_SPEC " caplen %d", packetnum, slot->pkthdr.caplen);
+        memcpy(slot->pktdata, pktconst, slot->pkthdr.caplen);
+        slot->packetnum = packetnum;
+        slot->cache_result = TCPR_DIR_C2S;
+
+#ifdef ENABLE_VERBOSE
+        if (options.verbose)
+            tcpdump_print(&tcpdump, &slot->pkthdr, slot->pktdata);
 #endif
-    } /* while() */
-    return 0;
+
+        /* Dual nic processing? */
+        if (options.cachedata != NULL)
+            slot->cache_result = check_cache(options.cachedata, packetnum);
+
+        pthread_mutex_lock(&pipeline->lock);
+        slot->state = SLOT_READ;
+        pipeline->next_read = packetnum + 1;
+        pthread_cond_signal(&pipeline->editable);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->eof = 1;
+    pthread_cond_broadcast(&pipeline->editable);
+    pthread_cond_broadcast(&pipeline->writable);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+#ifdef ENABLE_FRAGROUTE
+/**
+ * Runs an edited packet through the edit thread's fragroute context and
+ * stashes the fragments in the slot for the writer
+ */
+static void
+rewrite_fragroute(rewrite_worker_t *worker, rewrite_slot_t *slot)
+{
+    u_int32_t frag_len;
+    size_t need;
+    int len;
+
+    if (fragroute_process(worker->frag_ctx, slot->pktdata, slot->pkthdr.caplen) < 0)
+        errx(-1, "Error processing packet via fragroute: %s", worker->frag_ctx->errbuf);
+
+    slot->fragrouted = 1;
+    while ((len = fragroute_getfragment(worker->frag_ctx, &worker->frag)) > 0) {
+        frag_len = len;
+        need = slot->frags_len + sizeof(frag_len) + frag_len;
+        if (need > slot->frags_size) {
+            slot->frags_size = need * 2;
+            slot->frags = (u_char *)safe_realloc(slot->frags, slot->frags_size);
+        }
+        memcpy(&slot->frags[slot->frags_len], &frag_len, sizeof(frag_len));
+        memcpy(&slot->frags[slot->frags_len + sizeof(frag_len)], worker->frag, frag_len);
+        slot->frags_len = need;
+    }
+}
+
+/**
+ * Writes the fragments of a slot, each with the original packet's timestamp
+ */
+static void
+rewrite_write_frags(pcap_dumper_t *pout, rewrite_slot_t *slot)
+{
+    u_int32_t frag_len;
+    size_t off = 0;
+
+    while (off < slot->frags_len) {
+        memcpy(&frag_len, &slot->frags[off], sizeof(frag_len));
+        off += sizeof(frag_len);
+        slot->pkthdr.caplen = frag_len;
+        slot->pkthdr.len = frag_len;
+        dump_packet(pout, &slot->pkthdr, &slot->frags[off]);
+        off += frag_len;
+    }
 }
+#endif
+
+/**
+ * Edit thread: takes the next unedited packet, runs it through this
+ * thread's tcpedit and fragroute contexts and marks it ready for the writer.  Since 
+ * --seed randomizes each address purely as a function of the address and
+ * the seed, the output doesn't depend on which thread edits which packet.
+ */
+static void *
+rewrite_worker(void *arg)
+{
+    rewrite_worker_t *worker = (rewrite_worker_t *)arg;
+    rewrite_pipeline_t *pipeline = worker->pipeline;
+    rewrite_slot_t *slot;
+    struct pcap_pkthdr *pkthdr_ptr;
+    COUNTER packetnum;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (1) {
+        while (pipeline->next_edit == pipeline->next_read && ! pipeline->eof)
+            pthread_cond_wait(&pipeline->editable, &pipeline->lock);
+
+        if (pipeline->next_edit == pipeline->next_read)
+            break; /* EOF and nothing left to edit */
+
+        packetnum = pipeline->next_edit++;
+        slot = &pipeline->slots[(packetnum - 1) % pipeline->numslots];
+        pthread_mutex_unlock(&pipeline->lock);
+
+        /* NOSEND packets are written unedited so the cache stays in sync */
+        slot->rcode = TCPEDIT_OK;
+        slot->tcpedit = worker->tcpedit;
+        if (slot->cache_result != TCPR_DIR_NOSEND) {
+            pkthdr_ptr = &slot->pkthdr;
+            slot->rcode = tcpedit_packet(worker->tcpedit, &pkthdr_ptr, 
+                    &slot->pktdata, slot->cache_result);
+        }
+
+#ifdef ENABLE_FRAGROUTE
+        slot->fragrouted = 0;
+        slot->frags_len = 0;
+        if (worker->frag_ctx != NULL && slot->rcode != TCPEDIT_ERROR &&
+                ! (slot->rcode == TCPEDIT_SOFT_ERROR && HAVE_OPT(SKIP_SOFT_ERRORS)) &&
+                want_fragroute(worker->tcpedit, &slot->pkthdr, slot->pktdata, slot->cache_result))
+            rewrite_fragroute(worker, slot);
+#endif
+
+        pthread_mutex_lock(&pipeline->lock);
+        slot->state = SLOT_EDITED;
+        if (packetnum == pipeline->next_write)
+            pthread_cond_signal(&pipeline->writable);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+/**
+ * Multi-threaded version of rewrite_packets().  A reader thread feeds
+ * packets to threads edit threads, each with their own tcpedit context
+ * and the calling thread writes the packets out in their original order.
+ */
+int
+rewrite_packets_mt(tcpedit_t *tcpedit, pcap_t *pin, pcap_dumper_t *pout, int threads)
+{
+    rewrite_pipeline_t pipeline;
+    rewrite_worker_t *workers;
+    rewrite_slot_t *slot;
+    pthread_t reader;
+    u_char *buffers;
+    int i, done;
+#ifdef ENABLE_FRAGROUTE
+    char ebuf[FRAGROUTE_ERRBUF_LEN];
+#endif
 
+    assert(threads > 1);
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.readable, NULL);
+    pthread_cond_init(&pipeline.editable, NULL);
+    pthread_cond_init(&pipeline.writable, NULL);
+    pipeline.pin = pin;
+    pipeline.next_read = pipeline.next_edit = pipeline.next_write = 1;
+
+    /* all the packet buffers are allocated up front and recycled */
+    pipeline.numslots = threads * REWRITE_SLOTS_PER_THREAD;
+    pipeline.slots = (rewrite_slot_t *)safe_malloc(pipeline.numslots * sizeof(rewrite_slot_t));
+    buffers = (u_char *)safe_malloc(pipeline.numslots * MAXPACKET);
+    for (i = 0; i < pipeline.numslots; i++)
+        pipeline.slots[i].pktdata = &buffers[i * MAXPACKET];
+
+    /* 
+     * tcpedit contexts aren't thread safe, so each edit thread gets its own.
+     * any warnings were already printed when we parsed tcpedit's args
+     */
+    workers = (rewrite_worker_t *)safe_malloc(threads * sizeof(rewrite_worker_t));
+    for (i = 0; i < threads; i++) {
+        workers[i].pipeline = &pipeline;
+        if (tcpedit_init(&workers[i].tcpedit, pcap_datalink(pin)) < 0)
+            errx(-1, "Error initializing tcpedit: %s", tcpedit_geterr(workers[i].tcpedit));
+
+        if (tcpedit_post_args(&workers[i].tcpedit) < 0)
+            errx(-1, "Unable to parse args: %s", tcpedit_geterr(workers[i].tcpedit));
+
+        if (tcpedit_validate(workers[i].tcpedit) < 0)
+            errx(-1, "Unable to edit packets given options:\n%s",
+                    tcpedit_geterr(workers[i].tcpedit));
+
+#ifdef ENABLE_FRAGROUTE
+        /* fragroute contexts are independent, so every thread gets one too */
+        if (options.frag_ctx != NULL) {
+            if ((workers[i].frag_ctx = fragroute_init(65535, 
+                    tcpedit_get_output_dlt(workers[i].tcpedit), options.fragroute_args, ebuf)) == NULL)
+                errx(-1, "%s", ebuf);
+            workers[i].frag = (char *)safe_malloc(MAXPACKET);
+        }
+#endif
+    }
+
+    dbgx(1, "Rewriting with %d edit threads and %d packet buffers", threads, 
+            pipeline.numslots);
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, rewrite_worker, &workers[i]) != 0)
+            errx(-1, "Unable to create edit thread: %s", strerror(errno));
+    }
+
+    if (pthread_create(&reader, NULL, rewrite_reader, &pipeline) != 0)
+        errx(-1, "Unable to create reader thread: %s", strerror(errno));
+
+    /* we're the writer: write packets out in the order they were read */
+    while (1) {
+        slot = &pipeline.slots[(pipeline.next_write - 1) % pipeline.numslots];
+
+        pthread_mutex_lock(&pipeline.lock);
+        while (slot->state != SLOT_EDITED && 
+                ! (pipeline.eof && pipeline.next_write == pipeline.next_read))
+            pthread_cond_wait(&pipeline.writable, &pipeline.lock);
+        done = (slot->state != SLOT_EDITED);
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (done)
+            break; /* EOF and everything has been written */
+
+        if (slot->rcode == TCPEDIT_ERROR) {
+            errx(-1, "Error rewriting packet " COUNTER_SPEC ": %s", slot->packetnum,
+                    tcpedit_geterr(slot->tcpedit));
+        } else if ((slot->rcode == TCPEDIT_SOFT_ERROR) && HAVE_OPT(SKIP_SOFT_ERRORS)) {
+            /* don't write packet */
+            dbgx(1, "Packet " COUNTER_SPEC " is suppressed from being written due to soft errors", 
+                    slot->packetnum);
+#ifdef ENABLE_FRAGROUTE
+        } else if (slot->fragrouted) {
+            rewrite_write_frags(pout, slot);
+        } else {
+            /* the edit thread already decided not to fragroute this one */
+            dump_packet(pout, &slot->pkthdr, slot->pktdata);
+        }
+#else
+        } else {
+            write_packet(tcpedit, pout, &slot->pkthdr, slot->pktdata, 
+                    slot->cache_result, slot->packetnum);
+        }
+#endif
+
+        pthread_mutex_lock(&pipeline.lock);
+        slot->state = SLOT_FREE;
+        pipeline.next_write++;
+        pthread_cond_signal(&pipeline.readable);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    pthread_join(reader, NULL);
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        tcpedit_close(workers[i].tcpedit);
+#ifdef ENABLE_FRAGROUTE
+        if (workers[i].frag_ctx != NULL) {
+            fragroute_close(workers[i].frag_ctx);
+            safe_free(workers[i].frag);
+        }
+#endif
+    }
+#ifdef ENABLE_FRAGROUTE
+    for (i = 0; i < pipeline.numslots; i++) {
+        if (pipeline.slots[i].frags != NULL)
+            safe_free(pipeline.slots[i].frags);
+    }
+#endif
+
+    safe_free(workers);
+    safe_free(buffers);
+    safe_free(pipeline.slots);
+    pthread_cond_destroy(&pipeline.writable);
+    pthread_cond_destroy(&pipeline.editable);
+    pthread_cond_destroy(&pipeline.readable);
+    pthread_mutex_destroy(&pipeline.lock);
+
+    return 0;
+}
+#endif /* HAVE_LIBPTHREAD */
 
 /*
  Local Variables:
@@ -37,6 +37,7 @@
 #include "config.h"
 #include "defines.h"
 #include "tcpedit/tcpedit.h"
+#include "common/pcapwriter.h"
 
 #ifdef ENABLE_DMALLOC
 #include <dmalloc.h>
@@ -52,7 +53,10 @@ struct tcprewrite_opt_s {
     char *infile;
     char *outfile;
     pcap_t *pin;
-    pcap_dumper_t *pout;
+    pcap_dumper_t *pout;        /* only used when writing to STDOUT */
+    pcapwriter_t *writer;
+    size_t write_bufsize;
+    int write_flags;
 
     /* tcpprep cache data */
     COUNTER cache_packets;
@@ -76,6 +80,9 @@ struct tcprewrite_opt_s {
     int fragroute_dir;
 #endif
     tcpedit_t *tcpedit;
+
+    /* number of edit threads */
+    int threads;
 };
 
 typedef struct tcprewrite_opt_s tcprewrite_opt_t;
@@ -0,0 +1,83 @@
+#!/bin/sh
+# $Id$
+#
+# Fragroute memory stress test: streams the packets of test.pcap through
+# tcprewrite --fragroute over and over and fails if tcprewrite's resident
+# set size keeps growing once it has warmed up.  Linux only (/proc).
+#
+# Each loop is one pass over the 141 packets of test.pcap, so the default
+# of 20000 loops feeds tcprewrite about 2.8 million packets (several times
+# that come out after fragroute splits them).  The run has to outlast the
+# warm-up below.  For a soak run with over a hundred million packets, use
+# 1000000 or more loops.
+#
+# usage: fragroute_stress.sh <tcprewrite> [loops]
+
+TCPREWRITE=$1
+LOOPS=${2:-20000}
+CONFIG=test.fragroute_stress
+RECORDS=fragroute_stress.$$
+WARMUP=10	# seconds before taking the baseline
+SLACK=1024	# KB of growth tolerated after the baseline
+
+if [ ! -d /proc/$$ ]; then
+    echo "skipping: /proc is not available"
+    exit 0
+fi
+
+trap 'rm -f $RECORDS' 0 1 2 15
+
+# 100 copies of the packet records of test.pcap without the file header
+tail -c +25 test.pcap > $RECORDS.1
+i=0
+while [ $i -lt 100 ]; do
+    cat $RECORDS.1
+    i=`expr $i + 1`
+done > $RECORDS
+rm -f $RECORDS.1
+
+echo "streaming about `expr $LOOPS \* 141` packets through $TCPREWRITE"
+(
+    head -c 24 test.pcap
+    i=0
+    while [ $i -lt $LOOPS ]; do
+        cat $RECORDS
+        i=`expr $i + 100`
+    done
+) | $TCPREWRITE -i - -o - --fragroute=$CONFIG >/dev/null &
+PID=$!
+
+elapsed=0
+base=""
+max=0
+while kill -0 $PID 2>/dev/null; do
+    rss=`awk '/^VmRSS/ { print $2 }' /proc/$PID/status 2>/dev/null`
+    if [ -n "$rss" ]; then
+        if [ -z "$base" ] && [ $elapsed -ge $WARMUP ]; then
+            base=$rss
+        fi
+        [ $rss -gt $max ] && max=$rss
+        echo "${elapsed}s: VmRSS ${rss} KB"
+    fi
+    sleep 1
+    elapsed=`expr $elapsed + 1`
+done
+
+wait $PID
+status=$?
+if [ $status -ne 0 ]; then
+    echo "tcprewrite exited with $status"
+    exit 1
+fi
+
+if [ -z "$base" ]; then
+    echo "finished before warm-up, increase the number of loops"
+    exit 1
+fi
+
+echo "baseline ${base} KB, peak ${max} KB"
+if [ `expr $max - $base` -gt $SLACK ]; then
+    echo "resident memory kept growing"
+    exit 1
+fi
+exit 0
@@ -0,0 +1,41 @@
+#!/bin/sh
+# $Id$
+#
+# Prints a pcap file one byte per line with the IP ID and header checksum
+# of every Ethernet/IPv4 packet zeroed, so captures which only differ in
+# those can be compared with diff: fragroute's tcp_seg gives each segment
+# a random IP ID.
+#
+# usage: pcap_noipid.sh <file.pcap>
+
+od -An -v -tu1 "$1" | awk '
+BEGIN { n = 0; hdr = 0; left = 0; cap = 0 }
+{
+    for (f = 1; f <= NF; f++) {
+        b = $f
+        if (n < 24) {
+            # 0xd4 first: written on a little endian host
+            if (n == 0)
+                le = (b == 212)
+        } else if (left == 0) {
+            # 16 byte record header, caplen is its third word
+            if (hdr >= 8 && hdr < 12)
+                cap = le ? cap + b * 256 ^ (hdr - 8) : cap * 256 + b
+            if (++hdr == 16) {
+                left = cap
+                cap = hdr = pos = eth = 0
+            }
+        } else {
+            if (pos == 12)
+                eth = b * 256
+            else if (pos == 13)
+                eth += b
+            else if (eth == 2048 && (pos == 18 || pos == 19 || pos == 24 || pos == 25))
+                b = 0
+            pos++
+            left--
+        }
+        n++
+        print b
+    }
+}'
@@ -0,0 +1,187 @@
+#!/bin/sh
+# $Id$
+#
+# Replay benchmark: sends test.pcap and synthetic captures of several
+# packet size mixes through tcpreplay's sendpacket backend against local
+# sinks, so the send path can be measured without real NICs:
+#
+#   veth    a veth pair created for the run (Linux, needs root)
+#   vale    a port on netmap's VALE switch vale0 (needs /dev/netmap and
+#           tcpreplay built with --enable-force-netmap)
+#   null    tcpreplay's null device, which drops every packet
+#   memring tcpreplay's memring device, which copies every packet into a
+#           ring drained by another thread
+#
+# Every capture is sent twice per sink: with --topspeed to measure packets
+# and bits per second and CPU cycles per packet, then with --pps to measure
+# the pacing error.  Sinks which can't be set up are skipped.
+#
+# usage: replay_bench.sh <tcpreplay> [sinks]
+#
+# environment:
+#   BENCH_PACKETS    packets per --topspeed run (default 1000000)
+#   BENCH_PPS        rate of the --pps run (default 100000)
+#   BENCH_RESULTS    where to write "sink capture pps" lines (default
+#                    replay_bench.results)
+#   BENCH_BASELINE   results of an earlier run; fail if any --topspeed
+#                    rate drops more than BENCH_TOLERANCE percent below it
+#   BENCH_TOLERANCE  default 20
+
+TCPREPLAY=$1
+shift
+SINKS=${*:-"veth vale null memring"}
+PACKETS=${BENCH_PACKETS:-1000000}
+PPS=${BENCH_PPS:-100000}
+RESULTS=${BENCH_RESULTS:-replay_bench.results}
+TOLERANCE=${BENCH_TOLERANCE:-20}
+TMP=replay_bench.$$
+CYCLES=100	# copies of each size mix in a synthetic capture
+VETH=tcpr$$	# interface names are limited to 15 characters
+
+if [ -z "$TCPREPLAY" ]; then
+    echo "usage: $0 <tcpreplay> [sinks]"
+    exit 1
+fi
+
+trap 'rm -rf $TMP; ip link del ${VETH}a >/dev/null 2>&1' 0 1 2 15
+mkdir $TMP || exit 1
+
+# write n as 4 little endian bytes
+le32() {
+    printf "\\$(printf %03o $(($1 & 255)))\\$(printf %03o $((($1 >> 8) & 255)))"
+    printf "\\$(printf %03o $((($1 >> 16) & 255)))\\$(printf %03o $((($1 >> 24) & 255)))"
+}
+
+# one Ethernet frame of the given size, locally administered MACs and
+# the IEEE local experimental ethertype so nothing tries to handle it
+record() {
+    le32 $2
+    le32 $(($3 * 10))
+    le32 $1
+    le32 $1
+    printf '\002\000\000\000\000\002\002\000\000\000\000\001\210\265'
+    head -c `expr $1 - 14` /dev/zero
+}
+
+# capture of CYCLES copies of the given frame sizes
+synth() {
+    printf '\324\303\262\241\002\000\004\000\000\000\000\000\000\000\000\000'
+    printf '\377\377\000\000\001\000\000\000'
+    i=0
+    n=0
+    while [ $i -lt $CYCLES ]; do
+        for size in "$@"; do
+            record $size 1300000000 $n
+            n=`expr $n + 1`
+        done
+        i=`expr $i + 1`
+    done
+}
+
+synth 60 > $TMP/small.pcap
+synth 1514 > $TMP/large.pcap
+# simple IMIX: 7 small, 4 medium and 1 large frame
+synth 60 60 60 60 60 60 60 590 590 590 590 1514 > $TMP/imix.pcap
+cp test.pcap $TMP/test.pcap
+
+pcap_packets() {
+    $TCPREPLAY --dry-run -i $1 $2 2>/dev/null | awk '/^Dry run:/ { print $3 }'
+}
+
+# saves the CPU seconds used by our children so far (the second line of
+# `times`) in $TMP/$1.  Must not be called from a `command substitution`:
+# that runs in a subshell, which has no children of its own.
+child_cpu() {
+    times > $TMP/times
+    awk 'NR == 2 {
+        split($1, u, "m"); split($2, s, "m");
+        printf "%f\n", u[1] * 60 + u[2] + s[1] * 60 + s[2] }' $TMP/times > $TMP/$1
+}
+
+CPU_MHZ=`awk -F: '/^cpu MHz/ { print $2; exit }' /proc/cpuinfo 2>/dev/null`
+
+# set up a sink, print the device to send to or nothing if unavailable
+sink_open() {
+    case $1 in
+    veth)
+        if ip link add ${VETH}a type veth peer name ${VETH}b >/dev/null 2>&1 && \
+                ip link set ${VETH}a up && ip link set ${VETH}b up; then
+            echo ${VETH}a
+        fi
+        ;;
+    vale)
+        [ -c /dev/netmap ] && echo vale0:tcprbench
+        ;;
+    null|memring)
+        echo $1
+        ;;
+    esac
+}
+
+sink_close() {
+    [ $1 = veth ] && ip link del ${VETH}a >/dev/null 2>&1
+}
+
+$TCPREPLAY -V 2>&1 | grep -i "injection"
+printf "%-6s %-8s %10s %12s %10s %10s %8s\n" sink capture packets pps Mbps cycles/pkt pace_err
+: > $RESULTS
+failed=0
+
+for sink in $SINKS; do
+    dev=`sink_open $sink`
+    if [ -z "$dev" ]; then
+        echo "$sink: skipped (unavailable)"
+        continue
+    fi
+    if ! $TCPREPLAY -q -i $dev --limit=1 $TMP/test.pcap >$TMP/out 2>&1; then
+        echo "$sink: skipped (`tail -1 $TMP/out`)"
+        sink_close $sink
+        continue
+    fi
+
+    for pcap in test small imix large; do
+        file=$TMP/$pcap.pcap
+        count=`pcap_packets $dev $file`
+        [ -z "$count" ] && count=1
+
+        # throughput: loop a preloaded capture so disk I/O isn't measured
+        loops=`expr $PACKETS / $count + 1`
+        child_cpu before
+        $TCPREPLAY -q -i $dev --topspeed --preload-pcap --loop=$loops $file >$TMP/out 2>&1
+        child_cpu after
+        before=`cat $TMP/before`
+        after=`cat $TMP/after`
+        sent=`awk '/^Actual:/ { print $2 }' $TMP/out`
+        rate=`awk '/^Rated:/ { print $6 }' $TMP/out`
+        mbps=`awk '/^Rated:/ { print $4 }' $TMP/out`
+        cycles=`echo "$before $after $sent $CPU_MHZ" | awk '{
+            if ($3 > 0 && $4 > 0) printf "%.0f", ($2 - $1) * $4 * 1000000 / $3;
+            else printf "-" }'`
+
+        # pacing: about two seconds at --pps
+        limit=`expr $PPS \* 2`
+        loops=`expr $limit / $count + 1`
+        $TCPREPLAY -q -i $dev --pps=$PPS --preload-pcap --loop=$loops --limit=$limit $file >$TMP/pace 2>&1
+        pace=`awk -v want=$PPS '/^Rated:/ { printf "%.2f%%", ($6 - want) * 100 / want }' $TMP/pace`
+
+        printf "%-6s %-8s %10s %12s %10s %10s %8s\n" $sink $pcap "${sent:--}" \
+            "${rate:--}" "${mbps:--}" "$cycles" "${pace:--}"
+        echo "$sink $pcap ${rate:-0}" >> $RESULTS
+    done
+    sink_close $sink
+done
+
+if [ -n "$BENCH_BASELINE" ]; then
+    if [ ! -f "$BENCH_BASELINE" ]; then
+        echo "no baseline $BENCH_BASELINE"
+        exit 1
+    fi
+    awk -v tol=$TOLERANCE 'NR == FNR { base[$1 " " $2] = $3; next }
+        ($1 " " $2) in base && base[$1 " " $2] > 0 &&
+        $3 < base[$1 " " $2] * (100 - tol) / 100 {
+            printf "REGRESSION %s %s: %.2f pps, baseline %.2f pps\n",
+                $1, $2, $3, base[$1 " " $2]; bad = 1 }
+        END { exit bad }' $BENCH_BASELINE $RESULTS || failed=1
+fi
+
+exit $failed